@@ -1,12 +1,19 @@
+#include <getopt.h>
+#include <time.h>
+#include <zmq.h>
+
 #include <algorithm>
 #include <cassert>
+#include <cinttypes>
 #include <csignal>
+#include <cstdlib>
 #include <iostream>
 #include <map>
 #include <string>
 
 typedef void (*sighandler_t)(int sig);
 
+#include "cereal/messaging/bridge_mux.h"
 #include "cereal/services.h"
 #include "msgq/impl_msgq.h"
 #include "msgq/impl_zmq.h"
@@ -34,11 +41,189 @@ static std::vector<std::string> get_services(std::string whitelist_str, bool zmq
   return service_list;
 }
 
+static uint64_t clock_ns(clockid_t clock) {
+  struct timespec t;
+  clock_gettime(clock, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+struct MuxOptions {
+  int port = 8099;
+  size_t batch_size = 64 * 1024;
+  uint64_t batch_ns = 5000000;
+  int zstd_level = 0;
+};
+
+static void print_report(const char *title, MuxStats &stats, uint64_t &last_report, uint64_t now, const std::string &extra) {
+  const double seconds = (now - last_report) * 1e-9;
+  if (seconds < 10) return;
+  std::cout << title << ", " << extra << "\n" << stats.report(seconds) << std::flush;
+  last_report = now;
+}
+
+// all services (or the whitelisted ones) from msgq, in batches over a single zmq socket
+static int mux_send(const std::string &whitelist_str, const MuxOptions &opts) {
+  MSGQContext sub_context;
+  MSGQPoller poller;
+  std::map<SubSocket *, uint16_t> sub2service;
+  for (const std::string &name : get_services(whitelist_str, false)) {
+    if (!whitelist_str.empty() && whitelist_str.find(name) == std::string::npos) continue;
+    auto it = std::find(mux_services().begin(), mux_services().end(), name);
+    SubSocket *sock = new MSGQSubSocket();
+    sock->connect(&sub_context, name, "127.0.0.1", false);
+    poller.registerSocket(sock);
+    sub2service[sock] = it - mux_services().begin();
+  }
+
+  void *context = zmq_ctx_new();
+  void *pub = zmq_socket(context, ZMQ_PUB);
+  // drop batches rather than queue them up, when the link can't keep up. zmq drops them silently,
+  // the receiver counts them as lost batches from the gaps in their seq
+  int hwm = 100;
+  zmq_setsockopt(pub, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+  const std::string endpoint = "tcp://*:" + std::to_string(opts.port);
+  if (zmq_bind(pub, endpoint.c_str()) != 0) {
+    std::cerr << "failed to bind " << endpoint << ": " << zmq_strerror(zmq_errno()) << std::endl;
+    return 1;
+  }
+
+  MuxEncoder encoder(opts.batch_size, opts.batch_ns, opts.zstd_level);
+  MuxStats stats;
+  uint64_t last_report = clock_ns(CLOCK_MONOTONIC);
+  std::vector<uint64_t> received;
+  std::vector<std::pair<uint16_t, size_t>> batch;  // the records of the batch, for the stats
+  while (!do_exit) {
+    const int timeout = encoder.timeout_ms(clock_ns(CLOCK_MONOTONIC));
+    for (auto sock : poller.poll(timeout < 0 ? 100 : timeout)) {
+      // everything queued up, not just one message
+      while (Message *msg = sock->receive(true)) {
+        uint64_t now = clock_ns(CLOCK_MONOTONIC);
+        encoder.add(sub2service[sock], msg->getData(), msg->getSize(), now);
+        batch.push_back({sub2service[sock], msg->getSize()});
+        received.push_back(now);
+        delete msg;
+        if (encoder.due(now)) break;
+      }
+    }
+
+    const uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    if (encoder.due(now)) {
+      std::string_view data = encoder.flush(now, clock_ns(CLOCK_REALTIME));
+      int ret;
+      do {
+        ret = zmq_send(pub, data.data(), data.size(), ZMQ_DONTWAIT);
+      } while (ret == -1 && errno == EINTR && !do_exit);
+      // the time in the batch
+      for (int i = 0; i < batch.size(); ++i) stats.add(batch[i].first, batch[i].second, (now - received[i]) * 1e-6);
+      batch.clear();
+      received.clear();
+    }
+
+    char extra[128];
+    snprintf(extra, sizeof(extra), "%" PRIu64 " batches, %.1f%% of the raw size sent",
+             encoder.batches, encoder.raw_bytes ? 100.0 * encoder.sent_bytes / encoder.raw_bytes : 0.);
+    print_report("bridge mux send, latency in batch", stats, last_report, now, extra);
+  }
+
+  zmq_close(pub);
+  zmq_ctx_term(context);
+  return 0;
+}
+
+// the batches of mux_send, republished to msgq
+static int mux_receive(const std::string &ip, const std::string &whitelist_str, const MuxOptions &opts) {
+  MSGQContext pub_context;
+  std::vector<PubSocket *> pub_socks(mux_services().size(), nullptr);
+  for (const std::string &name : get_services(whitelist_str, true)) {
+    auto it = std::find(mux_services().begin(), mux_services().end(), name);
+    PubSocket *sock = new MSGQPubSocket();
+    sock->connect(&pub_context, name);
+    pub_socks[it - mux_services().begin()] = sock;
+  }
+
+  void *context = zmq_ctx_new();
+  void *sub = zmq_socket(context, ZMQ_SUB);
+  zmq_setsockopt(sub, ZMQ_SUBSCRIBE, "", 0);
+  const std::string endpoint = "tcp://" + ip + ":" + std::to_string(opts.port);
+  if (zmq_connect(sub, endpoint.c_str()) != 0) {
+    std::cerr << "failed to connect " << endpoint << ": " << zmq_strerror(zmq_errno()) << std::endl;
+    return 1;
+  }
+
+  MuxDecoder decoder;
+  MuxStats stats;
+  uint64_t last_report = clock_ns(CLOCK_MONOTONIC), invalid = 0;
+  zmq_msg_t msg;
+  zmq_msg_init(&msg);
+  while (!do_exit) {
+    zmq_pollitem_t item = {.socket = sub, .events = ZMQ_POLLIN};
+    if (zmq_poll(&item, 1, 100) > 0 && zmq_msg_recv(&msg, sub, ZMQ_DONTWAIT) >= 0) {
+      const uint64_t received = clock_ns(CLOCK_REALTIME);
+      bool valid = decoder.decode((const char *)zmq_msg_data(&msg), zmq_msg_size(&msg), [&](const MuxRecordHeader &r, const char *data) {
+        if (PubSocket *sock = pub_socks[r.service]) {
+          int ret;
+          do {
+            ret = sock->send((char *)data, r.size);
+          } while (ret == -1 && errno == EINTR && !do_exit);
+          // the time in the batch, then on the link. the latter needs the clocks of both ends in sync
+          stats.add(r.service, r.size, r.queued_us * 1e-3 + (int64_t)(received - decoder.header.sent_wall_time) * 1e-6);
+        }
+      });
+      invalid += !valid;
+    }
+
+    char extra[128];
+    snprintf(extra, sizeof(extra), "%" PRIu64 " batches, %" PRIu64 " lost, %" PRIu64 " invalid",
+             decoder.batches, decoder.lost_batches, invalid);
+    print_report("bridge mux receive, latency from the sender's msgq", stats, last_report, clock_ns(CLOCK_MONOTONIC), extra);
+  }
+
+  zmq_msg_close(&msg);
+  zmq_close(sub);
+  zmq_ctx_term(context);
+  return 0;
+}
+
 int main(int argc, char** argv) {
   signal(SIGPIPE, (sighandler_t)sigpipe_handler);
   signal(SIGINT, (sighandler_t)set_do_exit);
   signal(SIGTERM, (sighandler_t)set_do_exit);
 
+  bool mux = false;
+  MuxOptions mux_opts;
+  const option long_options[] = {
+    {"mux", no_argument, nullptr, 'm'},
+    {"port", required_argument, nullptr, 'p'},
+    {"batch-ms", required_argument, nullptr, 't'},
+    {"batch-kb", required_argument, nullptr, 's'},
+    {"zstd", required_argument, nullptr, 'z'},
+    {"help", no_argument, nullptr, 'h'},
+    {nullptr, 0, nullptr, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'm': mux = true; break;
+      case 'p': mux_opts.port = std::stoi(optarg); break;
+      case 't': mux_opts.batch_ns = std::stod(optarg) * 1e6; break;
+      case 's': mux_opts.batch_size = std::stoul(optarg) * 1024; break;
+      case 'z': mux_opts.zstd_level = std::stoi(optarg); break;
+      default:
+        std::cout << "Usage: " << argv[0] << " [--mux [--port N] [--batch-ms N] [--batch-kb N] [--zstd LEVEL]] [ip whitelist]\n"
+                  << "  msgq to zmq, or with an ip and a whitelist of services, zmq from ip to msgq.\n"
+                  << "  --mux sends all services over a single connection, in batches of at most --batch-kb (64)\n"
+                  << "  or --batch-ms (5) old, zstd compressed with --zstd LEVEL. The receiving end needs --mux too.\n"
+                  << "  The sender takes an optional whitelist." << std::endl;
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  if (mux) {
+    return argc > 2 ? mux_receive(argv[1], argv[2], mux_opts) : mux_send(argc > 1 ? argv[1] : "", mux_opts);
+  }
+
   bool zmq_to_msgq = argc > 2;
   std::string ip = zmq_to_msgq ? argv[1] : "127.0.0.1";
   std::string whitelist_str = zmq_to_msgq ? std::string(argv[2]) : "";
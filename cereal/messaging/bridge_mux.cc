@@ -0,0 +1,161 @@
+#include "cereal/messaging/bridge_mux.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+#include "cereal/services.h"
+
+const std::vector<std::string> &mux_services() {
+  static const std::vector<std::string> names = []() {
+    std::vector<std::string> names;
+    for (const auto &[name, _] : services) names.push_back(name);
+    return names;
+  }();
+  return names;
+}
+
+uint32_t mux_services_hash() {
+  // FNV-1a of the names
+  static const uint32_t hash = []() {
+    uint32_t h = 2166136261u;
+    for (const auto &name : mux_services()) {
+      for (char c : name + '\0') h = (h ^ (uint8_t)c) * 16777619u;
+    }
+    return h;
+  }();
+  return hash;
+}
+
+MuxEncoder::MuxEncoder(size_t batch_size, uint64_t batch_ns, int zstd_level)
+    : batch_size_(batch_size), batch_ns_(batch_ns), zstd_level_(zstd_level) {
+  assert(mux_services().size() <= UINT16_MAX);
+  if (zstd_level_ > 0) {
+    cctx_ = ZSTD_createCCtx();
+    assert(cctx_);
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, zstd_level_);
+  }
+  records_buf_.reserve(batch_size_ * 2);
+}
+
+MuxEncoder::~MuxEncoder() {
+  ZSTD_freeCCtx(cctx_);
+}
+
+void MuxEncoder::add(uint16_t service, const void *data, size_t size, uint64_t now) {
+  MuxRecordHeader r = {.service = service, .size = (uint32_t)size};
+  records_buf_.append((const char *)&r, sizeof(r));
+  records_buf_.append((const char *)data, size);
+  received_.push_back(now);
+  ++records_;
+}
+
+bool MuxEncoder::due(uint64_t now) const {
+  return records_ > 0 && (records_buf_.size() >= batch_size_ || now - received_[0] >= batch_ns_);
+}
+
+int MuxEncoder::timeout_ms(uint64_t now) const {
+  if (records_ == 0) return -1;
+  if (due(now)) return 0;
+  // rounded up, a poll that returns early would flush nothing
+  return (received_[0] + batch_ns_ - now + 999999) / 1000000;
+}
+
+std::string_view MuxEncoder::flush(uint64_t now, int64_t wall_time) {
+  // how long each message waited for its batch
+  size_t pos = 0;
+  for (uint64_t received : received_) {
+    MuxRecordHeader r;
+    memcpy(&r, records_buf_.data() + pos, sizeof(r));
+    r.queued_us = (now - received) / 1000;
+    memcpy(records_buf_.data() + pos, &r, sizeof(r));
+    pos += sizeof(r) + r.size;
+  }
+
+  MuxBatchHeader header = {
+    .services_hash = mux_services_hash(),
+    .records = records_,
+    .seq = seq_++,
+    .raw_size = records_buf_.size(),
+    .sent_wall_time = wall_time,
+  };
+  if (cctx_) {
+    header.flags |= MUX_ZSTD;
+    batch_buf_.resize(sizeof(header) + ZSTD_compressBound(records_buf_.size()));
+    size_t size = ZSTD_compress2(cctx_, batch_buf_.data() + sizeof(header), batch_buf_.size() - sizeof(header),
+                                 records_buf_.data(), records_buf_.size());
+    assert(!ZSTD_isError(size));
+    batch_buf_.resize(sizeof(header) + size);
+  } else {
+    batch_buf_.resize(sizeof(header));
+    batch_buf_.append(records_buf_);
+  }
+  memcpy(batch_buf_.data(), &header, sizeof(header));
+
+  ++batches;
+  raw_bytes += sizeof(header) + records_buf_.size();
+  sent_bytes += batch_buf_.size();
+  records_buf_.clear();
+  received_.clear();
+  records_ = 0;
+  return batch_buf_;
+}
+
+MuxDecoder::MuxDecoder() {
+  dctx_ = ZSTD_createDCtx();
+  assert(dctx_);
+}
+
+MuxDecoder::~MuxDecoder() {
+  ZSTD_freeDCtx(dctx_);
+}
+
+bool MuxDecoder::decompress(const char *data, size_t size) {
+  if (size < sizeof(header)) return false;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != MUX_MAGIC || header.version != MUX_VERSION || header.services_hash != mux_services_hash()) {
+    return false;
+  }
+
+  data += sizeof(header);
+  size -= sizeof(header);
+  if (header.flags & MUX_ZSTD) {
+    // a batch is at most a few batch sizes, anything bigger is garbage
+    if (header.raw_size > 256 * 1024 * 1024) return false;
+    raw_.resize(header.raw_size);
+    size_t raw_size = ZSTD_decompressDCtx(dctx_, raw_.data(), raw_.size(), data, size);
+    if (ZSTD_isError(raw_size) || raw_size != header.raw_size) return false;
+    records_ = raw_;
+  } else {
+    if (size != header.raw_size) return false;
+    records_ = std::string_view(data, size);
+  }
+
+  // sequence numbers restart with the sender
+  if (batches > 0 && header.seq > next_seq_) lost_batches += header.seq - next_seq_;
+  next_seq_ = header.seq + 1;
+  ++batches;
+  return true;
+}
+
+void MuxStats::add(uint16_t service, size_t size, double latency_ms) {
+  Service &s = services_[service];
+  ++s.msgs;
+  s.bytes += size;
+  s.latency_sum_ms += latency_ms;
+  s.latency_max_ms = std::max(s.latency_max_ms, latency_ms);
+}
+
+std::string MuxStats::report(double seconds) {
+  std::string out;
+  char line[256];
+  for (int i = 0; i < services_.size(); ++i) {
+    Service &s = services_[i];
+    if (s.msgs == 0) continue;
+    snprintf(line, sizeof(line), "  %-32s %8.1f msgs/s %9.1f KB/s  latency avg %7.2f ms  max %7.2f ms\n",
+             mux_services()[i].c_str(), s.msgs / seconds, s.bytes / seconds / 1024, s.latency_sum_ms / s.msgs, s.latency_max_ms);
+    out += line;
+    s = {};
+  }
+  return out;
+}
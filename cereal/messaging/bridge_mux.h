@@ -0,0 +1,130 @@
+#pragma once
+
+#include <zstd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The multiplexed bridge stream: every service over one connection, as batches of records instead of a socket and
+// a network frame per message.
+// A batch is a MuxBatchHeader followed by its records, zstd compressed if MUX_ZSTD is set. A record is a
+// MuxRecordHeader followed by the message.
+// Services are numbered in the order of services.h, both ends must have the same list (services_hash).
+
+constexpr uint32_t MUX_MAGIC = 0x5855424d;  // "MBUX"
+constexpr uint16_t MUX_VERSION = 1;
+constexpr uint16_t MUX_ZSTD = 1;
+
+struct MuxBatchHeader {
+  uint32_t magic = MUX_MAGIC;
+  uint16_t version = MUX_VERSION;
+  uint16_t flags = 0;
+  uint32_t services_hash;
+  uint32_t records;
+  uint64_t seq;
+  uint64_t raw_size;  // of the records, uncompressed
+  int64_t sent_wall_time;  // ns, CLOCK_REALTIME
+};
+
+struct MuxRecordHeader {
+  uint16_t service;
+  uint16_t reserved = 0;
+  uint32_t size;
+  uint32_t queued_us;  // from receiving the message to sending its batch
+};
+static_assert(sizeof(MuxBatchHeader) == 40 && sizeof(MuxRecordHeader) == 12);
+
+// the names by service id, and their hash
+const std::vector<std::string> &mux_services();
+uint32_t mux_services_hash();
+
+class MuxEncoder {
+public:
+  // a batch is due once it holds batch_size bytes, or its first message is batch_ns old. zstd_level 0 doesn't compress
+  MuxEncoder(size_t batch_size = 64 * 1024, uint64_t batch_ns = 5000000, int zstd_level = 0);
+  ~MuxEncoder();
+  // now is in ns, CLOCK_MONOTONIC
+  void add(uint16_t service, const void *data, size_t size, uint64_t now);
+  bool empty() const { return records_ == 0; }
+  bool due(uint64_t now) const;
+  // ms until the batch is due, -1 if it's empty
+  int timeout_ms(uint64_t now) const;
+  // ends the batch, the returned bytes are valid until the next add
+  std::string_view flush(uint64_t now, int64_t wall_time);
+
+  uint64_t batches = 0, raw_bytes = 0, sent_bytes = 0;
+
+private:
+  const size_t batch_size_;
+  const uint64_t batch_ns_;
+  const int zstd_level_;
+  ZSTD_CCtx *cctx_ = nullptr;
+  std::string records_buf_, batch_buf_;
+  std::vector<uint64_t> received_;  // by record
+  uint32_t records_ = 0;
+  uint64_t seq_ = 0;
+};
+
+class MuxDecoder {
+public:
+  MuxDecoder();
+  ~MuxDecoder();
+  // calls f(const MuxRecordHeader &, const char *data) for each record of the batch. false if it isn't a valid
+  // batch of this services list, and for batches with records of unknown services
+  template <class Func>
+  bool decode(const char *data, size_t size, Func &&f);
+
+  MuxBatchHeader header;  // of the last decoded batch
+  uint64_t batches = 0, lost_batches = 0;
+
+private:
+  bool decompress(const char *data, size_t size);
+
+  ZSTD_DCtx *dctx_ = nullptr;
+  std::string raw_;
+  std::string_view records_;
+  uint64_t next_seq_ = 0;
+};
+
+template <class Func>
+bool MuxDecoder::decode(const char *data, size_t size, Func &&f) {
+  if (!decompress(data, size)) return false;
+
+  // validate it whole before handing out records
+  const size_t services = mux_services().size();
+  MuxRecordHeader r;
+  size_t pos = 0;
+  for (uint32_t i = 0; i < header.records; ++i) {
+    if (pos + sizeof(r) > records_.size()) return false;
+    memcpy(&r, records_.data() + pos, sizeof(r));
+    pos += sizeof(r) + r.size;
+    if (r.service >= services || pos > records_.size()) return false;
+  }
+  if (pos != records_.size()) return false;
+
+  for (pos = 0; pos < records_.size(); pos += sizeof(r) + r.size) {
+    memcpy(&r, records_.data() + pos, sizeof(r));
+    f(r, records_.data() + pos + sizeof(r));
+  }
+  return true;
+}
+
+// per service counts of a bridge, reported every few seconds
+class MuxStats {
+public:
+  MuxStats() : services_(mux_services().size()) {}
+  void add(uint16_t service, size_t size, double latency_ms);
+  // the services with messages since the last report, one per line, then resets
+  std::string report(double seconds);
+
+private:
+  struct Service {
+    uint64_t msgs = 0, bytes = 0;
+    double latency_sum_ms = 0, latency_max_ms = 0;
+  };
+  std::vector<Service> services_;
+};
@@ -2,7 +2,12 @@
 
 #include <cstddef>
 #include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 #include <time.h>
@@ -19,10 +24,36 @@
 #define MSG_MULTIPLE_PUBLISHERS 100
 
 
+class AlignedBuffer {
+public:
+  kj::ArrayPtr<const capnp::word> align(const char *data, const size_t size) {
+    words_size = size / sizeof(capnp::word) + 1;
+    if (aligned_buf.size() < words_size) {
+      aligned_buf = kj::heapArray<capnp::word>(words_size < 512 ? 512 : words_size);
+    }
+    memcpy(aligned_buf.begin(), data, size);
+    return aligned_buf.slice(0, words_size);
+  }
+  inline kj::ArrayPtr<const capnp::word> align(Message *m) {
+    return align(m->getData(), m->getSize());
+  }
+private:
+  kj::Array<capnp::word> aligned_buf;
+  size_t words_size;
+};
+
 class SubMaster {
 public:
+  // A subscribed service resolved once to a dense index, for lookups without string compares:
+  //   const SubMaster::Handle car_state = sm.handle("carState");
+  //   if (sm.updated(car_state)) { auto cs = sm[car_state].getCarState(); ... }
+  struct Handle {
+    int index = -1;
+  };
+
   SubMaster(const std::vector<const char *> &service_list, const std::vector<const char *> &poll = {},
             const char *address = nullptr, const std::vector<const char *> &ignore_alive = {});
+  // no heap allocations of its own, only the transport's
   void update(int timeout = 1000);
   void update_msgs(uint64_t current_time, const std::vector<std::pair<std::string, cereal::Event::Reader>> &messages);
   inline bool allAlive(const std::vector<const char *> &service_list = {}) { return all_(service_list, false, true); }
@@ -31,25 +62,102 @@ public:
   void drain();
   ~SubMaster();
 
+  // throws std::out_of_range if the service isn't subscribed
+  Handle handle(const char *name) const;
+
   uint64_t frame = 0;
-  bool updated(const char *name) const;
-  bool alive(const char *name) const;
-  bool valid(const char *name) const;
-  uint64_t rcv_frame(const char *name) const;
-  uint64_t rcv_time(const char *name) const;
-  cereal::Event::Reader &operator[](const char *name) const;
+  // read word aligned messages in place instead of copying them
+  bool zero_copy = true;
+  uint64_t copies = 0, copies_avoided = 0;
+
+  inline bool updated(Handle h) const { return subs_[h.index]->updated; }
+  inline bool alive(Handle h) const { return subs_[h.index]->alive; }
+  inline bool valid(Handle h) const { return subs_[h.index]->valid; }
+  inline uint64_t rcv_frame(Handle h) const { return subs_[h.index]->rcv_frame; }
+  inline uint64_t rcv_time(Handle h) const { return subs_[h.index]->rcv_time; }
+  inline cereal::Event::Reader &operator[](Handle h) const { return subs_[h.index]->event; }
+
+  inline bool updated(const char *name) const { return updated(handle(name)); }
+  inline bool alive(const char *name) const { return alive(handle(name)); }
+  inline bool valid(const char *name) const { return valid(handle(name)); }
+  inline uint64_t rcv_frame(const char *name) const { return rcv_frame(handle(name)); }
+  inline uint64_t rcv_time(const char *name) const { return rcv_time(handle(name)); }
+  inline cereal::Event::Reader &operator[](const char *name) const { return (*this)[handle(name)]; }
+
+  // Opt-in history of the last messages of a service, for lookups by time and receive interval statistics. Only
+  // messages received by update() are kept. Samples and their readers are valid until the next update.
+  struct Sample {
+    uint64_t rcv_time = 0, log_mono_time = 0;
+    cereal::Event::Reader event;
+  };
+  struct Intervals {
+    int count = 0;  // intervals between the samples
+    double mean_ms = 0, max_ms = 0, jitter_ms = 0;  // jitter is the standard deviation
+  };
+  // keeps the last size messages, drops what the service received so far
+  void setHistory(Handle h, int size);
+  int historySize(Handle h) const;
+  // 0 is the oldest
+  const Sample &history(Handle h, int i) const;
+  // by logMonoTime, nullptr if there's none: the latest at or before t, the earliest at or after t, the nearest
+  const Sample *before(Handle h, uint64_t t) const;
+  const Sample *after(Handle h, uint64_t t) const;
+  const Sample *nearest(Handle h, uint64_t t) const;
+  // the samples around t to interpolate between, false if t is outside the history
+  bool bracket(Handle h, uint64_t t, const Sample *&lo, const Sample *&hi) const;
+  // of rcv_time. the mean and jitter are kept as messages come, the max is found on each call
+  Intervals intervals(Handle h) const;
+  // with a history, alive is the last message being at most 2 * mean + 4 * jitter old instead of 10 / frequency,
+  // once there are a few intervals
+  void setAdaptiveAlive(Handle h, bool adaptive);
 
 private:
+  // a received message and its reader. the words are in the message itself, or copied to aligned_buf
+  struct Received {
+    Message *msg = nullptr;
+    AlignedBuffer aligned_buf;
+    std::optional<capnp::FlatArrayMessageReader> reader;
+    Sample sample;
+  };
+  struct SubMessage {
+    std::string name;
+    SubSocket *socket = nullptr;
+    int freq = 0;
+    bool updated = false, alive = false, valid = true, ignore_alive;
+    uint64_t rcv_time = 0, rcv_frame = 0;
+    bool is_polled = false;
+    // a ring of the last messages: the history, and one more so readers from the last update stay valid through this
+    // one. without a history, the last message and the one before it.
+    std::unique_ptr<Received[]> buffers;
+    int num_buffers = 0, current = 0;
+    int history = 0;
+    uint64_t received = 0;
+    double interval_sum = 0, interval_sum_sq = 0;  // of the history, ms
+    bool adaptive_alive = false;
+    cereal::Event::Reader event;
+  };
+
   bool all_(const std::vector<const char *> &service_list, bool valid, bool alive);
+  void receive_(int index);
+  void resetBuffers_(SubMessage *m, int num_buffers);
+  // i-th sample of the history, 0 is the oldest
+  const Sample &sample_(const SubMessage *m, int i) const;
+  void addInterval_(SubMessage *m);
+  Intervals intervalStats_(const SubMessage *m) const;  // without max_ms
+  void update_msgs_(uint64_t current_time);
   Poller *poller_ = nullptr;
-  struct SubMessage;
-  std::map<SubSocket *, SubMessage *> messages_;
-  std::map<std::string, SubMessage *> services_;
+  std::vector<SubMessage *> subs_;  // by handle index
+  std::vector<int> not_polled_;
+  std::vector<int> received_;  // in this update, preallocated
+  std::unordered_map<SubSocket *, int> sockets_;
+  std::map<std::string, int, std::less<>> services_;
 };
 
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  // builds in scratch until the message outgrows it. scratch must be zeroed, it's zeroed again on destruction
+  MessageBuilder(kj::ArrayPtr<capnp::word> scratch) : capnp::MallocMessageBuilder(scratch) {}
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
@@ -82,31 +190,64 @@ private:
   kj::Array<capnp::word> heapArray_;
 };
 
+// MessageBuilders that build in memory kept between messages, for publishers sending at a high rate. The memory of
+// a builder grows to fit the largest message built in it, after that building a message allocates nothing.
+// One per publisher, not thread safe. Builders must not outlive their pool.
+//   MessageBuilderPool pool;
+//   auto msg = pool.get();
+//   msg->initEvent().initCan(n);
+//   pm.send("can", *msg);
+class MessageBuilderPool {
+public:
+  MessageBuilderPool(size_t segment_words = 1024) : segment_words_(segment_words) {}
+
+  // a builder of the pool, back in it when this goes out of scope
+  class Builder {
+  public:
+    Builder(Builder &&other) : pool_(other.pool_), slot_(other.slot_) { other.pool_ = nullptr; }
+    Builder(const Builder &) = delete;
+    Builder &operator=(const Builder &) = delete;
+    ~Builder() { if (pool_) pool_->release(slot_); }
+    inline MessageBuilder &operator*() const { return *pool_->slots_[slot_]->builder; }
+    inline MessageBuilder *operator->() const { return &*pool_->slots_[slot_]->builder; }
+
+  private:
+    friend class MessageBuilderPool;
+    Builder(MessageBuilderPool *pool, int slot) : pool_(pool), slot_(slot) {}
+    MessageBuilderPool *pool_;
+    int slot_;
+  };
+
+  Builder get();
+  // builders in the pool, in use or not
+  inline size_t size() const { return slots_.size(); }
+
+private:
+  struct Slot {
+    kj::Array<capnp::word> scratch;
+    std::optional<MessageBuilder> builder;
+  };
+  void release(int slot);
+
+  size_t segment_words_;
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::vector<int> free_;
+};
+
 class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
-  inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
+  inline int send(const char *name, capnp::byte *data, size_t size) { return socket_(name)->send((char *)data, size); }
+  // serializes into a buffer kept by the sending thread, allocates nothing once it fits the message
   int send(const char *name, MessageBuilder &msg);
   ~PubMaster();
 
 private:
-  std::map<std::string, PubSocket *> sockets_;
-};
-
-class AlignedBuffer {
-public:
-  kj::ArrayPtr<const capnp::word> align(const char *data, const size_t size) {
-    words_size = size / sizeof(capnp::word) + 1;
-    if (aligned_buf.size() < words_size) {
-      aligned_buf = kj::heapArray<capnp::word>(words_size < 512 ? 512 : words_size);
-    }
-    memcpy(aligned_buf.begin(), data, size);
-    return aligned_buf.slice(0, words_size);
-  }
-  inline kj::ArrayPtr<const capnp::word> align(Message *m) {
-    return align(m->getData(), m->getSize());
+  // throws std::out_of_range if the service isn't published
+  PubSocket *socket_(std::string_view name) const {
+    auto it = sockets_.find(name);
+    if (it == sockets_.end()) throw std::out_of_range("PubMaster: not publishing " + std::string(name));
+    return it->second;
   }
-private:
-  kj::Array<capnp::word> aligned_buf;
-  size_t words_size;
+  std::map<std::string, PubSocket *, std::less<>> sockets_;
 };
@@ -1,8 +1,12 @@
 #include <time.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <string>
 #include <mutex>
+#include <stdexcept>
 
 #include "cereal/services.h"
 #include "cereal/messaging/messaging.h"
@@ -38,19 +42,6 @@ private:
 
 MessageContext message_context;
 
-struct SubMaster::SubMessage {
-  std::string name;
-  SubSocket *socket = nullptr;
-  int freq = 0;
-  bool updated = false, alive = false, valid = true, ignore_alive;
-  uint64_t rcv_time = 0, rcv_frame = 0;
-  void *allocated_msg_reader = nullptr;
-  bool is_polled = false;
-  capnp::FlatArrayMessageReader *msg_reader = nullptr;
-  AlignedBuffer aligned_buf;
-  cereal::Event::Reader event;
-};
-
 SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::vector<const char *> &poll,
                      const char *address, const std::vector<const char *> &ignore_alive) {
   poller_ = Poller::create();
@@ -67,57 +58,111 @@ SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::v
       .socket = socket,
       .freq = serv.frequency,
       .ignore_alive = inList(ignore_alive, name),
-      .allocated_msg_reader = malloc(sizeof(capnp::FlatArrayMessageReader)),
       .is_polled = is_polled};
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader({});
-    messages_[socket] = m;
-    services_[name] = m;
+    resetBuffers_(m, 2);
+
+    const int index = subs_.size();
+    if (!is_polled) not_polled_.push_back(index);
+    subs_.push_back(m);
+    sockets_[socket] = index;
+    services_[name] = index;
   }
+  received_.reserve(subs_.size());
 }
 
-void SubMaster::update(int timeout) {
-  for (auto &kv : messages_) kv.second->updated = false;
+SubMaster::Handle SubMaster::handle(const char *name) const {
+  auto it = services_.find(std::string_view(name));
+  if (it == services_.end()) {
+    throw std::out_of_range(std::string("SubMaster: not subscribed to ") + name);
+  }
+  return {it->second};
+}
 
-  auto sockets = poller_->poll(timeout);
+void SubMaster::resetBuffers_(SubMessage *m, int num_buffers) {
+  if (m->buffers) {
+    for (int i = 0; i < m->num_buffers; ++i) {
+      m->buffers[i].reader.reset();
+      delete m->buffers[i].msg;
+    }
+  }
+  m->buffers.reset(new Received[num_buffers]);
+  m->num_buffers = num_buffers;
+  m->current = 0;
+  m->received = 0;
+  m->interval_sum = m->interval_sum_sq = 0;
+  m->event = cereal::Event::Reader();
+}
 
-  // add non-polled sockets for non-blocking receive
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
-    SubSocket *s = kv.first;
-    if (!m->is_polled) sockets.push_back(s);
+void SubMaster::receive_(int index) {
+  SubMessage *m = subs_[index];
+  Message *msg = m->socket->receive(true);
+  if (msg == nullptr) return;
+
+  // replaces the oldest message
+  m->current = (m->current + 1) % m->num_buffers;
+  Received &r = m->buffers[m->current];
+  r.reader.reset();
+  delete r.msg;
+  r.msg = nullptr;
+
+  kj::ArrayPtr<const capnp::word> words;
+  if (zero_copy && (uintptr_t)msg->getData() % alignof(capnp::word) == 0 && msg->getSize() % sizeof(capnp::word) == 0) {
+    words = kj::ArrayPtr<const capnp::word>((const capnp::word *)msg->getData(), msg->getSize() / sizeof(capnp::word));
+    r.msg = msg;
+    ++copies_avoided;
+  } else {
+    words = r.aligned_buf.align(msg);
+    delete msg;
+    ++copies;
   }
 
-  uint64_t current_time = nanos_since_boot();
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = kj::maxValue; // Don't limit
+  r.reader.emplace(words, options);
+  m->event = r.sample.event = r.reader->getRoot<cereal::Event>();
+  r.sample.log_mono_time = m->event.getLogMonoTime();
+  ++m->received;
+  received_.push_back(index);
+}
 
-  std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
+void SubMaster::update(int timeout) {
+  for (auto m : subs_) m->updated = false;
 
-  for (auto s : sockets) {
-    Message *msg = s->receive(true);
-    if (msg == nullptr) continue;
+  auto sockets = poller_->poll(timeout);
 
-    SubMessage *m = messages_.at(s);
+  uint64_t current_time = nanos_since_boot();
 
-    m->msg_reader->~FlatArrayMessageReader();
-    capnp::ReaderOptions options;
-    options.traversalLimitInWords = kj::maxValue; // Don't limit
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg), options);
-    delete msg;
-    messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
+  received_.clear();
+  for (auto s : sockets) receive_(sockets_.at(s));
+  // non-polled sockets get a non-blocking receive
+  for (int index : not_polled_) receive_(index);
+  for (int index : received_) {
+    SubMessage *m = subs_[index];
+    m->buffers[m->current].sample.rcv_time = current_time;
+    addInterval_(m);
   }
 
-  update_msgs(current_time, messages);
+  update_msgs_(current_time);
 }
 
 void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<std::string, cereal::Event::Reader>> &messages){
-  if (++frame == UINT64_MAX) frame = 1;
-
+  received_.clear();
   for (auto &kv : messages) {
     auto m_find = services_.find(kv.first);
     if (m_find == services_.end()){
       continue;
     }
-    SubMessage *m = m_find->second;
-    m->event = kv.second;
+    subs_[m_find->second]->event = kv.second;
+    received_.push_back(m_find->second);
+  }
+  update_msgs_(current_time);
+}
+
+void SubMaster::update_msgs_(uint64_t current_time) {
+  if (++frame == UINT64_MAX) frame = 1;
+
+  for (int index : received_) {
+    SubMessage *m = subs_[index];
     m->updated = true;
     m->rcv_time = current_time;
     m->rcv_frame = frame;
@@ -126,22 +171,116 @@ void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<s
   }
 
   if (!SIMULATION) {
-    for (auto &kv : messages_) {
-      SubMessage *m = kv.second;
-      m->alive = (m->freq <= (1e-5) || ((current_time - m->rcv_time) * (1e-9)) < (10.0 / m->freq));
+    for (size_t i = 0; i < subs_.size(); ++i) {
+      SubMessage *m = subs_[i];
+      const double age_ms = (current_time - m->rcv_time) * 1e-6;
+      Intervals iv;
+      if (m->adaptive_alive && (iv = intervalStats_(m)).count >= 4) {
+        m->alive = age_ms <= 2 * iv.mean_ms + 4 * iv.jitter_ms;
+      } else {
+        m->alive = (m->freq <= (1e-5) || age_ms * 1e-3 < (10.0 / m->freq));
+      }
     }
   }
 }
 
+void SubMaster::setHistory(Handle h, int size) {
+  SubMessage *m = subs_[h.index];
+  m->history = std::max(size, 0);
+  resetBuffers_(m, std::max(m->history + 1, 2));
+}
+
+void SubMaster::setAdaptiveAlive(Handle h, bool adaptive) {
+  subs_[h.index]->adaptive_alive = adaptive;
+}
+
+int SubMaster::historySize(Handle h) const {
+  const SubMessage *m = subs_[h.index];
+  return std::min<uint64_t>(m->received, m->history);
+}
+
+const SubMaster::Sample &SubMaster::sample_(const SubMessage *m, int i) const {
+  const int size = std::min<uint64_t>(m->received, m->history);
+  return m->buffers[(m->current - size + 1 + i + m->num_buffers) % m->num_buffers].sample;
+}
+
+const SubMaster::Sample &SubMaster::history(Handle h, int i) const {
+  assert(i >= 0 && i < historySize(h));
+  return sample_(subs_[h.index], i);
+}
+
+const SubMaster::Sample *SubMaster::before(Handle h, uint64_t t) const {
+  for (int i = historySize(h) - 1; i >= 0; --i) {
+    const Sample &s = sample_(subs_[h.index], i);
+    if (s.log_mono_time <= t) return &s;
+  }
+  return nullptr;
+}
+
+const SubMaster::Sample *SubMaster::after(Handle h, uint64_t t) const {
+  for (int i = 0; i < historySize(h); ++i) {
+    const Sample &s = sample_(subs_[h.index], i);
+    if (s.log_mono_time >= t) return &s;
+  }
+  return nullptr;
+}
+
+const SubMaster::Sample *SubMaster::nearest(Handle h, uint64_t t) const {
+  const Sample *lo = before(h, t), *hi = after(h, t);
+  if (!lo || !hi) return lo ? lo : hi;
+  return t - lo->log_mono_time <= hi->log_mono_time - t ? lo : hi;
+}
+
+bool SubMaster::bracket(Handle h, uint64_t t, const Sample *&lo, const Sample *&hi) const {
+  lo = before(h, t);
+  hi = after(h, t);
+  return lo && hi;
+}
+
+// the interval of the sample just received goes in the sums, and the one of the sample it pushed out of the history
+void SubMaster::addInterval_(SubMessage *m) {
+  const int size = std::min<uint64_t>(m->received, m->history);
+  if (size < 2) return;
+
+  auto gap_ms = [this, m](int i) { return (sample_(m, i).rcv_time - sample_(m, i - 1).rcv_time) * 1e-6; };
+  const double added = gap_ms(size - 1);
+  m->interval_sum += added;
+  m->interval_sum_sq += added * added;
+  if (m->received > m->history) {
+    // the sample that left is still in the spare buffer of the ring
+    const double removed = gap_ms(0);
+    m->interval_sum -= removed;
+    m->interval_sum_sq -= removed * removed;
+  }
+}
+
+SubMaster::Intervals SubMaster::intervalStats_(const SubMessage *m) const {
+  Intervals iv;
+  iv.count = std::max<int>(std::min<uint64_t>(m->received, m->history) - 1, 0);
+  if (iv.count == 0) return iv;
+
+  iv.mean_ms = m->interval_sum / iv.count;
+  iv.jitter_ms = std::sqrt(std::max(m->interval_sum_sq / iv.count - iv.mean_ms * iv.mean_ms, 0.0));
+  return iv;
+}
+
+SubMaster::Intervals SubMaster::intervals(Handle h) const {
+  const SubMessage *m = subs_[h.index];
+  Intervals iv = intervalStats_(m);
+  for (int i = 1; i <= iv.count; ++i) {
+    iv.max_ms = std::max(iv.max_ms, (sample_(m, i).rcv_time - sample_(m, i - 1).rcv_time) * 1e-6);
+  }
+  return iv;
+}
+
 bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid, bool alive) {
   int found = 0;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
+  for (auto m : subs_) {
     if (service_list.size() == 0 || inList(service_list, m->name.c_str())) {
       found += (!valid || m->valid) && (!alive || (m->alive || m->ignore_alive));
     }
   }
-  return service_list.size() == 0 ? found == messages_.size() : found == service_list.size();
+  return service_list.size() == 0 ? found == subs_.size() : found == service_list.size();
 }
 
 void SubMaster::drain() {
@@ -157,41 +296,49 @@ void SubMaster::drain() {
   }
 }
 
-bool SubMaster::updated(const char *name) const {
-  return services_.at(name)->updated;
-}
-
-bool SubMaster::alive(const char *name) const {
-  return services_.at(name)->alive;
-}
-
-bool SubMaster::valid(const char *name) const {
-  return services_.at(name)->valid;
-}
-
-uint64_t SubMaster::rcv_frame(const char *name) const {
-  return services_.at(name)->rcv_frame;
-}
-
-uint64_t SubMaster::rcv_time(const char *name) const {
-  return services_.at(name)->rcv_time;
-}
-
-cereal::Event::Reader &SubMaster::operator[](const char *name) const {
-  return services_.at(name)->event;
-}
-
 SubMaster::~SubMaster() {
   delete poller_;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
-    m->msg_reader->~FlatArrayMessageReader();
-    free(m->allocated_msg_reader);
+  for (auto m : subs_) {
+    for (int i = 0; i < m->num_buffers; ++i) {
+      m->buffers[i].reader.reset();
+      delete m->buffers[i].msg;
+    }
     delete m->socket;
     delete m;
   }
 }
 
+MessageBuilderPool::Builder MessageBuilderPool::get() {
+  if (free_.empty()) {
+    auto slot = std::make_unique<Slot>();
+    slot->scratch = kj::heapArray<capnp::word>(segment_words_);
+    memset(slot->scratch.begin(), 0, slot->scratch.asBytes().size());
+    slots_.push_back(std::move(slot));
+    free_.reserve(slots_.size());
+    free_.push_back(slots_.size() - 1);
+  }
+  const int i = free_.back();
+  free_.pop_back();
+  slots_[i]->builder.emplace(slots_[i]->scratch);
+  return Builder(this, i);
+}
+
+void MessageBuilderPool::release(int i) {
+  Slot &slot = *slots_[i];
+  // a message that outgrew the scratch got more segments from malloc. grow it to fit the whole message, with some
+  // room to spare, next time
+  size_t words = 0;
+  auto segments = slot.builder->getSegmentsForOutput();
+  for (auto segment : segments) words += segment.size();
+  const bool outgrown = segments.size() > 1;
+  slot.builder.reset();  // zeroes what it used of the scratch
+  if (outgrown) {
+    slot.scratch = kj::heapArray<capnp::word>(words + words / 4);
+    memset(slot.scratch.begin(), 0, slot.scratch.asBytes().size());
+  }
+  free_.push_back(i);
+}
+
 PubMaster::PubMaster(const std::vector<const char *> &service_list) {
   for (auto name : service_list) {
     assert(services.count(name) > 0);
@@ -202,8 +349,15 @@ PubMaster::PubMaster(const std::vector<const char *> &service_list) {
 }
 
 int PubMaster::send(const char *name, MessageBuilder &msg) {
-  auto bytes = msg.toBytes();
-  return send(name, bytes.begin(), bytes.size());
+  // per thread, a PubMaster can be shared by threads publishing different services
+  static thread_local kj::Array<capnp::word> buf;
+  const size_t words = capnp::computeSerializedSizeInWords(msg);
+  if (buf.size() < words) {
+    buf = kj::heapArray<capnp::word>(std::max(words, buf.size() * 2));
+  }
+  kj::ArrayOutputStream out(buf.asBytes());
+  capnp::writeMessage(out, msg);
+  return send(name, buf.asBytes().begin(), words * sizeof(capnp::word));
 }
 
 PubMaster::~PubMaster() {
@@ -0,0 +1,90 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+#include "cereal/messaging/messaging.h"
+
+// Sends of a CAN message as pandad publishes it, and of an IMU sample as sensord does: a new MessageBuilder and a
+// flat copy of it per message as PubMaster used to, a new MessageBuilder with the reused send buffer, and a builder
+// of a MessageBuilderPool. Counts heap allocations through operator new, and capnp's segments through calloc (glibc).
+
+static std::atomic<uint64_t> allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+#ifdef __GLIBC__
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *calloc(size_t n, size_t size) {
+  ++allocations;
+  return __libc_calloc(n, size);
+}
+#endif
+
+void build_can(MessageBuilder &msg) {
+  auto can = msg.initEvent().initCan(100);
+  for (int i = 0; i < 100; ++i) {
+    can[i].setAddress(0x100 + i);
+    can[i].setSrc(i % 3);
+    can[i].initDat(8)[0] = i;
+  }
+}
+
+void build_accelerometer(MessageBuilder &msg) {
+  auto event = msg.initEvent().initAccelerometer();
+  event.setSource(cereal::SensorEventData::SensorSource::LSM6DS3);
+  float xyz[] = {0.1, -0.1, 9.8};
+  auto svec = event.initAcceleration();
+  svec.setV(xyz);
+  svec.setStatus(true);
+}
+
+template <class Build>
+void bench(const char *service, Build &&build, int n) {
+  PubMaster pm({service});
+  MessageBuilderPool pool;
+  auto run = [&](const char *name, auto &&send) {
+    for (int i = 0; i < 100; ++i) send();  // warm up
+    const uint64_t start = allocations;
+    auto t = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) send();
+    const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    printf("  %-32s %10.0f msgs/s  %6.2f allocations/msg\n", name, n / s, double(allocations - start) / n);
+  };
+
+  printf("%s, %d messages\n", service, n);
+  run("new builder, flat copy", [&]() {
+    MessageBuilder msg;
+    build(msg);
+    auto bytes = msg.toBytes();
+    pm.send(service, bytes.begin(), bytes.size());
+  });
+  run("new builder, reused send buffer", [&]() {
+    MessageBuilder msg;
+    build(msg);
+    pm.send(service, msg);
+  });
+  run("pooled builder", [&]() {
+    auto msg = pool.get();
+    build(*msg);
+    pm.send(service, *msg);
+  });
+}
+
+int main(int argc, char *argv[]) {
+  const int n = argc > 1 ? atoi(argv[1]) : 100000;
+  // a subscriber, so msgq has a reader to copy to
+  SubMaster sm({"can", "accelerometer"});
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  bench("can", build_can, n);
+  bench("accelerometer", build_accelerometer, n);
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <capnp/dynamic.h>
+
+#include "cereal/messaging/messaging.h"
+#include "common/timing.h"
+
+// SubMaster in a controlsd like loop: an update with a new message on every service, then updated/alive/valid/[]
+// on each of them. By handle, by name, and by name as SubMaster used to look them up (std::map<std::string, ...>::at),
+// plus the update_msgs path with its vector of names. Before that, receiving messages of typical sizes, read in place
+// or copied. Counts heap allocations through operator new, the transport's included (msgq allocates every received
+// Message). capnp allocates segments with calloc, those aren't counted.
+
+static std::atomic<uint64_t> allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+const std::vector<const char *> SERVICES = {
+  "deviceState", "pandaStates", "peripheralState", "modelV2", "liveCalibration", "carOutput", "driverMonitoringState",
+  "longitudinalPlan", "liveLocationKalman", "managerState", "liveParameters", "radarState", "liveTorqueParameters",
+  "roadCameraState", "driverCameraState", "wideRoadCameraState", "carState", "carControl", "controlsState",
+  "onroadEvents", "accelerometer", "gyroscope",
+};
+
+template <class Func>
+double time_ns(Func &&func) {
+  auto start = std::chrono::steady_clock::now();
+  func();
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Result {
+  const char *name;
+  double ns = 0;
+  uint64_t allocs = 0, calls = 0;
+
+  template <class Func>
+  void run(Func &&func, int n = 1) {
+    const uint64_t start = allocations;
+    ns += time_ns(func);
+    allocs += allocations - start;
+    calls += n;
+  }
+  void report() const {
+    printf("  %-34s %10.1f ns/call  %8.2f allocations/call\n", name, ns / calls, (double)allocs / calls);
+  }
+};
+
+// update with one message of each size, read in place or copied
+void bench_sizes(int cycles) {
+  const std::vector<std::pair<const char *, size_t>> sizes = {
+    {"carState", 800}, {"liveLocationKalman", 3000}, {"modelV2", 60000}, {"roadEncodeData", 400000},
+  };
+  printf("receive, %d cycles\n", cycles);
+  for (auto [name, size] : sizes) {
+    // roadEncodeData with a blob, the size of a typical message of the service
+    MessageBuilder msg;
+    msg.initEvent().initRoadEncodeData().initData(size);
+    const kj::Array<capnp::word> words = capnp::messageToFlatArray(msg);
+
+    for (bool zero_copy : {false, true}) {
+      SubMaster sm({"roadEncodeData"});
+      PubMaster pm({"roadEncodeData"});
+      sm.zero_copy = zero_copy;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+      const std::string label = std::string(name) + " size, " + (zero_copy ? "zero copy" : "copied");
+      Result update{label.c_str()};
+      for (int c = 0; c < cycles; ++c) {
+        pm.send("roadEncodeData", (capnp::byte *)words.begin(), words.size() * sizeof(capnp::word));
+        update.run([&]() { sm.update(0); });
+      }
+      update.report();
+      printf("    %" PRIu64 " copies, %" PRIu64 " avoided\n", sm.copies, sm.copies_avoided);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const int cycles = argc > 1 ? atoi(argv[1]) : 2000;
+  bench_sizes(cycles);
+
+  SubMaster sm(SERVICES);
+  PubMaster pm(SERVICES);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  // a default message of each service
+  std::vector<kj::Array<capnp::word>> msgs;
+  for (auto name : SERVICES) {
+    MessageBuilder msg;
+    capnp::toDynamic(msg.initEvent()).init(name);
+    msgs.push_back(capnp::messageToFlatArray(msg));
+  }
+
+  std::vector<SubMaster::Handle> handles;
+  std::map<std::string, int> legacy;
+  for (int i = 0; i < SERVICES.size(); ++i) {
+    handles.push_back(sm.handle(SERVICES[i]));
+    legacy[SERVICES[i]] = handles.back().index;
+  }
+
+  Result update{"update, a message on every service"}, update_msgs{"update_msgs"};
+  Result by_handle{"lookup by handle"}, by_name{"lookup by name"}, by_legacy_name{"lookup by name, std::map::at"};
+  const int lookups = SERVICES.size() * 4;
+  int sum = 0;
+  for (int c = 0; c < cycles; ++c) {
+    for (int i = 0; i < SERVICES.size(); ++i) {
+      pm.send(SERVICES[i], (capnp::byte *)msgs[i].begin(), msgs[i].size() * sizeof(capnp::word));
+    }
+    update.run([&]() { sm.update(0); });
+
+    std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
+    update_msgs.run([&]() {
+      for (int i = 0; i < SERVICES.size(); ++i) messages.push_back({SERVICES[i], sm[handles[i]]});
+      sm.update_msgs(nanos_since_boot(), messages);
+    });
+
+    by_handle.run([&]() {
+      for (auto h : handles) sum += sm.updated(h) + sm.alive(h) + sm.valid(h) + sm[h].getValid();
+    }, lookups);
+    by_name.run([&]() {
+      for (auto name : SERVICES) sum += sm.updated(name) + sm.alive(name) + sm.valid(name) + sm[name].getValid();
+    }, lookups);
+    by_legacy_name.run([&]() {
+      for (auto name : SERVICES) {
+        sum += sm.updated({legacy.at(name)}) + sm.alive({legacy.at(name)}) + sm.valid({legacy.at(name)}) + sm[{legacy.at(name)}].getValid();
+      }
+    }, lookups);
+  }
+
+  printf("%zu services, %d cycles\n", SERVICES.size(), cycles);
+  update.report();
+  update_msgs.report();
+  by_handle.report();
+  by_name.report();
+  by_legacy_name.report();
+  return sum < 0;
+}
@@ -0,0 +1,116 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/bridge_mux.h"
+
+const uint64_t MS = 1000000;
+
+struct Record {
+  uint16_t service;
+  std::string data;
+};
+
+std::vector<Record> decode(MuxDecoder &decoder, std::string_view batch, bool *valid = nullptr) {
+  std::vector<Record> records;
+  bool ok = decoder.decode(batch.data(), batch.size(), [&](const MuxRecordHeader &r, const char *data) {
+    records.push_back({r.service, std::string(data, r.size)});
+  });
+  if (valid) *valid = ok;
+  return records;
+}
+
+TEST_CASE("bridge mux") {
+  const int zstd_level = GENERATE(0, 3);
+  INFO("zstd level " << zstd_level);
+  MuxEncoder encoder(1024, 5 * MS, zstd_level);
+  MuxDecoder decoder;
+  REQUIRE(encoder.empty());
+  REQUIRE(encoder.timeout_ms(0) == -1);
+
+  SECTION("round trip") {
+    std::mt19937 rng(42);
+    std::vector<Record> sent;
+    for (int i = 0; i < 20; ++i) {
+      sent.push_back({uint16_t(rng() % mux_services().size()), std::string(rng() % 40, 'a' + i)});
+      encoder.add(sent.back().service, sent.back().data.data(), sent.back().data.size(), 1000 * MS + i * 100000);
+    }
+    std::string_view batch = encoder.flush(1003 * MS, 42);
+    REQUIRE(encoder.empty());
+
+    bool valid;
+    std::vector<Record> received = decode(decoder, batch, &valid);
+    REQUIRE(valid);
+    REQUIRE(decoder.header.records == sent.size());
+    REQUIRE(decoder.header.sent_wall_time == 42);
+    REQUIRE(bool(decoder.header.flags & MUX_ZSTD) == (zstd_level > 0));
+    REQUIRE(received.size() == sent.size());
+    for (int i = 0; i < sent.size(); ++i) {
+      REQUIRE(received[i].service == sent[i].service);
+      REQUIRE(received[i].data == sent[i].data);
+    }
+    REQUIRE(encoder.batches == 1);
+    REQUIRE(encoder.raw_bytes == sizeof(MuxBatchHeader) + decoder.header.raw_size);
+  }
+
+  SECTION("time in the batch") {
+    encoder.add(0, "a", 1, 1000 * MS);
+    encoder.add(1, "b", 1, 1002 * MS);
+    std::vector<uint32_t> queued_us;
+    std::string_view batch = encoder.flush(1004 * MS, 0);
+    decoder.decode(batch.data(), batch.size(), [&](const MuxRecordHeader &r, const char *) { queued_us.push_back(r.queued_us); });
+    REQUIRE((queued_us == std::vector<uint32_t>{4000, 2000}));
+  }
+
+  SECTION("due by time") {
+    encoder.add(0, "a", 1, 1000 * MS);
+    REQUIRE(!encoder.due(1004 * MS));
+    REQUIRE(encoder.timeout_ms(1003 * MS + MS / 2) == 2);
+    REQUIRE(encoder.due(1005 * MS));
+    REQUIRE(encoder.timeout_ms(1005 * MS) == 0);
+  }
+
+  SECTION("due by size") {
+    const std::string data(500, 'x');
+    encoder.add(0, data.data(), data.size(), 1000 * MS);
+    REQUIRE(!encoder.due(1000 * MS));
+    encoder.add(0, data.data(), data.size(), 1000 * MS);
+    REQUIRE(encoder.due(1000 * MS));
+  }
+
+  SECTION("lost batches") {
+    std::vector<std::string> batches;
+    for (int i = 0; i < 5; ++i) {
+      encoder.add(0, "a", 1, 1000 * MS);
+      batches.emplace_back(encoder.flush(1000 * MS, 0));
+    }
+    decode(decoder, batches[0]);
+    decode(decoder, batches[3]);
+    decode(decoder, batches[4]);
+    REQUIRE(decoder.batches == 3);
+    REQUIRE(decoder.lost_batches == 2);
+  }
+
+  SECTION("invalid batches") {
+    encoder.add(0, "abc", 3, 1000 * MS);
+    encoder.add(1, "def", 3, 1000 * MS);
+    const std::string batch(encoder.flush(1000 * MS, 0));
+    bool valid;
+
+    std::string other = batch;
+    MuxBatchHeader header;
+    memcpy(&header, other.data(), sizeof(header));
+    header.services_hash += 1;
+    memcpy(other.data(), &header, sizeof(header));
+    REQUIRE(decode(decoder, other, &valid).empty());
+    REQUIRE(!valid);
+
+    for (size_t size : {size_t(10), sizeof(MuxBatchHeader), batch.size() - 1}) {
+      REQUIRE(decode(decoder, std::string_view(batch.data(), size), &valid).empty());
+      REQUIRE(!valid);
+    }
+    REQUIRE(decode(decoder, batch, &valid).size() == 2);
+    REQUIRE(valid);
+  }
+}
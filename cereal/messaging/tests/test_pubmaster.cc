@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+
+// heap allocations through operator new, by all of test_messaging. capnp allocates segments with calloc, the
+// pool's segments are checked by address instead
+static std::atomic<uint64_t> allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+void build_can(MessageBuilder &msg, int frames) {
+  auto can = msg.initEvent().initCan(frames);
+  for (int i = 0; i < frames; ++i) {
+    can[i].setAddress(i);
+    can[i].initDat(8)[0] = i;
+  }
+}
+
+TEST_CASE("MessageBuilderPool") {
+  MessageBuilderPool pool(64);
+  const capnp::word *first_segment;
+  {
+    auto msg = pool.get();
+    build_can(*msg, 1);
+    REQUIRE(msg->getSegmentsForOutput().size() == 1);
+    first_segment = msg->getSegmentsForOutput()[0].begin();
+  }
+  REQUIRE(pool.size() == 1);
+
+  SECTION("reuses the segment, zeroed") {
+    auto msg = pool.get();
+    REQUIRE(pool.size() == 1);
+    const capnp::byte *bytes = (const capnp::byte *)first_segment;
+    REQUIRE(std::all_of(bytes, bytes + 64 * sizeof(capnp::word), [](capnp::byte b) { return b == 0; }));
+    build_can(*msg, 1);
+    REQUIRE(msg->getSegmentsForOutput()[0].begin() == first_segment);
+  }
+
+  SECTION("a builder per message in flight") {
+    auto a = pool.get();
+    auto b = pool.get();
+    REQUIRE(pool.size() == 2);
+    build_can(*a, 1);
+    build_can(*b, 1);
+    REQUIRE(a->getSegmentsForOutput()[0].begin() != b->getSegmentsForOutput()[0].begin());
+  }
+
+  SECTION("grows to fit") {
+    {
+      auto msg = pool.get();
+      build_can(*msg, 100);
+      REQUIRE(msg->getSegmentsForOutput().size() > 1);
+    }
+    auto msg = pool.get();
+    build_can(*msg, 100);
+    REQUIRE(msg->getSegmentsForOutput().size() == 1);
+  }
+}
+
+TEST_CASE("PubMaster::send") {
+  SubMaster sm({"can"});
+  PubMaster pm({"can"});
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  MessageBuilderPool pool;
+
+  SECTION("sends the message") {
+    auto msg = pool.get();
+    build_can(*msg, 10);
+    const kj::Array<capnp::word> expected = capnp::messageToFlatArray(*msg);
+    REQUIRE(pm.send("can", *msg) == expected.asBytes().size());
+    sm.update(1000);
+    REQUIRE(sm.updated("can"));
+    auto can = sm["can"].getCan();
+    REQUIRE(can.size() == 10);
+    REQUIRE(can[9].getAddress() == 9);
+    REQUIRE(can[9].getDat()[0] == 9);
+  }
+
+  SECTION("allocates nothing") {
+    for (int frames : {100, 10, 100}) {
+      auto msg = pool.get();
+      build_can(*msg, frames);
+      pm.send("can", *msg);
+    }
+    const uint64_t start = allocations;
+    for (int i = 0; i < 1000; ++i) {
+      auto msg = pool.get();
+      build_can(*msg, i % 2 ? 100 : 10);
+      pm.send("can", *msg);
+    }
+    REQUIRE(allocations - start == 0);
+  }
+
+  REQUIRE_THROWS_AS(pm.send("carState", nullptr, 0), std::out_of_range);
+}
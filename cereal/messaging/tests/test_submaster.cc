@@ -0,0 +1,95 @@
+#include <thread>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+
+const uint64_t MS = 1000000;
+
+void send(PubMaster &pm, uint64_t log_mono_time, float speed) {
+  MessageBuilder msg;
+  auto event = msg.initEvent();
+  event.setLogMonoTime(log_mono_time);
+  event.initCarState().setVEgo(speed);
+  pm.send("carState", msg);
+}
+
+TEST_CASE("SubMaster") {
+  SubMaster sm({"carState", "controlsState"});
+  PubMaster pm({"carState"});
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  const SubMaster::Handle car_state = sm.handle("carState");
+  REQUIRE(car_state.index == 0);
+  REQUIRE(sm.handle("controlsState").index == 1);
+  REQUIRE_THROWS_AS(sm.handle("modelV2"), std::out_of_range);
+
+  SECTION("handles and names") {
+    send(pm, 1000 * MS, 1.0);
+    sm.update(1000);
+    REQUIRE(sm.updated(car_state));
+    REQUIRE(sm.updated("carState"));
+    REQUIRE(!sm.updated("controlsState"));
+    REQUIRE(sm.rcv_frame(car_state) == sm.rcv_frame("carState"));
+    REQUIRE(sm[car_state].getCarState().getVEgo() == 1.0);
+  }
+
+  SECTION("readers stay valid through the next update") {
+    send(pm, 1000 * MS, 1.0);
+    sm.update(1000);
+    const cereal::CarState::Reader first = sm[car_state].getCarState();
+    send(pm, 1010 * MS, 2.0);
+    sm.update(1000);
+    REQUIRE(first.getVEgo() == 1.0);
+    REQUIRE(sm[car_state].getCarState().getVEgo() == 2.0);
+    REQUIRE(sm.copies + sm.copies_avoided == 2);
+  }
+
+  SECTION("history") {
+    sm.setHistory(car_state, 5);
+    REQUIRE(sm.historySize(car_state) == 0);
+    REQUIRE(sm.before(car_state, 0) == nullptr);
+
+    // 8 messages 10ms apart, the last 5 are kept
+    for (int i = 0; i < 8; ++i) {
+      send(pm, (1000 + i * 10) * MS, i);
+      sm.update(1000);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    REQUIRE(sm.historySize(car_state) == 5);
+    for (int i = 0; i < 5; ++i) {
+      REQUIRE(sm.history(car_state, i).log_mono_time == (1030 + i * 10) * MS);
+      REQUIRE(sm.history(car_state, i).event.getCarState().getVEgo() == 3 + i);
+    }
+
+    REQUIRE(sm.before(car_state, 1045 * MS)->log_mono_time == 1040 * MS);
+    REQUIRE(sm.before(car_state, 1040 * MS)->log_mono_time == 1040 * MS);
+    REQUIRE(sm.after(car_state, 1045 * MS)->log_mono_time == 1050 * MS);
+    REQUIRE(sm.nearest(car_state, 1047 * MS)->log_mono_time == 1050 * MS);
+    REQUIRE(sm.nearest(car_state, 1000 * MS)->log_mono_time == 1030 * MS);
+    REQUIRE(sm.before(car_state, 1029 * MS) == nullptr);
+    REQUIRE(sm.after(car_state, 1071 * MS) == nullptr);
+
+    const SubMaster::Sample *lo, *hi;
+    REQUIRE(sm.bracket(car_state, 1055 * MS, lo, hi));
+    REQUIRE(lo->event.getCarState().getVEgo() == 5);
+    REQUIRE(hi->event.getCarState().getVEgo() == 6);
+    REQUIRE(!sm.bracket(car_state, 1075 * MS, lo, hi));
+
+    const SubMaster::Intervals iv = sm.intervals(car_state);
+    REQUIRE(iv.count == 4);
+    REQUIRE(iv.mean_ms >= 10);
+    REQUIRE(iv.max_ms >= iv.mean_ms);
+    // the running sums match the intervals in the history
+    double sum = 0;
+    for (int i = 1; i < 5; ++i) sum += (sm.history(car_state, i).rcv_time - sm.history(car_state, i - 1).rcv_time) * 1e-6;
+    REQUIRE(iv.mean_ms == Approx(sum / 4));
+    REQUIRE(sm.alive(car_state));
+
+    // gone for a lot longer than it used to take, but less than 10 / frequency
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    sm.update(0);
+    REQUIRE(sm.alive(car_state));
+    sm.setAdaptiveAlive(car_state, true);
+    sm.update(0);
+    REQUIRE(!sm.alive(car_state));
+  }
+}
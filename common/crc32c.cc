@@ -0,0 +1,90 @@
+#include "common/crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace {
+
+constexpr uint32_t POLY = 0x82F63B78;  // reversed 0x1EDC6F41
+
+// slicing by 8 tables
+constexpr std::array<std::array<uint32_t, 256>, 8> make_tables() {
+  std::array<std::array<uint32_t, 256>, 8> t = {};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k) {
+      c = (c >> 1) ^ ((c & 1) ? POLY : 0);
+    }
+    t[0][i] = c;
+  }
+  for (int n = 1; n < 8; ++n) {
+    for (int i = 0; i < 256; ++i) {
+      t[n][i] = (t[n - 1][i] >> 8) ^ t[0][t[n - 1][i] & 0xFF];
+    }
+  }
+  return t;
+}
+
+constexpr auto TABLES = make_tables();
+
+uint32_t crc32c_sw(const uint8_t *p, size_t size, uint32_t crc) {
+  for (; size >= 8; p += 8, size -= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    v ^= crc;
+    crc = TABLES[7][v & 0xFF] ^ TABLES[6][(v >> 8) & 0xFF] ^ TABLES[5][(v >> 16) & 0xFF] ^ TABLES[4][(v >> 24) & 0xFF] ^
+          TABLES[3][(v >> 32) & 0xFF] ^ TABLES[2][(v >> 40) & 0xFF] ^ TABLES[1][(v >> 48) & 0xFF] ^ TABLES[0][v >> 56];
+  }
+  for (; size > 0; ++p, --size) {
+    crc = (crc >> 8) ^ TABLES[0][(crc ^ *p) & 0xFF];
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t crc32c_hw(const uint8_t *p, size_t size, uint32_t crc) {
+  uint64_t c = crc;
+  for (; size >= 8; p += 8, size -= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+  crc = c;
+  for (; size > 0; ++p, --size) {
+    crc = _mm_crc32_u8(crc, *p);
+  }
+  return crc;
+}
+const bool HAS_HW_CRC = __builtin_cpu_supports("sse4.2");
+#elif defined(__ARM_FEATURE_CRC32)
+uint32_t crc32c_hw(const uint8_t *p, size_t size, uint32_t crc) {
+  for (; size >= 8; p += 8, size -= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    crc = __crc32cd(crc, v);
+  }
+  for (; size > 0; ++p, --size) {
+    crc = __crc32cb(crc, *p);
+  }
+  return crc;
+}
+const bool HAS_HW_CRC = true;
+#else
+uint32_t crc32c_hw(const uint8_t *p, size_t size, uint32_t crc) { return crc32c_sw(p, size, crc); }
+const bool HAS_HW_CRC = false;
+#endif
+
+}  // namespace
+
+uint32_t crc32c(const void *data, size_t size, uint32_t crc) {
+  const uint8_t *p = (const uint8_t *)data;
+  crc = ~crc;
+  crc = HAS_HW_CRC ? crc32c_hw(p, size, crc) : crc32c_sw(p, size, crc);
+  return ~crc;
+}
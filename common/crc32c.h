@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli), with the SSE4.2 or ARMv8 CRC instructions when available.
+// Pass the result of a previous call as crc to continue a checksum.
+uint32_t crc32c(const void *data, size_t size, uint32_t crc = 0);
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <ctime>
+#endif
+
+// Bounded lock-free queues, for hand-offs where SafeQueue's lock is contended. A push never blocks, it fails when the
+// queue is full, or with OnFull::DropOldest takes the place of the oldest item. pop() and a try_pop() with a timeout
+// wait on a futex, a push only makes a syscall if the consumer is waiting.
+// T must be default constructible and move assignable, the slots are allocated up front. Capacities are rounded up
+// to a power of 2.
+
+// the wait of the consumer, one thread. on Linux a futex, elsewhere it polls
+class QueueWaiter {
+public:
+  // after a push, its items must be visible to ready() of the waiter. only the first push after the consumer went
+  // to sleep wakes it, the next ones find it awake even if it didn't run yet
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting_.load(std::memory_order_relaxed) && waiting_.exchange(false, std::memory_order_relaxed)) {
+      seq_.fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+      syscall(SYS_futex, (uint32_t *)&seq_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+    }
+  }
+
+  // waits for ready(), up to timeout_ms, forever if it's negative. returns ready()
+  template <class Ready>
+  bool wait(Ready &&ready, int timeout_ms) {
+    if (ready()) return true;
+    if (timeout_ms == 0) return false;
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+      const uint32_t seq = seq_.load(std::memory_order_acquire);
+      waiting_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ready()) {
+        waiting_.store(false, std::memory_order_relaxed);
+        return true;
+      }
+      auto remaining = std::chrono::nanoseconds::max();
+      if (timeout_ms > 0) {
+        remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining.count() <= 0) {
+          waiting_.store(false, std::memory_order_relaxed);
+          return false;
+        }
+      }
+#ifdef __linux__
+      // returns once seq_ changed, also if it did before the call
+      if (timeout_ms > 0) {
+        const timespec ts = {(time_t)(remaining.count() / 1000000000), (long)(remaining.count() % 1000000000)};
+        syscall(SYS_futex, (uint32_t *)&seq_, FUTEX_WAIT_PRIVATE, seq, &ts, nullptr, 0);
+      } else {
+        syscall(SYS_futex, (uint32_t *)&seq_, FUTEX_WAIT_PRIVATE, seq, nullptr, nullptr, 0);
+      }
+#else
+      std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(remaining, std::chrono::microseconds(100)));
+#endif
+      waiting_.store(false, std::memory_order_relaxed);
+      if (ready()) return true;
+    }
+  }
+
+private:
+  std::atomic<uint32_t> seq_ = 0;
+  std::atomic<bool> waiting_ = false;
+};
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+inline size_t queue_capacity(size_t capacity) {
+  size_t n = 2;
+  while (n < capacity) n *= 2;
+  return n;
+}
+
+// one producer thread, one consumer thread
+template <class T>
+class SpscQueue {
+public:
+  explicit SpscQueue(size_t capacity = 1024) : mask_(queue_capacity(capacity) - 1), slots_(new T[mask_ + 1]) {}
+
+  // false if it's full
+  bool push(T v) {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    if (free_slots(head, 1) == 0) return false;
+    slots_[head & mask_] = std::move(v);
+    head_.store(head + 1, std::memory_order_release);
+    waiter_.notify();
+    return true;
+  }
+
+  // pushes what fits of the n items, returns how many
+  size_t push_batch(const T *items, size_t n) {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    n = std::min<size_t>(n, free_slots(head, n));
+    if (n == 0) return 0;
+    for (size_t i = 0; i < n; ++i) slots_[(head + i) & mask_] = items[i];
+    head_.store(head + n, std::memory_order_release);
+    waiter_.notify();
+    return n;
+  }
+
+  T pop() {
+    T v;
+    waiter_.wait([&]() { return try_pop_now(v); }, -1);
+    return v;
+  }
+
+  bool try_pop(T &v, int timeout_ms = 0) {
+    return waiter_.wait([&]() { return try_pop_now(v); }, timeout_ms);
+  }
+
+  // pops up to max items, waiting up to timeout_ms for the first. returns how many
+  size_t pop_batch(T *out, size_t max, int timeout_ms = 0) {
+    size_t n = 0;
+    waiter_.wait([&]() {
+      const uint64_t tail = tail_.load(std::memory_order_relaxed);
+      n = std::min<size_t>(max, available(tail, max));
+      for (size_t i = 0; i < n; ++i) out[i] = std::move(slots_[(tail + i) & mask_]);
+      tail_.store(tail + n, std::memory_order_release);
+      return n > 0;
+    }, timeout_ms);
+    return n;
+  }
+
+  bool empty() const { return size() == 0; }
+  size_t size() const {
+    const uint64_t tail = tail_.load(std::memory_order_acquire);
+    return head_.load(std::memory_order_acquire) - tail;
+  }
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  // of the producer, the consumer's tail is read again only when the cached one shows less than wanted free
+  size_t free_slots(uint64_t head, size_t wanted) {
+    if (mask_ + 1 - (head - tail_cache_) < wanted) tail_cache_ = tail_.load(std::memory_order_acquire);
+    return mask_ + 1 - (head - tail_cache_);
+  }
+  // of the consumer, likewise
+  size_t available(uint64_t tail, size_t wanted) {
+    if (head_cache_ - tail < wanted) head_cache_ = head_.load(std::memory_order_acquire);
+    return head_cache_ - tail;
+  }
+  bool try_pop_now(T &v) {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (available(tail, 1) == 0) return false;
+    v = std::move(slots_[tail & mask_]);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  const size_t mask_;
+  std::unique_ptr<T[]> slots_;
+  // the producer's and the consumer's, on their own cache lines
+  alignas(64) std::atomic<uint64_t> head_ = 0;
+  uint64_t tail_cache_ = 0;
+  alignas(64) std::atomic<uint64_t> tail_ = 0;
+  uint64_t head_cache_ = 0;
+  alignas(64) QueueWaiter waiter_;
+};
+
+// what a push to a full queue does
+enum class OnFull {
+  Reject,      // fails
+  DropOldest,  // pops and drops the oldest item, counted in dropped()
+};
+
+// any number of producer threads, one consumer thread. a slot has a sequence number telling whose turn it is
+// (Vyukov's bounded queue), with OnFull::DropOldest the producers pop too
+template <class T, OnFull on_full = OnFull::Reject>
+class MpscQueue {
+public:
+  explicit MpscQueue(size_t capacity = 1024) : mask_(queue_capacity(capacity) - 1), slots_(new Slot[mask_ + 1]) {
+    for (size_t i = 0; i <= mask_; ++i) slots_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  // false if it's full, never with OnFull::DropOldest
+  bool push(T v) {
+    if (!push_now(v)) return false;
+    waiter_.notify();
+    return true;
+  }
+
+  // pushes the items until one doesn't fit, returns how many. one notify for all of them
+  size_t push_batch(const T *items, size_t n) {
+    size_t pushed = 0;
+    for (; pushed < n; ++pushed) {
+      T v = items[pushed];
+      if (!push_now(v)) break;
+    }
+    if (pushed > 0) waiter_.notify();
+    return pushed;
+  }
+
+  T pop() {
+    T v;
+    waiter_.wait([&]() { return pop_now(v); }, -1);
+    return v;
+  }
+
+  bool try_pop(T &v, int timeout_ms = 0) {
+    return waiter_.wait([&]() { return pop_now(v); }, timeout_ms);
+  }
+
+  // pops up to max items, waiting up to timeout_ms for the first. returns how many
+  size_t pop_batch(T *out, size_t max, int timeout_ms = 0) {
+    size_t n = 0;
+    waiter_.wait([&]() {
+      while (n < max && pop_now(out[n])) ++n;
+      return n > 0;
+    }, timeout_ms);
+    return n;
+  }
+
+  // approximate while pushes and pops are in progress
+  size_t size() const {
+    const uint64_t tail = tail_.load(std::memory_order_acquire);
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    return head > tail ? std::min<size_t>(head - tail, mask_ + 1) : 0;
+  }
+  bool empty() const { return size() == 0; }
+  size_t capacity() const { return mask_ + 1; }
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> seq;  // pos when it's free for the push of pos, pos + 1 once that push is done
+    T value;
+  };
+
+  bool push_now(T &v) {
+    uint64_t pos = head_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      const int64_t diff = (int64_t)(slot->seq.load(std::memory_order_acquire) - pos);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        // full, the item pushed capacity pushes ago wasn't popped yet
+        if constexpr (on_full == OnFull::Reject) {
+          return false;
+        } else {
+          // unless it's being popped, or the push of the oldest isn't done yet
+          T oldest;
+          if (tail_.load(std::memory_order_relaxed) + mask_ + 1 <= pos && pop_now(oldest)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+          } else {
+            std::this_thread::yield();
+          }
+          pos = head_.load(std::memory_order_relaxed);
+        }
+      } else {
+        // another producer took it
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = std::move(v);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop_now(T &v) {
+    uint64_t pos = tail_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      const int64_t diff = (int64_t)(slot->seq.load(std::memory_order_acquire) - (pos + 1));
+      if (diff == 0) {
+        // the consumer's, unless a DropOldest producer pops it first
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;  // empty, or its push isn't done
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    v = std::move(slot->value);
+    slot->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<uint64_t> head_ = 0;
+  alignas(64) std::atomic<uint64_t> tail_ = 0;
+  std::atomic<uint64_t> dropped_ = 0;
+  alignas(64) QueueWaiter waiter_;
+};
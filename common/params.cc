@@ -5,10 +5,11 @@
 
 #include <algorithm>
 #include <cassert>
+#include <climits>
 #include <csignal>
+#include <cstdlib>
 #include <unordered_map>
 
-#include "common/queue.h"
 #include "common/swaglog.h"
 #include "common/util.h"
 #include "system/hardware/hw.h"
@@ -73,6 +74,50 @@ std::string ensure_params_path(const std::string &prefix, const std::string &pat
   return params_path;
 }
 
+// a directory of values, no subdirectories
+void remove_dir(const std::string &path) {
+  if (DIR *d = opendir(path.c_str())) {
+    while (struct dirent *de = readdir(d)) {
+      if (de->d_type != DT_DIR) unlink((path + "/" + de->d_name).c_str());
+    }
+    closedir(d);
+  }
+  rmdir(path.c_str());
+}
+
+std::string real_path(const std::string &path) {
+  char buf[PATH_MAX];
+  return realpath(path.c_str(), buf) ? buf : "";
+}
+
+// atomically, through a temporary link
+int replace_symlink(const std::string &target, const std::string &link_path) {
+  const std::string tmp_link = link_path + ".new";
+  unlink(tmp_link.c_str());
+  if (symlink(target.c_str(), tmp_link.c_str()) != 0) return -1;
+  return rename(tmp_link.c_str(), link_path.c_str());
+}
+
+// what earlier transactions left: the directory before the current one, and those of commits that didn't finish.
+// transaction directories are <key path>.XXXXXX, next to the key path
+void remove_stale_dirs(const std::string &key_path, const std::string &current) {
+  const std::string prev = real_path(key_path + ".prev");
+  if (!prev.empty() && prev != current) remove_dir(prev);
+
+  const size_t slash = key_path.find_last_of('/');
+  const std::string parent = key_path.substr(0, slash), prefix = key_path.substr(slash + 1) + ".";
+  if (DIR *d = opendir(parent.c_str())) {
+    while (struct dirent *de = readdir(d)) {
+      const std::string name = de->d_name, path = parent + "/" + name;
+      if (de->d_type == DT_DIR && name.size() == prefix.size() + 6 && name.compare(0, prefix.size(), prefix) == 0 &&
+          path != current) {
+        remove_dir(path);
+      }
+    }
+    closedir(d);
+  }
+}
+
 class FileLock {
 public:
   FileLock(const std::string &fn) {
@@ -215,13 +260,19 @@ std::unordered_map<std::string, uint32_t> keys = {
 Params::Params(const std::string &path) {
   params_prefix = "/" + util::getenv("OPENPILOT_PREFIX", "d");
   params_path = ensure_params_path(params_prefix, path);
+  cache_dir = ParamsCache::instance().open(getParamPath());
 }
 
 Params::~Params() {
-  if (future.valid()) {
-    future.wait();
+  if (write_thread.joinable()) {
+    {
+      std::lock_guard lk(write_lock);
+      write_exit = true;
+    }
+    write_cv.notify_one();
+    write_thread.join();
   }
-  assert(queue.empty());
+  assert(pending.empty());
 }
 
 std::vector<std::string> Params::allKeys() const {
@@ -290,7 +341,7 @@ int Params::remove(const std::string &key) {
 
 std::string Params::get(const std::string &key, bool block) {
   if (!block) {
-    return util::read_file(getParamPath(key));
+    return cache_dir ? ParamsCache::instance().get(cache_dir, key) : ParamsCache::readValue(getParamPath(), key);
   } else {
     // blocking read until successful
     params_do_exit = 0;
@@ -298,8 +349,11 @@ std::string Params::get(const std::string &key, bool block) {
     void (*prev_handler_sigterm)(int) = std::signal(SIGTERM, params_sig_handler);
 
     std::string value;
-    while (!params_do_exit) {
-      if (value = util::read_file(getParamPath(key)); !value.empty()) {
+    if (cache_dir) {
+      value = ParamsCache::instance().getBlocking(cache_dir, key, params_do_exit);
+    }
+    while (!cache_dir && !params_do_exit) {
+      if (value = ParamsCache::readValue(getParamPath(), key); !value.empty()) {
         break;
       }
       util::sleep_for(100);  // 0.1 s
@@ -337,19 +391,125 @@ void Params::clearAll(ParamKeyType key_type) {
   fsync_dir(getParamPath());
 }
 
+int Params::Transaction::commit() {
+  // The key path is a symlink to the directory of the values (see create_params_path). The new values go into a new
+  // directory, next to hard links to the values that stay, which then replaces the old one in a single rename of the
+  // symlink. A crash before that leaves the old directory as it was.
+  FileLock file_lock(params->params_path + "/.lock");
+  const std::string key_path = params->getParamPath();
+  const std::string current = real_path(key_path);
+  if (current.empty()) return -1;
+  remove_stale_dirs(key_path, current);
+
+  std::string dir = key_path + ".XXXXXX";
+  if (mkdtemp(dir.data()) == nullptr) return -1;
+
+  int result = 0;
+  std::vector<int> fds;
+  do {
+    // 1) the new values
+    for (const auto &[key, value] : values) {
+      if (!value) continue;
+      int fd = HANDLE_EINTR(open((dir + "/" + key).c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+      if (fd < 0) {
+        result = -1;
+        break;
+      }
+      fds.push_back(fd);
+      ssize_t bytes_written = HANDLE_EINTR(write(fd, value->data(), value->size()));
+      if (bytes_written < 0 || (size_t)bytes_written != value->size()) {
+        result = -20;
+        break;
+      }
+    }
+    if (result != 0) break;
+
+    // 2) links to the values that stay
+    if (DIR *d = opendir(current.c_str())) {
+      while (struct dirent *de = readdir(d)) {
+        if (de->d_type == DT_DIR || values.count(de->d_name)) continue;
+        if ((result = link((current + "/" + de->d_name).c_str(), (dir + "/" + de->d_name).c_str())) < 0) break;
+      }
+      closedir(d);
+    } else {
+      result = -1;
+    }
+    if (result != 0) break;
+
+    // 3) one pass of fsyncs, then the directory
+    for (int fd : fds) {
+      if ((result = fsync(fd)) < 0) break;
+    }
+    if (result != 0 || (result = fsync_dir(dir)) < 0) break;
+
+    // 4) switch over, and sync the parent of the symlink
+    if ((result = replace_symlink(dir, key_path)) < 0) break;
+    result = fsync_dir(params->params_path);
+
+    // the old directory stays until the next commit, for readers that resolved the symlink just before. a reader
+    // slower than that reads again from the new one (see ParamsCache::readValue)
+    replace_symlink(current, key_path + ".prev");
+  } while (false);
+
+  for (int fd : fds) close(fd);
+  if (result != 0 && real_path(key_path) != real_path(dir)) {
+    remove_dir(dir);
+  }
+  return result;
+}
+
 void Params::putNonBlocking(const std::string &key, const std::string &val) {
-   queue.push(std::make_pair(key, val));
-  // start thread on demand
-  if (!future.valid() || future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
-    future = std::async(std::launch::async, &Params::asyncWriteThread, this);
+  {
+    std::lock_guard lk(write_lock);
+    ++queued_puts;
+    ++write_stats.puts;
+    write_stats.coalesced += !pending.insert_or_assign(key, val).second;
+    // started on demand, runs until destruction
+    if (!write_thread.joinable()) {
+      write_thread = std::thread(&Params::asyncWriteThread, this);
+    }
   }
+  write_cv.notify_one();
+}
+
+void Params::flush() {
+  std::unique_lock lk(write_lock);
+  const uint64_t target = queued_puts;
+  flushing = true;
+  write_cv.notify_one();
+  written_cv.wait(lk, [&]() { return written_puts >= target; });
+  flushing = false;
+}
+
+Params::NonBlockingStats Params::nonBlockingStats() {
+  std::lock_guard lk(write_lock);
+  return write_stats;
 }
 
 void Params::asyncWriteThread() {
-  // TODO: write the latest one if a key has multiple values in the queue.
-  std::pair<std::string, std::string> p;
-  while (queue.try_pop(p, 0)) {
+  util::set_thread_name("params_writer");
+  std::unique_lock lk(write_lock);
+  while (true) {
+    write_cv.wait(lk, [&]() { return write_exit || !pending.empty(); });
+    if (pending.empty()) break;
+
+    // more writes of the same keys replace these meanwhile
+    if (flush_interval_ms > 0) {
+      write_cv.wait_for(lk, std::chrono::milliseconds(flush_interval_ms), [&]() { return write_exit || flushing; });
+    }
+    std::map<std::string, std::string> batch;
+    batch.swap(pending);
+    const uint64_t target = queued_puts;
+    lk.unlock();
+
     // Params::put is Thread-Safe
-    put(p.first, p.second);
+    for (const auto &[key, value] : batch) {
+      put(key, value);
+    }
+
+    lk.lock();
+    written_puts = target;
+    write_stats.written += batch.size();
+    written_cv.notify_all();
   }
 }
@@ -1,13 +1,17 @@
 #pragma once
 
-#include <future>
+#include <condition_variable>
+#include <cstdint>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <utility>
 #include <vector>
 
-#include "common/queue.h"
+#include "common/params_cache.h"
 
 enum ParamKeyType {
   PERSISTENT = 0x02,
@@ -53,18 +57,58 @@ public:
   inline int putBool(const std::string &key, bool val) {
     return put(key.c_str(), val ? "1" : "0", 1);
   }
+  // Written by a thread of this Params. A key put again before it was written is written once, with the last value.
+  // The thread waits flush_interval_ms after the first of a batch of writes, to coalesce more of them. The keys of a
+  // batch are written in key order, not in the order they were put.
   void putNonBlocking(const std::string &key, const std::string &val);
   inline void putBoolNonBlocking(const std::string &key, bool val) {
     putNonBlocking(key, val ? "1" : "0");
   }
+  // waits for the nonblocking writes so far to be written
+  void flush();
+  inline void setFlushInterval(int ms) {
+    std::lock_guard lk(write_lock);
+    flush_interval_ms = ms;
+  }
+  struct NonBlockingStats {
+    uint64_t puts = 0, coalesced = 0, written = 0;  // written is the number of puts (file and directory fsyncs)
+  };
+  NonBlockingStats nonBlockingStats();
+
+  // Writes of several keys that readAll() sees all at once, or not at all. Separate get()s of the keys can straddle a
+  // commit, each sees the value before or after it, and never an older value than an earlier get(). The values are
+  // staged in memory, commit() writes them with one lock, one pass of fsyncs and one directory sync, then switches
+  // the params symlink over to the new directory.
+  class Transaction {
+  public:
+    inline void put(const std::string &key, const std::string &val) { values[key] = val; }
+    inline void putBool(const std::string &key, bool val) { values[key] = val ? "1" : "0"; }
+    inline void remove(const std::string &key) { values[key] = std::nullopt; }
+    // 0 on success. the staged values are kept either way
+    int commit();
+
+  private:
+    friend class Params;
+    Transaction(Params *params) : params(params) {}
+    Params *params;
+    std::map<std::string, std::optional<std::string>> values;  // nullopt removes
+  };
+  inline Transaction transaction() { return Transaction(this); }
 
 private:
   void asyncWriteThread();
 
   std::string params_path;
   std::string params_prefix;
+  ParamsCache::Dir *cache_dir = nullptr;  // nullptr reads the files
 
-  // for nonblocking write
-  std::future<void> future;
-  SafeQueue<std::pair<std::string, std::string>> queue;
+  // for nonblocking write: the latest value of each key, and a count of the puts and of those written
+  std::mutex write_lock;
+  std::condition_variable write_cv, written_cv;
+  std::map<std::string, std::string> pending;
+  uint64_t queued_puts = 0, written_puts = 0;
+  bool flushing = false, write_exit = false;
+  int flush_interval_ms = 0;
+  NonBlockingStats write_stats;
+  std::thread write_thread;
 };
@@ -0,0 +1,205 @@
+#include "common/params_cache.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+#include "common/swaglog.h"
+#include "common/util.h"
+
+struct ParamsCache::Dir {
+  std::string path, parent, name;  // the directory, and where it is. the path can be a symlink
+  int wd = -1, parent_wd = -1;
+  std::unordered_map<std::string, std::string> values;
+};
+
+ParamsCache &ParamsCache::instance() {
+  // never destroyed, Params can outlive static destructors
+  static ParamsCache *cache = new ParamsCache();
+  return *cache;
+}
+
+std::string ParamsCache::readValue(const std::string &path, const std::string &key) {
+  std::string value = util::read_file(path + "/" + key);
+  // empty, or the directory was removed during the read. through the resolved directory, a read is valid if the
+  // symlink still points there after it
+  char dir[PATH_MAX], after[PATH_MAX];
+  while (value.empty() && realpath(path.c_str(), dir)) {
+    value = util::read_file(std::string(dir) + "/" + key);
+    if (!value.empty() || !realpath(path.c_str(), after) || strcmp(dir, after) == 0) break;
+  }
+  return value;
+}
+
+#ifdef __linux__
+
+namespace {
+
+// anything that can change a value. a symlinked directory being replaced shows in its parent
+constexpr uint32_t DIR_EVENTS = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+constexpr uint32_t PARENT_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD;
+
+}  // namespace
+
+ParamsCache::ParamsCache() {
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0) {
+    LOGE("params cache disabled, inotify_init1 failed, errno=%d", errno);
+  }
+  pthread_atfork(prepareFork, parentAfterFork, childAfterFork);
+}
+
+void ParamsCache::prepareFork() { instance().lock_.lock(); }
+void ParamsCache::parentAfterFork() { instance().lock_.unlock(); }
+void ParamsCache::childAfterFork() {
+  // a new fd, everything watched again by the next get
+  ParamsCache &cache = instance();
+  close(cache.fd_);
+  cache.fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  for (auto &dir : cache.dirs_) {
+    dir->values.clear();
+    dir->wd = dir->parent_wd = -1;
+  }
+  cache.lock_.unlock();
+}
+
+ParamsCache::Dir *ParamsCache::open(const std::string &path) {
+  if (fd_ < 0) return nullptr;
+
+  std::lock_guard lk(lock_);
+  for (auto &dir : dirs_) {
+    if (dir->path == path) return dir.get();
+  }
+  auto dir = std::make_unique<Dir>();
+  dir->path = path;
+  const size_t slash = path.find_last_of('/');
+  dir->parent = slash == std::string::npos ? "." : path.substr(0, std::max<size_t>(slash, 1));
+  dir->name = path.substr(slash + 1);
+  if (!watch(*dir)) return nullptr;
+  dirs_.push_back(std::move(dir));
+  return dirs_.back().get();
+}
+
+bool ParamsCache::watch(Dir &dir) {
+  // the parent first, a replaced symlink between the two shows as an event
+  if (dir.parent_wd < 0) {
+    dir.parent_wd = inotify_add_watch(fd_, dir.parent.c_str(), PARENT_EVENTS);
+  }
+  if (dir.wd < 0) {
+    dir.wd = inotify_add_watch(fd_, dir.path.c_str(), DIR_EVENTS);
+  }
+  return dir.parent_wd >= 0 && dir.wd >= 0;
+}
+
+void ParamsCache::unwatch(int wd, bool remove) {
+  // symlinks to the same directory share its watch
+  for (auto &dir : dirs_) {
+    if (dir->wd == wd) {
+      dir->values.clear();
+      dir->wd = -1;
+    }
+  }
+  if (remove) inotify_rm_watch(fd_, wd);
+}
+
+void ParamsCache::readEvents() {
+  alignas(inotify_event) char buf[4096];
+  ssize_t n;
+  while ((n = HANDLE_EINTR(read(fd_, buf, sizeof(buf)))) > 0) {
+    for (char *p = buf; p < buf + n;) {
+      const inotify_event *ev = (const inotify_event *)p;
+      p += sizeof(inotify_event) + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+        // events were lost
+        for (auto &dir : dirs_) dir->values.clear();
+        continue;
+      }
+      for (auto &dir : dirs_) {
+        if (ev->wd == dir->wd) {
+          if (ev->len > 0) {
+            dir->values.erase(ev->name);
+          } else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+            // gone, watched again by the next get
+            unwatch(dir->wd, !(ev->mask & IN_IGNORED));
+          }
+        } else if (ev->wd == dir->parent_wd) {
+          if (ev->mask & IN_IGNORED) {
+            dir->parent_wd = -1;
+          } else if (ev->len > 0 && dir->name == ev->name && dir->wd >= 0) {
+            // the symlink may point somewhere else now
+            unwatch(dir->wd, true);
+          }
+        }
+      }
+    }
+  }
+}
+
+std::string ParamsCache::lookup(Dir &dir, const std::string &key) {
+  readEvents();
+  if (dir.wd < 0 || dir.parent_wd < 0) {
+    // not watched, e.g. the directory was deleted. a value read now can't be kept
+    if (!watch(dir)) {
+      ++misses;
+      return readValue(dir.path, key);
+    }
+  }
+
+  auto it = dir.values.find(key);
+  if (it != dir.values.end()) {
+    ++hits;
+    return it->second;
+  }
+  ++misses;
+  // a change while reading is in the events of the next lookup
+  std::string value = readValue(dir.path, key);
+  dir.values.emplace(key, value);
+  return value;
+}
+
+std::string ParamsCache::get(Dir *dir, const std::string &key) {
+  std::lock_guard lk(lock_);
+  return lookup(*dir, key);
+}
+
+std::string ParamsCache::getBlocking(Dir *dir, const std::string &key, volatile std::sig_atomic_t &do_exit) {
+  while (!do_exit) {
+    {
+      std::lock_guard lk(lock_);
+      if (std::string value = lookup(*dir, key); !value.empty()) return value;
+    }
+    // another thread can read the events first, the timeout bounds the wait then. a signal ends it early
+    pollfd pfd = {.fd = fd_, .events = POLLIN, .revents = 0};
+    poll(&pfd, 1, 100);
+  }
+  return {};
+}
+
+#else
+
+ParamsCache::ParamsCache() {}
+void ParamsCache::prepareFork() {}
+void ParamsCache::parentAfterFork() {}
+void ParamsCache::childAfterFork() {}
+ParamsCache::Dir *ParamsCache::open(const std::string &path) { return nullptr; }
+bool ParamsCache::watch(Dir &dir) { return false; }
+void ParamsCache::unwatch(int wd, bool remove) {}
+void ParamsCache::readEvents() {}
+std::string ParamsCache::lookup(Dir &dir, const std::string &key) { return readValue(dir.path, key); }
+std::string ParamsCache::get(Dir *dir, const std::string &key) { return lookup(*dir, key); }
+std::string ParamsCache::getBlocking(Dir *dir, const std::string &key, volatile std::sig_atomic_t &do_exit) { return {}; }
+
+#endif
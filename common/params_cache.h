@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process-wide cache of the values of params directories, kept up to date with inotify. A value is read from its
+// file once, then again only after its file changed, whichever process changed it. The pending events are read
+// before every lookup: a get costs a lock, a read() of the inotify fd that finds nothing, and a hash lookup, and
+// never returns a value older than a write that completed before it started.
+// Each process using it holds one inotify instance, counted against fs.inotify.max_user_instances (128 by default),
+// and a watch per directory. When it can't get one, open() returns nullptr and Params reads the files.
+// Linux only, elsewhere open() returns nullptr too.
+class ParamsCache {
+public:
+  struct Dir;
+
+  static ParamsCache &instance();
+  // the cache of a directory of values, watched from now on. nullptr if it can't be watched
+  Dir *open(const std::string &path);
+  std::string get(Dir *dir, const std::string &key);
+  // waits for the value to be non-empty, woken by inotify. empty if do_exit is set first
+  std::string getBlocking(Dir *dir, const std::string &key, volatile std::sig_atomic_t &do_exit);
+
+  // reads a value of a directory that can be a symlink. a commit switching the symlink can remove the directory the
+  // read went through, then it's read again from the new one
+  static std::string readValue(const std::string &path, const std::string &key);
+
+  std::atomic<uint64_t> hits = 0, misses = 0;
+
+private:
+  ParamsCache();
+  ~ParamsCache() = default;
+  // a forked child shares the inotify fd with its parent, and would read the parent's events
+  static void prepareFork();
+  static void parentAfterFork();
+  static void childAfterFork();
+  bool watch(Dir &dir);
+  // drops the values of the directories of the watch
+  void unwatch(int wd, bool remove);
+  void readEvents();
+  std::string lookup(Dir &dir, const std::string &key);
+
+  int fd_ = -1;
+  std::mutex lock_;
+  std::vector<std::unique_ptr<Dir>> dirs_;
+};
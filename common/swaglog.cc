@@ -4,17 +4,155 @@
 
 #include "common/swaglog.h"
 
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
 #include <cassert>
+#include <condition_variable>
+#include <cstring>
 #include <limits>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include <zmq.h>
 #include <stdarg.h>
 #include "third_party/json11/json11.hpp"
+#include "common/util.h"
 #include "common/version.h"
 #include "system/hardware/hw.h"
 
+// Logging is asynchronous: a log call formats its message and writes a binary record into a ring of its thread,
+// a drainer thread turns the records into the JSON logmessaged receives and sends them. The log call takes no lock
+// and doesn't allocate. A record that doesn't fit in the ring is dropped and counted, the drainer logs how many.
+// Errors and worse are sent by their log call, after what its thread logged before, unless the drainer is sending.
+// Records too big for a ring are sent before the call returns.
+// SWAGLOG_ASYNC=0 sends every record from its log call, as it used to. So does a forked child, it has no drainer.
+
+namespace {
+
+// a record in a ring, then its filename, func and msg, padded to 8 bytes
+struct Record {
+  uint32_t size;
+  int32_t lineno;
+  uint8_t levelnum;
+  uint8_t timestamp;  // a LOGT event, time_ns and frame_id are set
+  uint16_t filename_len, func_len;
+  uint32_t msg_len;
+  uint32_t frame_id;
+  double created;
+  uint64_t time_ns;
+};
+static_assert(sizeof(Record) == 40);
+
+// the size of a record that only pads the end of a ring
+constexpr uint32_t PADDING = 1u << 31;
+
+// single producer, single consumer ring of records
+class StagingRing {
+public:
+  explicit StagingRing(size_t capacity) : capacity_(capacity), buf_(new char[capacity]) {}
+
+  // the producer. false if it's full
+  bool push(const Record &r, const char *filename, const char *func, const char *msg) {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    const uint64_t tail = tail_.load(std::memory_order_acquire);
+    size_t offset = head & (capacity_ - 1);
+    const size_t contiguous = capacity_ - offset;
+    const size_t needed = r.size + (contiguous < r.size ? contiguous : 0);
+    if (capacity_ - (head - tail) < needed) return false;
+    if (contiguous < r.size) {
+      const uint32_t padding = contiguous | PADDING;
+      memcpy(buf_.get() + offset, &padding, sizeof(padding));
+      offset = 0;
+    }
+    char *p = buf_.get() + offset;
+    memcpy(p, &r, sizeof(r));
+    p += sizeof(r);
+    memcpy(p, filename, r.filename_len);
+    memcpy(p + r.filename_len, func, r.func_len);
+    memcpy(p + r.filename_len + r.func_len, msg, r.msg_len);
+    head_.store(head + needed, std::memory_order_release);
+    return true;
+  }
+
+  // the consumer, the drainer or the ring's thread under send_lock. calls f(const Record &, filename, func, msg)
+  // for each record
+  template <class Func>
+  size_t drain(Func &&f) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    size_t n = 0;
+    while (tail != head) {
+      const char *p = buf_.get() + (tail & (capacity_ - 1));
+      uint32_t size;
+      memcpy(&size, p, sizeof(size));
+      if (!(size & PADDING)) {
+        Record r;
+        memcpy(&r, p, sizeof(r));
+        const char *filename = p + sizeof(r);
+        f(r, std::string_view(filename, r.filename_len), std::string_view(filename + r.filename_len, r.func_len),
+          std::string_view(filename + r.filename_len + r.func_len, r.msg_len));
+        ++n;
+      }
+      tail += size & ~PADDING;
+    }
+    tail_.store(tail, std::memory_order_release);
+    return n;
+  }
+
+  bool empty() const { return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed); }
+
+  std::atomic<bool> closed = false;  // its thread exited
+
+private:
+  const size_t capacity_;
+  std::unique_ptr<char[]> buf_;
+  alignas(64) std::atomic<uint64_t> head_ = 0;
+  alignas(64) std::atomic<uint64_t> tail_ = 0;
+};
+
+// per call site rate limit, a call site is hashed to one of these
+struct CallSite {
+  std::atomic<uint64_t> window = 0;  // its second, since boot
+  std::atomic<uint32_t> count = 0;
+  std::atomic<uint32_t> suppressed = 0;
+};
+constexpr size_t CALL_SITES = 1024;
+
+// a JSON string, escaped as json11 does
+void append_json(std::string &out, std::string_view s) {
+  out += '"';
+  for (size_t i = 0; i < s.size(); ++i) {
+    const uint8_t ch = s[i];
+    if (ch == '\\' || ch == '"') {
+      out += '\\';
+      out += ch;
+    } else if (ch <= 0x1f) {
+      const char *escaped = ch == '\b' ? "\\b" : ch == '\f' ? "\\f" : ch == '\n' ? "\\n" : ch == '\r' ? "\\r" : ch == '\t' ? "\\t" : nullptr;
+      if (escaped) {
+        out += escaped;
+      } else {
+        char buf[8];
+        out.append(buf, snprintf(buf, sizeof(buf), "\\u%04x", ch));
+      }
+    } else if (ch == 0xe2 && i + 2 < s.size() && (uint8_t)s[i + 1] == 0x80 && ((uint8_t)s[i + 2] == 0xa8 || (uint8_t)s[i + 2] == 0xa9)) {
+      out += (uint8_t)s[i + 2] == 0xa8 ? "\\u2028" : "\\u2029";
+      i += 2;
+    } else {
+      out += ch;
+    }
+  }
+  out += '"';
+}
+
+}  // namespace
+
 class SwaglogState {
 public:
   SwaglogState() {
@@ -56,83 +194,315 @@ public:
     ctx_j["version"] = COMMA_VERSION;
     ctx_j["dirty"] = !getenv("CLEAN");
     ctx_j["device"] = Hardware::get_name();
+    ctx_s = ((json11::Json)ctx_j).dump();
+
+    // records per second of a call site, the rest are suppressed. 0 is no limit
+    rate_limit = util::getenv("SWAGLOG_RATE_LIMIT", 0);
+    ring_size = 1024 * std::max(util::getenv("SWAGLOG_RING_KB", 64), 4);
+    ring_size = 1ul << (64 - __builtin_clzl(ring_size - 1));  // a power of 2
+    if (util::getenv("SWAGLOG_ASYNC", 1)) {
+      drainer = std::thread(&SwaglogState::drainThread, this);
+    }
+    pthread_atfork(nullptr, nullptr, childAfterFork);
   }
 
   ~SwaglogState() {
+    if (forked) {
+      drainer.detach();
+    } else if (drainer.joinable()) {
+      {
+        std::lock_guard lk(drain_lock);
+        exit = true;
+      }
+      drain_cv.notify_one();
+      drainer.join();
+    }
     zmq_close(sock);
     zmq_ctx_destroy(zctx);
   }
 
-  void log(int levelnum, const char* filename, int lineno, const char* func, const char* msg, const std::string& log_s) {
-    std::lock_guard lk(lock);
-    if (levelnum >= print_level) {
-      printf("%s: %s\n", filename, msg);
+  static SwaglogState &instance() {
+    static SwaglogState s;
+    return s;
+  }
+
+  bool async() const { return drainer.joinable() && !forked; }
+
+  // false if the call site sent rate_limit records in this second. missed is how many it didn't send in the
+  // previous second it logged in
+  bool allow(const char *filename, int lineno, uint32_t &missed) {
+    if (rate_limit == 0) return true;
+    CallSite &site = call_sites[(std::hash<const void *>()(filename) ^ (lineno * 0x9e3779b9u)) % CALL_SITES];
+    const uint64_t window = nanos_since_boot() / 1000000000ULL;
+    uint64_t prev = site.window.load(std::memory_order_relaxed);
+    if (prev != window && site.window.compare_exchange_strong(prev, window, std::memory_order_relaxed)) {
+      site.count.store(0, std::memory_order_relaxed);
+      missed = site.suppressed.exchange(0, std::memory_order_relaxed);
+    }
+    if (site.count.fetch_add(1, std::memory_order_relaxed) < rate_limit) return true;
+    site.suppressed.fetch_add(1, std::memory_order_relaxed);
+    suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  void log(Record &r, const char *filename, const char *func, const char *msg) {
+    r.filename_len = std::min<size_t>(strlen(filename), UINT16_MAX);
+    r.func_len = std::min<size_t>(strlen(func), UINT16_MAX);
+    r.size = (sizeof(r) + r.filename_len + r.func_len + r.msg_len + 7) & ~7u;
+
+    StagingRing *ring = async() && r.size <= ring_size / 4 ? threadRing() : nullptr;
+    if (ring && r.levelnum >= CLOUDLOG_ERROR) {
+      // sent from here, after what the thread logged before, without waiting for the drainer. if the socket is
+      // busy it's being drained, the record goes through the ring
+      std::unique_lock sk(send_lock, std::try_to_lock);
+      if (sk) {
+        sendRing(*ring);
+        send(r, filename, func, std::string_view(msg, r.msg_len));
+        return;
+      }
+    }
+    if (ring) {
+      if (!ring->push(r, filename, func, msg)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      // the drainer reads sleeping after checking the rings, a record pushed before this is seen either way
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false)) {
+        std::lock_guard lk(drain_lock);
+        drain_cv.notify_one();
+      }
+      return;
+    }
+
+    // sent from here, after what the thread logged before. also the records of a thread logging from its
+    // thread_local destructors
+    if (async()) flush();
+    std::lock_guard lk(send_lock);
+    send(r, filename, func, std::string_view(msg, r.msg_len));
+  }
+
+  // waits for the drainer to send what was logged before
+  void flush() {
+    if (!async()) return;
+    std::unique_lock lk(drain_lock);
+    const uint64_t seq = ++flush_seq;
+    sleeping = false;
+    drain_cv.notify_one();
+    flushed_cv.wait(lk, [&]() { return drained_seq >= seq || exit; });
+  }
+
+  // the JSON json11 would dump, keys in order, without building a json11 object per record
+  void send(const Record &r, std::string_view filename, std::string_view func, std::string_view msg) {
+    char num[32];
+    log_s.clear();
+    log_s += (char)r.levelnum;
+    log_s += "{\"created\": ";
+    log_s.append(num, snprintf(num, sizeof(num), "%.17g", r.created));
+    log_s += ", \"ctx\": ";
+    log_s += ctx_s;
+    log_s += ", \"filename\": ";
+    append_json(log_s, filename);
+    log_s += ", \"funcname\": ";
+    append_json(log_s, func);
+    log_s += ", \"levelnum\": ";
+    log_s.append(num, snprintf(num, sizeof(num), "%d", r.levelnum));
+    log_s += ", \"lineno\": ";
+    log_s.append(num, snprintf(num, sizeof(num), "%d", r.lineno));
+    log_s += ", \"msg\": ";
+    if (r.timestamp) {
+      log_s += "{\"timestamp\": {\"event\": ";
+      append_json(log_s, msg);
+      if (r.frame_id < std::numeric_limits<uint32_t>::max()) {
+        log_s += ", \"frame_id\": ";
+        log_s.append(num, snprintf(num, sizeof(num), "\"%u\"", r.frame_id));
+      }
+      log_s += ", \"time\": ";
+      log_s.append(num, snprintf(num, sizeof(num), "\"%" PRIu64 "\"", r.time_ns));
+      log_s += "}}";
+    } else {
+      append_json(log_s, msg);
+    }
+    log_s += '}';
+
+    if (r.levelnum >= print_level) {
+      printf("%.*s: %.*s\n", (int)filename.size(), filename.data(), (int)msg.size(), msg.data());
     }
     zmq_send(sock, log_s.data(), log_s.length(), ZMQ_NOBLOCK);
   }
 
-  std::mutex lock;
+  // sends the records in a ring, under send_lock
+  void sendRing(StagingRing &ring) {
+    ring.drain([this](const Record &r, std::string_view filename, std::string_view func, std::string_view msg) {
+      send(r, filename, func, msg);
+    });
+  }
+
+  // a WARNING from swaglog itself
+  void sendWarning(const char *func, const std::string &msg) {
+    Record r = {.lineno = 0, .levelnum = CLOUDLOG_WARNING, .created = seconds_since_epoch()};
+    send(r, __FILE__, func, msg);
+  }
+
+  // nullptr once the thread is exiting
+  StagingRing *threadRing() {
+    // the ring outlives its thread until the drainer sent what's left in it
+    static thread_local bool exited = false;
+    struct ThreadRing {
+      std::shared_ptr<StagingRing> ring;
+      ~ThreadRing() {
+        if (ring) ring->closed = true;
+        exited = true;
+      }
+    };
+    static thread_local ThreadRing t;
+    if (exited) return nullptr;
+    if (!t.ring) {
+      t.ring = std::make_shared<StagingRing>(ring_size);
+      std::lock_guard lk(rings_lock);
+      rings.push_back(t.ring);
+    }
+    return t.ring.get();
+  }
+
+  void drainThread() {
+    util::set_thread_name("swaglog");
+    std::vector<std::shared_ptr<StagingRing>> draining;
+    uint64_t reported_dropped = 0;
+    double last_report = seconds_since_boot();
+
+    std::unique_lock lk(drain_lock);
+    while (true) {
+      sleeping = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!exit && flush_seq == drained_seq && allEmpty()) {
+        // the timeout bounds the wait on a missed wakeup, and reports drops of an idle process
+        drain_cv.wait_for(lk, std::chrono::milliseconds(100), [&]() { return !sleeping || exit; });
+      }
+      sleeping = false;
+      const uint64_t seq = flush_seq;
+      const bool exiting = exit;
+      lk.unlock();
+
+      {
+        std::lock_guard rk(rings_lock);
+        draining = rings;
+        // rings of exited threads are freed once empty, they're drained below one last time
+        rings.erase(std::remove_if(rings.begin(), rings.end(), [](auto &r) { return r->closed.load(); }), rings.end());
+      }
+      {
+        std::lock_guard sk(send_lock);
+        for (auto &ring : draining) {
+          sendRing(*ring);
+        }
+        const double now = seconds_since_boot();
+        if (now - last_report >= 1.0 || exiting) {
+          const uint64_t total = dropped.load(std::memory_order_relaxed);
+          if (total > reported_dropped) {
+            sendWarning("drainThread", "swaglog: " + std::to_string(total - reported_dropped) + " messages dropped, ring full");
+            reported_dropped = total;
+          }
+          last_report = now;
+        }
+      }
+      draining.clear();
+
+      lk.lock();
+      drained_seq = seq;
+      flushed_cv.notify_all();
+      if (exiting) break;
+    }
+  }
+
+  bool allEmpty() {
+    std::lock_guard rk(rings_lock);
+    for (auto &ring : rings) {
+      if (!ring->empty()) return false;
+    }
+    return true;
+  }
+
+  static void childAfterFork() {
+    // the child has no drainer, and the locks may have been held by a thread of the parent
+    SwaglogState &s = instance();
+    s.forked = true;
+    new (&s.send_lock) std::mutex();
+  }
+
   void* zctx = nullptr;
   void* sock = nullptr;
   int print_level;
   json11::Json::object ctx_j;
+  std::string ctx_s;
+  uint32_t rate_limit;
+  size_t ring_size;
+
+  std::mutex send_lock;  // of the socket, and log_s, and consuming a ring
+  std::string log_s;
+
+  std::mutex rings_lock;
+  std::vector<std::shared_ptr<StagingRing>> rings;
+
+  std::mutex drain_lock;
+  std::condition_variable drain_cv, flushed_cv;
+  std::atomic<bool> sleeping = false;
+  uint64_t flush_seq = 0, drained_seq = 0;
+  bool exit = false;
+  bool forked = false;
+  std::thread drainer;
+
+  CallSite call_sites[CALL_SITES];
+  std::atomic<uint64_t> dropped = 0, suppressed = 0;
 };
 
 bool LOG_TIMESTAMPS = getenv("LOG_TIMESTAMPS");
 uint32_t NO_FRAME_ID = std::numeric_limits<uint32_t>::max();
 
-static void cloudlog_common(int levelnum, const char* filename, int lineno, const char* func,
-                            char* msg_buf, const json11::Json::object &msg_j={}) {
-  static SwaglogState s;
+static void cloudlog_common(Record &r, const char* filename, const char* func, const char* fmt, va_list args) {
+  SwaglogState &s = SwaglogState::instance();
+  uint32_t missed = 0;
+  if (!s.allow(filename, r.lineno, missed)) return;
 
-  json11::Json::object log_j = json11::Json::object {
-    {"ctx", s.ctx_j},
-    {"levelnum", levelnum},
-    {"filename", filename},
-    {"lineno", lineno},
-    {"funcname", func},
-    {"created", seconds_since_epoch()}
-  };
-  if (msg_j.empty()) {
-    log_j["msg"] = msg_buf;
-  } else {
-    log_j["msg"] = msg_j;
+  // formatted into a buffer of the thread, vasprintf if it doesn't fit
+  static thread_local char msg_buf[1024];
+  char *msg = msg_buf;
+  va_list args_copy;
+  va_copy(args_copy, args);
+  int ret = vsnprintf(msg_buf, sizeof(msg_buf), fmt, args_copy);
+  va_end(args_copy);
+  if (ret >= (int)sizeof(msg_buf)) {
+    ret = vasprintf(&msg, fmt, args);
   }
+  if (ret <= 0 || !msg) return;
 
-  std::string log_s;
-  log_s += (char)levelnum;
-  ((json11::Json)log_j).dump(log_s);
-  s.log(levelnum, filename, lineno, func, msg_buf, log_s);
+  r.created = seconds_since_epoch();
+  r.msg_len = ret;
+  s.log(r, filename, func, msg);
+  if (msg != msg_buf) free(msg);
 
-  free(msg_buf);
+  if (missed > 0) {
+    char suppressed_msg[64];
+    Record w = {.lineno = r.lineno, .levelnum = CLOUDLOG_WARNING, .created = r.created};
+    w.msg_len = snprintf(suppressed_msg, sizeof(suppressed_msg), "cloudlog: %u messages suppressed", missed);
+    s.log(w, filename, func, suppressed_msg);
+  }
 }
 
 void cloudlog_e(int levelnum, const char* filename, int lineno, const char* func,
                 const char* fmt, ...) {
+  Record r = {.lineno = lineno, .levelnum = (uint8_t)levelnum};
   va_list args;
   va_start(args, fmt);
-  char* msg_buf = nullptr;
-  int ret = vasprintf(&msg_buf, fmt, args);
+  cloudlog_common(r, filename, func, fmt, args);
   va_end(args);
-  if (ret <= 0 || !msg_buf) return;
-  cloudlog_common(levelnum, filename, lineno, func, msg_buf);
 }
 
 void cloudlog_t_common(int levelnum, const char* filename, int lineno, const char* func,
                        uint32_t frame_id, const char* fmt, va_list args) {
   if (!LOG_TIMESTAMPS) return;
-  char* msg_buf = nullptr;
-  int ret = vasprintf(&msg_buf, fmt, args);
-  if (ret <= 0 || !msg_buf) return;
-  json11::Json::object tspt_j = json11::Json::object{
-    {"event", msg_buf},
-    {"time", std::to_string(nanos_since_boot())}
-  };
-  if (frame_id < NO_FRAME_ID) {
-    tspt_j["frame_id"] = std::to_string(frame_id);
-  }
-  tspt_j = json11::Json::object{{"timestamp", tspt_j}};
-  cloudlog_common(levelnum, filename, lineno, func, msg_buf, tspt_j);
+  Record r = {.lineno = lineno, .levelnum = (uint8_t)levelnum, .timestamp = 1, .frame_id = frame_id,
+              .time_ns = nanos_since_boot()};
+  cloudlog_common(r, filename, func, fmt, args);
 }
 
 
@@ -150,3 +520,12 @@ void cloudlog_te(int levelnum, const char* filename, int lineno, const char* fun
   cloudlog_t_common(levelnum, filename, lineno, func, frame_id, fmt, args);
   va_end(args);
 }
+
+void swaglog_flush() {
+  SwaglogState::instance().flush();
+}
+
+SwaglogStats swaglog_stats() {
+  SwaglogState &s = SwaglogState::instance();
+  return {s.dropped, s.suppressed};
+}
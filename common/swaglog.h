@@ -24,6 +24,15 @@ void cloudlog_te(int levelnum, const char* filename, int lineno, const char* fun
 void cloudlog_te(int levelnum, const char* filename, int lineno, const char* func,
                  uint32_t frame_id, const char* fmt, ...) SWAG_LOG_CHECK_FMT(6, 7);
 
+// waits for the records logged so far to be sent
+void swaglog_flush();
+
+struct SwaglogStats {
+  uint64_t dropped;     // a full ring
+  uint64_t suppressed;  // over SWAGLOG_RATE_LIMIT records per second of a call site, off by default
+};
+SwaglogStats swaglog_stats();
+
 
 #define cloudlog(lvl, fmt, ...) cloudlog_e(lvl, __FILE__, __LINE__, \
                                            __func__, \
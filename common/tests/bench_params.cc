@@ -0,0 +1,71 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "common/params.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+// Params::get through the cache, and reading the file as it used to. Then how long a blocking get takes to see a
+// value put by another process, woken by inotify, and polling every 100 ms as it used to.
+
+template <class Func>
+double time_ns(Func &&func, int n) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; ++i) func();
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+}
+
+// the put happens in another process, the value is when
+template <class Get>
+double wake_ms(const std::string &path, Params &params, Get &&get) {
+  params.remove("DongleId");
+  pid_t pid = fork();
+  if (pid == 0) {
+    util::sleep_for(50 + rand() % 100);
+    Params(path).put("DongleId", std::to_string(nanos_since_boot()));
+    _exit(0);
+  }
+  const std::string value = get();
+  const double ms = (nanos_since_boot() - std::stoull(value)) * 1e-6;
+  waitpid(pid, nullptr, 0);
+  return ms;
+}
+
+int main(int argc, char *argv[]) {
+  const int n = argc > 1 ? atoi(argv[1]) : 100000;
+  char tmp_path[] = "/tmp/bench_params_XXXXXX";
+  const std::string path = mkdtemp(tmp_path);
+  Params params(path);
+  const std::vector<std::string> keys = {"IsMetric", "CarParams", "OpenpilotEnabledToggle", "LongitudinalPersonality"};
+  params.put("IsMetric", "1");
+  params.put("CarParams", std::string(4000, 'c'));
+  params.put("OpenpilotEnabledToggle", "1");
+
+  int k = 0;
+  const double cached = time_ns([&]() { params.get(keys[k++ % keys.size()]); }, n);
+  const double uncached = time_ns([&]() { util::read_file(params.getParamPath(keys[k++ % keys.size()])); }, n);
+  printf("get, %d keys (one missing), %d gets\n", (int)keys.size(), n);
+  printf("  %-24s %10.1f ns/get\n", "cached", cached);
+  printf("  %-24s %10.1f ns/get\n", "read_file", uncached);
+
+  const int wakes = 10;
+  double inotify = 0, polled = 0;
+  for (int i = 0; i < wakes; ++i) {
+    inotify += wake_ms(path, params, [&]() { return params.get("DongleId", true); });
+    polled += wake_ms(path, params, [&]() {
+      std::string value;
+      while ((value = util::read_file(params.getParamPath("DongleId"))).empty()) util::sleep_for(100);
+      return value;
+    });
+  }
+  printf("blocking get, put by another process, %d times\n", wakes);
+  printf("  %-24s %10.2f ms\n", "inotify", inotify / wakes);
+  printf("  %-24s %10.2f ms\n", "polling every 100 ms", polled / wakes);
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "common/lockfree_queue.h"
+#include "common/queue.h"
+
+// Items/s from N producers to one consumer blocked in pop(): SafeQueue, MpscQueue, batches of MpscQueue, and
+// SpscQueue with one producer. A full lock-free queue makes its producer yield and retry.
+
+const int BATCH = 32;
+
+template <class Push, class Pop>
+double run(int producers, int items, Push &&push, Pop &&pop) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&, p]() {
+      for (int i = 0; i < items;) {
+        const int pushed = push(p, i);
+        if (pushed == 0) std::this_thread::yield();
+        i += pushed;
+      }
+    });
+  }
+  for (long received = 0; received < (long)producers * items;) received += pop();
+  for (auto &t : threads) t.join();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const char *name, int producers, int items, double seconds) {
+  printf("  %-20s %d producers %12.0f items/s\n", name, producers, producers * items / seconds);
+}
+
+int main(int argc, char *argv[]) {
+  const int items = argc > 1 ? atoi(argv[1]) : 1000000;
+  printf("%d items per producer\n", items);
+  for (int producers : {1, 2, 4, 8}) {
+    {
+      SafeQueue<long> q;
+      report("SafeQueue", producers, items, run(producers, items, [&](int p, int i) { q.push(i); return 1; },
+                                                  [&]() { q.pop(); return 1; }));
+    }
+    {
+      MpscQueue<long> q(4096);
+      report("MpscQueue", producers, items, run(producers, items, [&](int p, int i) { return (int)q.push(i); },
+                                                  [&]() { q.pop(); return 1; }));
+    }
+    {
+      MpscQueue<long> q(4096);
+      report("MpscQueue, batches", producers, items, run(producers, items, [&](int p, int i) {
+        long batch[BATCH];
+        const int n = std::min(BATCH, items - i);
+        for (int k = 0; k < n; ++k) batch[k] = i + k;
+        return (int)q.push_batch(batch, n);
+      }, [&]() {
+        long batch[BATCH];
+        return (int)q.pop_batch(batch, BATCH, -1);
+      }));
+    }
+    if (producers == 1) {
+      SpscQueue<long> q(4096);
+      report("SpscQueue", producers, items, run(producers, items, [&](int p, int i) { return (int)q.push(i); },
+                                                  [&]() { q.pop(); return 1; }));
+      SpscQueue<long> batched(4096);
+      report("SpscQueue, batches", producers, items, run(producers, items, [&](int p, int i) {
+        long batch[BATCH];
+        const int n = std::min(BATCH, items - i);
+        for (int k = 0; k < n; ++k) batch[k] = i + k;
+        return (int)batched.push_batch(batch, n);
+      }, [&]() {
+        long batch[BATCH];
+        return (int)batched.pop_batch(batch, BATCH, -1);
+      }));
+    }
+  }
+  return 0;
+}
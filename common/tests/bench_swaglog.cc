@@ -0,0 +1,88 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <zmq.h>
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "common/swaglog.h"
+#include "system/hardware/hw.h"
+
+// Log calls per second from N threads, sending each record from its log call (SWAGLOG_ASYNC=0, as swaglog used to)
+// and through the rings of the threads. Without the rate limit, then with it, every thread logging from the same
+// call site. A process per run, swaglog reads its settings once. A receiver takes the place of logmessaged, what it
+// received is what was sent by the end of the run. ns/call is of a call of a thread, wall time.
+
+struct Mode {
+  const char *name;
+  const char *async, *rate_limit;
+};
+
+void run(const Mode &mode, int threads, int calls) {
+  setenv("SWAGLOG_ASYNC", mode.async, 1);
+  setenv("SWAGLOG_RATE_LIMIT", mode.rate_limit, 1);
+
+  void *zctx = zmq_ctx_new();
+  void *sock = zmq_socket(zctx, ZMQ_PULL);
+  zmq_bind(sock, Path::swaglog_ipc().c_str());
+  std::atomic<bool> done = false;
+  uint64_t received = 0;
+  std::thread receiver([&]() {
+    char buf[4096];
+    int timeout = 10;
+    zmq_setsockopt(sock, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    while (!done) received += zmq_recv(sock, buf, sizeof(buf), 0) > 0;
+  });
+  LOGD("warm up");
+  swaglog_flush();
+
+  std::vector<std::thread> loggers;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < threads; ++t) {
+    loggers.emplace_back([=]() {
+      for (int i = 0; i < calls; ++i) {
+        LOGD("thread %d, record %d of %d", t, i, calls);
+      }
+    });
+  }
+  for (auto &t : loggers) t.join();
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  swaglog_flush();
+  done = true;
+  receiver.join();
+
+  const SwaglogStats stats = swaglog_stats();
+  printf("  %-20s %d threads %10.0f calls/s %8.1f ns/call %8" PRIu64 " received %8" PRIu64 " dropped %8" PRIu64 " suppressed\n",
+         mode.name, threads, threads * calls / seconds, seconds * 1e9 / calls, received - 1, stats.dropped, stats.suppressed);
+  zmq_close(sock);
+  zmq_ctx_destroy(zctx);
+}
+
+int main(int argc, char *argv[]) {
+  const int calls = argc > 1 ? atoi(argv[1]) : 100000;
+  const Mode modes[] = {
+    {"sync", "0", "0"},
+    {"async", "1", "0"},
+    {"async, rate limited", "1", "1000"},
+  };
+  printf("%d log calls per thread\n", calls);
+  for (const Mode &mode : modes) {
+    for (int threads : {1, 2, 4, 8}) {
+      fflush(stdout);
+      pid_t pid = fork();
+      if (pid == 0) {
+        run(mode, threads, calls);
+        fflush(stdout);
+        _exit(0);
+      }
+      waitpid(pid, nullptr, 0);
+    }
+  }
+  return 0;
+}
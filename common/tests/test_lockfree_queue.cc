@@ -0,0 +1,155 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/lockfree_queue.h"
+
+// the producer in the high bits, its sequence number in the low bits
+uint64_t item(int producer, uint64_t seq) { return ((uint64_t)producer << 40) | seq; }
+int producer_of(uint64_t v) { return v >> 40; }
+uint64_t seq_of(uint64_t v) { return v & ((1ull << 40) - 1); }
+
+TEST_CASE("SpscQueue") {
+  SECTION("capacity and batches") {
+    SpscQueue<int> q(5);
+    REQUIRE(q.capacity() == 8);
+    const int items[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    REQUIRE(q.push_batch(items, 10) == 8);
+    REQUIRE(!q.push(8));
+    int out[10];
+    REQUIRE(q.pop_batch(out, 3) == 3);
+    REQUIRE(out[2] == 2);
+    // wraps around
+    REQUIRE(q.push_batch(items + 8, 2) == 2);
+    REQUIRE(q.size() == 7);
+    REQUIRE(q.pop_batch(out, 10) == 7);
+    for (int i = 0; i < 7; ++i) REQUIRE(out[i] == i + 3);
+    REQUIRE(q.empty());
+  }
+
+  SECTION("stress") {
+    const uint64_t n = 1000000;
+    SpscQueue<uint64_t> q(64);
+    std::thread producer([&]() {
+      uint64_t batch[16];
+      for (uint64_t i = 0; i < n;) {
+        if (i % 3 == 0) {
+          // a batch, as much of it as fits
+          const size_t len = std::min<uint64_t>(16, n - i);
+          for (size_t k = 0; k < len; ++k) batch[k] = i + k;
+          i += q.push_batch(batch, len);
+        } else if (q.push(i)) {
+          ++i;
+        }
+      }
+    });
+
+    uint64_t expected = 0;
+    uint64_t batch[16];
+    while (expected < n) {
+      if (expected % 5 == 0) {
+        const size_t len = q.pop_batch(batch, 16, 100);
+        REQUIRE(len > 0);
+        for (size_t k = 0; k < len; ++k) REQUIRE(batch[k] == expected++);
+      } else if (expected % 5 == 1) {
+        uint64_t v;
+        REQUIRE(q.try_pop(v, 100));
+        REQUIRE(v == expected++);
+      } else {
+        REQUIRE(q.pop() == expected++);
+      }
+    }
+    producer.join();
+    REQUIRE(q.empty());
+  }
+}
+
+TEST_CASE("MpscQueue") {
+  const int producers = 4;
+  const uint64_t n = 200000;
+
+  SECTION("stress, reject") {
+    MpscQueue<uint64_t> q(256);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+      threads.emplace_back([&, p]() {
+        uint64_t batch[8];
+        for (uint64_t i = 0; i < n;) {
+          if (i % 2 == 0) {
+            const size_t len = std::min<uint64_t>(8, n - i);
+            for (size_t k = 0; k < len; ++k) batch[k] = item(p, i + k);
+            i += q.push_batch(batch, len);
+          } else if (q.push(item(p, i))) {
+            ++i;
+          } else {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+
+    // everything, in order by producer
+    std::vector<uint64_t> next(producers);
+    uint64_t batch[32];
+    for (uint64_t received = 0; received < producers * n;) {
+      const size_t len = received % 2 ? q.pop_batch(batch, 32, 1000) : q.try_pop(batch[0], 1000);
+      REQUIRE(len > 0);
+      for (size_t k = 0; k < len; ++k) {
+        const int p = producer_of(batch[k]);
+        REQUIRE(seq_of(batch[k]) == next[p]++);
+      }
+      received += len;
+    }
+    for (auto &t : threads) t.join();
+    REQUIRE(q.empty());
+    REQUIRE(q.dropped() == 0);
+  }
+
+  SECTION("stress, drop oldest") {
+    MpscQueue<uint64_t, OnFull::DropOldest> q(64);
+    std::atomic<int> done = 0, rejected = 0;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+      threads.emplace_back([&, p]() {
+        for (uint64_t i = 0; i < n; ++i) rejected += !q.push(item(p, i));
+        ++done;
+      });
+    }
+
+    // in order by producer, with gaps. what was pushed was popped or dropped
+    std::vector<int64_t> last(producers, -1);
+    uint64_t received = 0;
+    uint64_t v;
+    while (done < producers || !q.empty()) {
+      if (!q.try_pop(v, 10)) continue;
+      const int p = producer_of(v);
+      REQUIRE((int64_t)seq_of(v) > last[p]);
+      last[p] = seq_of(v);
+      ++received;
+    }
+    for (auto &t : threads) t.join();
+    while (q.try_pop(v)) ++received;
+    INFO("received " << received << ", dropped " << q.dropped());
+    REQUIRE(rejected == 0);
+    REQUIRE(received + q.dropped() == producers * n);
+  }
+
+  SECTION("blocking pop") {
+    MpscQueue<uint64_t> q(16);
+    uint64_t v;
+    const auto start = std::chrono::steady_clock::now();
+    REQUIRE(!q.try_pop(v, 50));
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+
+    // woken by a push of another thread
+    std::thread producer([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      q.push(42);
+    });
+    REQUIRE(q.pop() == 42);
+    producer.join();
+  }
+}
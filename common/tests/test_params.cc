@@ -1,3 +1,12 @@
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <random>
+
 #include "catch2/catch.hpp"
 #define private public
 #include "common/params.h"
@@ -16,8 +25,7 @@ TEST_CASE("params_nonblocking_put") {
     }
 
     // check if thread is running
-    REQUIRE(params.future.valid());
-    REQUIRE(params.future.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout);
+    REQUIRE(params.write_thread.joinable());
   }
   // check results
   Params p(param_path);
@@ -25,3 +33,212 @@ TEST_CASE("params_nonblocking_put") {
     REQUIRE(p.get(name) == "1");
   }
 }
+
+TEST_CASE("params_cache") {
+  char tmp_path[] = "/tmp/params_cache_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+  ParamsCache &cache = ParamsCache::instance();
+  REQUIRE(params.cache_dir != nullptr);
+
+  params.put("IsMetric", "1");
+  REQUIRE(params.get("IsMetric") == "1");
+  const uint64_t misses = cache.misses;
+  for (int i = 0; i < 10; ++i) {
+    REQUIRE(params.get("IsMetric") == "1");
+  }
+  REQUIRE(cache.misses == misses);
+
+  SECTION("writes of this process") {
+    params.put("IsMetric", "0");
+    REQUIRE(params.get("IsMetric") == "0");
+    params.remove("IsMetric");
+    REQUIRE(params.get("IsMetric").empty());
+    params.putBool("IsMetric", true);
+    params.clearAll(PERSISTENT);
+    REQUIRE(params.get("IsMetric").empty());
+  }
+
+  SECTION("writes of other processes") {
+    // as fast as possible, then a file written in place
+    const int writes = 500;
+    pid_t pid = fork();
+    if (pid == 0) {
+      Params child(param_path);
+      for (int i = 2; i <= writes; ++i) child.put("IsMetric", std::to_string(i));
+      util::write_file(child.getParamPath("IsMetric").c_str(), "done", 4);
+      _exit(0);
+    }
+    // values only go forward, and the last one is seen once the writer is gone
+    int last = 1;
+    while (waitpid(pid, nullptr, WNOHANG) == 0) {
+      const std::string value = params.get("IsMetric");
+      if (value == "done") break;
+      const int i = std::stoi(value);
+      REQUIRE(i >= last);
+      last = i;
+    }
+    waitpid(pid, nullptr, 0);
+    REQUIRE(params.get("IsMetric") == "done");
+  }
+
+  SECTION("blocking get") {
+    params.remove("DongleId");
+    pid_t pid = fork();
+    if (pid == 0) {
+      util::sleep_for(200);
+      Params(param_path).put("DongleId", "cafe");
+      _exit(0);
+    }
+    REQUIRE(params.get("DongleId", true) == "cafe");
+    waitpid(pid, nullptr, 0);
+  }
+
+  SECTION("directory replaced") {
+    // as OpenpilotPrefix cleans up: the directory and its symlink deleted, then created again
+    const std::string key_path = params.getParamPath();
+    const std::string real_path = util::readlink(key_path);
+    REQUIRE(system(("rm -rf " + real_path + " " + key_path).c_str()) == 0);
+    Params recreated(param_path);
+    REQUIRE(recreated.cache_dir == params.cache_dir);
+    REQUIRE(params.get("IsMetric").empty());
+    recreated.put("IsMetric", "2");
+    REQUIRE(params.get("IsMetric") == "2");
+  }
+}
+
+TEST_CASE("params_nonblocking_coalescing") {
+  char tmp_path[] = "/tmp/params_coalescing_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+  params.setFlushInterval(20);
+
+  // as fast as possible, for a while: one write per key and flush interval at most
+  const int puts = 20000;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 1; i <= puts; ++i) {
+    params.putNonBlocking("LiveParameters", std::to_string(i));
+    params.putBoolNonBlocking("IsMetric", i % 2);
+    if (i % 1000 == 0) util::sleep_for(5);
+  }
+  params.flush();
+  const double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  REQUIRE(params.get("LiveParameters") == std::to_string(puts));
+  REQUIRE(params.get("IsMetric") == "0");
+
+  const Params::NonBlockingStats stats = params.nonBlockingStats();
+  INFO("written " << stats.written << " in " << elapsed_ms << " ms");
+  REQUIRE(stats.puts == 2 * puts);
+  REQUIRE(stats.coalesced + stats.written == stats.puts);
+  REQUIRE(stats.written <= 2 * (elapsed_ms / 20 + 2));
+
+  SECTION("flush waits for the last value") {
+    params.putNonBlocking("LiveParameters", "last");
+    params.flush();
+    REQUIRE(params.get("LiveParameters") == "last");
+    // nothing pending
+    params.flush();
+  }
+
+  SECTION("written on destruction") {
+    {
+      Params other(param_path);
+      other.setFlushInterval(1000);
+      other.putNonBlocking("LiveParameters", "destroyed");
+    }
+    REQUIRE(params.get("LiveParameters") == "destroyed");
+  }
+}
+
+int count_dirs(const std::string &path) {
+  int n = 0;
+  if (DIR *d = opendir(path.c_str())) {
+    while (struct dirent *de = readdir(d)) n += de->d_type == DT_DIR && de->d_name[0] != '.';
+    closedir(d);
+  }
+  return n;
+}
+
+TEST_CASE("params_transaction") {
+  char tmp_path[] = "/tmp/params_transaction_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+  params.put("IsMetric", "1");
+  params.put("DongleId", "cafe");
+
+  auto txn = params.transaction();
+  txn.put("CarVin", "vin");
+  txn.putBool("IsMetric", false);
+  txn.remove("DongleId");
+  // staged only
+  REQUIRE(params.get("CarVin").empty());
+  REQUIRE(params.get("IsMetric") == "1");
+  REQUIRE(txn.commit() == 0);
+  REQUIRE(params.get("CarVin") == "vin");
+  REQUIRE(params.get("IsMetric") == "0");
+  REQUIRE(params.get("DongleId").empty());
+
+  SECTION("other keys and writers") {
+    params.put("GitBranch", "master");
+    auto txn2 = params.transaction();
+    txn2.put("CarVin", "vin2");
+    REQUIRE(txn2.commit() == 0);
+    REQUIRE(params.get("GitBranch") == "master");
+    REQUIRE(params.get("IsMetric") == "0");
+    REQUIRE(params.get("CarVin") == "vin2");
+    // single puts go to the new directory
+    params.put("GitBranch", "release");
+    REQUIRE(Params(param_path).get("GitBranch") == "release");
+    // the current directory and the one before
+    REQUIRE(count_dirs(param_path) == 2);
+  }
+
+  SECTION("killed mid-commit") {
+    // a writer committing groups as fast as it can, killed at random. readAll sees whole groups only, and gets see
+    // each key's values in order, never older than an earlier get
+    const std::vector<std::string> keys = {"CarVin", "CarParams", "CarParamsCache"};
+    for (const auto &key : keys) params.put(key, "0");
+    std::mt19937 rng(42);
+    for (int run = 0; run < 20; ++run) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        Params writer(param_path);
+        for (int i = 1;; ++i) {
+          auto group = writer.transaction();
+          for (const auto &key : keys) group.put(key, std::to_string(run * 1000000 + i));
+          group.commit();
+        }
+      }
+
+      const auto kill_at = std::chrono::steady_clock::now() + std::chrono::microseconds(1000 + rng() % 20000);
+      while (std::chrono::steady_clock::now() < kill_at) {
+        std::vector<long> values;
+        for (const auto &key : keys) {
+          const std::string value = params.get(key);
+          REQUIRE(!value.empty());
+          values.push_back(std::stol(value));
+        }
+        REQUIRE(std::is_sorted(values.begin(), values.end()));
+
+        auto all = params.readAll();
+        REQUIRE(!all[keys[0]].empty());
+        for (const auto &key : keys) {
+          REQUIRE(all[key] == all[keys[0]]);
+        }
+      }
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+
+      const std::string last = params.get(keys[0]);
+      for (const auto &key : keys) {
+        REQUIRE(params.get(key) == last);
+      }
+      REQUIRE(params.get("IsMetric") == "0");
+    }
+    // what the killed commits left is cleaned up by the next one
+    auto txn2 = params.transaction();
+    txn2.put("CarVin", "vin");
+    REQUIRE(txn2.commit() == 0);
+    REQUIRE(count_dirs(param_path) == 2);
+  }
+}
@@ -11,7 +11,7 @@
 
 std::string daemon_name = "testy";
 std::string dongle_id = "test_dongle_id";
-int LINE_NO = 0;
+std::atomic<int> LINE_NO = 0;
 
 void log_thread(int thread_id, int msg_cnt) {
   for (int i = 0; i < msg_cnt; ++i) {
@@ -41,6 +41,7 @@ void recv_log(int thread_cnt, int thread_msg_cnt) {
     std::string err;
     auto msg = json11::Json::parse(buf + 1, err);
     REQUIRE(!msg.is_null());
+    REQUIRE(msg.dump() == buf + 1);
 
     REQUIRE(msg["levelnum"].int_value() == CLOUDLOG_DEBUG);
     REQUIRE_THAT(msg["filename"].string_value(), Catch::Contains("test_swaglog.cc"));
@@ -75,6 +76,7 @@ TEST_CASE("swaglog") {
   setenv("MANAGER_DAEMON", daemon_name.c_str(), 1);
   setenv("DONGLE_ID", dongle_id.c_str(), 1);
   setenv("dirty", "1", 1);
+  setenv("SWAGLOG_RATE_LIMIT", "1000", 1);  // for swaglog_rate_limit, read with the first record
   const int thread_cnt = 5;
   const int thread_msg_cnt = 100;
 
@@ -86,3 +88,82 @@ TEST_CASE("swaglog") {
 
   recv_log(thread_cnt, thread_msg_cnt);
 }
+
+int BURST_LINE_NO = 0;
+
+void burst(int msg_cnt) {
+  for (int i = 0; i < msg_cnt; ++i) {
+    LOGD("burst %d", i);
+    BURST_LINE_NO = __LINE__ - 1;
+  }
+}
+
+TEST_CASE("swaglog_rate_limit") {
+  setenv("SWAGLOG_RATE_LIMIT", "1000", 1);  // if it's the first test
+  void *zctx = zmq_ctx_new();
+  void *sock = zmq_socket(zctx, ZMQ_PULL);
+  zmq_bind(sock, Path::swaglog_ipc().c_str());
+  util::sleep_for(100);
+
+  // more than a call site may log in a second, then one more once the second is over
+  const int msg_cnt = 1500;
+  const SwaglogStats before = swaglog_stats();
+  burst(msg_cnt);
+  swaglog_flush();
+  const SwaglogStats after = swaglog_stats();
+  REQUIRE(after.suppressed > before.suppressed);
+  util::sleep_for(1100);
+  burst(1);
+  swaglog_flush();
+
+  int received = 0, reported_suppressed = 0;
+  // the warning comes last
+  for (auto start = std::chrono::steady_clock::now();
+       std::chrono::steady_clock::now() < start + std::chrono::seconds{1} && reported_suppressed == 0;) {
+    char buf[4096] = {};
+    if (zmq_recv(sock, buf, sizeof(buf), ZMQ_DONTWAIT) <= 0) continue;
+    std::string err;
+    auto msg = json11::Json::parse(buf + 1, err);
+    if (msg["funcname"].string_value() != "burst") continue;  // swaglog's own, the drops of a full ring
+    REQUIRE(msg["lineno"].int_value() == BURST_LINE_NO);
+    const std::string text = msg["msg"].string_value();
+    if (text.find("burst") == 0) {
+      ++received;
+    } else {
+      REQUIRE(msg["levelnum"].int_value() == CLOUDLOG_WARNING);
+      reported_suppressed = atoi(text.c_str() + strlen("cloudlog: "));
+    }
+  }
+  // every record is sent, suppressed, or dropped and counted
+  INFO("received " << received << ", suppressed " << reported_suppressed);
+  REQUIRE(reported_suppressed == after.suppressed - before.suppressed);
+  REQUIRE(received + reported_suppressed + (after.dropped - before.dropped) == msg_cnt + 1);
+  zmq_close(sock);
+  zmq_ctx_destroy(zctx);
+}
+
+TEST_CASE("swaglog_escaping") {
+  void *zctx = zmq_ctx_new();
+  void *sock = zmq_socket(zctx, ZMQ_PULL);
+  zmq_bind(sock, Path::swaglog_ipc().c_str());
+
+  // written without json11, the same bytes as json11 would dump
+  const std::string text = "quote \" backslash \\ tab \t newline \n bell \a line separator \u2028 \xc3\xa9";
+  LOGE("%s", text.c_str());
+  swaglog_flush();
+
+  std::string received;
+  for (auto start = std::chrono::steady_clock::now();
+       std::chrono::steady_clock::now() < start + std::chrono::seconds{1} && received.empty();) {
+    char buf[4096] = {};
+    if (zmq_recv(sock, buf, sizeof(buf), ZMQ_DONTWAIT) <= 0) continue;
+    std::string err;
+    auto msg = json11::Json::parse(buf + 1, err);
+    if (msg["levelnum"].int_value() != CLOUDLOG_ERROR) continue;
+    REQUIRE(msg.dump() == buf + 1);
+    received = msg["msg"].string_value();
+  }
+  REQUIRE(received == text);
+  zmq_close(sock);
+  zmq_ctx_destroy(zctx);
+}
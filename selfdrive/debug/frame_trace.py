@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+import argparse
+import json
+from collections import defaultdict
+
+import cereal.messaging as messaging
+from openpilot.tools.lib.logreader import LogReader
+
+# renders the frame_trace reports of encoderd and loggerd, see system/loggerd/frame_trace.h
+
+PREFIX = "frame_trace "
+COUNTERS = ("frames", "lost", "skipped", "dropped")
+
+
+class StageLatency:
+  def __init__(self):
+    self.buckets = [0] * 32
+    self.max_ms = 0.
+
+  def add(self, stage):
+    for i, n in enumerate(stage['buckets']):
+      self.buckets[i] += int(n)
+    self.max_ms = max(self.max_ms, stage['max_ms'])
+
+  def percentile(self, p):
+    # upper bound of the bucket, as LatencyHistogram::percentile. bucket i holds [2^(i-1), 2^i) us
+    count = sum(self.buckets)
+    target = max(1, int(p / 100 * count + 0.5))
+    n = 0
+    for i, b in enumerate(self.buckets):
+      n += b
+      if n >= target:
+        return min(2 ** i / 1000, self.max_ms)
+    return self.max_ms
+
+
+class StreamTrace:
+  def __init__(self):
+    self.counters = defaultdict(int)
+    self.stages = {}  # in order of the stages
+
+  def add(self, report):
+    for c in COUNTERS:
+      self.counters[c] += int(report.get(c, 0))
+    for stage in report['stages']:
+      self.stages.setdefault(stage['stage'], StageLatency()).add(stage)
+
+
+def parse_logmessage(msg):
+  try:
+    log = json.loads(msg)
+  except json.decoder.JSONDecodeError:
+    return None
+  text = log.get('msg')
+  if not isinstance(text, str) or not text.startswith(PREFIX):
+    return None
+  return json.loads(text[len(PREFIX):])
+
+
+def print_traces(traces):
+  for (process, stream), trace in sorted(traces.items()):
+    counters = ", ".join(f"{trace.counters[c]} {c}" for c in COUNTERS)
+    print(f"{stream} ({process}): {counters}")
+    for name, latency in trace.stages.items():
+      print(f"  {name:<24} p50 {latency.percentile(50):8.2f} ms  p99 {latency.percentile(99):8.2f} ms  max {latency.max_ms:8.2f} ms")
+  print()
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Per camera stage latencies of frames through encoderd and loggerd")
+  parser.add_argument('--addr', default='127.0.0.1')
+  parser.add_argument("route", type=str, nargs='*', help="route name + segment number for offline usage")
+  args = parser.parse_args()
+
+  traces = defaultdict(StreamTrace)
+  if args.route:
+    for route in args.route:
+      for m in LogReader(route):
+        if m.which() == 'logMessage' and (report := parse_logmessage(m.logMessage)) is not None:
+          traces[(report['process'], report['stream'])].add(report)
+    print_traces(traces)
+  else:
+    sm = messaging.SubMaster(['logMessage'], addr=args.addr)
+    while True:
+      sm.update()
+      if sm.updated['logMessage'] and (report := parse_logmessage(sm['logMessage'])) is not None:
+        traces[(report['process'], report['stream'])].add(report)
+        print_traces(traces)
@@ -201,6 +201,7 @@ void can_recv_thread(std::vector<Panda *> pandas) {
   util::set_thread_name("pandad_can_recv");
 
   PubMaster pm({"can"});
+  MessageBuilderPool pool;
 
   // run at 100Hz
   RateKeeper rk("pandad_can_recv", 100);
@@ -213,8 +214,8 @@ void can_recv_thread(std::vector<Panda *> pandas) {
       comms_healthy &= panda->can_receive(raw_can_data);
     }
 
-    MessageBuilder msg;
-    auto evt = msg.initEvent();
+    auto msg = pool.get();
+    auto evt = msg->initEvent();
     evt.setValid(comms_healthy);
     auto canData = evt.initCan(raw_can_data.size());
     for (uint i = 0; i<raw_can_data.size(); i++) {
@@ -223,7 +224,7 @@ void can_recv_thread(std::vector<Panda *> pandas) {
       canData[i].setDat(kj::arrayPtr((uint8_t*)raw_can_data[i].dat.data(), raw_can_data[i].dat.size()));
       canData[i].setSrc(raw_can_data[i].src);
     }
-    pm.send("can", msg);
+    pm.send("can", *msg);
 
     rk.keepTime();
   }
@@ -0,0 +1,132 @@
+#include "system/loggerd/drain_scheduler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+
+namespace {
+
+class FifoDrainScheduler : public DrainScheduler {
+ public:
+  void ready(int id) override {
+    if (!queued[id]) {
+      queued[id] = true;
+      queue.push_back(id);
+    }
+  }
+  bool next(Turn &turn) override {
+    if (queue.empty()) return false;
+    turn = {.id = queue.front(), .max_msgs = 200, .max_bytes = SIZE_MAX};
+    queued[turn.id] = false;
+    queue.pop_front();
+    return true;
+  }
+
+ private:
+  void serviceAdded(int id) override { queued.push_back(false); }
+  std::vector<bool> queued;
+  std::deque<int> queue;
+};
+
+}  // namespace
+
+std::unique_ptr<DrainScheduler> DrainScheduler::create(const std::string &type) {
+  if (type == "fifo") {
+    return std::make_unique<FifoDrainScheduler>();
+  }
+  assert(type == "fair");
+  return std::make_unique<FairDrainScheduler>();
+}
+
+int DrainScheduler::addService(const std::string &name, int frequency, int priority) {
+  services.push_back({.name = name, .frequency = frequency, .priority = priority});
+  const int id = services.size() - 1;
+  serviceAdded(id);
+  return id;
+}
+
+void DrainScheduler::drained(int id, int msgs, size_t bytes, bool empty) {
+  ServiceStats &s = services[id];
+  s.msgs += msgs;
+  s.bytes += bytes;
+  ++s.turns;
+  if (msgs > 0) {
+    const double size = bytes / (double)msgs;
+    s.avg_size = s.avg_size == 0 ? size : 0.9 * s.avg_size + 0.1 * size;
+  }
+  // messages sent since the last one we read
+  s.backlog = empty ? 0 : s.last_latency_ns * 1e-9 * std::max(s.frequency, 1);
+}
+
+void DrainScheduler::addLatency(int id, uint64_t ns) {
+  services[id].latency.add(ns);
+  services[id].last_latency_ns = ns;
+}
+
+void DrainScheduler::resetLatency() {
+  for (auto &s : services) {
+    s.latency.reset();
+  }
+}
+
+// FairDrainScheduler
+
+void FairDrainScheduler::serviceAdded(int id) {
+  deficit.push_back(0);
+  is_active.push_back(false);
+}
+
+double FairDrainScheduler::quantum(int id) const {
+  const ServiceStats &s = services[id];
+  const double msgs_per_round = std::max(s.frequency, 1) * ROUND_SECONDS;
+  const double boost = std::min(1.0 + s.backlog / std::max(msgs_per_round, 1.0), MAX_BOOST);
+  // at least one message per round. the size isn't known before the first one, it sets the average.
+  return std::max(msgs_per_round * s.avg_size, std::max(s.avg_size, 1.0)) * boost;
+}
+
+void FairDrainScheduler::ready(int id) {
+  if (!is_active[id]) {
+    is_active[id] = true;
+    active.push_back(id);
+  }
+}
+
+void FairDrainScheduler::startRound() {
+  round.assign(active.begin(), active.end());
+  std::stable_sort(round.begin(), round.end(), [this](int a, int b) {
+    return services[a].priority > services[b].priority;
+  });
+  for (int id : round) {
+    deficit[id] += quantum(id);
+  }
+  in_round = true;
+}
+
+bool FairDrainScheduler::next(Turn &turn) {
+  if (!in_round) {
+    if (active.empty()) return false;
+    startRound();
+  }
+  while (!round.empty()) {
+    const int id = round.front();
+    round.pop_front();
+    // overdrawn by a large message, it waits for its deficit to be paid back
+    if (!is_active[id] || deficit[id] <= 0) continue;
+
+    turn = {.id = id, .max_msgs = INT_MAX, .max_bytes = (size_t)std::ceil(deficit[id])};
+    return true;
+  }
+  in_round = false;
+  return false;
+}
+
+void FairDrainScheduler::drained(int id, int msgs, size_t bytes, bool empty) {
+  DrainScheduler::drained(id, msgs, bytes, empty);
+  deficit[id] -= bytes;
+  if (empty) {
+    deficit[id] = 0;
+    is_active[id] = false;
+    active.erase(std::find(active.begin(), active.end(), id));
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "system/loggerd/latency_histogram.h"
+
+// Decides in which order loggerd drains the sockets with new messages, and how much in one turn.
+// A round gives a turn to every service that had messages when it started:
+//   for (auto sock : poller->poll(scheduler->backlogged() ? 0 : 1000)) scheduler->ready(id[sock]);
+//   for (DrainScheduler::Turn turn; scheduler->next(turn);) { ...; scheduler->drained(turn.id, msgs, bytes, empty); }
+class DrainScheduler {
+ public:
+  struct Turn {
+    int id;
+    int max_msgs;
+    size_t max_bytes;  // the turn ends after the message crossing it
+  };
+
+  struct ServiceStats {
+    std::string name;
+    int frequency;
+    int priority;
+    uint64_t msgs = 0, bytes = 0, turns = 0;
+    double avg_size = 0;     // bytes per message, moving average
+    double backlog = 0;      // estimated messages waiting, from the latency of the last one
+    uint64_t last_latency_ns = 0;
+    LatencyHistogram latency;  // logMonoTime until handed to the log writer
+  };
+
+  // "fifo": up to 200 messages per socket in poller order, what loggerd used to do. "fair": FairDrainScheduler
+  static std::unique_ptr<DrainScheduler> create(const std::string &type);
+  virtual ~DrainScheduler() {}
+
+  // frequency as in cereal/services.py. in each round higher priorities go first. returns the service id
+  int addService(const std::string &name, int frequency, int priority = 0);
+  // the service has messages
+  virtual void ready(int id) = 0;
+  // the next turn of the current round. false once the round is over, the next call starts a new one
+  virtual bool next(Turn &turn) = 0;
+  // result of a turn. empty: the socket had no messages left
+  virtual void drained(int id, int msgs, size_t bytes, bool empty);
+  // some services still had messages at the end of their last turn
+  virtual bool backlogged() const { return false; }
+
+  void addLatency(int id, uint64_t ns);
+  inline const std::vector<ServiceStats> &stats() const { return services; }
+  void resetLatency();
+
+ protected:
+  virtual void serviceAdded(int id) {}
+  std::vector<ServiceStats> services;
+};
+
+// Deficit round robin over bytes. Each round a service may write its share of ~10ms of its expected
+// traffic (frequency * average message size), so a service flooding messages can't hold up the others
+// for longer than one round, and the rest of the bandwidth still goes to it. Services falling behind
+// get up to 4x their share until their latency recovers.
+class FairDrainScheduler : public DrainScheduler {
+ public:
+  void ready(int id) override;
+  bool next(Turn &turn) override;
+  void drained(int id, int msgs, size_t bytes, bool empty) override;
+  bool backlogged() const override { return !active.empty(); }
+  double quantum(int id) const;
+
+  static constexpr double ROUND_SECONDS = 0.01;
+  static constexpr double MAX_BOOST = 4.0;
+
+ private:
+  void serviceAdded(int id) override;
+  void startRound();
+
+  std::vector<double> deficit;
+  std::vector<bool> is_active;
+  std::vector<int> active;   // in order of arrival
+  std::deque<int> round;     // turns left in the current round
+  bool in_round = false;
+};
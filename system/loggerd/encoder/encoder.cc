@@ -1,7 +1,8 @@
 #include "system/loggerd/encoder/encoder.h"
 
 VideoEncoder::VideoEncoder(const EncoderInfo &encoder_info, int in_width, int in_height)
-    : encoder_info(encoder_info), in_width(in_width), in_height(in_height) {
+    : encoder_info(encoder_info), in_width(in_width), in_height(in_height),
+      trace("encoderd", encoder_info.publish_name, {"sof", "eof", "received", "encoding", "published"}) {
 
   out_width = encoder_info.frame_width > 0 ? encoder_info.frame_width : in_width;
   out_height = encoder_info.frame_height > 0 ? encoder_info.frame_height : in_height;
@@ -45,6 +46,8 @@ void VideoEncoder::publisher_publish(VideoEncoder *e, int segment_num, uint32_t
   kj::ArrayOutputStream output_stream(kj::ArrayPtr<capnp::byte>(e->msg_cache.data(), bytes_size));
   capnp::writeMessage(output_stream, msg);
   e->pm->send(e->encoder_info.publish_name, e->msg_cache.data(), bytes_size);
+  e->trace.mark(extra.frame_id, STAGE_PUBLISHED);
+  e->trace.complete(extra.frame_id);
 
   // Publish keyframe thumbnail
   if ((flags & V4L2_BUF_FLAG_KEYFRAME) && e->encoder_info.thumbnail_name != NULL) {
@@ -14,16 +14,24 @@
 
 #define V4L2_BUF_FLAG_KEYFRAME 8
 
+// stages of a frame through encoderd, in VideoEncoder::trace
+enum EncoderStage { STAGE_SOF, STAGE_EOF, STAGE_RECEIVED, STAGE_ENCODING, STAGE_PUBLISHED };
+
 class VideoEncoder {
 public:
   VideoEncoder(const EncoderInfo &encoder_info, int in_width, int in_height);
   virtual ~VideoEncoder() {}
+  // returns the index of the frame in the segment, -1 if encoding failed, or FRAME_DROPPED
   virtual int encode_frame(VisionBuf* buf, VisionIpcBufExtra *extra) = 0;
+  static constexpr int FRAME_DROPPED = -2;
   virtual void encoder_open(const char* path) = 0;
   virtual void encoder_close() = 0;
 
   void publisher_publish(VideoEncoder *e, int segment_num, uint32_t idx, VisionIpcBufExtra &extra, unsigned int flags, kj::ArrayPtr<capnp::byte> header, kj::ArrayPtr<capnp::byte> dat);
 
+  // encoderd marks the stages up to STAGE_ENCODING, publisher_publish completes the frame
+  FrameTracer trace;
+
 protected:
   void publish_thumbnail(uint32_t frame_id, uint64_t timestamp_eof, kj::ArrayPtr<capnp::byte> dat);
 
@@ -5,14 +5,14 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 
 #define __STDC_CONSTANT_MACROS
 
-#include "third_party/libyuv/include/libyuv.h"
-
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -21,52 +21,95 @@ extern "C" {
 
 #include "common/swaglog.h"
 #include "common/util.h"
+#include "system/loggerd/encoder/nv12_scale.h"
 
 const int env_debug_encoder = (getenv("DEBUG_ENCODER") != NULL) ? atoi(getenv("DEBUG_ENCODER")) : 0;
 
-FfmpegEncoder::FfmpegEncoder(const EncoderInfo &encoder_info, int in_width, int in_height)
-    : VideoEncoder(encoder_info, in_width, in_height) {
-  frame = av_frame_alloc();
-  assert(frame);
-  frame->format = AV_PIX_FMT_YUV420P;
-  frame->width = out_width;
-  frame->height = out_height;
-  frame->linesize[0] = out_width;
-  frame->linesize[1] = out_width/2;
-  frame->linesize[2] = out_width/2;
-
-  convert_buf.resize(in_width * in_height * 3 / 2);
-
-  if (in_width != out_width || in_height != out_height) {
-    downscale_buf.resize(out_width * out_height * 3 / 2);
+static bool supports_pix_fmt(const AVCodec *codec, AVPixelFormat pix_fmt) {
+  for (const AVPixelFormat *p = codec->pix_fmts; p && *p != AV_PIX_FMT_NONE; ++p) {
+    if (*p == pix_fmt) return true;
+  }
+  return false;
+}
+
+FfmpegEncoder::DropPolicy FfmpegEncoder::drop_policy(const std::string &name) {
+  if (name == "newest") return DropPolicy::NEWEST;
+  if (name == "oldest") return DropPolicy::OLDEST;
+  if (name != "block") LOGE("unknown drop policy %s, blocking", name.c_str());
+  return DropPolicy::BLOCK;
+}
+
+FfmpegEncoder::FfmpegEncoder(const EncoderInfo &encoder_info, int in_width, int in_height, int queue_size, DropPolicy drop, int threads)
+    : VideoEncoder(encoder_info, in_width, in_height), drop(drop), threads(threads), slots(std::max(queue_size, 2)) {
+  codec = avcodec_find_encoder(AV_CODEC_ID_FFVHUFF);
+  assert(codec);
+  pix_fmt = supports_pix_fmt(codec, AV_PIX_FMT_NV12) ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+
+  for (int i = 0; i < slots.size(); ++i) {
+    Slot &slot = slots[i];
+    slot.buf.resize(out_width * out_height * 3 / 2);
+    slot.frame = av_frame_alloc();
+    assert(slot.frame);
+    slot.frame->format = pix_fmt;
+    slot.frame->width = out_width;
+    slot.frame->height = out_height;
+    slot.frame->data[0] = slot.buf.data();
+    slot.frame->data[1] = slot.buf.data() + out_width * out_height;
+    slot.frame->linesize[0] = out_width;
+    if (pix_fmt == AV_PIX_FMT_NV12) {
+      slot.frame->linesize[1] = out_width;
+    } else {
+      slot.frame->data[2] = slot.frame->data[1] + (out_width / 2) * (out_height / 2);
+      slot.frame->linesize[1] = out_width/2;
+      slot.frame->linesize[2] = out_width/2;
+    }
+    free_slots.push(i);
   }
+  thread = std::thread(&FfmpegEncoder::encode_thread, this);
 }
 
 FfmpegEncoder::~FfmpegEncoder() {
   encoder_close();
-  av_frame_free(&frame);
+  encode_queue.push(-1);
+  thread.join();
+  for (auto &slot : slots) {
+    av_frame_free(&slot.frame);
+  }
 }
 
 void FfmpegEncoder::encoder_open(const char* path) {
-  const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_FFVHUFF);
-
   this->codec_ctx = avcodec_alloc_context3(codec);
   assert(this->codec_ctx);
-  this->codec_ctx->width = frame->width;
-  this->codec_ctx->height = frame->height;
-  this->codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  this->codec_ctx->width = out_width;
+  this->codec_ctx->height = out_height;
+  this->codec_ctx->pix_fmt = pix_fmt;
   this->codec_ctx->time_base = (AVRational){ 1, encoder_info.fps };
+  this->codec_ctx->thread_count = threads;
+  this->codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
   int err = avcodec_open2(this->codec_ctx, codec, NULL);
   assert(err >= 0);
 
   is_open = true;
   segment_num++;
   counter = 0;
+  queued = 0;
+  sent = 0;
 }
 
 void FfmpegEncoder::encoder_close() {
   if (!is_open) return;
 
+  // all slots are free once the frames in flight are encoded
+  std::vector<int> held;
+  for (int n = 0; n < slots.size(); ++n) held.push_back(free_slots.pop());
+  for (int i : held) free_slots.push(i);
+
+  // and the codec's threads still hold the last few. encode_thread is idle until the next frame
+  if (encode(nullptr, nullptr) == -1) {
+    LOGE("Failed to flush encoder %s", encoder_info.publish_name);
+  }
+  in_codec.clear();
+
   avcodec_free_context(&codec_ctx);
   is_open = false;
 }
@@ -75,38 +118,49 @@ int FfmpegEncoder::encode_frame(VisionBuf* buf, VisionIpcBufExtra *extra) {
   assert(buf->width == this->in_width);
   assert(buf->height == this->in_height);
 
-  uint8_t *cy = convert_buf.data();
-  uint8_t *cu = cy + in_width * in_height;
-  uint8_t *cv = cu + (in_width / 2) * (in_height / 2);
-  libyuv::NV12ToI420(buf->y, buf->stride,
-                     buf->uv, buf->stride,
-                     cy, in_width,
-                     cu, in_width/2,
-                     cv, in_width/2,
-                     in_width, in_height);
-
-  if (downscale_buf.size() > 0) {
-    uint8_t *out_y = downscale_buf.data();
-    uint8_t *out_u = out_y + frame->width * frame->height;
-    uint8_t *out_v = out_u + (frame->width / 2) * (frame->height / 2);
-    libyuv::I420Scale(cy, in_width,
-                      cu, in_width/2,
-                      cv, in_width/2,
-                      in_width, in_height,
-                      out_y, frame->width,
-                      out_u, frame->width/2,
-                      out_v, frame->width/2,
-                      frame->width, frame->height,
-                      libyuv::kFilterNone);
-    frame->data[0] = out_y;
-    frame->data[1] = out_u;
-    frame->data[2] = out_v;
-  } else {
-    frame->data[0] = cy;
-    frame->data[1] = cu;
-    frame->data[2] = cv;
+  int i;
+  if (!free_slots.try_pop(i)) {
+    // the encoder is behind
+    if (drop == DropPolicy::NEWEST) {
+      ++dropped;
+      trace.drop();
+      LOGW_100("%s: encoder queue full, dropped frame %d, %" PRIu64 " total", encoder_info.publish_name, extra->frame_id, dropped);
+      return FRAME_DROPPED;
+    } else if (drop == DropPolicy::OLDEST && encode_queue.try_pop(i)) {
+      ++dropped;
+      trace.drop();
+      LOGW_100("%s: encoder queue full, dropped frame %d, %" PRIu64 " total", encoder_info.publish_name, slots[i].extra.frame_id, dropped);
+    } else {
+      i = free_slots.pop();
+    }
+  }
+
+  // straight from NV12 to the encoder's format and size, in one pass
+  AVFrame *frame = slots[i].frame;
+  nv12_scale(buf->y, buf->uv, buf->stride, in_width, in_height,
+             frame->data[0], frame->data[1], pix_fmt == AV_PIX_FMT_NV12 ? nullptr : frame->data[2],
+             out_width, out_height);
+  slots[i].extra = *extra;
+  encode_queue.push(i);
+  return queued++;
+}
+
+void FfmpegEncoder::encode_thread() {
+  util::set_thread_name("encoder");
+  for (int i; (i = encode_queue.pop()) != -1;) {
+    if (encode(slots[i].frame, &slots[i].extra) == -1) {
+      LOGE("Failed to encode frame. frame_id: %d", slots[i].extra.frame_id);
+    }
+    free_slots.push(i);
+  }
+}
+
+int FfmpegEncoder::encode(AVFrame *frame, const VisionIpcBufExtra *extra) {
+  if (frame) {
+    frame->pts = sent*50*1000; // 50ms per frame
+    in_codec.push_back({frame->pts, *extra});
+    sent++;
   }
-  frame->pts = counter*50*1000; // 50ms per frame
 
   int ret = counter;
 
@@ -134,11 +188,20 @@ int FfmpegEncoder::encode_frame(VisionBuf* buf, VisionIpcBufExtra *extra) {
       break;
     }
 
+    // the frame of the packet. frames before it got no packet
+    while (!in_codec.empty() && in_codec.front().first < pkt.pts) in_codec.pop_front();
+    if (in_codec.empty() || in_codec.front().first != pkt.pts) {
+      LOGE("no frame for packet pts %" PRId64, pkt.pts);
+      continue;
+    }
+    VisionIpcBufExtra frame_extra = in_codec.front().second;
+    in_codec.pop_front();
+
     if (env_debug_encoder) {
-      printf("%20s got %8d bytes flags %8x idx %4d id %8d\n", encoder_info.publish_name, pkt.size, pkt.flags, counter, extra->frame_id);
+      printf("%20s got %8d bytes flags %8x idx %4d id %8d\n", encoder_info.publish_name, pkt.size, pkt.flags, counter, frame_extra.frame_id);
     }
 
-    publisher_publish(this, segment_num, counter, *extra,
+    publisher_publish(this, segment_num, counter, frame_extra,
       (pkt.flags & AV_PKT_FLAG_KEY) ? V4L2_BUF_FLAG_KEYFRAME : 0,
       kj::arrayPtr<capnp::byte>(pkt.data, (size_t)0), // TODO: get the header
       kj::arrayPtr<capnp::byte>(pkt.data, pkt.size));
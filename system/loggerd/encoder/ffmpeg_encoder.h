@@ -2,7 +2,10 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <deque>
 #include <string>
+#include <utility>
+#include <thread>
 #include <vector>
 
 extern "C" {
@@ -11,24 +14,55 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+#include "common/queue.h"
 #include "system/loggerd/encoder/encoder.h"
 #include "system/loggerd/loggerd.h"
 
+// Frames are converted on the calling thread, and encoded and published on encode_thread with libavcodec's frame and
+// slice threads. Up to queue_size frames are in flight. When they're all taken, encode_frame waits for the encoder
+// (BLOCK), or drops the new frame (NEWEST) or the oldest one still waiting (OLDEST).
 class FfmpegEncoder : public VideoEncoder {
 public:
-  FfmpegEncoder(const EncoderInfo &encoder_info, int in_width, int in_height);
+  enum class DropPolicy { NEWEST, OLDEST, BLOCK };
+  static DropPolicy drop_policy(const std::string &name);
+
+  FfmpegEncoder(const EncoderInfo &encoder_info, int in_width, int in_height, int queue_size = ENCODERD_QUEUE,
+                DropPolicy drop = drop_policy(ENCODERD_DROP), int threads = ENCODERD_THREADS);
   ~FfmpegEncoder();
+  // returns the index of the frame in the segment, FRAME_DROPPED if it was dropped. failures are logged by encode_thread.
   int encode_frame(VisionBuf* buf, VisionIpcBufExtra *extra);
   void encoder_open(const char* path);
+  // publishes the frames in flight, to the segment they were queued in
   void encoder_close();
 
+  // frames dropped with a full queue
+  uint64_t dropped = 0;
+
 private:
+  struct Slot {
+    AVFrame *frame = nullptr;
+    std::vector<uint8_t> buf;
+    VisionIpcBufExtra extra;
+  };
+  // a null frame flushes the codec
+  int encode(AVFrame *frame, const VisionIpcBufExtra *extra);
+  void encode_thread();
+
   int segment_num = -1;
-  int counter = 0;
+  int counter = 0;  // packets in the segment
+  int queued = 0;   // frames queued in the segment
+  int sent = 0;     // frames sent to the codec in the segment
   bool is_open = false;
 
+  const AVCodec *codec;
   AVCodecContext *codec_ctx;
-  AVFrame *frame = NULL;
-  std::vector<uint8_t> convert_buf;
-  std::vector<uint8_t> downscale_buf;
+  AVPixelFormat pix_fmt;  // NV12 if the codec takes it, I420 otherwise
+  const DropPolicy drop;
+  const int threads;
+
+  std::vector<Slot> slots;
+  SafeQueue<int> free_slots, encode_queue;
+  // the frames in the codec by pts. with frame threads, their packets come a few frames later
+  std::deque<std::pair<int64_t, VisionIpcBufExtra>> in_codec;
+  std::thread thread;
 };
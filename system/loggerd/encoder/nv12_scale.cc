@@ -0,0 +1,52 @@
+#include "system/loggerd/encoder/nv12_scale.h"
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "third_party/libyuv/include/libyuv.h"
+
+// 16.16 fixed point steps, as libyuv's point sampling
+static inline int fixed_div(int num, int div) { return (int)(((int64_t)num << 16) / div); }
+
+void nv12_scale(const uint8_t *src_y, const uint8_t *src_uv, int src_stride, int src_width, int src_height,
+                uint8_t *dst_y, uint8_t *dst_u, uint8_t *dst_v, int dst_width, int dst_height) {
+  assert(dst_width <= src_width && dst_height <= src_height);
+  const int src_cw = src_width / 2, src_ch = src_height / 2;
+  const int dst_cw = dst_width / 2, dst_ch = dst_height / 2;
+
+  if (dst_width == src_width && dst_height == src_height) {
+    libyuv::CopyPlane(src_y, src_stride, dst_y, dst_width, dst_width, dst_height);
+    if (dst_v) {
+      libyuv::SplitUVPlane(src_uv, src_stride, dst_u, dst_cw, dst_v, dst_cw, dst_cw, dst_ch);
+    } else {
+      libyuv::CopyPlane(src_uv, src_stride, dst_u, dst_width, dst_width, dst_ch);
+    }
+    return;
+  }
+
+  libyuv::ScalePlane(src_y, src_stride, src_width, src_height, dst_y, dst_width, dst_width, dst_height, libyuv::kFilterNone);
+
+  // sample the UV pairs, and split them on the way if needed
+  const int dx = fixed_div(src_cw, dst_cw), dy = fixed_div(src_ch, dst_ch);
+  thread_local std::vector<int> cols;
+  cols.resize(dst_cw);
+  for (int i = 0, x = dx >> 1; i < dst_cw; ++i, x += dx) {
+    cols[i] = (x >> 16) * 2;
+  }
+  for (int j = 0, y = dy >> 1; j < dst_ch; ++j, y += dy) {
+    const uint8_t *row = src_uv + (size_t)(y >> 16) * src_stride;
+    if (dst_v) {
+      uint8_t *u = dst_u + j * dst_cw, *v = dst_v + j * dst_cw;
+      for (int i = 0; i < dst_cw; ++i) {
+        u[i] = row[cols[i]];
+        v[i] = row[cols[i] + 1];
+      }
+    } else {
+      uint8_t *uv = dst_u + j * dst_width;
+      for (int i = 0; i < dst_cw; ++i) {
+        memcpy(uv + i * 2, row + cols[i], 2);
+      }
+    }
+  }
+}
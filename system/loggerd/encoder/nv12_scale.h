@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+
+// Scales an NV12 image without converting all of it to I420 first. Sampling is nearest neighbor,
+// like libyuv::I420Scale with kFilterNone. Only the output is deinterleaved.
+// dst_v == nullptr: NV12 output, with the interleaved UV plane in dst_u. otherwise I420.
+// The output planes are packed: strides are dst_width, or dst_width / 2 for U and V.
+void nv12_scale(const uint8_t *src_y, const uint8_t *src_uv, int src_stride, int src_width, int src_height,
+                uint8_t *dst_y, uint8_t *dst_u, uint8_t *dst_v, int dst_width, int dst_height);
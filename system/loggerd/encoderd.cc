@@ -74,9 +74,11 @@ void encoder_thread(EncoderdState *s, const LogCameraInfo &cam_info) {
       VisionIpcBufExtra extra;
       VisionBuf* buf = vipc_client.recv(&extra);
       if (buf == nullptr) continue;
+      const uint64_t received = nanos_since_boot();
 
       // detect loop around and drop the frames
       if (buf->get_frame_id() != extra.frame_id) {
+        for (auto &e : encoders) e->trace.drop();
         if (!lagging) {
           LOGE("encoder %s lag  buffer id: %" PRIu64 " extra id: %d", cam_info.thread_name, buf->get_frame_id(), extra.frame_id);
           lagging = true;
@@ -102,6 +104,11 @@ void encoder_thread(EncoderdState *s, const LogCameraInfo &cam_info) {
 
       // encode a frame
       for (int i = 0; i < encoders.size(); ++i) {
+        FrameTracer &trace = encoders[i]->trace;
+        trace.mark(extra.frame_id, STAGE_SOF, extra.timestamp_sof);
+        trace.mark(extra.frame_id, STAGE_EOF, extra.timestamp_eof);
+        trace.mark(extra.frame_id, STAGE_RECEIVED, received);
+        trace.mark(extra.frame_id, STAGE_ENCODING);
         int out_id = encoders[i]->encode_frame(buf, &extra);
 
         if (out_id == -1) {
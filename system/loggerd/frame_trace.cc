@@ -0,0 +1,100 @@
+#include "system/loggerd/frame_trace.h"
+
+#include <cassert>
+
+#include "common/swaglog.h"
+
+FrameTracer::FrameTracer(const std::string &process, const std::string &stream, const std::vector<std::string> &stages,
+                         double report_interval)
+    : process(process), stream(stream), stages(stages), latency(stages.size() - 1), report_interval_ns(report_interval * 1e9) {
+  assert(stages.size() >= 2 && stages.size() <= MAX_STAGES);
+}
+
+void FrameTracer::mark(uint32_t frame_id, int stage, uint64_t ns) {
+  Slot &slot = ring[frame_id % RING_SIZE];
+  if (stage == 0) {
+    slot.t[0].store(ns, std::memory_order_relaxed);
+    slot.marked.store(1, std::memory_order_relaxed);
+    slot.frame_id.store(frame_id, std::memory_order_release);
+  } else if (slot.frame_id.load(std::memory_order_acquire) == frame_id) {
+    slot.t[stage].store(ns, std::memory_order_relaxed);
+    slot.marked.fetch_or(1 << stage, std::memory_order_release);
+  }
+}
+
+void FrameTracer::complete(uint32_t frame_id) {
+  Slot &slot = ring[frame_id % RING_SIZE];
+  uint64_t t[MAX_STAGES];
+  const uint32_t all = (1 << stages.size()) - 1;
+  bool valid = slot.frame_id.load(std::memory_order_acquire) == frame_id &&
+               slot.marked.load(std::memory_order_acquire) == all;
+  for (int i = 0; i < stages.size(); ++i) {
+    t[i] = slot.t[i].load(std::memory_order_relaxed);
+  }
+  // the slot can be reused while reading it, if this frame is far behind
+  valid = valid && slot.frame_id.load(std::memory_order_acquire) == frame_id;
+
+  if (!valid) {
+    ++lost;
+  } else {
+    // the stages come from different clocks, e.g. the camera's eof. they can be a bit out of order
+    for (int i = 0; i + 1 < stages.size(); ++i) {
+      latency[i].add(t[i + 1] > t[i] ? t[i + 1] - t[i] : 0);
+    }
+    total.add(t[stages.size() - 1] > t[0] ? t[stages.size() - 1] - t[0] : 0);
+    ++frames;
+  }
+  if (last_frame_id >= 0 && frame_id > last_frame_id + 1) {
+    skipped += frame_id - last_frame_id - 1;
+  }
+  last_frame_id = frame_id;
+
+  const uint64_t now = nanos_since_boot();
+  if (last_report == 0) {
+    last_report = now;
+  } else if (now - last_report > report_interval_ns) {
+    LOG("frame_trace %s", summary().dump().c_str());
+    reset();
+    last_report = now;
+  }
+}
+
+static json11::Json histogram_json(const LatencyHistogram &h) {
+  json11::Json::array buckets;
+  for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) buckets.push_back((double)h.bucket(i));
+  return json11::Json::object{
+    {"p50_ms", h.percentile(50) * 1e-6},
+    {"p99_ms", h.percentile(99) * 1e-6},
+    {"max_ms", h.max() * 1e-6},
+    {"buckets", buckets},
+  };
+}
+
+json11::Json FrameTracer::summary() const {
+  json11::Json::array stage_latency;
+  for (int i = 0; i < latency.size(); ++i) {
+    json11::Json::object h = histogram_json(latency[i]).object_items();
+    h["stage"] = stages[i] + "->" + stages[i + 1];
+    stage_latency.push_back(h);
+  }
+  json11::Json::object h = histogram_json(total).object_items();
+  h["stage"] = stages.front() + "->" + stages.back();
+  stage_latency.push_back(h);
+
+  return json11::Json::object{
+    {"process", process},
+    {"stream", stream},
+    {"frames", (double)frames},
+    {"lost", (double)lost},
+    {"skipped", (double)skipped},
+    {"dropped", (double)dropped.load()},
+    {"stages", stage_latency},
+  };
+}
+
+void FrameTracer::reset() {
+  for (auto &h : latency) h.reset();
+  total.reset();
+  frames = lost = skipped = 0;
+  dropped = 0;
+}
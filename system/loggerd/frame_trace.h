@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/timing.h"
+#include "system/loggerd/latency_histogram.h"
+#include "third_party/json11/json11.hpp"
+
+// Timestamps of the stages of each frame of a camera stream through encoderd or loggerd, e.g. eof -> received -> published.
+// Stages are marked from any thread without locks, into a ring of the last frames by frame id. Once a frame went through
+// all of them, complete() adds the time between the stages to histograms. Every report interval they are logged as
+//   frame_trace {"process": "encoderd", "stream": "roadEncodeData", "stages": [...], ...}
+// for selfdrive/debug/frame_trace.py, and reset.
+class FrameTracer {
+ public:
+  static constexpr int MAX_STAGES = 8;
+  static constexpr int RING_SIZE = 64;  // frames in flight
+
+  FrameTracer(const std::string &process, const std::string &stream, const std::vector<std::string> &stages,
+              double report_interval = 10.0);
+  // stage 0 starts the frame. a later stage of a frame no longer in the ring is ignored
+  void mark(uint32_t frame_id, int stage, uint64_t ns);
+  inline void mark(uint32_t frame_id, int stage) { mark(frame_id, stage, nanos_since_boot()); }
+  // the frame went through the last stage. called from one thread
+  void complete(uint32_t frame_id);
+  // a dropped frame, by a lagging stream or a full encoder queue
+  inline void drop() { ++dropped; }
+
+  json11::Json summary() const;
+  void reset();
+
+  const std::string process, stream;
+  const std::vector<std::string> stages;
+  // time from stage i to i + 1, and from the first to the last
+  std::vector<LatencyHistogram> latency;
+  LatencyHistogram total;
+  uint64_t frames = 0;
+  uint64_t lost = 0;     // overwritten in the ring or missing a stage
+  uint64_t skipped = 0;  // gaps in the ids of the completed frames
+  std::atomic<uint64_t> dropped = 0;
+
+ private:
+  struct Slot {
+    std::atomic<uint32_t> frame_id = UINT32_MAX;
+    std::atomic<uint32_t> marked = 0;  // bit per stage
+    std::array<std::atomic<uint64_t>, MAX_STAGES> t = {};
+  };
+  std::array<Slot, RING_SIZE> ring;
+  const uint64_t report_interval_ns;
+  uint64_t last_report = 0;
+  int64_t last_frame_id = -1;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "common/crc32c.h"
+
+// Framed logs (LOGGERD_FRAMED) put a header before every message:
+//   magic, message size, CRC32C of the message, CRC32C of the three fields before it
+// with the message padded to 8 bytes. A torn write at the end (power loss) or corruption in the
+// middle only loses the messages it touches: readers check the CRCs and resync on the next valid header.
+// The magic can't be the start of a capnp message, readers tell framed and raw logs apart by the first word.
+
+constexpr uint32_t LOG_FRAME_MAGIC = 0x4D52464C;  // "LFRM"
+constexpr size_t LOG_FRAME_ALIGNMENT = 8;
+constexpr size_t LOG_FRAME_MAX_SIZE = 256 * 1024 * 1024;
+
+struct LogFrameHeader {
+  uint32_t magic;
+  uint32_t size;
+  uint32_t crc;
+  uint32_t header_crc;
+
+  static LogFrameHeader make(const void *data, size_t size) {
+    LogFrameHeader h = {.magic = LOG_FRAME_MAGIC, .size = (uint32_t)size, .crc = crc32c(data, size)};
+    h.header_crc = crc32c(&h, offsetof(LogFrameHeader, header_crc));
+    return h;
+  }
+  inline bool valid() const {
+    return magic == LOG_FRAME_MAGIC && size <= LOG_FRAME_MAX_SIZE && header_crc == crc32c(this, offsetof(LogFrameHeader, header_crc));
+  }
+  inline size_t paddedSize() const { return (size + LOG_FRAME_ALIGNMENT - 1) & ~(LOG_FRAME_ALIGNMENT - 1); }
+};
+static_assert(sizeof(LogFrameHeader) % LOG_FRAME_ALIGNMENT == 0);
+
+inline bool is_framed_log(const char *data, size_t size) {
+  uint32_t magic;
+  return size >= sizeof(magic) && (memcpy(&magic, data, sizeof(magic)), magic == LOG_FRAME_MAGIC);
+}
+
+struct LogScanStats {
+  size_t messages = 0;
+  size_t corrupt_regions = 0;  // runs of bytes without a valid frame, each followed by a resync
+  size_t corrupt_bytes = 0;
+  size_t truncated_bytes = 0;  // incomplete or torn frames at the end
+};
+
+// Calls on_message(data, size) for every intact message of a framed log.
+template <class Func>
+LogScanStats scan_framed_log(const char *data, size_t size, Func &&on_message) {
+  LogScanStats stats;
+  size_t pos = 0, corrupt_start = 0;
+  bool in_corrupt = false;
+  while (pos + sizeof(LogFrameHeader) <= size) {
+    LogFrameHeader h;
+    memcpy(&h, data + pos, sizeof(h));
+    const char *msg = data + pos + sizeof(h);
+    if (h.valid()) {
+      if (pos + sizeof(h) + h.size > size) break;  // cut off, e.g. by a power loss
+      if (crc32c(msg, h.size) == h.crc) {
+        if (in_corrupt) {
+          stats.corrupt_bytes += pos - corrupt_start;
+          in_corrupt = false;
+        }
+        on_message(msg, (size_t)h.size);
+        ++stats.messages;
+        pos += sizeof(h) + h.paddedSize();
+        continue;
+      }
+    }
+    // resync on the next aligned frame header
+    if (!in_corrupt) {
+      ++stats.corrupt_regions;
+      corrupt_start = pos;
+      in_corrupt = true;
+    }
+    pos += LOG_FRAME_ALIGNMENT;
+  }
+  // no valid frame after it, it's the torn end of the log
+  if (in_corrupt) {
+    --stats.corrupt_regions;
+    pos = corrupt_start;
+  }
+  stats.truncated_bytes = size - std::min(pos, size);
+  return stats;
+}
@@ -0,0 +1,25 @@
+#include "system/loggerd/latency_histogram.h"
+
+#include <algorithm>
+
+void LatencyHistogram::add(uint64_t ns) {
+  const uint64_t us = ns / 1000;
+  const int i = us == 0 ? 0 : std::min(64 - __builtin_clzll(us), BUCKETS - 1);
+  ++buckets[i];
+  ++count_;
+  max_ = std::max(max_, ns);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+  const uint64_t target = std::max<uint64_t>(1, p / 100.0 * count_ + 0.5);
+  uint64_t n = 0;
+  for (int i = 0; i < BUCKETS; ++i) {
+    n += buckets[i];
+    if (n >= target) return std::min<uint64_t>((1ULL << i) * 1000, max_);
+  }
+  return max_;
+}
+
+void LatencyHistogram::reset() {
+  *this = {};
+}
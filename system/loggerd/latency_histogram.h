@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+// Latencies in power of two buckets, from 1us to ~70min
+class LatencyHistogram {
+ public:
+  static constexpr int BUCKETS = 32;
+
+  void add(uint64_t ns);
+  // upper bound of the bucket holding the p-th percentile, in ns
+  uint64_t percentile(double p) const;
+  // bucket i holds [2^(i-1), 2^i) us, bucket 0 is under 1us
+  inline uint64_t bucket(int i) const { return buckets[i]; }
+  inline uint64_t count() const { return count_; }
+  inline uint64_t max() const { return max_; }
+  void reset();
+
+ private:
+  uint64_t buckets[BUCKETS] = {};
+  uint64_t count_ = 0, max_ = 0;
+};
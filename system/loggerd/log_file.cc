@@ -0,0 +1,187 @@
+#include "system/loggerd/log_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/swaglog.h"
+#include "common/timing.h"
+#include "system/loggerd/framed_log.h"
+
+constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+static void update_max(std::atomic<uint64_t> &max, uint64_t value) {
+  uint64_t prev = max;
+  while (prev < value && !max.compare_exchange_weak(prev, value)) {}
+}
+
+AsyncFile::AsyncFile(const std::string &path, const Options &options, Stats *stats) : options(options), stats(stats) {
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+  direct_io = options.direct_io;
+  if (direct_io) flags |= O_DIRECT;
+#endif
+  fd = HANDLE_EINTR(open(path.c_str(), flags, 0664));
+#ifdef O_DIRECT
+  if (fd < 0 && direct_io) {
+    // e.g. tmpfs doesn't support O_DIRECT
+    LOGW("O_DIRECT not supported for %s: %s", path.c_str(), strerror(errno));
+    direct_io = false;
+    fd = HANDLE_EINTR(open(path.c_str(), flags & ~O_DIRECT, 0664));
+  }
+#endif
+  assert(fd >= 0);
+
+  // O_DIRECT needs aligned buffers and sizes
+  capacity = (options.buffer_size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+  buffers.resize(std::max(options.num_buffers, 2));
+  for (auto &buf : buffers) {
+    int ret = posix_memalign((void **)&buf.data, DIRECT_IO_ALIGNMENT, capacity);
+    assert(ret == 0);
+    free_buffers.push_back(&buf);
+  }
+  active = free_buffers.front();
+  free_buffers.pop_front();
+
+  thread = std::thread(&AsyncFile::writerThread, this);
+}
+
+AsyncFile::~AsyncFile() {
+  submit();
+  {
+    std::lock_guard lk(lock);
+    exiting = true;
+  }
+  cv.notify_all();
+  thread.join();
+
+  int err = close(fd);
+  assert(err == 0);
+  for (auto &buf : buffers) {
+    free(buf.data);
+  }
+}
+
+void AsyncFile::write(void *data, size_t size) {
+  const char *src = (const char *)data;
+  while (size > 0) {
+    size_t n = std::min(size, capacity - active->size);
+    memcpy(active->data + active->size, src, n);
+    active->size += n;
+    src += n;
+    size -= n;
+    if (active->size == capacity) {
+      submit();
+    }
+  }
+}
+
+// hand the active buffer to the writer thread, and wait for a free one if there is none
+void AsyncFile::submit() {
+  if (active->size == 0) return;
+
+  std::unique_lock lk(lock);
+  full_buffers.push_back(active);
+  stats->queue_depth = full_buffers.size();
+  if (full_buffers.size() > stats->max_queue_depth) {
+    stats->max_queue_depth = full_buffers.size();
+  }
+  cv.notify_all();
+
+  if (free_buffers.empty()) {
+    ++stats->stalls;
+    const double start = millis_since_boot();
+    cv.wait(lk, [this]() { return !free_buffers.empty(); });
+    stats->stall_us += (millis_since_boot() - start) * 1000;
+  }
+  active = free_buffers.front();
+  free_buffers.pop_front();
+}
+
+void AsyncFile::sync() {
+  submit();
+  std::unique_lock lk(lock);
+  cv.wait(lk, [this]() { return full_buffers.empty() && !writing; });
+  datasync();
+}
+
+void AsyncFile::writerThread() {
+  util::set_thread_name("loggerd_writer");
+
+  double last_sync_ms = millis_since_boot();
+  std::unique_lock lk(lock);
+  while (true) {
+    cv.wait(lk, [this]() { return exiting || !full_buffers.empty(); });
+    if (full_buffers.empty()) break;  // exit once everything is written
+
+    Buffer *buf = full_buffers.front();
+    full_buffers.pop_front();
+    stats->queue_depth = full_buffers.size();
+    writing = true;
+    lk.unlock();
+
+    writeBuffer(buf);
+    if (options.sync_interval_ms > 0 && (millis_since_boot() - last_sync_ms) >= options.sync_interval_ms) {
+      datasync();
+      last_sync_ms = millis_since_boot();
+    }
+
+    lk.lock();
+    buf->size = 0;
+    free_buffers.push_back(buf);
+    writing = false;
+    cv.notify_all();
+  }
+}
+
+void AsyncFile::writeBuffer(const Buffer *buf) {
+#ifdef O_DIRECT
+  if (direct_io && buf->size % DIRECT_IO_ALIGNMENT != 0) {
+    // only the last or a synced buffer is partial. the file offset is unaligned after it, stay buffered.
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+    direct_io = false;
+  }
+#endif
+
+  const double start = millis_since_boot();
+  size_t written = 0;
+  while (written < buf->size) {
+    ssize_t n = HANDLE_EINTR(::write(fd, buf->data + written, buf->size - written));
+    if (n < 0) {
+      LOGE("failed to write log: %s", strerror(errno));
+      assert(false);
+    }
+    written += n;
+  }
+  const uint64_t elapsed_us = (millis_since_boot() - start) * 1000;
+  stats->bytes_written += written;
+  ++stats->writes;
+  stats->write_us += elapsed_us;
+  update_max(stats->max_write_us, elapsed_us);
+}
+
+void AsyncFile::datasync() {
+#ifdef __APPLE__
+  int ret = fsync(fd);
+#else
+  int ret = fdatasync(fd);
+#endif
+  if (ret != 0) {
+    LOGE("failed to sync log: %s", strerror(errno));
+  }
+  ++stats->syncs;
+}
+
+// FramedFile
+
+void FramedFile::write(void *data, size_t size) {
+  // one write for the whole frame, so a compressed sink never starts a zstd frame inside it
+  const LogFrameHeader header = LogFrameHeader::make(data, size);
+  buf.resize(sizeof(header) + header.paddedSize());
+  memcpy(buf.data(), &header, sizeof(header));
+  memcpy(buf.data() + sizeof(header), data, size);
+  memset(buf.data() + sizeof(header) + size, 0, header.paddedSize() - size);
+  out->write(buf.data(), buf.size());
+}
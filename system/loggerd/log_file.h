@@ -0,0 +1,120 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "common/util.h"
+
+class LogFile {
+ public:
+  virtual ~LogFile() {}
+  virtual void write(void* data, size_t size) = 0;
+  inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
+  // make everything written so far durable
+  virtual void sync() = 0;
+};
+
+class RawFile : public LogFile {
+ public:
+  RawFile(const std::string &path) {
+    file = util::safe_fopen(path.c_str(), "wb");
+    assert(file != nullptr);
+  }
+  ~RawFile() {
+    util::safe_fflush(file);
+    int err = fclose(file);
+    assert(err == 0);
+  }
+  inline void write(void* data, size_t size) override {
+    int written = util::safe_fwrite(data, 1, size, file);
+    assert(written == size);
+  }
+  using LogFile::write;
+  void sync() override {
+    util::safe_fflush(file);
+    fsync(fileno(file));
+  }
+
+ private:
+  FILE* file = nullptr;
+};
+
+// AsyncFile copies writes into a ring of large aligned buffers, and a writer thread writes the full ones
+// to disk. A slow flash write only blocks the caller when all buffers are full (a stall).
+class AsyncFile : public LogFile {
+ public:
+  struct Options {
+    size_t buffer_size = 2 * 1024 * 1024;
+    int num_buffers = 4;
+    bool direct_io = false;    // O_DIRECT, bypass the page cache
+    int sync_interval_ms = 0;  // fdatasync period, 0 leaves it to the kernel
+  };
+
+  // Counters shared by all files of a LoggerState
+  struct Stats {
+    std::atomic<uint64_t> bytes_written = 0;
+    std::atomic<uint64_t> writes = 0;
+    std::atomic<uint64_t> write_us = 0;
+    std::atomic<uint64_t> max_write_us = 0;
+    std::atomic<uint64_t> syncs = 0;
+    std::atomic<uint64_t> stalls = 0;
+    std::atomic<uint64_t> stall_us = 0;
+    std::atomic<uint32_t> queue_depth = 0;  // full buffers waiting for the writer
+    std::atomic<uint32_t> max_queue_depth = 0;
+  };
+
+  AsyncFile(const std::string &path, const Options &options, Stats *stats);
+  ~AsyncFile();
+  void write(void* data, size_t size) override;
+  using LogFile::write;
+  // write out all buffered data and fdatasync
+  void sync() override;
+
+ private:
+  struct Buffer {
+    char *data = nullptr;
+    size_t size = 0;
+  };
+  void submit();
+  void writerThread();
+  void writeBuffer(const Buffer *buf);
+  void datasync();
+
+  int fd = -1;
+  bool direct_io = false;
+  size_t capacity = 0;
+  const Options options;
+  Stats *stats;
+
+  std::vector<Buffer> buffers;
+  Buffer *active = nullptr;  // only used by the caller's thread
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<Buffer *> full_buffers, free_buffers;
+  bool writing = false;
+  bool exiting = false;
+  std::thread thread;
+};
+
+// FramedFile writes every message with a header holding its size and CRC, see framed_log.h
+class FramedFile : public LogFile {
+ public:
+  FramedFile(std::unique_ptr<LogFile> out) : out(std::move(out)) {}
+  void write(void* data, size_t size) override;
+  using LogFile::write;
+  void sync() override { out->sync(); }
+
+ private:
+  std::unique_ptr<LogFile> out;
+  std::string buf;
+};
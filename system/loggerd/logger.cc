@@ -10,6 +10,7 @@
 #include "common/params.h"
 #include "common/swaglog.h"
 #include "common/version.h"
+#include "system/loggerd/seekable_zstd.h"
 
 // ***** log metadata *****
 kj::Array<capnp::word> logger_build_init_data() {
@@ -121,7 +122,7 @@ static void log_sentinel(LoggerState *log, SentinelType type, int exit_signal =
   log->write(msg.toBytes(), true);
 }
 
-LoggerState::LoggerState(const std::string &log_root) {
+LoggerState::LoggerState(const std::string &log_root, const LoggerOptions &options) : options(options) {
   route_name = logger_get_identifier("RouteCount");
   route_path = log_root + "/" + route_name;
   init_data = logger_build_init_data();
@@ -130,6 +131,7 @@ LoggerState::LoggerState(const std::string &log_root) {
 LoggerState::~LoggerState() {
   if (rlog) {
     log_sentinel(this, SentinelType::END_OF_ROUTE, exit_signal);
+    closeFiles();
     std::remove(lock_file.c_str());
   }
 }
@@ -137,6 +139,7 @@ LoggerState::~LoggerState() {
 bool LoggerState::next() {
   if (rlog) {
     log_sentinel(this, SentinelType::END_OF_SEGMENT);
+    closeFiles();
     std::remove(lock_file.c_str());
   }
 
@@ -144,12 +147,11 @@ bool LoggerState::next() {
   bool ret = util::create_directories(segment_path, 0775);
   assert(ret == true);
 
-  const std::string rlog_path = segment_path + "/rlog";
-  lock_file = rlog_path + ".lock";
+  lock_file = segment_path + "/rlog.lock";
   std::ofstream{lock_file};
 
-  rlog.reset(new RawFile(rlog_path));
-  qlog.reset(new RawFile(segment_path + "/qlog"));
+  rlog = openLog("rlog");
+  qlog = openLog("qlog");
 
   // log init data & sentinel type.
   write(init_data.asBytes(), true);
@@ -157,6 +159,37 @@ bool LoggerState::next() {
   return true;
 }
 
+std::unique_ptr<LogFile> LoggerState::openFile(const std::string &path) {
+  if (options.async) {
+    return std::make_unique<AsyncFile>(path, options.async_options, &writer_stats);
+  }
+  return std::make_unique<RawFile>(path);
+}
+
+std::unique_ptr<LogFile> LoggerState::openLog(const std::string &name) {
+  std::unique_ptr<LogFile> file = openFile(segment_path + "/" + name + (options.compress ? ".zst" : ""));
+  if (options.compress) {
+    file = std::make_unique<SeekableZstdWriter>(std::move(file));
+  }
+  if (options.framed) {
+    file = std::make_unique<FramedFile>(std::move(file));
+  }
+  return file;
+}
+
+void LoggerState::sync() {
+  if (rlog) {
+    rlog->sync();
+    qlog->sync();
+  }
+}
+
+// the files must be complete (e.g. the zstd seek table written) before the lock is released
+void LoggerState::closeFiles() {
+  rlog.reset();
+  qlog.reset();
+}
+
 void LoggerState::write(uint8_t* data, size_t size, bool in_qlog) {
   rlog->write(data, size);
   if (in_qlog) qlog->write(data, size);
@@ -7,34 +7,20 @@
 #include "cereal/messaging/messaging.h"
 #include "common/util.h"
 #include "system/hardware/hw.h"
-
-class RawFile {
- public:
-  RawFile(const std::string &path) {
-    file = util::safe_fopen(path.c_str(), "wb");
-    assert(file != nullptr);
-  }
-  ~RawFile() {
-    util::safe_fflush(file);
-    int err = fclose(file);
-    assert(err == 0);
-  }
-  inline void write(void* data, size_t size) {
-    int written = util::safe_fwrite(data, 1, size, file);
-    assert(written == size);
-  }
-  inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
-
- private:
-  FILE* file = nullptr;
-};
+#include "system/loggerd/log_file.h"
 
 typedef cereal::Sentinel::SentinelType SentinelType;
 
+struct LoggerOptions {
+  bool compress = false;  // write rlog and qlog as seekable zstd (rlog.zst, qlog.zst)
+  bool async = false;     // write from a separate thread, see AsyncFile
+  bool framed = false;    // size and CRC header per message, see framed_log.h
+  AsyncFile::Options async_options = {};
+};
 
 class LoggerState {
 public:
-  LoggerState(const std::string& log_root = Path::log_root());
+  LoggerState(const std::string& log_root = Path::log_root(), const LoggerOptions &options = {});
   ~LoggerState();
   bool next();
   void write(uint8_t* data, size_t size, bool in_qlog);
@@ -42,13 +28,24 @@ public:
   inline const std::string& segmentPath() const { return segment_path; }
   inline const std::string& routeName() const { return route_name; }
   inline void write(kj::ArrayPtr<kj::byte> bytes, bool in_qlog) { write(bytes.begin(), bytes.size(), in_qlog); }
+  // a message already in the rlog, see QlogDecimator
+  inline void writeQlog(const uint8_t *data, size_t size) { qlog->write((void *)data, size); }
   inline void setExitSignal(int signal) { exit_signal = signal; }
+  inline const AsyncFile::Stats &writerStats() const { return writer_stats; }
+  // make the current segment durable, e.g. on power failure
+  void sync();
 
 protected:
+  void closeFiles();
+  std::unique_ptr<LogFile> openFile(const std::string &path);
+  std::unique_ptr<LogFile> openLog(const std::string &name);
+
   int part = -1, exit_signal = 0;
+  const LoggerOptions options;
+  AsyncFile::Stats writer_stats;
   std::string route_path, route_name, segment_path, lock_file;
   kj::Array<capnp::word> init_data;
-  std::unique_ptr<RawFile> rlog, qlog;
+  std::unique_ptr<LogFile> rlog, qlog;
 };
 
 kj::Array<capnp::word> logger_build_init_data();
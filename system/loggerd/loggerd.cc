@@ -1,26 +1,21 @@
 #include <sys/xattr.h>
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "common/params.h"
+#include "system/loggerd/drain_scheduler.h"
 #include "system/loggerd/encoder/encoder.h"
 #include "system/loggerd/loggerd.h"
-#include "system/loggerd/video_writer.h"
+#include "system/loggerd/qlog_decimator.h"
 
 ExitHandler do_exit;
 
-struct LoggerdState {
-  LoggerState logger;
-  std::atomic<double> last_camera_seen_tms;
-  std::atomic<int> ready_to_rotate;  // count of encoders ready to rotate
-  int max_waiting = 0;
-  double last_rotate_tms = 0.;      // last rotate time in ms
-};
-
 void logger_rotate(LoggerdState *s) {
   bool ret =s->logger.next();
   assert(ret);
@@ -53,17 +48,6 @@ void rotate_if_needed(LoggerdState *s) {
   }
 }
 
-struct RemoteEncoder {
-  std::unique_ptr<VideoWriter> writer;
-  int encoderd_segment_offset;
-  int current_segment = -1;
-  std::vector<Message *> q;
-  int dropped_frames = 0;
-  bool recording = false;
-  bool marked_ready_to_rotate = false;
-  bool seen_first_packet = false;
-};
-
 int handle_encoder_msg(LoggerdState *s, Message *msg, std::string &name, struct RemoteEncoder &re, const EncoderInfo &encoder_info) {
   int bytes_count = 0;
 
@@ -102,6 +86,12 @@ int handle_encoder_msg(LoggerdState *s, Message *msg, std::string &name, struct
       }
     }
 
+    // trace the packet after the queued ones, they are older frames
+    if (!re.trace) re.trace.reset(new FrameTracer("loggerd", name, {"eof", "published", "received", "written"}));
+    re.trace->mark(idx.getFrameId(), ENCODE_DATA_EOF, idx.getTimestampEof());
+    re.trace->mark(idx.getFrameId(), ENCODE_DATA_PUBLISHED, event.getLogMonoTime());
+    re.trace->mark(idx.getFrameId(), ENCODE_DATA_RECEIVED);
+
     // if we aren't recording yet, try to start, since we are in the correct segment
     if (!re.recording) {
       if (flags & V4L2_BUF_FLAG_KEYFRAME) {
@@ -137,7 +127,8 @@ int handle_encoder_msg(LoggerdState *s, Message *msg, std::string &name, struct
     // if we are actually writing the video file, do so
     if (re.writer) {
       auto data = edata.getData();
-      re.writer->write((uint8_t *)data.begin(), data.size(), idx.getTimestampEof()/1000, false, flags & V4L2_BUF_FLAG_KEYFRAME);
+      re.writer->write((uint8_t *)data.begin(), data.size(), idx.getTimestampEof()/1000, false, flags & V4L2_BUF_FLAG_KEYFRAME,
+                       idx.getFrameId(), idx.getSegmentId(), idx.getTimestampSof()/1000);
     }
 
     // put it in log stream as the idx packet
@@ -148,6 +139,8 @@ int handle_encoder_msg(LoggerdState *s, Message *msg, std::string &name, struct
     auto new_msg = bmsg.toBytes();
     s->logger.write((uint8_t *)new_msg.begin(), new_msg.size(), true);   // always in qlog?
     bytes_count += new_msg.size();
+    re.trace->mark(idx.getFrameId(), ENCODE_DATA_WRITTEN);
+    re.trace->complete(idx.getFrameId());
 
     // free the message, we used it
     delete msg;
@@ -197,18 +190,158 @@ void handle_user_flag(LoggerdState *s) {
   prev_segment = s->logger.segment();
 }
 
-void loggerd_thread() {
-  // setup messaging
-  typedef struct ServiceState {
-    std::string name;
-    int counter, freq;
-    bool encoder, user_flag;
-  } ServiceState;
+typedef struct ServiceState {
+  std::string name;
+  bool encoder, user_flag;
+  int id;  // in the DrainScheduler and QlogDecimator
+  int latency_every;  // latency of every latency_every-th message
+  uint64_t received;
+} ServiceState;
+
+static uint64_t log_mono_time(Message *msg) {
+  try {
+    capnp::FlatArrayMessageReader cmsg(kj::ArrayPtr<capnp::word>((capnp::word *)msg->getData(), msg->getSize() / sizeof(capnp::word)));
+    return cmsg.getRoot<cereal::Event>().getLogMonoTime();
+  } catch (const kj::Exception &e) {
+    return 0;
+  }
+}
+
+// Drains the sockets of one poller, in the order and amounts decided by a DrainScheduler.
+// Plain logs are drained on the loggerd thread, encoder sockets optionally on their own thread.
+struct LogDrainer {
+  LogDrainer(const std::string &name) : name(name) {}
+  void addSocket(SubSocket *sock, ServiceState state);
+  void drain(LoggerdState *s, std::map<std::string, EncoderInfo> &encoder_infos_dict);
+  void reportStats();
+
+  const std::string name;
+  std::unique_ptr<Poller> poller{Poller::create()};
+  std::unique_ptr<DrainScheduler> scheduler = DrainScheduler::create(LOGGERD_SCHEDULER);
+  QlogDecimator qlog;
+  std::vector<SubSocket *> sockets;  // by service id
   std::unordered_map<SubSocket*, ServiceState> service_state;
   std::unordered_map<SubSocket*, struct RemoteEncoder> remote_encoders;
 
+  uint64_t msg_count = 0, bytes_count = 0, last_stalls = 0;
+  double start_ts = millis_since_boot();
+  double last_report_ts = millis_since_boot();
+};
+
+void LogDrainer::addSocket(SubSocket *sock, ServiceState state) {
+  poller->registerSocket(sock);
+  // encoder packets are large but lag tolerant, plain logs go first in each round
+  state.id = scheduler->addService(state.name, services.at(state.name).frequency, state.encoder ? 0 : 1);
+  state.latency_every = std::max(1, services.at(state.name).frequency / LATENCY_SAMPLE_RATE);
+  state.received = 0;
+  qlog.addService(state.name, qlog_policy(state.name));
+  sockets.push_back(sock);
+  service_state[sock] = state;
+}
+
+// one poll, and a round of turns for the sockets with messages
+void LogDrainer::drain(LoggerdState *s, std::map<std::string, EncoderInfo> &encoder_infos_dict) {
+  // don't wait if messages were left behind in the last round
+  for (auto sock : poller->poll(scheduler->backlogged() ? 0 : 1000)) {
+    if (do_exit) break;
+
+    ServiceState &service = service_state[sock];
+    if (service.user_flag) {
+      std::lock_guard lk(s->lock);
+      handle_user_flag(s);
+    }
+    scheduler->ready(service.id);
+  }
+
+  DrainScheduler::Turn turn;
+  while (!do_exit && scheduler->next(turn)) {
+    SubSocket *sock = sockets[turn.id];
+    ServiceState &service = service_state[sock];
+
+    // drain socket
+    int count = 0;
+    size_t size = 0;
+    Message *msg = nullptr;
+    while (count < turn.max_msgs && size < turn.max_bytes && !do_exit && (msg = sock->receive(true))) {
+      // parsed for a sample of the latency, and for qlog rate limits on logMonoTime
+      const bool sample = (service.received++ % service.latency_every) == 0;
+      const uint64_t mono_time = sample || (!service.encoder && qlog.timed(service.id)) ? log_mono_time(msg) : 0;
+      size += msg->getSize();
+      {
+        std::lock_guard lk(s->lock);
+        if (service.encoder) {
+          s->last_camera_seen_tms = millis_since_boot();
+          bytes_count += handle_encoder_msg(s, msg, service.name, remote_encoders[sock], encoder_infos_dict[service.name]);
+        } else {
+          const bool in_qlog = qlog.select(service.id, mono_time, (uint8_t *)msg->getData(), msg->getSize(), [&](const uint8_t *data, size_t size) {
+            s->logger.writeQlog(data, size);
+          });
+          s->logger.write((uint8_t *)msg->getData(), msg->getSize(), in_qlog);
+          bytes_count += msg->getSize();
+          delete msg;
+        }
+
+        rotate_if_needed(s);
+      }
+      if (sample && mono_time > 0) {
+        scheduler->addLatency(turn.id, nanos_since_boot() - mono_time);
+      }
+
+      if ((++msg_count % 1000) == 0) {
+        double seconds = (millis_since_boot() - start_ts) / 1000.0;
+        LOGD("%s: %" PRIu64 " messages, %.2f msg/sec, %.2f KB/sec", name.c_str(), msg_count, msg_count / seconds, bytes_count * 0.001 / seconds);
+        const AsyncFile::Stats &writer_stats = s->logger.writerStats();
+        LOGD("writer: queue depth %u (max %u), max write %.2f ms, %" PRIu64 " stalls",
+             writer_stats.queue_depth.load(), writer_stats.max_queue_depth.load(), writer_stats.max_write_us / 1000.0, writer_stats.stalls.load());
+        if (writer_stats.stalls > last_stalls) {
+          LOGW("log writer stalled %" PRIu64 " times, %.2f ms total", writer_stats.stalls.load(), writer_stats.stall_us / 1000.0);
+          last_stalls = writer_stats.stalls;
+        }
+      }
+      count++;
+    }
+    scheduler->drained(turn.id, count, size, msg == nullptr);
+  }
+
+  if ((millis_since_boot() - last_report_ts) > STATS_REPORT_INTERVAL * 1000) {
+    reportStats();
+    last_report_ts = millis_since_boot();
+  }
+}
+
+// latency from logMonoTime until the message is handed to the log writer, per service
+void LogDrainer::reportStats() {
+  for (const auto &service : scheduler->stats()) {
+    const LatencyHistogram &latency = service.latency;
+    if (latency.count() == 0) continue;
+
+    const double p50 = latency.percentile(50) * 1e-6, p99 = latency.percentile(99) * 1e-6, max = latency.max() * 1e-6;
+    LOGD("%s: %" PRIu64 " latency samples, %.0f bytes avg, latency p50 %.2f ms, p99 %.2f ms, max %.2f ms",
+         service.name.c_str(), latency.count(), service.avg_size, p50, p99, max);
+    if (p99 > MAX_DRAIN_LATENCY_MS) {
+      LOGW("%s is falling behind, p99 latency %.2f ms, %.0f messages backlog", service.name.c_str(), p99, service.backlog);
+    }
+  }
+  scheduler->resetLatency();
+
+  uint64_t msgs = 0, kept = 0, changes = 0, windowed = 0;
+  for (const auto &service : qlog.stats()) {
+    msgs += service.msgs;
+    kept += service.kept;
+    changes += service.changes;
+    windowed += service.windowed;
+  }
+  if (msgs > 0) {
+    LOGD("%s: qlog has %" PRIu64 " of %" PRIu64 " messages, %" PRIu64 " kept on change, %" PRIu64 " in trigger windows",
+         name.c_str(), kept, msgs, changes, windowed);
+  }
+}
+
+void loggerd_thread() {
+  // setup messaging
+  LogDrainer logs("loggerd"), encoders("encoders");
+
   std::unique_ptr<Context> ctx(Context::create());
-  std::unique_ptr<Poller> poller(Poller::create());
 
   // subscribe to all socks
   for (const auto& [_, it] : services) {
@@ -219,14 +352,12 @@ void loggerd_thread() {
 
     SubSocket * sock = SubSocket::create(ctx.get(), it.name);
     assert(sock != NULL);
-    poller->registerSocket(sock);
-    service_state[sock] = {
+    LogDrainer &drainer = (encoder && LOGGERD_ENCODER_THREAD) ? encoders : logs;
+    drainer.addSocket(sock, {
       .name = it.name,
-      .counter = 0,
-      .freq = it.decimation,
       .encoder = encoder,
       .user_flag = it.name == "userFlag",
-    };
+    });
   }
 
   LoggerdState s;
@@ -242,72 +373,32 @@ void loggerd_thread() {
     }
   }
 
-  uint64_t msg_count = 0, bytes_count = 0;
-  double start_ts = millis_since_boot();
-  while (!do_exit) {
-    // poll for new messages on all sockets
-    for (auto sock : poller->poll(1000)) {
-      if (do_exit) break;
-
-      ServiceState &service = service_state[sock];
-      if (service.user_flag) {
-        handle_user_flag(&s);
+  std::thread encoder_thread;
+  if (LOGGERD_ENCODER_THREAD) {
+    encoder_thread = std::thread([&]() {
+      util::set_thread_name("loggerd_encoders");
+      while (!do_exit) {
+        encoders.drain(&s, encoder_infos_dict);
       }
+    });
+  }
 
-      // drain socket
-      int count = 0;
-      Message *msg = nullptr;
-      while (!do_exit && (msg = sock->receive(true))) {
-        const bool in_qlog = service.freq != -1 && (service.counter++ % service.freq == 0);
-        if (service.encoder) {
-          s.last_camera_seen_tms = millis_since_boot();
-          bytes_count += handle_encoder_msg(&s, msg, service.name, remote_encoders[sock], encoder_infos_dict[service.name]);
-        } else {
-          s.logger.write((uint8_t *)msg->getData(), msg->getSize(), in_qlog);
-          bytes_count += msg->getSize();
-          delete msg;
-        }
-
-        rotate_if_needed(&s);
-
-        if ((++msg_count % 1000) == 0) {
-          double seconds = (millis_since_boot() - start_ts) / 1000.0;
-          LOGD("%" PRIu64 " messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count / seconds, bytes_count * 0.001 / seconds);
-        }
-
-        count++;
-        if (count >= 200) {
-          LOGD("large volume of '%s' messages", service.name.c_str());
-          break;
-        }
-      }
-    }
+  while (!do_exit) {
+    logs.drain(&s, encoder_infos_dict);
   }
+  if (encoder_thread.joinable()) encoder_thread.join();
 
   LOGW("closing logger");
   s.logger.setExitSignal(do_exit.signal);
 
   if (do_exit.power_failure) {
     LOGE("power failure");
+    s.logger.sync();
     sync();
     LOGE("sync done");
   }
 
   // messaging cleanup
-  for (auto &[sock, service] : service_state) delete sock;
-}
-
-int main(int argc, char** argv) {
-  if (!Hardware::PC()) {
-    int ret;
-    ret = util::set_core_affinity({0, 1, 2, 3});
-    assert(ret == 0);
-    // TODO: why does this impact camerad timings?
-    //ret = util::set_realtime_priority(1);
-    //assert(ret == 0);
-  }
-
-  loggerd_thread();
-
-  return 0;
+  for (auto sock : logs.sockets) delete sock;
+  for (auto sock : encoders.sockets) delete sock;
 }
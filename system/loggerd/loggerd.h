@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "cereal/messaging/messaging.h"
@@ -11,7 +15,9 @@
 #include "common/swaglog.h"
 #include "common/util.h"
 
+#include "system/loggerd/frame_trace.h"
 #include "system/loggerd/logger.h"
+#include "system/loggerd/video_writer.h"
 
 constexpr int MAIN_FPS = 20;
 const int MAIN_BITRATE = 1e7;
@@ -27,6 +33,20 @@ const int QCAM_BITRATE = 256000;
 
 const bool LOGGERD_TEST = getenv("LOGGERD_TEST");
 const int SEGMENT_LENGTH = LOGGERD_TEST ? atoi(getenv("LOGGERD_SEGMENT_LENGTH")) : 60;
+const bool LOGGERD_ZSTD = getenv("LOGGERD_ZSTD");  // write rlog.zst and qlog.zst
+const bool LOGGERD_FRAMED = getenv("LOGGERD_FRAMED");  // size and CRC header per message, see framed_log.h
+const std::string LOGGERD_SCHEDULER = util::getenv("LOGGERD_SCHEDULER", "fair");  // "fair" or "fifo", see DrainScheduler
+const bool LOGGERD_ENCODER_THREAD = getenv("LOGGERD_ENCODER_THREAD");  // drain encoder sockets on a separate thread
+const int LOGGERD_SYNC_INTERVAL_MS = util::getenv("LOGGERD_SYNC_INTERVAL_MS", 1000);  // fdatasync period of the logs, 0 leaves it to the kernel
+
+// software encoding on PC, see FfmpegEncoder
+const int ENCODERD_THREADS = util::getenv("ENCODERD_THREADS", 0);  // libavcodec threads per encoder, 0 for one per core
+const int ENCODERD_QUEUE = util::getenv("ENCODERD_QUEUE", 4);  // frames in flight per encoder
+const std::string ENCODERD_DROP = util::getenv("ENCODERD_DROP", "block");  // when they're all taken: "block", or drop the "newest" or "oldest"
+
+#define STATS_REPORT_INTERVAL 60  // seconds between per service latency reports
+#define LATENCY_SAMPLE_RATE 10  // messages per second and service parsed for the latency stats
+#define MAX_DRAIN_LATENCY_MS 500  // warn about services with a higher p99 latency
 
 constexpr char PRESERVE_ATTR_NAME[] = "user.preserve";
 constexpr char PRESERVE_ATTR_VALUE = '1';
@@ -154,3 +174,35 @@ const LogCameraInfo stream_driver_camera_info{
 
 const LogCameraInfo cameras_logged[] = {road_camera_info, wide_road_camera_info, driver_camera_info};
 const LogCameraInfo stream_cameras_logged[] = {stream_road_camera_info, stream_wide_road_camera_info, stream_driver_camera_info};
+
+struct LoggerdState {
+  LoggerdState(const LoggerOptions &options = {.compress = LOGGERD_ZSTD, .async = true, .framed = LOGGERD_FRAMED,
+                                               .async_options = {.sync_interval_ms = LOGGERD_SYNC_INTERVAL_MS}}) : logger(Path::log_root(), options) {}
+  LoggerState logger;
+  std::atomic<double> last_camera_seen_tms;
+  std::atomic<int> ready_to_rotate;  // count of encoders ready to rotate
+  int max_waiting = 0;
+  double last_rotate_tms = 0.;      // last rotate time in ms
+  std::mutex lock;                  // logger and encoder state, when encoders are drained on their own thread
+};
+
+// stages of an encoder packet through loggerd, in RemoteEncoder::trace
+enum EncodeDataStage { ENCODE_DATA_EOF, ENCODE_DATA_PUBLISHED, ENCODE_DATA_RECEIVED, ENCODE_DATA_WRITTEN };
+
+struct RemoteEncoder {
+  std::unique_ptr<VideoWriter> writer;
+  int encoderd_segment_offset;
+  int current_segment = -1;
+  std::vector<Message *> q;
+  int dropped_frames = 0;
+  bool recording = false;
+  bool marked_ready_to_rotate = false;
+  bool seen_first_packet = false;
+  std::unique_ptr<FrameTracer> trace;
+};
+
+void logger_rotate(LoggerdState *s);
+void rotate_if_needed(LoggerdState *s);
+// writes the video packet, and its index to the rlog. returns the bytes written
+int handle_encoder_msg(LoggerdState *s, Message *msg, std::string &name, struct RemoteEncoder &re, const EncoderInfo &encoder_info);
+void loggerd_thread();
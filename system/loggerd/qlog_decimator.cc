@@ -0,0 +1,195 @@
+#include "system/loggerd/qlog_decimator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string_view>
+
+#include <capnp/any.h>
+#include <capnp/serialize.h>
+
+#include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
+#include "common/swaglog.h"
+
+// on top of the decimation in cereal/services.py
+const std::map<std::string, QlogPolicy> QLOG_POLICIES = {
+  // engagement and alert changes
+  {"controlsState", {.on_change = {"state", "enabled", "alertType"}, .trigger = true}},
+  {"carState", {.on_change = {"gearShifter", "standstill"}, .window_before = 100, .window_after = 100}},
+  {"carControl", {.window_before = 100, .window_after = 100}},
+  {"carOutput", {.window_before = 100, .window_after = 100}},
+  {"deviceState", {.on_change = {"started", "thermalStatus"}}},
+  {"userFlag", {.trigger = true}},
+};
+
+QlogPolicy qlog_policy(const std::string &name) {
+  const auto &s = services.at(name);
+  auto it = QLOG_POLICIES.find(name);
+  if (it == QLOG_POLICIES.end()) {
+    return {.decimation = s.decimation};
+  }
+
+  QlogPolicy policy = it->second;
+  if (!policy.interval) {
+    if (s.decimation == -1) {
+      policy.interval = -1;
+    } else if (s.decimation <= 1 || s.frequency <= 0) {
+      policy.interval = 0;
+    } else {
+      policy.interval = s.decimation / (double)s.frequency;
+    }
+  }
+  return policy;
+}
+
+// bits of a field in the data section of a struct, 0 if it isn't there
+static int data_bits(capnp::schema::Type::Which type) {
+  switch (type) {
+    case capnp::schema::Type::BOOL: return 1;
+    case capnp::schema::Type::INT8: case capnp::schema::Type::UINT8: return 8;
+    case capnp::schema::Type::INT16: case capnp::schema::Type::UINT16: case capnp::schema::Type::ENUM: return 16;
+    case capnp::schema::Type::INT32: case capnp::schema::Type::UINT32: case capnp::schema::Type::FLOAT32: return 32;
+    case capnp::schema::Type::INT64: case capnp::schema::Type::UINT64: case capnp::schema::Type::FLOAT64: return 64;
+    default: return 0;
+  }
+}
+
+int QlogDecimator::addService(const std::string &name, const QlogPolicy &policy) {
+  Service &s = services.emplace_back();
+  s.policy = policy;
+  if (policy.interval.value_or(0) > 0) {
+    s.interval_ns = *policy.interval * 1e9;
+  }
+  s.history.resize(policy.window_before);
+
+  if (!policy.on_change.empty()) {
+    const capnp::StructSchema event_schema = capnp::Schema::from<cereal::Event>();
+    KJ_IF_MAYBE(field, event_schema.findFieldByName(name)) {
+      if (field->getProto().isSlot() && field->getType().isStruct()) {
+        s.service_which = field->getProto().getDiscriminantValue();
+        s.service_ptr = field->getProto().getSlot().getOffset();
+        for (const auto &f : policy.on_change) {
+          KJ_IF_MAYBE(service_field, field->getType().asStruct().findFieldByName(f)) {
+            const auto type = service_field->getProto().isSlot() ? service_field->getType().which() : capnp::schema::Type::VOID;
+            if (data_bits(type) > 0 || type == capnp::schema::Type::TEXT || type == capnp::schema::Type::DATA) {
+              s.fields.push_back({.type = type, .offset = service_field->getProto().getSlot().getOffset()});
+            } else {
+              LOGE("qlog: can't watch changes of %s.%s, only primitive, enum, text and data fields", name.c_str(), f.c_str());
+            }
+          } else {
+            LOGE("qlog: %s has no field %s", name.c_str(), f.c_str());
+          }
+        }
+      }
+    }
+    if (s.fields.empty()) {
+      LOGE("qlog: can't watch changes of %s", name.c_str());
+    }
+  }
+
+  stats_.push_back({.name = name});
+  return services.size() - 1;
+}
+
+std::optional<size_t> QlogDecimator::fieldsHash(const Service &service, const uint8_t *data, size_t size) const {
+  try {
+    capnp::FlatArrayMessageReader cmsg(kj::ArrayPtr<const capnp::word>((const capnp::word *)data, size / sizeof(capnp::word)));
+    cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+    if ((uint16_t)event.which() != service.service_which) return std::nullopt;
+
+    // hash the raw field values of the service struct, without a dynamic reader or strings
+    auto event_ptrs = capnp::AnyStruct::Reader(event).getPointerSection();
+    if (service.service_ptr >= event_ptrs.size()) return std::nullopt;
+    capnp::AnyStruct::Reader msg = event_ptrs[service.service_ptr].getAs<capnp::AnyStruct>();
+    const auto msg_data = msg.getDataSection();
+    const auto msg_ptrs = msg.getPointerSection();
+
+    size_t hash = 0;
+    for (const auto &field : service.fields) {
+      size_t field_hash = 0;
+      if (const int bits = data_bits(field.type); bits > 0) {
+        // fields past the end of the data section are at their default
+        const size_t bit = (size_t)field.offset * bits;
+        uint64_t value = 0;
+        if (bits == 1 && bit / 8 < msg_data.size()) {
+          value = (msg_data[bit / 8] >> (bit % 8)) & 1;
+        } else if (bits > 1 && bit / 8 + bits / 8 <= msg_data.size()) {
+          memcpy(&value, msg_data.begin() + bit / 8, bits / 8);
+        }
+        field_hash = std::hash<uint64_t>{}(value);
+      } else if (field.offset < msg_ptrs.size()) {
+        const capnp::Data::Reader bytes = msg_ptrs[field.offset].getAs<capnp::Data>();
+        field_hash = std::hash<std::string_view>{}(std::string_view((const char *)bytes.begin(), bytes.size()));
+      }
+      hash = hash * 31 + field_hash;
+    }
+    return hash;
+  } catch (const kj::Exception &e) {
+    return std::nullopt;
+  }
+}
+
+void QlogDecimator::trigger(const Backfill &backfill) {
+  for (int id = 0; id < services.size(); ++id) {
+    Service &s = services[id];
+    for (; s.history_size > 0; --s.history_size) {
+      const std::string &msg = s.history[(s.history_pos + s.history.size() - s.history_size) % s.history.size()];
+      backfill((const uint8_t *)msg.data(), msg.size());
+      ++stats_[id].kept;
+      ++stats_[id].windowed;
+    }
+    s.window_left = s.policy.window_after;
+  }
+}
+
+bool QlogDecimator::select(int id, uint64_t mono_time, const uint8_t *data, size_t size, const Backfill &backfill) {
+  Service &s = services[id];
+  Stats &stats = stats_[id];
+  ++stats.msgs;
+
+  bool changed = false;
+  if (!s.fields.empty()) {
+    if (auto value = fieldsHash(s, data, size)) {
+      // the first message sets the value, it isn't a change
+      changed = s.value && *s.value != *value;
+      s.value = value;
+    }
+  }
+  if (s.policy.trigger && (changed || s.policy.on_change.empty())) {
+    trigger(backfill);
+  }
+
+  bool keep = false;
+  if (!s.policy.interval) {
+    // the first of every decimation messages
+    keep = s.policy.decimation > 0 && (stats.msgs - 1) % s.policy.decimation == 0;
+  } else if (*s.policy.interval == 0) {
+    keep = true;
+  } else if (*s.policy.interval > 0 && mono_time >= s.next_time) {
+    // keep to a grid of interval_ns. a late message doesn't shift it, after a gap it restarts.
+    keep = true;
+    s.next_time = std::max(s.next_time + s.interval_ns, mono_time + s.interval_ns / 2);
+  }
+
+  if (changed && !keep) {
+    keep = true;
+    ++stats.changes;
+  }
+  if (s.window_left > 0) {
+    --s.window_left;
+    if (!keep) {
+      keep = true;
+      ++stats.windowed;
+    }
+  }
+
+  if (keep) {
+    ++stats.kept;
+  } else if (!s.history.empty()) {
+    s.history[s.history_pos].assign((const char *)data, size);
+    s.history_pos = (s.history_pos + 1) % s.history.size();
+    s.history_size = std::min(s.history_size + 1, s.history.size());
+  }
+  return keep;
+}
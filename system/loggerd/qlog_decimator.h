@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <capnp/schema.h>
+
+// Which messages of a service go in the qlog
+struct QlogPolicy {
+  // seconds between qlog messages on logMonoTime, 0: every message, < 0: none. unset: every decimation-th message
+  std::optional<double> interval;
+  int decimation = 1;  // < 1: none
+  // fields of the service, a message changing one of them is always kept
+  std::vector<std::string> on_change;
+  // a change of the on_change fields, or any message without them, opens a window on all services
+  bool trigger = false;
+  // messages kept before and after a trigger
+  int window_before = 0, window_after = 0;
+};
+
+// policy for a service, the services.py decimation. services in QLOG_POLICIES have overrides, and their decimation
+// is a rate limit on logMonoTime
+QlogPolicy qlog_policy(const std::string &name);
+
+// Picks the messages of the rlog that go in the qlog.
+// Services with an interval are rate limited on logMonoTime instead of message counts, so bursts and rate changes
+// don't skew the sampling. Messages changing a selected field are always kept, and triggers keep the messages around them.
+// Messages from before a trigger were already written to the rlog, they are appended to the qlog late, out of
+// logMonoTime order. Readers that need the qlog in order must sort it by logMonoTime.
+class QlogDecimator {
+ public:
+  typedef std::function<void(const uint8_t *data, size_t size)> Backfill;
+
+  struct Stats {
+    std::string name;
+    uint64_t msgs = 0, kept = 0;
+    uint64_t changes = 0, windowed = 0;  // kept because of a change, or in a trigger window
+  };
+
+  // returns the service id
+  int addService(const std::string &name, const QlogPolicy &policy);
+  // true if the message goes in the qlog. messages of other services kept by a trigger are passed to backfill, oldest first
+  bool select(int id, uint64_t mono_time, const uint8_t *data, size_t size, const Backfill &backfill);
+  // false if select() doesn't use the mono_time of the service
+  inline bool timed(int id) const { return services[id].policy.interval.has_value(); }
+  inline const std::vector<Stats> &stats() const { return stats_; }
+
+ private:
+  struct WatchedField {
+    capnp::schema::Type::Which type;
+    uint32_t offset;  // in the data section in units of the type's size, or in the pointer section
+  };
+  struct Service {
+    QlogPolicy policy;
+    uint64_t interval_ns = 0;
+    uint64_t next_time = 0;
+    uint16_t service_which = 0;  // the service in the Event union, and its pointer
+    uint32_t service_ptr = 0;
+    std::vector<WatchedField> fields;  // on_change
+    std::optional<size_t> value;  // hash of the on_change fields
+    int window_left = 0;
+    // messages not in the qlog, the last window_before
+    std::vector<std::string> history;
+    size_t history_pos = 0, history_size = 0;
+  };
+
+  std::optional<size_t> fieldsHash(const Service &service, const uint8_t *data, size_t size) const;
+  void trigger(const Backfill &backfill);
+
+  std::vector<Service> services;
+  std::vector<Stats> stats_;
+};
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <string>
+
+#include "cereal/messaging/messaging.h"
+#include "common/util.h"
+#include "system/loggerd/framed_log.h"
+#include "system/loggerd/logger.h"
+#include "system/loggerd/seekable_zstd.h"
+
+// Salvages every intact message from a damaged rlog or qlog, e.g. cut off by a power loss.
+// Framed logs are checked against their CRCs. Raw logs are parsed in order, and after a bad message
+// the scan resumes at the next offset where a whole event parses.
+// The output is a plain (raw) log, readable by all the log tools.
+
+// size of the event at data, 0 if there is no valid one
+static size_t parse_event(const char *data, size_t size) {
+  uint32_t segment_count;
+  if (size < 8 || (memcpy(&segment_count, data, 4), segment_count >= 64)) return 0;
+
+  try {
+    kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    event.totalSize();  // checks every pointer
+    if (event.getLogMonoTime() == 0) return 0;
+    return (reader.getEnd() - words.begin()) * sizeof(capnp::word);
+  } catch (const kj::Exception &e) {
+    return 0;
+  }
+}
+
+template <class Func>
+LogScanStats scan_raw_log(const char *data, size_t size, Func &&on_message) {
+  LogScanStats stats;
+  size_t pos = 0, corrupt_start = 0;
+  bool in_corrupt = false;
+  while (pos + sizeof(capnp::word) <= size) {
+    if (size_t msg_size = parse_event(data + pos, size - pos)) {
+      if (in_corrupt) {
+        stats.corrupt_bytes += pos - corrupt_start;
+        in_corrupt = false;
+      }
+      on_message(data + pos, msg_size);
+      ++stats.messages;
+      pos += msg_size;
+      continue;
+    }
+    if (!in_corrupt) {
+      ++stats.corrupt_regions;
+      corrupt_start = pos;
+      in_corrupt = true;
+    }
+    pos += sizeof(capnp::word);
+  }
+  if (in_corrupt) {
+    --stats.corrupt_regions;
+    pos = corrupt_start;
+  }
+  stats.truncated_bytes = size - std::min(pos, size);
+  return stats;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s <rlog|qlog|rlog.zst|qlog.zst> [output]\n", argv[0]);
+    return 1;
+  }
+  const std::string path = argv[1];
+  const bool compressed = util::ends_with(path, ".zst");
+  const std::string output = argc > 2 ? argv[2] : path.substr(0, path.size() - (compressed ? 4 : 0)) + ".recovered";
+
+  std::string log;
+  if (compressed) {
+    // frames cut off at the end are dropped, the others decompress on their own
+    SeekableZstdReader reader;
+    if (reader.open(path)) {
+      log = reader.read(0, reader.size());
+    }
+  } else {
+    log = util::read_file(path);
+  }
+  // keep the messages 8 byte aligned
+  const size_t size = log.size() & ~(sizeof(capnp::word) - 1);
+  AlignedBuffer aligned_buf;
+  const char *data = (const char *)aligned_buf.align(log.data(), size).begin();
+
+  std::string recovered;
+  auto on_message = [&recovered](const char *msg, size_t msg_size) { recovered.append(msg, msg_size); };
+  const bool framed = is_framed_log(data, size);
+  const LogScanStats stats = framed ? scan_framed_log(data, size, on_message) : scan_raw_log(data, size, on_message);
+
+  printf("%s (%s, %zu bytes): recovered %zu messages (%zu bytes)\n", path.c_str(), framed ? "framed" : "raw", log.size(),
+         stats.messages, recovered.size());
+  printf("  %zu corrupt regions (%zu bytes), %zu bytes truncated at the end\n", stats.corrupt_regions, stats.corrupt_bytes,
+         stats.truncated_bytes + (log.size() - size));
+  if (stats.messages == 0) {
+    fprintf(stderr, "nothing to recover\n");
+    return 1;
+  }
+
+  {
+    RawFile file(output);
+    file.write(recovered.data(), recovered.size());
+  }
+  printf("wrote %s\n", output.c_str());
+  return 0;
+}
@@ -0,0 +1,338 @@
+#include "system/loggerd/seekable_zstd.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/swaglog.h"
+#include "system/loggerd/framed_log.h"
+
+namespace {
+
+constexpr size_t SEEK_TABLE_FOOTER_SIZE = 9;
+constexpr size_t SKIPPABLE_HEADER_SIZE = 8;
+
+template <class T>
+inline void append(std::string &buf, T v) {
+  buf.append((const char *)&v, sizeof(v));
+}
+
+template <class T>
+inline T read_le(const char *p) {
+  T v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+}  // namespace
+
+// SeekableZstdWriter
+
+SeekableZstdWriter::SeekableZstdWriter(std::unique_ptr<LogFile> out, int level, size_t max_frame_size)
+    : out(std::move(out)), max_frame_size(max_frame_size), out_buf(ZSTD_CStreamOutSize()) {
+  cctx = ZSTD_createCCtx();
+  assert(cctx != nullptr);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+}
+
+SeekableZstdWriter::~SeekableZstdWriter() {
+  endFrame();
+  writeSeekTable();
+  out.reset();
+  ZSTD_freeCCtx(cctx);
+}
+
+void SeekableZstdWriter::write(void *data, size_t size) {
+  compress(data, size, ZSTD_e_continue);
+  current.decompressed_size += size;
+  if (current.decompressed_size >= max_frame_size) {
+    endFrame();
+  }
+}
+
+void SeekableZstdWriter::sync() {
+  endFrame();
+  out->sync();
+}
+
+void SeekableZstdWriter::endFrame() {
+  if (current.decompressed_size == 0) return;
+
+  compress(nullptr, 0, ZSTD_e_end);
+  entries.push_back(current);
+  current = {};
+}
+
+void SeekableZstdWriter::compress(const void *data, size_t size, ZSTD_EndDirective mode) {
+  ZSTD_inBuffer input = {data, size, 0};
+  bool finished = false;
+  while (!finished) {
+    ZSTD_outBuffer output = {out_buf.data(), out_buf.size(), 0};
+    size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+    assert(!ZSTD_isError(remaining));
+    if (output.pos > 0) {
+      out->write(out_buf.data(), output.pos);
+      current.compressed_size += output.pos;
+    }
+    finished = mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size;
+  }
+}
+
+void SeekableZstdWriter::writeSeekTable() {
+  const uint32_t table_size = entries.size() * sizeof(SeekEntry) + SEEK_TABLE_FOOTER_SIZE;
+  std::string buf;
+  buf.reserve(SKIPPABLE_HEADER_SIZE + table_size);
+  append(buf, ZSTD_SEEK_TABLE_SKIPPABLE_MAGIC);
+  append(buf, table_size);
+  for (const auto &e : entries) {
+    append(buf, e.compressed_size);
+    append(buf, e.decompressed_size);
+  }
+  append(buf, (uint32_t)entries.size());
+  append(buf, (uint8_t)0);  // descriptor: no per frame checksums
+  append(buf, ZSTD_SEEKABLE_MAGIC);
+  out->write(buf.data(), buf.size());
+}
+
+// SeekableZstdReader
+
+SeekableZstdReader::~SeekableZstdReader() {
+  if (fd >= 0) close(fd);
+}
+
+bool SeekableZstdReader::open(const std::string &path) {
+  if (fd >= 0) close(fd);
+  frames_.clear();
+  start_times_.clear();
+
+  fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) return false;
+
+  if (readSeekTable(st.st_size)) return true;
+
+  LOGW("no seek table in %s, scanning frames", path.c_str());
+  return scanFrames(st.st_size);
+}
+
+bool SeekableZstdReader::readCompressed(uint64_t offset, size_t size, std::string &out) const {
+  out.resize(size);
+  size_t pos = 0;
+  while (pos < size) {
+    ssize_t n = pread(fd, out.data() + pos, size - pos, offset + pos);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    pos += n;
+  }
+  return true;
+}
+
+bool SeekableZstdReader::readSeekTable(uint64_t file_size) {
+  std::string footer;
+  if (file_size < SKIPPABLE_HEADER_SIZE + SEEK_TABLE_FOOTER_SIZE ||
+      !readCompressed(file_size - SEEK_TABLE_FOOTER_SIZE, SEEK_TABLE_FOOTER_SIZE, footer) ||
+      read_le<uint32_t>(&footer[5]) != ZSTD_SEEKABLE_MAGIC) {
+    return false;
+  }
+
+  const uint32_t num_frames = read_le<uint32_t>(&footer[0]);
+  const uint8_t descriptor = footer[4];
+  const size_t entry_size = (descriptor & 0x80) ? 12 : 8;
+  const uint64_t table_size = num_frames * entry_size + SEEK_TABLE_FOOTER_SIZE;
+  if (file_size < table_size + SKIPPABLE_HEADER_SIZE) return false;
+
+  const uint64_t table_offset = file_size - table_size - SKIPPABLE_HEADER_SIZE;
+  std::string table;
+  if (!readCompressed(table_offset, table_size + SKIPPABLE_HEADER_SIZE, table) ||
+      read_le<uint32_t>(&table[0]) != ZSTD_SEEK_TABLE_SKIPPABLE_MAGIC ||
+      read_le<uint32_t>(&table[4]) != table_size) {
+    return false;
+  }
+
+  uint64_t compressed_offset = 0, decompressed_offset = 0;
+  for (uint32_t i = 0; i < num_frames; ++i) {
+    const char *entry = &table[SKIPPABLE_HEADER_SIZE + i * entry_size];
+    Frame f = {.compressed_offset = compressed_offset,
+               .decompressed_offset = decompressed_offset,
+               .compressed_size = read_le<uint32_t>(entry),
+               .decompressed_size = read_le<uint32_t>(entry + 4)};
+    compressed_offset += f.compressed_size;
+    decompressed_offset += f.decompressed_size;
+    frames_.push_back(f);
+  }
+  if (compressed_offset != table_offset) {
+    frames_.clear();
+    return false;
+  }
+  return true;
+}
+
+bool SeekableZstdReader::scanFrames(uint64_t file_size) {
+  std::string buf;
+  if (!readCompressed(0, file_size, buf)) return false;
+
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+  std::vector<char> out(ZSTD_DStreamOutSize());
+  uint64_t pos = 0, decompressed_offset = 0;
+  while (pos < buf.size()) {
+    size_t frame_size = ZSTD_findFrameCompressedSize(buf.data() + pos, buf.size() - pos);
+    if (ZSTD_isError(frame_size)) break;  // the last frame is truncated
+
+    const uint32_t magic = read_le<uint32_t>(buf.data() + pos);
+    if ((magic & 0xFFFFFFF0) != 0x184D2A50) {  // not a skippable frame
+      uint64_t decompressed_size = 0;
+      ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+      ZSTD_inBuffer input = {buf.data() + pos, frame_size, 0};
+      size_t ret = 1;
+      while (ret != 0 && !ZSTD_isError(ret)) {
+        ZSTD_outBuffer output = {out.data(), out.size(), 0};
+        ret = ZSTD_decompressStream(dctx, &output, &input);
+        decompressed_size += output.pos;
+      }
+      if (ZSTD_isError(ret)) break;
+
+      frames_.push_back({.compressed_offset = pos,
+                         .decompressed_offset = decompressed_offset,
+                         .compressed_size = (uint32_t)frame_size,
+                         .decompressed_size = (uint32_t)decompressed_size});
+      decompressed_offset += decompressed_size;
+    }
+    pos += frame_size;
+  }
+  ZSTD_freeDCtx(dctx);
+  return !frames_.empty();
+}
+
+std::string SeekableZstdReader::readFrame(size_t i) const {
+  assert(i < frames_.size());
+  const Frame &f = frames_[i];
+  std::string compressed, out(f.decompressed_size, '\0');
+  if (!readCompressed(f.compressed_offset, f.compressed_size, compressed)) {
+    LOGE("failed to read frame %zu", i);
+    return {};
+  }
+  size_t ret = ZSTD_decompress(out.data(), out.size(), compressed.data(), compressed.size());
+  if (ZSTD_isError(ret) || ret != f.decompressed_size) {
+    LOGE("failed to decompress frame %zu: %s", i, ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "size mismatch");
+    return {};
+  }
+  return out;
+}
+
+std::string SeekableZstdReader::read(uint64_t offset, size_t size) const {
+  std::string result;
+  if (offset >= this->size()) return result;
+
+  auto it = std::upper_bound(frames_.begin(), frames_.end(), offset,
+                             [](uint64_t offset, const Frame &f) { return offset < f.decompressed_offset; });
+  for (size_t i = std::max<int>(0, it - frames_.begin() - 1); i < frames_.size() && result.size() < size; ++i) {
+    const std::string data = readFrame(i);
+    if (data.empty()) break;
+
+    const uint64_t begin = std::max(offset, frames_[i].decompressed_offset) - frames_[i].decompressed_offset;
+    result.append(data, begin, size - result.size());
+  }
+  return result;
+}
+
+std::string SeekableZstdReader::readFramePrefix(size_t i, size_t size) const {
+  const Frame &f = frames_[i];
+  size = std::min<size_t>(size, f.decompressed_size);
+  std::string out(size, '\0'), compressed;
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+  ZSTD_outBuffer output = {out.data(), out.size(), 0};
+  // the compressed frame in chunks, until enough of it is decompressed
+  const size_t chunk_size = ZSTD_DStreamInSize();
+  for (uint64_t pos = 0; output.pos < output.size && pos < f.compressed_size;) {
+    const size_t n = std::min<uint64_t>(chunk_size, f.compressed_size - pos);
+    if (!readCompressed(f.compressed_offset + pos, n, compressed)) break;
+    ZSTD_inBuffer input = {compressed.data(), n, 0};
+    while (input.pos < input.size && output.pos < output.size) {
+      if (ZSTD_isError(ZSTD_decompressStream(dctx, &output, &input))) {
+        output.pos = 0;
+        pos = f.compressed_size;
+        break;
+      }
+    }
+    pos += n;
+  }
+  ZSTD_freeDCtx(dctx);
+  out.resize(output.pos);
+  return out;
+}
+
+uint64_t SeekableZstdReader::readStartTime(size_t i) const {
+  // the frame header of framed logs, and the segment table of the first message
+  std::string data = readFramePrefix(i, sizeof(LogFrameHeader) + sizeof(uint32_t));
+  const size_t offset = is_framed_log(data.data(), data.size()) ? sizeof(LogFrameHeader) : 0;
+  if (data.size() < offset + sizeof(uint32_t)) return 0;
+
+  const uint32_t segment_count = read_le<uint32_t>(&data[offset]) + 1;
+  if (segment_count > 512) return 0;
+  const size_t table_size = (segment_count / 2 + 1) * sizeof(capnp::word);
+  data = readFramePrefix(i, offset + table_size);
+  if (data.size() < offset + table_size) return 0;
+
+  // and then only as much of the frame as the first message
+  size_t message_size = table_size;
+  for (uint32_t s = 0; s < segment_count; ++s) {
+    message_size += read_le<uint32_t>(&data[offset + (s + 1) * sizeof(uint32_t)]) * sizeof(capnp::word);
+  }
+  data = readFramePrefix(i, offset + message_size);
+  if (data.size() < offset + message_size) return 0;
+
+  try {
+    AlignedBuffer aligned_buf;
+    capnp::FlatArrayMessageReader reader(aligned_buf.align(data.data() + offset, message_size));
+    return reader.getRoot<cereal::Event>().getLogMonoTime();
+  } catch (const kj::Exception &e) {
+    LOGE("failed to parse frame %zu: %s", i, e.getDescription().cStr());
+    return 0;
+  }
+}
+
+uint64_t SeekableZstdReader::frameStartTime(size_t i) const {
+  assert(i < frames_.size());
+  if (start_times_.size() != frames_.size()) {
+    start_times_.resize(frames_.size());
+    for (size_t k = 0; k < frames_.size(); ++k) {
+      start_times_[k] = readStartTime(k);
+    }
+  }
+  return start_times_[i];
+}
+
+std::string SeekableZstdReader::readTimeRange(uint64_t start_mono_time, uint64_t end_mono_time) const {
+  if (frames_.empty()) return {};
+  frameStartTime(0);
+
+  // search the frames with a known start time, the unknown ones are read along with their neighbours
+  std::vector<size_t> known;
+  for (size_t i = 0; i < start_times_.size(); ++i) {
+    if (start_times_[i] != 0) known.push_back(i);
+  }
+  if (known.empty()) {
+    LOGE("no frame start times, can't read a time range");
+    return {};
+  }
+
+  // first known frames starting after start_mono_time and after end_mono_time
+  auto starts_after = [&](uint64_t t) {
+    auto cmp = [this](uint64_t time, size_t i) { return time < start_times_[i]; };
+    return std::upper_bound(known.begin(), known.end(), t, cmp) - known.begin();
+  };
+  const size_t first_known = starts_after(start_mono_time), last_known = starts_after(end_mono_time);
+  const size_t first = first_known > 0 ? known[first_known - 1] : 0;
+  const size_t last = last_known < known.size() ? known[last_known] : frames_.size();
+  std::string result;
+  for (size_t i = first; i < last; ++i) {
+    result += readFrame(i);
+  }
+  return result;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <zstd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "system/loggerd/log_file.h"
+
+// Seekable zstd, as described in
+// https://github.com/facebook/zstd/blob/dev/contrib/seekable_format/zstd_seekable_compression_format.md
+// The file is a sequence of independent zstd frames followed by a skippable frame holding the seek table,
+// so any zstd decoder can read it as a whole, and SeekableZstdReader can decompress single frames.
+
+constexpr uint32_t ZSTD_SEEKABLE_MAGIC = 0x8F92EAB1;
+constexpr uint32_t ZSTD_SEEK_TABLE_SKIPPABLE_MAGIC = 0x184D2A5E;
+
+class SeekableZstdWriter : public LogFile {
+ public:
+  // frames end at the first write boundary after max_frame_size bytes of input
+  SeekableZstdWriter(std::unique_ptr<LogFile> out, int level = 3, size_t max_frame_size = 1024 * 1024);
+  ~SeekableZstdWriter();
+  void write(void* data, size_t size) override;
+  using LogFile::write;
+  // ends the current frame, so everything written so far can be decompressed
+  void sync() override;
+  void endFrame();
+
+ private:
+  struct SeekEntry {
+    uint32_t compressed_size = 0;
+    uint32_t decompressed_size = 0;
+  };
+  void compress(const void *data, size_t size, ZSTD_EndDirective mode);
+  void writeSeekTable();
+
+  std::unique_ptr<LogFile> out;
+  ZSTD_CCtx *cctx = nullptr;
+  const size_t max_frame_size;
+  std::vector<char> out_buf;
+  SeekEntry current;
+  std::vector<SeekEntry> entries;
+};
+
+class SeekableZstdReader {
+ public:
+  struct Frame {
+    uint64_t compressed_offset;
+    uint64_t decompressed_offset;
+    uint32_t compressed_size;
+    uint32_t decompressed_size;
+  };
+
+  ~SeekableZstdReader();
+  // Reads the seek table. Files without one (e.g. loggerd was killed) are indexed by scanning their frames.
+  // Opening another file closes the previous one.
+  bool open(const std::string &path);
+  inline const std::vector<Frame> &frames() const { return frames_; }
+  inline uint64_t size() const { return frames_.empty() ? 0 : frames_.back().decompressed_offset + frames_.back().decompressed_size; }
+  std::string readFrame(size_t i) const;
+  std::string read(uint64_t offset, size_t size) const;
+  // logMonoTime of the first event of a frame, 0 if it can't be read. frames start at message boundaries.
+  // the first call reads them for all frames, decompressing only their first event
+  uint64_t frameStartTime(size_t i) const;
+  // Whole frames covering the events logged in [start_mono_time, end_mono_time].
+  // Events in a log are only roughly ordered by time, the result may have some events outside of the range.
+  // Frames with an unknown start time are included when they lie between included frames.
+  std::string readTimeRange(uint64_t start_mono_time, uint64_t end_mono_time) const;
+
+ private:
+  bool readSeekTable(uint64_t file_size);
+  bool scanFrames(uint64_t file_size);
+  bool readCompressed(uint64_t offset, size_t size, std::string &out) const;
+  // the first size bytes of a frame, fewer if it's smaller or corrupt
+  std::string readFramePrefix(size_t i, size_t size) const;
+  uint64_t readStartTime(size_t i) const;
+
+  int fd = -1;
+  std::vector<Frame> frames_;
+  mutable std::vector<uint64_t> start_times_;
+};
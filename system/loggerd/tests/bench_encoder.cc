@@ -0,0 +1,254 @@
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "common/queue.h"
+#include "system/loggerd/encoder/ffmpeg_encoder.h"
+#include "system/loggerd/encoder/nv12_scale.h"
+#include "system/loggerd/loggerd.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+// The stages of FfmpegEncoder on a camera frame: the NV12 conversion, old (NV12ToI420, then I420Scale) and new (nv12_scale),
+// and the FFVHUFF encode. Then the whole path, with the conversion done serially or overlapped with encoding, and the
+// encode with libavcodec threads. Last FfmpegEncoder itself, with each drop policy.
+
+template <class Func>
+double time_ms(Func &&func) {
+  auto start = std::chrono::steady_clock::now();
+  func();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Stage {
+  std::string name;
+  std::vector<double> times;  // ms
+
+  void report() {
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for (double t : times) total += t;
+    printf("  %-22s avg %8.3f ms  p50 %8.3f ms  p99 %8.3f ms  %7.1f fps\n", name.c_str(), total / times.size(),
+           times[times.size() / 2], times[std::min<size_t>(times.size() - 1, times.size() * 0.99)], times.size() / (total / 1000));
+  }
+};
+
+struct Frame {
+  std::vector<uint8_t> buf;
+  uint8_t *y, *u, *v;
+  AVFrame *av;
+
+  Frame(int width, int height) : buf(width * height * 3 / 2) {
+    y = buf.data();
+    u = y + width * height;
+    v = u + (width / 2) * (height / 2);
+    av = av_frame_alloc();
+    av->format = AV_PIX_FMT_YUV420P;
+    av->width = width;
+    av->height = height;
+    av->data[0] = y;
+    av->data[1] = u;
+    av->data[2] = v;
+    av->linesize[0] = width;
+    av->linesize[1] = av->linesize[2] = width / 2;
+  }
+  ~Frame() { av_frame_free(&av); }
+};
+
+AVCodecContext *open_encoder(int width, int height, int threads = 1) {
+  const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_FFVHUFF);
+  AVCodecContext *ctx = avcodec_alloc_context3(codec);
+  ctx->width = width;
+  ctx->height = height;
+  ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  ctx->time_base = (AVRational){1, MAIN_FPS};
+  ctx->thread_count = threads;
+  ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  int err = avcodec_open2(ctx, codec, nullptr);
+  assert(err >= 0);
+  return ctx;
+}
+
+// a null frame flushes the encoder
+size_t encode(AVCodecContext *ctx, AVFrame *frame, AVPacket *pkt) {
+  int err = avcodec_send_frame(ctx, frame);
+  assert(err >= 0);
+  size_t size = 0;
+  while (avcodec_receive_packet(ctx, pkt) == 0) {
+    size += pkt->size;
+    av_packet_unref(pkt);
+  }
+  return size;
+}
+
+void bench(const std::vector<uint8_t> &nv12, int in_width, int in_height, int stride, int out_width, int out_height, int frames) {
+  printf("%dx%d -> %dx%d\n", in_width, in_height, out_width, out_height);
+  const uint8_t *src_y = nv12.data(), *src_uv = nv12.data() + stride * in_height;
+  const bool scale = out_width != in_width || out_height != in_height;
+
+  Frame converted(in_width, in_height), old_out(out_width, out_height), new_out(out_width, out_height), nv12_out(out_width, out_height);
+  Stage old_convert{"NV12ToI420 + I420Scale"}, new_convert{"nv12_scale, I420"}, new_convert_nv12{"nv12_scale, NV12"}, encode_stage{"encode"};
+  AVCodecContext *ctx = open_encoder(out_width, out_height);
+  AVPacket *pkt = av_packet_alloc();
+  for (int i = 0; i < frames; ++i) {
+    old_convert.times.push_back(time_ms([&]() {
+      libyuv::NV12ToI420(src_y, stride, src_uv, stride, converted.y, in_width, converted.u, in_width / 2, converted.v, in_width / 2, in_width, in_height);
+      if (scale) {
+        libyuv::I420Scale(converted.y, in_width, converted.u, in_width / 2, converted.v, in_width / 2, in_width, in_height,
+                          old_out.y, out_width, old_out.u, out_width / 2, old_out.v, out_width / 2, out_width, out_height, libyuv::kFilterNone);
+      }
+    }));
+    new_convert.times.push_back(time_ms([&]() {
+      nv12_scale(src_y, src_uv, stride, in_width, in_height, new_out.y, new_out.u, new_out.v, out_width, out_height);
+    }));
+    new_convert_nv12.times.push_back(time_ms([&]() {
+      nv12_scale(src_y, src_uv, stride, in_width, in_height, nv12_out.y, nv12_out.u, nullptr, out_width, out_height);
+    }));
+    encode_stage.times.push_back(time_ms([&]() { encode(ctx, new_out.av, pkt); }));
+  }
+
+  const std::vector<uint8_t> &expected = scale ? old_out.buf : converted.buf;
+  size_t diff = 0;
+  for (size_t i = 0; i < expected.size(); ++i) diff += expected[i] != new_out.buf[i];
+
+  old_convert.report();
+  new_convert.report();
+  new_convert_nv12.report();
+  encode_stage.report();
+  printf("  nv12_scale output differs from the old path in %zu of %zu bytes\n", diff, expected.size());
+
+  // convert and encode one after the other, then overlapped as in FfmpegEncoder
+  Stage serial{"serial"}, pipelined{"pipelined"};
+  for (int i = 0; i < frames; ++i) {
+    serial.times.push_back(time_ms([&]() {
+      nv12_scale(src_y, src_uv, stride, in_width, in_height, new_out.y, new_out.u, new_out.v, out_width, out_height);
+      encode(ctx, new_out.av, pkt);
+    }));
+  }
+
+  Frame slot_frames[2] = {Frame(out_width, out_height), Frame(out_width, out_height)};
+  SafeQueue<int> free_slots, queue;
+  free_slots.push(0);
+  free_slots.push(1);
+  std::thread encoder([&]() {
+    for (int i; (i = queue.pop()) != -1;) {
+      encode(ctx, slot_frames[i].av, pkt);
+      free_slots.push(i);
+    }
+  });
+  const double total = time_ms([&]() {
+    for (int i = 0; i < frames; ++i) {
+      const int slot = free_slots.pop();
+      Frame &f = slot_frames[slot];
+      nv12_scale(src_y, src_uv, stride, in_width, in_height, f.y, f.u, f.v, out_width, out_height);
+      queue.push(slot);
+    }
+    free_slots.pop();
+    free_slots.pop();
+  });
+  queue.push(-1);
+  encoder.join();
+  pipelined.times.assign(frames, total / frames);
+  serial.report();
+  pipelined.report();
+
+  // FfmpegEncoder's frame and slice threads. packets come a few frames late, the throughput is what counts
+  for (int threads : {2, 4, 0}) {
+    AVCodecContext *threaded = open_encoder(out_width, out_height, threads);
+    Stage stage{threads ? "encode, " + std::to_string(threads) + " threads" : "encode, thread per core"};
+    const double threaded_total = time_ms([&]() {
+      for (int i = 0; i < frames; ++i) {
+        new_out.av->pts = i;
+        encode(threaded, new_out.av, pkt);
+      }
+      encode(threaded, nullptr, pkt);
+    });
+    stage.times.assign(frames, threaded_total / frames);
+    stage.report();
+    avcodec_free_context(&threaded);
+  }
+
+  av_packet_free(&pkt);
+  avcodec_free_context(&ctx);
+}
+
+// frames in as encoderd feeds them, as fast as possible. the packets come from the codec's threads a few frames late,
+// they're matched to their frames by pts, and encoder_close flushes the last ones. every frame that wasn't dropped
+// is published once, in order
+void bench_ffmpeg_encoder(std::vector<uint8_t> &nv12, int width, int height, int stride, const EncoderInfo &info, int frames) {
+  VisionBuf buf;
+  buf.width = width;
+  buf.height = height;
+  buf.stride = stride;
+  buf.y = nv12.data();
+  buf.uv = nv12.data() + stride * height;
+
+  printf("FfmpegEncoder %dx%d -> %dx%d, %d frames in flight\n", width, height, info.frame_width, info.frame_height, ENCODERD_QUEUE);
+  for (const char *drop : {"block", "newest", "oldest"}) {
+    for (int threads : {1, 0}) {
+      FfmpegEncoder encoder(info, width, height, ENCODERD_QUEUE, FfmpegEncoder::drop_policy(drop), threads);
+      encoder.encoder_open(nullptr);
+      Stage stage{std::string(drop) + (threads ? ", 1 thread" : ", thread per core")};
+      const double total = time_ms([&]() {
+        for (int i = 0; i < frames; ++i) {
+          const uint64_t t = nanos_since_boot();
+          VisionIpcBufExtra extra = {.frame_id = (uint32_t)i, .timestamp_sof = t, .timestamp_eof = t};
+          for (int s : {STAGE_SOF, STAGE_EOF, STAGE_RECEIVED, STAGE_ENCODING}) encoder.trace.mark(i, s, t);
+          encoder.encode_frame(&buf, &extra);
+        }
+        encoder.encoder_close();
+      });
+      stage.times.assign(frames, total / frames);
+      stage.report();
+
+      const FrameTracer &trace = encoder.trace;
+      printf("  %24s %" PRIu64 " published, %" PRIu64 " dropped\n", "", trace.frames, encoder.dropped);
+      assert(trace.lost == 0 && trace.frames + encoder.dropped == (uint64_t)frames && trace.dropped == encoder.dropped);
+      assert(std::string(drop) != "block" || (encoder.dropped == 0 && trace.skipped == 0));
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int frames = 200;
+  const option long_options[] = {
+    {"frames", required_argument, nullptr, 'f'},
+    {"help", no_argument, nullptr, 'h'},
+    {nullptr, 0, nullptr, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'f': frames = std::stoi(optarg); break;
+      default: printf("Usage: %s [--frames N]\n", argv[0]); return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  // a camera frame with some texture, in a VisionIPC like buffer with padded rows
+  const int width = 1928, height = 1208, stride = 2048;
+  std::vector<uint8_t> nv12(stride * height * 3 / 2);
+  std::mt19937 rng(42);
+  for (int y = 0; y < height * 3 / 2; ++y) {
+    for (int x = 0; x < width; ++x) {
+      nv12[y * stride + x] = (x + y) / 8 + rng() % 16;
+    }
+  }
+
+  bench(nv12, width, height, stride, width, height, frames);
+  bench(nv12, width, height, stride, qcam_encoder_info.frame_width, qcam_encoder_info.frame_height, frames);
+  bench_ffmpeg_encoder(nv12, width, height, stride, qcam_encoder_info, frames);
+  return 0;
+}
@@ -0,0 +1,360 @@
+#include <getopt.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "third_party/json11/json11.hpp"
+
+#include "common/timing.h"
+#include "system/loggerd/encoder/encoder.h"
+#include "system/loggerd/loggerd.h"
+#include "system/loggerd/qlog_decimator.h"
+
+// Feeds a message mix through the loggerd write paths at up to N x realtime: LoggerState for the logs,
+// handle_encoder_msg and VideoWriter for the camera packets, and segment rotation.
+// Reports throughput and latency percentiles per stage, to size the storage and CPU budgets.
+
+class BenchMessage : public Message {
+ public:
+  BenchMessage(kj::Array<capnp::word> &&words) : words(std::move(words)) {}
+  void init(size_t size) override { words = kj::heapArray<capnp::word>((size + sizeof(capnp::word) - 1) / sizeof(capnp::word)); }
+  void init(char *data, size_t size) override {
+    init(size);
+    memcpy(words.begin(), data, size);
+  }
+  void close() override { words = nullptr; }
+  size_t getSize() override { return words.size() * sizeof(capnp::word); }
+  char *getData() override { return (char *)words.begin(); }
+
+ private:
+  kj::Array<capnp::word> words;
+};
+
+struct Stage {
+  std::string name;
+  std::vector<double> latencies;  // us
+  uint64_t bytes = 0;
+
+  void add(double us, size_t size) {
+    latencies.push_back(us);
+    bytes += size;
+  }
+
+  json11::Json report() {
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [this](double p) { return latencies.empty() ? 0 : latencies[std::min<size_t>(latencies.size() - 1, p * latencies.size())]; };
+    double total_us = 0;
+    for (double l : latencies) total_us += l;
+    const double secs = total_us / 1e6;
+    const double max = latencies.empty() ? 0 : latencies.back();
+    printf("%-16s %8zu calls %10.0f /s %10.1f MB/s   p50 %9.1fus  p99 %9.1fus  p999 %9.1fus  max %9.1fus\n", name.c_str(),
+           latencies.size(), secs > 0 ? latencies.size() / secs : 0, secs > 0 ? bytes / 1e6 / secs : 0,
+           percentile(0.5), percentile(0.99), percentile(0.999), max);
+    return json11::Json::object{
+      {"stage", name}, {"calls", (double)latencies.size()}, {"bytes", (double)bytes}, {"total_ms", total_us / 1000},
+      {"calls_per_sec", secs > 0 ? latencies.size() / secs : 0}, {"mb_per_sec", secs > 0 ? bytes / 1e6 / secs : 0},
+      {"p50_us", percentile(0.5)}, {"p99_us", percentile(0.99)}, {"p999_us", percentile(0.999)}, {"max_us", max},
+    };
+  }
+};
+
+template <class Func>
+double time_us(Func &&func) {
+  auto start = std::chrono::steady_clock::now();
+  func();
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+// a service publishing at a fixed rate, or the events of a recorded rlog
+struct Source {
+  std::string name;
+  uint64_t next_time;  // ns from the start
+  uint64_t period;
+  int counter = 0;
+  int qlog_id = -1;  // in the QlogDecimator
+  const EncoderInfo *encoder_info = nullptr;
+  RemoteEncoder remote_encoder;
+  std::vector<std::string> events;  // recorded
+};
+
+struct Options {
+  double speed = 1;          // x realtime, 0 for as fast as possible
+  double duration = 60;      // seconds
+  double segment_length = 10;
+  size_t msg_size = 256;
+  std::string root = util::file_exists("/dev/shm") ? "/dev/shm/bench_loggerd" : "/tmp/bench_loggerd";
+  std::string rlog, json;
+  bool compress = false, async = true;
+};
+
+std::vector<std::string> read_rlog(const std::string &path) {
+  std::vector<std::string> events;
+  const std::string log = util::read_file(path);
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)log.data(), log.size() / sizeof(capnp::word));
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words);
+    switch (reader.getRoot<cereal::Event>().which()) {
+      case cereal::Event::INIT_DATA:
+      case cereal::Event::SENTINEL:
+      // camera packets are generated, their indexes come from handle_encoder_msg
+      case cereal::Event::ROAD_ENCODE_IDX:
+      case cereal::Event::WIDE_ROAD_ENCODE_IDX:
+      case cereal::Event::DRIVER_ENCODE_IDX:
+      case cereal::Event::Q_ROAD_ENCODE_IDX:
+        break;
+      default:
+        events.emplace_back((const char *)words.begin(), (reader.getEnd() - words.begin()) * sizeof(capnp::word));
+    }
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+  }
+  return events;
+}
+
+uint64_t log_mono_time(const std::string &event) {
+  capnp::FlatArrayMessageReader reader(kj::ArrayPtr<const capnp::word>((const capnp::word *)event.data(), event.size() / sizeof(capnp::word)));
+  return reader.getRoot<cereal::Event>().getLogMonoTime();
+}
+
+kj::Array<capnp::word> build_log_msg(Source &src, uint64_t mono_time, size_t size, std::mt19937 &rng) {
+  MessageBuilder msg;
+  auto event = msg.initEvent();
+  event.setLogMonoTime(mono_time);
+  // CAN frames with half random data, compressing about as well as real logs
+  auto can = event.initCan(std::max<size_t>(1, size / 24));
+  for (int i = 0; i < can.size(); ++i) {
+    uint32_t dat[2] = {(uint32_t)src.counter, (uint32_t)rng()};
+    can[i].setAddress(0x100 + i);
+    can[i].setDat(kj::arrayPtr((const kj::byte *)dat, sizeof(dat)));
+  }
+  return capnp::messageToFlatArray(msg);
+}
+
+kj::Array<capnp::word> build_encoder_msg(Source &src, uint64_t mono_time, int segment_num, int segment_id, std::vector<uint8_t> &payload) {
+  const EncoderInfo &info = *src.encoder_info;
+  const bool h264 = info.encode_type == cereal::EncodeIndex::Type::QCAMERA_H264;
+  const bool keyframe = src.counter % info.fps == 0;
+  const size_t size = std::max(info.bitrate / 8 / info.fps * (keyframe ? 3 : 1), 16);
+  if (payload.size() < size) payload.resize(size);
+  // annex b access unit delimiter, the ts muxer checks for it
+  const uint8_t aud[] = {0, 0, 0, 1, 9, 0xf0};
+  memcpy(payload.data(), aud, sizeof(aud));
+
+  MessageBuilder msg;
+  auto event = msg.initEvent();
+  event.setLogMonoTime(mono_time);
+  auto edata = (event.*(info.init_encode_data_func))();
+  auto idx = edata.initIdx();
+  idx.setFrameId(src.counter);
+  idx.setType(h264 ? cereal::EncodeIndex::Type::QCAMERA_H264 : cereal::EncodeIndex::Type::FULL_H_E_V_C);
+  idx.setEncodeId(src.counter);
+  idx.setSegmentNum(segment_num);
+  idx.setSegmentId(segment_id);
+  idx.setTimestampSof(mono_time);
+  idx.setTimestampEof(mono_time);
+  idx.setFlags(keyframe ? V4L2_BUF_FLAG_KEYFRAME : 0);
+  idx.setLen(size);
+  edata.setData(kj::arrayPtr(payload.data(), size));
+  if (keyframe) {
+    edata.setHeader(kj::arrayPtr(payload.data(), sizeof(aud)));
+  }
+  edata.setWidth(info.frame_width > 0 ? info.frame_width : 1928);
+  edata.setHeight(info.frame_height > 0 ? info.frame_height : 1208);
+  return capnp::messageToFlatArray(msg);
+}
+
+void usage(const char *argv0) {
+  printf("Usage: %s [options]\n"
+         "  --speed N          x realtime, 0 for as fast as possible (default 1)\n"
+         "  --duration S       seconds of logs (default 60)\n"
+         "  --segment S        segment length in seconds (default 10)\n"
+         "  --msg-size BYTES   size of the generated log messages (default 256)\n"
+         "  --rlog FILE        replay the messages of an uncompressed rlog instead\n"
+         "  --root DIR         where to write, e.g. a tmpfs or the real disk (default /dev/shm/bench_loggerd)\n"
+         "  --zstd             write rlog.zst and qlog.zst\n"
+         "  --sync             write from the loggerd thread, instead of AsyncFile\n"
+         "  --json FILE        write the results as json\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  Options opts;
+  const option long_options[] = {
+    {"speed", required_argument, nullptr, 's'},
+    {"duration", required_argument, nullptr, 'd'},
+    {"segment", required_argument, nullptr, 'g'},
+    {"msg-size", required_argument, nullptr, 'm'},
+    {"rlog", required_argument, nullptr, 'r'},
+    {"root", required_argument, nullptr, 'o'},
+    {"zstd", no_argument, nullptr, 'z'},
+    {"sync", no_argument, nullptr, 'y'},
+    {"json", required_argument, nullptr, 'j'},
+    {"help", no_argument, nullptr, 'h'},
+    {nullptr, 0, nullptr, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 's': opts.speed = std::stod(optarg); break;
+      case 'd': opts.duration = std::stod(optarg); break;
+      case 'g': opts.segment_length = std::stod(optarg); break;
+      case 'm': opts.msg_size = std::stoul(optarg); break;
+      case 'r': opts.rlog = optarg; break;
+      case 'o': opts.root = optarg; break;
+      case 'z': opts.compress = true; break;
+      case 'y': opts.async = false; break;
+      case 'j': opts.json = optarg; break;
+      default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  system(("rm -rf " + opts.root).c_str());
+  setenv("LOG_ROOT", opts.root.c_str(), 1);
+  std::mt19937 rng(42);
+
+  // the message mix
+  std::vector<Source> sources;
+  QlogDecimator qlog;
+  if (!opts.rlog.empty()) {
+    sources.push_back({.name = "rlog", .next_time = 0, .period = 0});
+    sources.back().events = read_rlog(opts.rlog);
+    if (sources.back().events.empty()) {
+      fprintf(stderr, "no events in %s\n", opts.rlog.c_str());
+      return 1;
+    }
+  } else {
+    for (const auto &[name, service] : services) {
+      if (!service.should_log || service.frequency <= 0 || util::ends_with(name, "EncodeData")) continue;
+      sources.push_back({.name = name, .next_time = 0, .period = (uint64_t)(1e9 / service.frequency)});
+      sources.back().qlog_id = qlog.addService(name, qlog_policy(name));
+    }
+  }
+  int encoder_count = 0;
+  for (const auto &cam : cameras_logged) {
+    for (const auto &info : cam.encoder_infos) {
+      sources.push_back({.name = info.publish_name, .next_time = 0, .period = (uint64_t)(1e9 / info.fps), .encoder_info = &info});
+      ++encoder_count;
+    }
+  }
+
+  Stage log_stage{"log write"}, encoder_stage{"encoder packet"}, rotate_stage{"rotate"}, close_stage{"close"};
+  auto s = std::make_unique<LoggerdState>(LoggerOptions{.compress = opts.compress, .async = opts.async});
+  s->max_waiting = encoder_count;
+  logger_rotate(s.get());
+  printf("writing %.0f s of logs at %gx realtime to %s, %s%s\n", opts.duration, opts.speed, s->logger.segmentPath().c_str(),
+         opts.compress ? "zstd" : "raw", opts.async ? ", async" : "");
+
+  // the sources, by their next message
+  auto later = [&sources](int a, int b) { return sources[a].next_time > sources[b].next_time; };
+  std::priority_queue<int, std::vector<int>, decltype(later)> queue(later);
+  for (int i = 0; i < sources.size(); ++i) queue.push(i);
+
+  // recorded events keep their relative times
+  const uint64_t rlog_start = opts.rlog.empty() ? 0 : log_mono_time(sources[0].events[0]);
+
+  const uint64_t start_mono_time = nanos_since_boot();
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t duration_ns = opts.duration * 1e9;
+  std::vector<uint8_t> payload;
+  double max_lag_ms = 0;
+  uint64_t total_bytes = 0;
+  while (!queue.empty()) {
+    const int i = queue.top();
+    queue.pop();
+    Source &src = sources[i];
+    const uint64_t t = src.next_time;
+    if (t >= duration_ns) continue;
+
+    if (opts.speed > 0) {
+      const auto due = start + std::chrono::nanoseconds((uint64_t)(t / opts.speed));
+      const auto now = std::chrono::steady_clock::now();
+      if (due > now) {
+        std::this_thread::sleep_until(due);
+      } else {
+        max_lag_ms = std::max(max_lag_ms, std::chrono::duration<double, std::milli>(now - due).count());
+      }
+    }
+
+    if (src.encoder_info) {
+      const uint64_t segment_ns = opts.segment_length * 1e9;
+      const int segment_id = (t % segment_ns) / src.period;
+      auto msg = new BenchMessage(build_encoder_msg(src, start_mono_time + t, t / segment_ns, segment_id, payload));
+      const size_t size = msg->getSize();
+      s->last_camera_seen_tms = millis_since_boot();
+      encoder_stage.add(time_us([&]() { handle_encoder_msg(s.get(), msg, src.name, src.remote_encoder, *src.encoder_info); }), size);
+      total_bytes += size;
+    } else {
+      std::string recorded;
+      kj::Array<capnp::word> generated;
+      kj::ArrayPtr<const kj::byte> bytes;
+      if (!src.events.empty()) {
+        recorded = src.events[src.counter];
+        bytes = kj::arrayPtr((const kj::byte *)recorded.data(), recorded.size());
+      } else {
+        generated = build_log_msg(src, start_mono_time + t, opts.msg_size, rng);
+        bytes = generated.asBytes();
+      }
+      log_stage.add(time_us([&]() {
+        const bool in_qlog = src.qlog_id != -1 && qlog.select(src.qlog_id, start_mono_time + t, bytes.begin(), bytes.size(), [&](const uint8_t *data, size_t size) {
+          s->logger.writeQlog(data, size);
+        });
+        s->logger.write((uint8_t *)bytes.begin(), bytes.size(), in_qlog);
+      }), bytes.size());
+      total_bytes += bytes.size();
+    }
+
+    const int segment = s->logger.segment();
+    const double rotate_us = time_us([&]() { rotate_if_needed(s.get()); });
+    if (s->logger.segment() != segment) {
+      rotate_stage.add(rotate_us, 0);
+    }
+
+    // next message
+    ++src.counter;
+    if (!src.events.empty()) {
+      if (src.counter == src.events.size()) continue;  // replayed the whole rlog
+      src.next_time = std::max(log_mono_time(src.events[src.counter]), rlog_start) - rlog_start;
+    } else {
+      src.next_time += src.period;
+    }
+    queue.push(i);
+  }
+
+  // closing the last segment flushes everything
+  const AsyncFile::Stats &writer_stats = s->logger.writerStats();
+  const uint64_t stalls = writer_stats.stalls, max_write_us = writer_stats.max_write_us, max_queue_depth = writer_stats.max_queue_depth;
+  close_stage.add(time_us([&]() {
+    for (auto &src : sources) src.remote_encoder.writer.reset();
+    s.reset();
+  }), 0);
+  const double wall_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("\n");
+  json11::Json::array stages;
+  for (Stage *stage : {&log_stage, &encoder_stage, &rotate_stage, &close_stage}) {
+    stages.push_back(stage->report());
+  }
+  printf("\n%.1f MB in %.2f s, %.1f MB/s, %.1fx realtime, max lag %.1f ms\n", total_bytes / 1e6, wall_secs,
+         total_bytes / 1e6 / wall_secs, opts.duration / wall_secs, max_lag_ms);
+  if (opts.async) {
+    printf("writer: max write %.2f ms, max queue depth %" PRIu64 ", %" PRIu64 " stalls\n", max_write_us / 1000.0, max_queue_depth, stalls);
+  }
+
+  if (!opts.json.empty()) {
+    json11::Json result = json11::Json::object{
+      {"speed", opts.speed}, {"duration", opts.duration}, {"segment_length", opts.segment_length},
+      {"compress", opts.compress}, {"async", opts.async}, {"root", opts.root},
+      {"bytes", (double)total_bytes}, {"wall_secs", wall_secs}, {"max_lag_ms", max_lag_ms},
+      {"writer_stalls", (double)stalls}, {"writer_max_write_us", (double)max_write_us},
+      {"stages", stages},
+    };
+    std::ofstream(opts.json) << result.dump();
+  }
+  return 0;
+}
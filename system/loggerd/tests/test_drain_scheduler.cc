@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "system/loggerd/drain_scheduler.h"
+
+// Services publishing at fixed rates, drained by a logger writing a fixed number of bytes per us
+struct SimService {
+  std::string name;
+  int frequency;     // declared, as in services.py
+  double rate;       // actual messages per second
+  size_t msg_size;
+  int priority;
+  std::deque<double> queue;  // publish times in us
+  double next_publish = 0;
+};
+
+struct SimResult {
+  std::vector<double> max_latency_us;
+  std::vector<uint64_t> drained_bytes;
+};
+
+SimResult simulate(DrainScheduler *scheduler, std::vector<SimService> services, double bytes_per_us, double duration_us) {
+  SimResult result = {std::vector<double>(services.size()), std::vector<uint64_t>(services.size())};
+  for (auto &s : services) {
+    scheduler->addService(s.name, s.frequency, s.priority);
+  }
+
+  double now = 0;
+  auto publish = [&]() {
+    for (auto &s : services) {
+      for (; s.next_publish <= now; s.next_publish += 1e6 / s.rate) {
+        s.queue.push_back(s.next_publish);
+      }
+    }
+  };
+
+  while (now < duration_us) {
+    // like a poll, every socket with messages is ready
+    publish();
+    bool any_ready = false;
+    for (int i = 0; i < services.size(); ++i) {
+      if (!services[i].queue.empty()) {
+        scheduler->ready(i);
+        any_ready = true;
+      }
+    }
+    if (!any_ready) {
+      now += 100;
+      continue;
+    }
+
+    DrainScheduler::Turn turn;
+    while (scheduler->next(turn)) {
+      SimService &s = services[turn.id];
+      int msgs = 0;
+      size_t bytes = 0;
+      while (msgs < turn.max_msgs && bytes < turn.max_bytes && !s.queue.empty()) {
+        const double latency = now - s.queue.front();
+        result.max_latency_us[turn.id] = std::max(result.max_latency_us[turn.id], latency);
+        scheduler->addLatency(turn.id, latency * 1000);
+        s.queue.pop_front();
+        bytes += s.msg_size;
+        ++msgs;
+        // writing takes time, and new messages arrive meanwhile
+        now += s.msg_size / bytes_per_us;
+        publish();
+      }
+      result.drained_bytes[turn.id] += bytes;
+      scheduler->drained(turn.id, msgs, bytes, s.queue.empty());
+    }
+  }
+  return result;
+}
+
+TEST_CASE("LatencyHistogram") {
+  LatencyHistogram hist;
+  for (int i = 1; i <= 100; ++i) {
+    hist.add(i * 1000000ULL);  // 1..100 ms
+  }
+  REQUIRE(hist.count() == 100);
+  REQUIRE(hist.max() == 100000000ULL);
+  // power of two buckets, within 2x
+  REQUIRE(hist.percentile(50) >= 50000000ULL);
+  REQUIRE(hist.percentile(50) < 100000000ULL);
+  REQUIRE(hist.percentile(99) == hist.max());
+  hist.reset();
+  REQUIRE(hist.count() == 0);
+}
+
+TEST_CASE("DrainScheduler under peak load") {
+  // 20MB/s of writes. 20 services at 100Hz, a slow important one, and a camera flooding at twice the write speed.
+  const double bytes_per_us = 20;
+  std::vector<SimService> services;
+  for (int i = 0; i < 20; ++i) {
+    services.push_back({.name = "service" + std::to_string(i), .frequency = 100, .rate = 100, .msg_size = 1000, .priority = 1});
+  }
+  services.push_back({.name = "slow", .frequency = 1, .rate = 1, .msg_size = 2000, .priority = 1});
+  services.push_back({.name = "flood", .frequency = 20, .rate = 400, .msg_size = 100000, .priority = 0});
+  const int flood = services.size() - 1;
+  const double duration_s = 10;
+
+  auto fair = DrainScheduler::create("fair");
+  SimResult fair_result = simulate(fair.get(), services, bytes_per_us, duration_s * 1e6);
+  auto fifo = DrainScheduler::create("fifo");
+  SimResult fifo_result = simulate(fifo.get(), services, bytes_per_us, duration_s * 1e6);
+
+  double fair_max = 0, fifo_max = 0;
+  for (int i = 0; i < flood; ++i) {
+    fair_max = std::max(fair_max, fair_result.max_latency_us[i]);
+    fifo_max = std::max(fifo_max, fifo_result.max_latency_us[i]);
+    // every message of the other services is written
+    REQUIRE(fair_result.drained_bytes[i] >= services[i].rate * services[i].msg_size * (duration_s - 1));
+  }
+  INFO("max latency fair " << fair_max / 1000.0 << " ms, fifo " << fifo_max / 1000.0 << " ms");
+  REQUIRE(fair_max < 50000);
+  REQUIRE(fair_max * 10 < fifo_max);
+
+  // the flooding service isn't starved either, it gets the rest of the bandwidth
+  const double others = 20 * 100 * 1000 + 2000;
+  REQUIRE(fair_result.drained_bytes[flood] > (bytes_per_us * 1e6 - others) * duration_s * 0.95);
+
+  // the backlog shows up in the stats
+  const auto &stats = fair->stats()[flood];
+  REQUIRE(stats.backlog > 0);
+  REQUIRE(stats.latency.percentile(99) > fair->stats()[0].latency.percentile(99));
+}
@@ -0,0 +1,85 @@
+#include <thread>
+
+#include "catch2/catch.hpp"
+#include "common/queue.h"
+#include "system/loggerd/frame_trace.h"
+
+const uint64_t MS = 1000000;
+
+TEST_CASE("FrameTracer") {
+  FrameTracer trace("encoderd", "roadEncodeData", {"eof", "received", "published"});
+
+  SECTION("stage latency") {
+    for (uint32_t i = 0; i < 100; ++i) {
+      const uint64_t eof = 1000 * MS + i * 50 * MS;
+      trace.mark(i, 0, eof);
+      trace.mark(i, 1, eof + 1 * MS);
+      trace.mark(i, 2, eof + (i < 90 ? 10 : 30) * MS);
+      trace.complete(i);
+    }
+    REQUIRE(trace.frames == 100);
+    REQUIRE(trace.latency[0].count() == 100);
+    REQUIRE(trace.latency[0].max() == 1 * MS);
+    REQUIRE(trace.latency[1].percentile(50) == 16384 * 1000);  // 9ms, in the [8.192, 16.384) ms bucket
+    REQUIRE(trace.latency[1].max() == 29 * MS);
+    REQUIRE(trace.total.percentile(99) == 30 * MS);
+
+    const json11::Json summary = trace.summary();
+    REQUIRE(summary["stream"].string_value() == "roadEncodeData");
+    REQUIRE(summary["stages"].array_items().size() == 3);
+    REQUIRE(summary["stages"][2]["stage"].string_value() == "eof->published");
+    REQUIRE(summary["stages"][2]["max_ms"].number_value() == Approx(30));
+
+    trace.reset();
+    REQUIRE(trace.frames == 0);
+    REQUIRE(trace.total.count() == 0);
+  }
+
+  SECTION("lost and skipped frames") {
+    for (uint32_t i = 0; i < 10; ++i) {
+      if (i == 5) continue;
+      trace.mark(i, 0, i * MS);
+      if (i != 7) trace.mark(i, 1, i * MS + 1);  // missing a stage
+      trace.mark(i, 2, i * MS + 2);
+      trace.complete(i);
+    }
+    REQUIRE(trace.frames == 8);
+    REQUIRE(trace.lost == 1);
+    REQUIRE(trace.skipped == 1);
+
+    // frame 10 is overwritten by 10 + RING_SIZE before it's done
+    trace.mark(10, 0, 10 * MS);
+    trace.mark(10 + FrameTracer::RING_SIZE, 0, 11 * MS);
+    trace.mark(10, 1, 10 * MS + 1);
+    trace.mark(10, 2, 10 * MS + 2);
+    trace.complete(10);
+    REQUIRE(trace.lost == 2);
+
+    trace.drop();
+    REQUIRE(trace.summary()["dropped"].int_value() == 1);
+  }
+
+  SECTION("stages on different threads") {
+    // as in encoderd: the frame starts on the camera thread, and is published on the encoder's. a few frames in flight
+    const int frames = 10000, in_flight = 8;
+    SafeQueue<int> queue, done;
+    std::thread publisher([&]() {
+      for (int i; (i = queue.pop()) != -1;) {
+        trace.mark(i, 2);
+        trace.complete(i);
+        done.push(i);
+      }
+    });
+    for (int i = 0; i < frames; ++i) {
+      if (i >= in_flight) done.pop();
+      trace.mark(i, 0);
+      trace.mark(i, 1);
+      queue.push(i);
+    }
+    queue.push(-1);
+    publisher.join();
+    REQUIRE(trace.frames == frames);
+    REQUIRE(trace.lost == 0);
+    REQUIRE(trace.skipped == 0);
+  }
+}
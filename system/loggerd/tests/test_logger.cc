@@ -1,5 +1,10 @@
+#include <chrono>
+
 #include "catch2/catch.hpp"
+#include "common/timing.h"
+#include "system/loggerd/framed_log.h"
 #include "system/loggerd/logger.h"
+#include "system/loggerd/seekable_zstd.h"
 
 typedef cereal::Sentinel::SentinelType SentinelType;
 
@@ -72,3 +77,192 @@ TEST_CASE("logger") {
     verify_segment(log_root + "/" + route_name, i, segment_cnt, 1);
   }
 }
+
+// Events from the rlog in LOGGERD_TEST_RLOG (uncompressed), or generated ones.
+std::vector<std::string> test_events() {
+  std::vector<std::string> events;
+  if (const char *rlog = getenv("LOGGERD_TEST_RLOG")) {
+    const std::string log = util::read_file(rlog);
+    REQUIRE(!log.empty());
+    kj::ArrayPtr<const capnp::word> words((const capnp::word *)log.data(), log.size() / sizeof(capnp::word));
+    while (words.size() > 0) {
+      capnp::FlatArrayMessageReader reader(words);
+      events.emplace_back((const char *)words.begin(), (reader.getEnd() - words.begin()) * sizeof(capnp::word));
+      words = kj::arrayPtr(reader.getEnd(), words.end());
+    }
+  } else {
+    // after the init data, which is logged when LoggerState is created
+    const uint64_t start_time = nanos_since_boot() + 60e9;
+    for (int i = 0; i < 100000; ++i) {
+      MessageBuilder msg;
+      auto event = msg.initEvent();
+      event.setLogMonoTime(start_time + i * 1e6);
+      auto can = event.initCan(4);
+      for (int j = 0; j < 4; ++j) {
+        uint8_t dat[8] = {(uint8_t)i, (uint8_t)(i >> 8), (uint8_t)j};
+        can[j].setAddress(0x100 + j);
+        can[j].setDat(kj::arrayPtr(dat, sizeof(dat)));
+      }
+      auto bytes = msg.toBytes();
+      events.emplace_back((const char *)bytes.begin(), bytes.size());
+    }
+  }
+  return events;
+}
+
+TEST_CASE("logger zstd") {
+  const std::string log_root = "/tmp/test_logger_zstd";
+  system(("rm " + log_root + " -rf").c_str());
+  const auto events = test_events();
+
+  std::string segment_path;
+  size_t total_size = 0;
+  auto start = std::chrono::steady_clock::now();
+  {
+    LoggerState logger(log_root, {.compress = true});
+    REQUIRE(logger.next());
+    segment_path = logger.segmentPath();
+    for (int i = 0; i < events.size(); ++i) {
+      logger.write((uint8_t *)events[i].data(), events[i].size(), i % 10 == 0);
+      total_size += events[i].size();
+    }
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("compressed %.1f MB at %.1f MB/s, ratio %.2f\n", total_size / 1e6, total_size / 1e6 / secs,
+         total_size / (double)util::read_file(segment_path + "/rlog.zst").size());
+  REQUIRE(!util::file_exists(segment_path + "/rlog.lock"));
+  REQUIRE(!util::file_exists(segment_path + "/rlog"));
+
+  SeekableZstdReader reader;
+  REQUIRE(reader.open(segment_path + "/rlog.zst"));
+  REQUIRE(reader.frames().size() > 1);
+
+  // init data, start sentinel, the events and the end sentinel
+  const std::string log = reader.read(0, reader.size());
+  REQUIRE(log.size() == reader.size());
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)log.data(), log.size() / sizeof(capnp::word));
+  std::vector<std::string> read_events;
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader msg_reader(words);
+    read_events.emplace_back((const char *)words.begin(), (msg_reader.getEnd() - words.begin()) * sizeof(capnp::word));
+    words = kj::arrayPtr(msg_reader.getEnd(), words.end());
+  }
+  REQUIRE(read_events.size() == events.size() + 3);
+  for (int i = 0; i < events.size(); ++i) {
+    REQUIRE(read_events[i + 2] == events[i]);
+  }
+
+  // every frame decompresses on its own and starts at an event
+  for (int i = 0; i < reader.frames().size(); ++i) {
+    std::string frame = reader.readFrame(i);
+    REQUIRE(frame.size() == reader.frames()[i].decompressed_size);
+    REQUIRE(reader.frameStartTime(i) > 0);
+  }
+
+  // a range in the middle only needs a few frames
+  const auto &last_frame = reader.frames().back();
+  uint64_t mid_time = reader.frameStartTime(reader.frames().size() / 2);
+  std::string range = reader.readTimeRange(mid_time, mid_time + 1);
+  REQUIRE(range.size() > 0);
+  REQUIRE(range.size() < last_frame.decompressed_offset);
+
+  // the frames are still readable without the seek table
+  REQUIRE(truncate((segment_path + "/rlog.zst").c_str(), last_frame.compressed_offset + last_frame.compressed_size) == 0);
+  SeekableZstdReader scanned;
+  REQUIRE(scanned.open(segment_path + "/rlog.zst"));
+  REQUIRE(scanned.frames().size() == reader.frames().size());
+  REQUIRE(scanned.read(0, scanned.size()) == log);
+
+  SeekableZstdReader qlog_reader;
+  REQUIRE(qlog_reader.open(segment_path + "/qlog.zst"));
+  REQUIRE(qlog_reader.size() > 0);
+
+  // a reader can be opened again on another file
+  REQUIRE(scanned.open(segment_path + "/qlog.zst"));
+  REQUIRE(scanned.frames().size() == qlog_reader.frames().size());
+  REQUIRE(scanned.read(0, scanned.size()) == qlog_reader.read(0, qlog_reader.size()));
+}
+
+TEST_CASE("logger async") {
+  const std::string log_root = "/tmp/test_logger_async";
+  system(("rm " + log_root + " -rf").c_str());
+  const auto events = test_events();
+
+  // small buffers, so the writer falls behind
+  LoggerOptions options = {.async = true, .async_options = {.buffer_size = 64 * 1024, .num_buffers = 2}};
+  std::string segment_path, expected;
+  {
+    LoggerState logger(log_root, options);
+    REQUIRE(logger.next());
+    segment_path = logger.segmentPath();
+    for (int i = 0; i < events.size(); ++i) {
+      logger.write((uint8_t *)events[i].data(), events[i].size(), false);
+      expected += events[i];
+      if (i == events.size() / 2) {
+        // everything written so far is on disk after a sync
+        logger.sync();
+        REQUIRE(util::read_file(segment_path + "/rlog").find(expected) != std::string::npos);
+      }
+    }
+    const auto &stats = logger.writerStats();
+    REQUIRE(stats.writes > 0);
+    REQUIRE(stats.syncs >= 2);
+    REQUIRE(stats.max_queue_depth <= 2);
+  }
+  REQUIRE(!util::file_exists(segment_path + "/rlog.lock"));
+
+  // init data and start sentinel, the events, then the end sentinel
+  const std::string log = util::read_file(segment_path + "/rlog");
+  const size_t events_start = log.find(expected);
+  REQUIRE(events_start != std::string::npos);
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)(log.data() + events_start + expected.size()),
+                                         (log.size() - events_start - expected.size()) / sizeof(capnp::word));
+  capnp::FlatArrayMessageReader reader(words);
+  REQUIRE(reader.getRoot<cereal::Event>().getSentinel().getType() == SentinelType::END_OF_ROUTE);
+}
+
+TEST_CASE("logger framed") {
+  const std::string log_root = "/tmp/test_logger_framed";
+  system(("rm " + log_root + " -rf").c_str());
+  const auto events = test_events();
+
+  std::string segment_path;
+  {
+    LoggerState logger(log_root, {.framed = true});
+    REQUIRE(logger.next());
+    segment_path = logger.segmentPath();
+    for (const auto &e : events) {
+      logger.write((uint8_t *)e.data(), e.size(), false);
+    }
+  }
+
+  std::string log = util::read_file(segment_path + "/rlog");
+  REQUIRE(is_framed_log(log.data(), log.size()));
+  auto scan = [](const std::string &log) {
+    std::vector<std::string> messages;
+    LogScanStats stats = scan_framed_log(log.data(), log.size(), [&](const char *msg, size_t size) { messages.emplace_back(msg, size); });
+    REQUIRE(stats.messages == messages.size());
+    return std::pair{stats, messages};
+  };
+
+  // init data, start sentinel, the events and the end sentinel
+  auto [stats, messages] = scan(log);
+  REQUIRE(messages.size() == events.size() + 3);
+  REQUIRE(stats.corrupt_regions == 0);
+  REQUIRE(stats.truncated_bytes == 0);
+  for (int i = 0; i < events.size(); ++i) {
+    REQUIRE(messages[i + 2] == events[i]);
+  }
+
+  // a flipped bit in the middle only loses that message, a torn write at the end only the last one
+  const size_t mid = log.size() / 2;
+  log[mid] ^= 0x10;
+  log.resize(log.size() - 3);
+  auto [damaged_stats, damaged] = scan(log);
+  REQUIRE(damaged.size() == messages.size() - 2);
+  REQUIRE(damaged_stats.corrupt_regions == 1);
+  REQUIRE(damaged_stats.corrupt_bytes > 0);
+  REQUIRE(damaged_stats.truncated_bytes > 0);
+  REQUIRE(damaged.front() == messages.front());
+  REQUIRE(damaged.back() == messages[messages.size() - 2]);
+}
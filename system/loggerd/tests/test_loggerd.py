@@ -15,6 +15,7 @@ from cereal.services import SERVICE_LIST
 from openpilot.common.basedir import BASEDIR
 from openpilot.common.params import Params
 from openpilot.common.timeout import Timeout
+from openpilot.system.hardware import PC
 from openpilot.system.hardware.hw import Paths
 from openpilot.system.loggerd.xattr_cache import getxattr
 from openpilot.system.loggerd.deleter import PRESERVE_ATTR_NAME, PRESERVE_ATTR_VALUE
@@ -29,6 +30,8 @@ SentinelType = log.Sentinel.SentinelType
 
 CEREAL_SERVICES = [f for f in log.Event.schema.union_fields if f in SERVICE_LIST
                    and SERVICE_LIST[f].should_log and "encode" not in f.lower()]
+# services with a QLOG_POLICIES entry in qlog_decimator.cc, rate limited and with trigger windows
+QLOG_POLICY_SERVICES = {"controlsState", "carState", "carControl", "carOutput", "deviceState", "userFlag"}
 
 
 class TestLoggerd:
@@ -143,6 +146,9 @@ class TestLoggerd:
 
     d = DEVICE_CAMERAS[("tici", "ar0231")]
     expected_files = {"rlog", "qlog", "qcamera.ts", "fcamera.hevc", "dcamera.hevc", "ecamera.hevc"}
+    if not PC:
+      # frame index of the raw hevc files, PC writes lossless mkv
+      expected_files |= {"fcamera.hevc.idx", "dcamera.hevc.idx", "ecamera.hevc.idx"}
     streams = [(VisionStreamType.VISION_STREAM_ROAD, (d.fcam.width, d.fcam.height, 2048*2346, 2048, 2048*1216), "roadCameraState"),
                (VisionStreamType.VISION_STREAM_DRIVER, (d.dcam.width, d.dcam.height, 2048*2346, 2048, 2048*1216), "driverCameraState"),
                (VisionStreamType.VISION_STREAM_WIDE_ROAD, (d.ecam.width, d.ecam.height, 2048*2346, 2048, 2048*1216), "wideRoadCameraState")]
@@ -222,8 +228,10 @@ class TestLoggerd:
     assert int(bl1.group('count')) == 0 and int(bl2.group('count')) == 1
 
   def test_qlog(self):
-    qlog_services = [s for s in CEREAL_SERVICES if SERVICE_LIST[s].decimation is not None]
-    no_qlog_services = [s for s in CEREAL_SERVICES if SERVICE_LIST[s].decimation is None]
+    # the services in QLOG_POLICIES of qlog_decimator.cc aren't decimated by message count
+    decimated = [s for s in CEREAL_SERVICES if s not in QLOG_POLICY_SERVICES]
+    qlog_services = [s for s in decimated if SERVICE_LIST[s].decimation is not None]
+    no_qlog_services = [s for s in decimated if SERVICE_LIST[s].decimation is None]
 
     services = random.sample(qlog_services, random.randint(2, min(10, len(qlog_services)))) + \
                random.sample(no_qlog_services, random.randint(2, min(10, len(no_qlog_services))))
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "system/loggerd/qlog_decimator.h"
+
+const uint64_t SECOND = 1e9;
+
+struct Event {
+  cereal::Event::Which which;
+  uint64_t mono_time;
+  int value;  // carState gear, controlsState state
+};
+
+// 20s of a drive: carState at 100Hz, with stalls and bursts, then at 200Hz. controlsState and carControl at 100Hz, and a userFlag.
+std::string build_rlog(std::mt19937 &rng, int state_changes, uint64_t user_flag_time) {
+  std::vector<Event> events;
+  std::uniform_int_distribution<int> jitter(0, 4000000);
+  for (uint64_t t = 0, i = 0; t < 20 * SECOND; ++i) {
+    events.push_back({cereal::Event::CAR_STATE, t + jitter(rng), (int)(t / (4 * SECOND)) % 2});
+    if (t < 10 * SECOND && i % 200 == 199) {
+      // stalled for 200ms, then the backlog comes 1ms apart
+      for (int j = 1; j <= 20; ++j) events.push_back({cereal::Event::CAR_STATE, t + 200000000 + j * 1000000, events.back().value});
+      t += 221000000;
+    } else {
+      t += t < 10 * SECOND ? 10000000 : 5000000;
+    }
+  }
+  std::set<int> changes;
+  while (changes.size() < state_changes) changes.insert(std::uniform_int_distribution<int>(1, 1999)(rng));
+  for (int i = 0, state = 0; i < 2000; ++i) {
+    if (changes.count(i)) state = (state + 1) % 3;
+    events.push_back({cereal::Event::CONTROLS_STATE, i * 10000000ULL, state});
+    events.push_back({cereal::Event::CAR_CONTROL, i * 10000000ULL + 1000, 0});
+  }
+  events.push_back({cereal::Event::USER_FLAG, user_flag_time, 0});
+  std::stable_sort(events.begin(), events.end(), [](auto &a, auto &b) { return a.mono_time < b.mono_time; });
+
+  std::string rlog;
+  for (const auto &e : events) {
+    MessageBuilder msg;
+    auto event = msg.initEvent();
+    event.setLogMonoTime(e.mono_time);
+    if (e.which == cereal::Event::CAR_STATE) {
+      event.initCarState().setGearShifter(e.value ? cereal::CarState::GearShifter::REVERSE : cereal::CarState::GearShifter::DRIVE);
+    } else if (e.which == cereal::Event::CONTROLS_STATE) {
+      event.initControlsState().setState((cereal::ControlsState::OpenpilotState)e.value);
+    } else if (e.which == cereal::Event::CAR_CONTROL) {
+      event.initCarControl().setEnabled(true);
+    } else {
+      event.initUserFlag();
+    }
+    auto bytes = msg.toBytes();
+    rlog.append((const char *)bytes.begin(), bytes.size());
+  }
+  return rlog;
+}
+
+TEST_CASE("QlogDecimator") {
+  std::mt19937 rng(42);
+  const uint64_t user_flag_time = 15 * SECOND + 500000;
+  const std::string rlog = build_rlog(rng, 5, user_flag_time);
+
+  QlogDecimator decimator;
+  const std::map<cereal::Event::Which, int> ids = {
+    {cereal::Event::CAR_STATE, decimator.addService("carState", {.interval = 0.1, .on_change = {"gearShifter"}})},
+    {cereal::Event::CONTROLS_STATE, decimator.addService("controlsState", {.interval = 0.1, .on_change = {"state"}, .trigger = true})},
+    {cereal::Event::CAR_CONTROL, decimator.addService("carControl", {.interval = 0.1, .window_before = 20, .window_after = 20})},
+    {cereal::Event::USER_FLAG, decimator.addService("userFlag", {.interval = 0, .trigger = true})},
+  };
+
+  // replay the rlog, and collect what's in the qlog
+  std::map<cereal::Event::Which, std::vector<uint64_t>> rlog_times, qlog_times;
+  std::vector<uint64_t> state_changes;
+  size_t rlog_msgs = 0, qlog_msgs = 0, counter_qlog_msgs = 0;
+  auto add_qlog = [&](const uint8_t *data, size_t size) {
+    capnp::FlatArrayMessageReader reader(kj::ArrayPtr<const capnp::word>((const capnp::word *)data, size / sizeof(capnp::word)));
+    auto event = reader.getRoot<cereal::Event>();
+    qlog_times[event.which()].push_back(event.getLogMonoTime());
+    ++qlog_msgs;
+  };
+
+  int prev_state = -1;
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)rlog.data(), rlog.size() / sizeof(capnp::word));
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    const kj::ArrayPtr<const capnp::word> msg(words.begin(), reader.getEnd());
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+
+    if (event.which() == cereal::Event::CONTROLS_STATE) {
+      const int state = (int)event.getControlsState().getState();
+      if (prev_state != -1 && state != prev_state) state_changes.push_back(event.getLogMonoTime());
+      prev_state = state;
+    }
+    const int id = ids.at(event.which());
+    rlog_times[event.which()].push_back(event.getLogMonoTime());
+    // what loggerd used to do, one in ten
+    counter_qlog_msgs += (decimator.stats()[id].msgs % 10 == 0);
+    ++rlog_msgs;
+    if (decimator.select(id, event.getLogMonoTime(), (const uint8_t *)msg.begin(), msg.asBytes().size(), add_qlog)) {
+      add_qlog((const uint8_t *)msg.begin(), msg.asBytes().size());
+    }
+  }
+  REQUIRE(state_changes.size() == 5);
+  for (auto &[_, times] : qlog_times) std::sort(times.begin(), times.end());
+
+  SECTION("even coverage in time") {
+    // 10 per second, with stalls and bursts in the first half, and twice the rate in the second
+    const auto &times = qlog_times[cereal::Event::CAR_STATE];
+    for (int s = 0; s < 20; ++s) {
+      const auto n = std::count_if(times.begin(), times.end(), [=](uint64_t t) { return t >= s * SECOND && t < (s + 1) * SECOND; });
+      INFO("second " << s);
+      REQUIRE(n >= 8);
+      REQUIRE(n <= 12);
+    }
+    uint64_t max_gap = 0;
+    for (int i = 1; i < times.size(); ++i) max_gap = std::max(max_gap, times[i] - times[i - 1]);
+    REQUIRE(max_gap < 0.35 * SECOND);  // the 200ms stalls
+  }
+
+  SECTION("changes are kept") {
+    const auto &times = qlog_times[cereal::Event::CONTROLS_STATE];
+    for (uint64_t t : state_changes) {
+      REQUIRE(std::binary_search(times.begin(), times.end(), t));
+    }
+    // and the gear changes of carState
+    REQUIRE(decimator.stats()[ids.at(cereal::Event::CAR_STATE)].changes > 0);
+  }
+
+  SECTION("trigger windows") {
+    const auto &all = rlog_times[cereal::Event::CAR_CONTROL];
+    const auto &kept = qlog_times[cereal::Event::CAR_CONTROL];
+    state_changes.push_back(user_flag_time);
+    for (uint64_t t : state_changes) {
+      // the 20 messages on each side
+      const int i = std::lower_bound(all.begin(), all.end(), t) - all.begin();
+      for (int m = std::max(i - 20, 0); m < std::min<int>(i + 20, all.size()); ++m) {
+        REQUIRE(std::binary_search(kept.begin(), kept.end(), all[m]));
+      }
+    }
+    REQUIRE(decimator.stats()[ids.at(cereal::Event::CAR_CONTROL)].windowed > 0);
+  }
+
+  // the rate limit keeps fewer than one in ten, on top of it come the changes and windows
+  size_t extra = 0;
+  for (const auto &service : decimator.stats()) extra += service.changes + service.windowed;
+  INFO("qlog " << qlog_msgs << " messages, " << extra << " changes and in windows, one in ten " << counter_qlog_msgs << ", rlog " << rlog_msgs);
+  REQUIRE(qlog_msgs - extra < counter_qlog_msgs);
+  REQUIRE(qlog_msgs < counter_qlog_msgs * 1.2);
+}
+
+TEST_CASE("qlog_policy") {
+  // decimation of cereal/services.py, a message count
+  REQUIRE(!qlog_policy("liveTracks").interval);
+  REQUIRE(qlog_policy("liveTracks").decimation < 0);
+  REQUIRE(qlog_policy("can").decimation == 1223);
+  // a rate limit for the services in QLOG_POLICIES
+  REQUIRE(*qlog_policy("carState").interval == Approx(0.1));
+  REQUIRE(*qlog_policy("deviceState").interval == 0);
+  // overrides
+  REQUIRE(qlog_policy("controlsState").trigger);
+  REQUIRE(!qlog_policy("controlsState").on_change.empty());
+}
+
+TEST_CASE("QlogDecimator decimation") {
+  QlogDecimator decimator;
+  const int id = decimator.addService("can", {.decimation = 10});
+  REQUIRE(!decimator.timed(id));
+  MessageBuilder msg;
+  msg.initEvent().initCan(1);
+  auto bytes = msg.toBytes();
+
+  // the first of every ten, whatever their logMonoTime
+  int kept = 0;
+  for (int i = 0; i < 25; ++i) {
+    kept += decimator.select(id, 0, bytes.begin(), bytes.size(), [](const uint8_t *, size_t) {});
+  }
+  REQUIRE(kept == (25 - 1) / 10 + 1);
+}
+
+TEST_CASE("QlogDecimator field types") {
+  QlogDecimator decimator;
+  const int id = decimator.addService("controlsState", {.interval = -1, .on_change = {"enabled", "alertType", "vCruise"}});
+  const std::tuple<bool, const char *, float> values[] = {
+    {false, "", 0}, {false, "", 0}, {true, "", 0}, {true, "", 0}, {true, "alert", 0}, {true, "alert", 0}, {true, "alert", 25.5}, {true, "alert", 25.5},
+  };
+  int kept = 0;
+  for (const auto &[enabled, alert_type, v_cruise] : values) {
+    MessageBuilder msg;
+    auto cs = msg.initEvent().initControlsState();
+    cs.setEnabled(enabled);
+    cs.setAlertType(alert_type);
+    cs.setVCruise(v_cruise);
+    auto bytes = msg.toBytes();
+    kept += decimator.select(id, 0, bytes.begin(), bytes.size(), [](const uint8_t *, size_t) {});
+  }
+  // only the changes of the bool, text and float field
+  REQUIRE(kept == 3);
+  REQUIRE(decimator.stats()[id].changes == 3);
+}
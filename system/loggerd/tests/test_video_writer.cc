@@ -0,0 +1,72 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "system/loggerd/video_index.h"
+#include "system/loggerd/video_writer.h"
+
+TEST_CASE("VideoWriter frame index") {
+  const std::string path = "/tmp/test_video_writer";
+  system(("rm " + path + " -rf && mkdir -p " + path).c_str());
+  const std::string video_path = path + "/fcamera.hevc";
+
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> frame_size(100, 50000);
+  const std::string header(80, 'h');
+  std::vector<std::string> frames;
+  {
+    VideoWriter writer(path.c_str(), "fcamera.hevc", false, 1928, 1208, 20, cereal::EncodeIndex::Type::FULL_H_E_V_C);
+    writer.write((uint8_t *)header.data(), header.size(), 1000, true, false);
+    for (int i = 0; i < 100; ++i) {
+      frames.emplace_back(frame_size(rng), 'a' + i % 26);
+      writer.write((uint8_t *)frames[i].data(), frames[i].size(), 50000 * i + 1000, false, i % 20 == 0, 500 + i, i, 50000 * i);
+    }
+  }
+
+  std::vector<VideoIndexEntry> index;
+  REQUIRE(read_video_index(video_path, index));
+  REQUIRE(index.size() == frames.size());
+  const std::string video = util::read_file(video_path);
+  for (int i = 0; i < index.size(); ++i) {
+    const auto &e = index[i];
+    // the header is part of the first frame
+    REQUIRE(video.substr(e.offset, e.size) == (i == 0 ? header : "") + frames[i]);
+    REQUIRE(bool(e.flags & VIDEO_INDEX_KEYFRAME) == (i % 20 == 0));
+    REQUIRE(e.frame_id == 500 + i);
+    REQUIRE(e.segment_id == i);
+    REQUIRE(e.timestamp_sof == 50000 * i);
+    REQUIRE(e.timestamp_eof == 50000 * i + 1000);
+  }
+
+  SECTION("cut short") {
+    // a torn index entry, the last frame isn't indexed
+    const std::string idx = util::read_file(video_index_path(video_path));
+    util::write_file(video_index_path(video_path).c_str(), idx.data(), idx.size() - 10, O_WRONLY | O_TRUNC);
+    REQUIRE(!read_video_index(video_path, index));
+    REQUIRE(index.size() == frames.size() - 1);
+
+    // frames missing from the video, the index is valid up to the end of the video
+    const auto cut = index[50];
+    truncate(video_path.c_str(), cut.offset + 10);
+    REQUIRE(!read_video_index(video_path, index));
+    truncate(video_path.c_str(), cut.offset);
+    REQUIRE(read_video_index(video_path, index));
+    REQUIRE(index.size() == 50);
+  }
+
+  SECTION("flushed as frames are written") {
+    VideoWriter writer(path.c_str(), "ecamera.hevc", false, 1928, 1208, 20, cereal::EncodeIndex::Type::FULL_H_E_V_C);
+    writer.write((uint8_t *)header.data(), header.size(), 1000, true, false);
+    for (int i = 0; i < 3; ++i) {
+      writer.write((uint8_t *)frames[i].data(), frames[i].size(), 50000 * i + 1000, false, i == 0, i, i, 50000 * i);
+    }
+    REQUIRE(read_video_index(path + "/ecamera.hevc", index));
+    REQUIRE(index.size() == 3);
+  }
+
+  SECTION("no index") {
+    unlink(video_index_path(video_path).c_str());
+    REQUIRE(!read_video_index(video_path, index));
+  }
+}
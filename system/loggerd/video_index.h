@@ -0,0 +1,63 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "common/util.h"
+
+// Index of the frames of a raw video file (fcamera.hevc, ...), written next to it as <file>.idx by VideoWriter.
+// Readers can seek to any frame without demuxing the whole file first.
+// A header, followed by one entry per frame. Entries are flushed as frames are written, after the frame itself.
+
+constexpr uint32_t VIDEO_INDEX_MAGIC = 0x58444956;  // "VIDX"
+constexpr uint32_t VIDEO_INDEX_VERSION = 1;
+constexpr uint32_t VIDEO_INDEX_KEYFRAME = 1;
+
+struct VideoIndexHeader {
+  uint32_t magic = VIDEO_INDEX_MAGIC;
+  uint32_t version = VIDEO_INDEX_VERSION;
+  uint32_t entry_size;
+  uint32_t fps;
+};
+
+struct VideoIndexEntry {
+  uint64_t offset;  // of the frame in the video file. the codec header is part of the first frame.
+  uint32_t size;
+  uint32_t flags;
+  uint32_t frame_id;
+  uint32_t segment_id;  // frame number in the segment
+  int64_t timestamp_sof, timestamp_eof;  // us
+};
+static_assert(sizeof(VideoIndexHeader) == 16 && sizeof(VideoIndexEntry) == 40);
+
+inline std::string video_index_path(const std::string &video_path) { return video_path + ".idx"; }
+
+// the frames of the index. false if there's no valid index, or if it doesn't reach the end of the video
+// (e.g. loggerd crashed before writing the entry of the last frame), then the video has to be demuxed.
+inline bool read_video_index(const std::string &video_path, std::vector<VideoIndexEntry> &entries) {
+  const std::string idx = util::read_file(video_index_path(video_path));
+  VideoIndexHeader header;
+  if (idx.size() < sizeof(header)) return false;
+
+  memcpy(&header, idx.data(), sizeof(header));
+  if (header.magic != VIDEO_INDEX_MAGIC || header.version != VIDEO_INDEX_VERSION || header.entry_size < sizeof(VideoIndexEntry)) {
+    return false;
+  }
+
+  struct stat st;
+  if (stat(video_path.c_str(), &st) != 0) return false;
+  const uint64_t video_size = st.st_size;
+  entries.clear();
+  for (size_t pos = sizeof(header); pos + header.entry_size <= idx.size(); pos += header.entry_size) {
+    VideoIndexEntry e;
+    memcpy(&e, idx.data() + pos, sizeof(e));
+    const uint64_t expected = entries.empty() ? 0 : entries.back().offset + entries.back().size;
+    if (e.offset != expected || e.offset + e.size > video_size) break;
+    entries.push_back(e);
+  }
+  return !entries.empty() && entries.back().offset + entries.back().size == video_size;
+}
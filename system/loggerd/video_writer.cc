@@ -2,6 +2,7 @@
 #include <cassert>
 
 #include "system/loggerd/video_writer.h"
+#include "system/loggerd/video_index.h"
 #include "common/swaglog.h"
 #include "common/util.h"
 
@@ -47,15 +48,40 @@ VideoWriter::VideoWriter(const char *path, const char *filename, bool remuxing,
   } else {
     this->of = util::safe_fopen(this->vid_path.c_str(), "wb");
     assert(this->of);
+
+    this->index_file = util::safe_fopen(video_index_path(this->vid_path).c_str(), "wb");
+    assert(this->index_file);
+    VideoIndexHeader header = {.entry_size = sizeof(VideoIndexEntry), .fps = (uint32_t)fps};
+    util::safe_fwrite(&header, sizeof(header), 1, this->index_file);
   }
 }
 
-void VideoWriter::write(uint8_t *data, int len, long long timestamp, bool codecconfig, bool keyframe) {
+void VideoWriter::write(uint8_t *data, int len, long long timestamp, bool codecconfig, bool keyframe,
+                        uint32_t frame_id, uint32_t segment_id, long long timestamp_sof) {
   if (of && data) {
     size_t written = util::safe_fwrite(data, 1, len, of);
     if (written != len) {
       LOGE("failed to write file.errno=%d", errno);
     }
+    file_offset += written;
+  }
+
+  // the codec header goes with the first frame, as demuxers read it
+  if (index_file && !codecconfig) {
+    VideoIndexEntry entry = {
+      .offset = frame_start,
+      .size = (uint32_t)(file_offset - frame_start),
+      .flags = keyframe ? VIDEO_INDEX_KEYFRAME : 0,
+      .frame_id = frame_id,
+      .segment_id = segment_id,
+      .timestamp_sof = timestamp_sof,
+      .timestamp_eof = timestamp,
+    };
+    // the frame reaches the video file before its entry, so a crash never leaves an entry past the end of the video
+    util::safe_fflush(of);
+    util::safe_fwrite(&entry, sizeof(entry), 1, index_file);
+    util::safe_fflush(index_file);
+    frame_start = file_offset;
   }
 
   if (remuxing) {
@@ -107,6 +133,9 @@ VideoWriter::~VideoWriter() {
     util::safe_fflush(this->of);
     fclose(this->of);
     this->of = nullptr;
+    util::safe_fflush(this->index_file);
+    fclose(this->index_file);
+    this->index_file = nullptr;
   }
   unlink(this->lock_path.c_str());
 }
@@ -12,11 +12,15 @@ extern "C" {
 class VideoWriter {
 public:
   VideoWriter(const char *path, const char *filename, bool remuxing, int width, int height, int fps, cereal::EncodeIndex::Type codec);
-  void write(uint8_t *data, int len, long long timestamp, bool codecconfig, bool keyframe);
+  // timestamps in us. frame_id, segment_id and timestamp_sof only go in the frame index
+  void write(uint8_t *data, int len, long long timestamp, bool codecconfig, bool keyframe,
+             uint32_t frame_id = 0, uint32_t segment_id = 0, long long timestamp_sof = 0);
   ~VideoWriter();
 private:
   std::string vid_path, lock_path;
   FILE *of = nullptr;
+  FILE *index_file = nullptr;  // raw files only, see video_index.h
+  uint64_t file_offset = 0, frame_start = 0;
 
   AVCodecContext *codec_ctx;
   AVFormatContext *ofmt_ctx;
@@ -10,6 +10,7 @@
 #include <QScrollBar>
 #include <QShortcut>
 #include <QToolTip>
+#include <QtConcurrent>
 
 #include "tools/cabana/commands.h"
 
@@ -34,8 +35,17 @@ BinaryView::BinaryView(QWidget *parent) : QTableView(parent) {
   setMouseTracking(true);
   setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
 
+  bit_stats_watcher = new QFutureWatcher<std::shared_ptr<BitStatsIndex>>(this);
+
   QObject::connect(dbc(), &DBCManager::DBCFileChanged, this, &BinaryView::refresh);
   QObject::connect(UndoStack::instance(), &QUndoStack::indexChanged, this, &BinaryView::refresh);
+  QObject::connect(can, &AbstractStream::eventsMerged, this, &BinaryView::eventsMerged);
+  QObject::connect(can, &AbstractStream::timeRangeChanged, model, &BinaryViewModel::updateBitStats);
+  QObject::connect(bit_stats_watcher, &QFutureWatcher<std::shared_ptr<BitStatsIndex>>::finished, [this]() {
+    model->bit_stats = bit_stats_watcher->result();
+    bit_stats_merged_from = std::numeric_limits<uint64_t>::max();
+    model->updateBitStats();
+  });
 
   addShortcuts();
   setWhatsThis(R"(
@@ -193,10 +203,33 @@ void BinaryView::leaveEvent(QEvent *event) {
   QTableView::leaveEvent(event);
 }
 
+BinaryView::~BinaryView() {
+  bit_stats_watcher->waitForFinished();
+}
+
 void BinaryView::setMessage(const MessageId &message_id) {
   model->msg_id = message_id;
   verticalScrollBar()->setValue(0);
   refresh();
+  model->bit_stats.reset();
+  model->updateBitStats();
+  buildBitStats();
+}
+
+void BinaryView::eventsMerged(const MessageEventsMap &new_events) {
+  if (auto it = new_events.find(model->msg_id); it != new_events.end() && !it->second.empty()) {
+    bit_stats_merged_from = std::min(bit_stats_merged_from, it->second.front()->mono_time);
+    buildBitStats();
+  }
+}
+
+// Index the bits of the selected message in the background. After a merge the current index is
+// kept on screen and only the events from the merged ones on are indexed again. The result is
+// dropped if another message is selected before it's ready.
+void BinaryView::buildBitStats() {
+  bit_stats_watcher->setFuture(QtConcurrent::run([events = can->events(model->msg_id), prev = model->bit_stats, merged_from = bit_stats_merged_from]() {
+    return prev ? std::make_shared<BitStatsIndex>(events, *prev, merged_from) : std::make_shared<BitStatsIndex>(events);
+  }));
 }
 
 void BinaryView::refresh() {
@@ -282,6 +315,20 @@ void BinaryViewModel::refresh() {
   updateState();
 }
 
+void BinaryViewModel::updateBitStats() {
+  range_stats.clear();
+  if (bit_stats) {
+    if (auto time_range = can->timeRange()) {
+      uint64_t first_time = (can->routeStartTime() + time_range->first) * 1e9;
+      uint64_t last_time = (can->routeStartTime() + time_range->second) * 1e9;
+      range_stats = bit_stats->queryTime(first_time, last_time);
+    } else {
+      range_stats = bit_stats->query(0, bit_stats->size());
+    }
+  }
+  updateState();
+}
+
 void BinaryViewModel::updateItem(int row, int col, uint8_t val, const QColor &color) {
   auto &item = items[row * column_count + col];
   if (item.val != val || item.bg_color != color) {
@@ -312,9 +359,13 @@ void BinaryViewModel::updateState() {
       int val = ((binary[i] >> (7 - j)) & 1) != 0 ? 1 : 0;
       // Bit update frequency based highlighting
       double offset = !item.sigs.empty() ? 50 : 0;
-      auto n = last_msg.last_changes[i].bit_change_counts[j];
+      // Use the exact flip counts of the selected time range once they are indexed
+      const int bit_idx = i * 8 + j;
+      const bool use_range = can->timeRange() && bit_idx < (int)range_stats.size();
+      auto n = use_range ? range_stats[bit_idx].flips : last_msg.last_changes[i].bit_change_counts[j];
+      auto count = use_range ? range_stats[bit_idx].count : last_msg.count;
       double min_f = n == 0 ? offset : offset + 25;
-      double alpha = std::clamp(offset + log2(1.0 + factor * (double)n / (double)last_msg.count) * scaler, min_f, max_f);
+      double alpha = std::clamp(offset + log2(1.0 + factor * (double)n / (double)std::max<uint32_t>(count, 1)) * scaler, min_f, max_f);
       auto color = item.bg_color;
       color.setAlpha(alpha);
       updateItem(i, j, val, color);
@@ -336,7 +387,19 @@ QVariant BinaryViewModel::headerData(int section, Qt::Orientation orientation, i
 
 QVariant BinaryViewModel::data(const QModelIndex &index, int role) const {
   auto item = (const BinaryViewModel::Item *)index.internalPointer();
-  return role == Qt::ToolTipRole && item && !item->sigs.empty() ? signalToolTip(item->sigs.back()) : QVariant();
+  if (role != Qt::ToolTipRole || !item) return {};
+
+  QString tooltip = !item->sigs.empty() ? signalToolTip(item->sigs.back()) : QString();
+  const int bit_idx = index.row() * 8 + index.column();
+  if (index.column() < 8 && bit_idx < (int)range_stats.size()) {
+    const auto &stats = range_stats[bit_idx];
+    tooltip += QObject::tr(R"(
+      <span font-size:small">Flips: %1<br />
+      Duty Cycle: %2%<br />
+      Entropy: %3</span>
+    )").arg(stats.flips).arg(stats.dutyCycle() * 100, 0, 'f', 1).arg(stats.entropy(), 0, 'f', 3);
+  }
+  return tooltip.isEmpty() ? QVariant() : tooltip;
 }
 
 // BinaryItemDelegate
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <limits>
+#include <memory>
 #include <tuple>
 #include <vector>
 
+#include <QFutureWatcher>
 #include <QList>
 #include <QSet>
 #include <QStyledItemDelegate>
@@ -10,6 +13,7 @@
 
 #include "tools/cabana/dbc/dbcmanager.h"
 #include "tools/cabana/streams/abstractstream.h"
+#include "tools/cabana/tools/bitstats.h"
 
 class BinaryItemDelegate : public QStyledItemDelegate {
 public:
@@ -28,6 +32,7 @@ public:
   BinaryViewModel(QObject *parent) : QAbstractTableModel(parent) {}
   void refresh();
   void updateState();
+  void updateBitStats();
   void updateItem(int row, int col, uint8_t val, const QColor &color);
   QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
   QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
@@ -49,6 +54,8 @@ public:
     bool valid = false;
   };
   std::vector<Item> items;
+  std::shared_ptr<BitStatsIndex> bit_stats;
+  std::vector<BitStatsIndex::BitStats> range_stats;  // stats of the selected time range, or of all events
 
   MessageId msg_id;
   int row_count = 0;
@@ -60,6 +67,7 @@ class BinaryView : public QTableView {
 
 public:
   BinaryView(QWidget *parent = nullptr);
+  ~BinaryView();
   void setMessage(const MessageId &message_id);
   void highlight(const cabana::Signal *sig);
   QSet<const cabana::Signal*> getOverlappingSignals() const;
@@ -75,6 +83,8 @@ signals:
 private:
   void addShortcuts();
   void refresh();
+  void buildBitStats();
+  void eventsMerged(const MessageEventsMap &new_events);
   std::tuple<int, int, bool> getSelection(QModelIndex index);
   void setSelection(const QRect &rect, QItemSelectionModel::SelectionFlags flags) override;
   void mousePressEvent(QMouseEvent *event) override;
@@ -86,6 +96,8 @@ private:
   QModelIndex anchor_index;
   BinaryViewModel *model;
   BinaryItemDelegate *delegate;
+  QFutureWatcher<std::shared_ptr<BitStatsIndex>> *bit_stats_watcher;
+  uint64_t bit_stats_merged_from = std::numeric_limits<uint64_t>::max();  // first merged event since bit_stats was built
   const cabana::Signal *resize_sig = nullptr;
   const cabana::Signal *hovered_sig = nullptr;
   friend class BinaryItemDelegate;
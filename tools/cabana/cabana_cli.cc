@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include "tools/cabana/dbc/dbcfile.h"
+#include "tools/cabana/streams/eventstore.h"
+#include "tools/cabana/tools/analysis.h"
+
+// Headless batch analysis of routes and logs: decode, find-signal, similar-bits and export.
+// Every route is loaded into its own CanEventStore and processed in parallel. Results and timing
+// statistics are written to stdout as JSON.
+
+struct Options {
+  QString command;
+  QString data_dir;
+  bool use_qlog = false;
+  std::map<int, std::shared_ptr<DBCFile>> dbcs;  // bus -> dbc, -1 for all buses
+  analysis::SearchConfig search;
+  std::vector<std::function<bool(double)>> find_steps;
+  double end_sec = 0;
+  uint8_t src_bus = 0, find_bus = 0;
+  uint32_t src_address = 0;
+  int byte_idx = 0, bit_idx = 0, min_msgs = 100;
+  bool equal = true;
+  int max_results = 100;
+  QString out_dir;
+};
+
+static DBCFile *dbcFor(const Options &opts, uint8_t source) {
+  auto it = opts.dbcs.find(source);
+  if (it == opts.dbcs.end()) it = opts.dbcs.find(-1);
+  return it != opts.dbcs.end() ? it->second.get() : nullptr;
+}
+
+static std::function<bool(double)> parseCompare(const QString &str) {
+  // <op>:<value>[:<value2>]
+  auto parts = str.split(":");
+  const QString op = parts[0];
+  const double v1 = parts.size() > 1 ? parts[1].toDouble() : 0;
+  const double v2 = parts.size() > 2 ? parts[2].toDouble() : 0;
+  if (op == "eq") return [v1](double v) { return v == v1; };
+  if (op == "gt") return [v1](double v) { return v > v1; };
+  if (op == "ge") return [v1](double v) { return v >= v1; };
+  if (op == "ne") return [v1](double v) { return v != v1; };
+  if (op == "lt") return [v1](double v) { return v < v1; };
+  if (op == "le") return [v1](double v) { return v <= v1; };
+  if (op == "between") return [v1, v2](double v) { return v >= v1 && v <= v2; };
+  return nullptr;
+}
+
+static QJsonArray decode(const CanEventStore &store, const Options &opts) {
+  QJsonArray results;
+  for (const auto &[id, events] : store.eventsMap()) {
+    auto dbc_file = dbcFor(opts, id.source);
+    auto msg = dbc_file ? dbc_file->msg(id) : nullptr;
+    if (!msg || events.empty()) continue;
+
+    QJsonArray sigs;
+    for (auto s : msg->sigs) {
+      double min = std::numeric_limits<double>::max(), max = std::numeric_limits<double>::lowest(), sum = 0, value = 0;
+      int count = 0;
+      for (auto e : events) {
+        if (s->getValue(e->dat, e->size, &value)) {
+          min = std::min(min, value);
+          max = std::max(max, value);
+          sum += value;
+          ++count;
+        }
+      }
+      if (count > 0) {
+        sigs.append(QJsonObject{{"name", s->name}, {"count", count}, {"min", min}, {"max", max},
+                                {"mean", sum / count}, {"last", value}});
+      }
+    }
+    results.append(QJsonObject{{"id", id.toString()}, {"name", msg->name}, {"count", (qint64)events.size()}, {"signals", sigs}});
+  }
+  return results;
+}
+
+static QJsonArray findSignal(const CanEventStore &store, const Options &opts, int *matches) {
+  const double route_start_sec = store.routeStartTime() / 1e9;
+  analysis::SearchConfig config = opts.search;
+  config.first_time = store.routeStartTime() + config.first_time;
+  const uint64_t last_time = opts.end_sec > 0 ? store.routeStartTime() + opts.end_sec * 1e9 : std::numeric_limits<uint64_t>::max();
+
+  auto candidates = analysis::initialSignals(store.eventsMap(), config);
+  for (const auto &cmp : opts.find_steps) {
+    candidates = analysis::searchSignals(store.eventsMap(), candidates, cmp, route_start_sec, last_time);
+  }
+
+  *matches = candidates.size();
+  QJsonArray results;
+  for (int i = 0; i < std::min(candidates.size(), opts.max_results); ++i) {
+    const auto &s = candidates[i];
+    results.append(QJsonObject{{"id", s.id.toString()}, {"start_bit", s.sig.start_bit}, {"size", s.sig.size},
+                               {"is_little_endian", s.sig.is_little_endian}, {"values", QJsonArray::fromStringList(s.values)}});
+  }
+  return results;
+}
+
+static QJsonArray similarBits(const CanEventStore &store, const Options &opts) {
+  QJsonArray results;
+  auto bits = analysis::findSimilarBits(store.allEvents(), opts.src_bus, opts.src_address, opts.byte_idx, opts.bit_idx,
+                                        opts.find_bus, opts.equal, opts.min_msgs);
+  for (int i = 0; i < std::min(bits.size(), opts.max_results); ++i) {
+    const auto &b = bits[i];
+    results.append(QJsonObject{{"address", QString::number(b.address, 16)}, {"byte_idx", (int)b.byte_idx}, {"bit_idx", (int)b.bit_idx},
+                               {"mismatches", (int)b.mismatches}, {"total", (int)b.total}, {"perc", b.perc}});
+  }
+  return results;
+}
+
+static QJsonArray exportRoute(const CanEventStore &store, const Options &opts, const QString &route) {
+  QString dir = opts.out_dir + "/" + QString(route).replace('|', '_').replace('/', '_');
+  QDir().mkpath(dir);
+
+  QJsonArray files;
+  auto write = [&](const QString &fn, auto &&func) {
+    QFile file(fn);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      QTextStream stream(&file);
+      func(stream);
+      files.append(fn);
+    }
+  };
+
+  const uint64_t start_sec = store.routeStartTime() / 1e9;
+  write(dir + "/can.csv", [&](QTextStream &s) { analysis::exportToCSV(s, store.allEvents(), start_sec); });
+  for (const auto &[id, events] : store.eventsMap()) {
+    auto dbc_file = dbcFor(opts, id.source);
+    if (auto msg = dbc_file ? dbc_file->msg(id) : nullptr; msg && !msg->sigs.empty()) {
+      QString fn = QString("%1/%2_%3.csv").arg(dir).arg(id.source).arg(msg->name);
+      write(fn, [&](QTextStream &s) { analysis::exportSignalsToCSV(s, events, *msg, start_sec); });
+    }
+  }
+  return files;
+}
+
+static QJsonObject processRoute(const QString &route, const Options &opts) {
+  QJsonObject result{{"route", route}};
+  QElapsedTimer timer;
+  timer.start();
+
+  CanEventStore store;
+  bool success = QFileInfo(route).isFile() ? store.loadLog(route.toStdString())
+                                            : store.loadRoute(route, opts.data_dir, opts.use_qlog);
+  const qint64 load_ms = timer.restart();
+  result["success"] = success;
+  if (!success) {
+    result["error"] = "failed to load";
+    return result;
+  }
+
+  int matches = 0;
+  QJsonArray results;
+  if (opts.command == "decode") {
+    results = decode(store, opts);
+  } else if (opts.command == "find-signal") {
+    results = findSignal(store, opts, &matches);
+    result["matches"] = matches;
+  } else if (opts.command == "similar-bits") {
+    results = similarBits(store, opts);
+  } else if (opts.command == "export") {
+    results = exportRoute(store, opts, route);
+  }
+  result["results"] = results;
+  result["stats"] = QJsonObject{{"events", (qint64)store.allEvents().size()},
+                                {"messages", (qint64)store.eventsMap().size()},
+                                {"load_ms", load_ms},
+                                {"analyze_ms", timer.elapsed()}};
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Headless cabana analytics over routes and logs.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("command", "decode, find-signal, similar-bits or export");
+  parser.addPositionalArgument("routes", "routes or rlog/qlog files", "routes...");
+  parser.addOption({"data_dir", "local directory with routes", "data_dir"});
+  parser.addOption({"qlog", "load qlogs instead of rlogs"});
+  parser.addOption({"jobs", "number of routes processed in parallel", "n", QString::number(QThread::idealThreadCount())});
+  parser.addOption({"dbc", "dbc file for all buses, or <bus>:<file>. can be repeated", "dbc"});
+  parser.addOption({"bus", "comma separated buses to search", "bus"});
+  parser.addOption({"address", "comma separated hex addresses to search", "address"});
+  parser.addOption({"size", "signal sizes to search, <min>-<max>", "size", "8-8"});
+  parser.addOption({"big-endian", "search big endian signals"});
+  parser.addOption({"signed", "search signed signals"});
+  parser.addOption({"factor", "signal factor", "factor", "1.0"});
+  parser.addOption({"offset", "signal offset", "offset", "0.0"});
+  parser.addOption({"find", "search step <eq|gt|ge|ne|lt|le|between>:<value>[:<value2>]. can be repeated", "find"});
+  parser.addOption({"start", "search from <seconds>", "seconds", "0"});
+  parser.addOption({"end", "search until <seconds>", "seconds", "0"});
+  parser.addOption({"src-bus", "similar-bits: bus of the source message", "bus", "0"});
+  parser.addOption({"src-address", "similar-bits: hex address of the source message", "address", "0"});
+  parser.addOption({"byte", "similar-bits: byte index", "byte", "0"});
+  parser.addOption({"bit", "similar-bits: bit index", "bit", "0"});
+  parser.addOption({"find-bus", "similar-bits: bus to search", "bus", "0"});
+  parser.addOption({"not-equal", "similar-bits: find bits not equal to the source bit"});
+  parser.addOption({"min-msgs", "similar-bits: min message count", "n", "100"});
+  parser.addOption({"max-results", "max results per route", "n", "100"});
+  parser.addOption({"out", "export: output directory", "dir", "."});
+  parser.process(app);
+
+  const QStringList args = parser.positionalArguments();
+  if (args.size() < 2) {
+    parser.showHelp(1);
+  }
+
+  Options opts;
+  opts.command = args[0];
+  if (!QStringList({"decode", "find-signal", "similar-bits", "export"}).contains(opts.command)) {
+    fprintf(stderr, "unknown command %s\n", qPrintable(opts.command));
+    return 1;
+  }
+  opts.data_dir = parser.value("data_dir");
+  opts.use_qlog = parser.isSet("qlog");
+  for (const QString &value : parser.values("dbc")) {
+    int idx = value.indexOf(':');
+    bool is_bus = false;
+    int bus = idx > 0 ? value.left(idx).toInt(&is_bus) : -1;
+    QString fn = is_bus ? value.mid(idx + 1) : value;
+    try {
+      opts.dbcs[is_bus ? bus : -1] = std::make_shared<DBCFile>(fn);
+    } catch (std::exception &e) {
+      fprintf(stderr, "failed to load dbc %s: %s\n", qPrintable(fn), e.what());
+      return 1;
+    }
+  }
+
+  for (const auto &bus : parser.value("bus").split(",", QString::SkipEmptyParts)) {
+    opts.search.buses.insert(bus.trimmed().toUShort());
+  }
+  for (const auto &addr : parser.value("address").split(",", QString::SkipEmptyParts)) {
+    opts.search.addresses.insert(addr.trimmed().toULong(nullptr, 16));
+  }
+  auto sizes = parser.value("size").split("-");
+  opts.search.min_size = std::clamp(sizes[0].toInt(), 1, 64);
+  opts.search.max_size = std::clamp(sizes.size() > 1 ? sizes[1].toInt() : opts.search.min_size, opts.search.min_size, 64);
+  opts.search.is_little_endian = !parser.isSet("big-endian");
+  opts.search.is_signed = parser.isSet("signed");
+  opts.search.factor = parser.value("factor").toDouble();
+  opts.search.offset = parser.value("offset").toDouble();
+  opts.search.first_time = parser.value("start").toDouble() * 1e9;  // relative to the route start
+  opts.end_sec = parser.value("end").toDouble();
+  for (const QString &step : parser.values("find")) {
+    auto cmp = parseCompare(step);
+    if (!cmp) {
+      fprintf(stderr, "invalid search step %s\n", qPrintable(step));
+      return 1;
+    }
+    opts.find_steps.push_back(cmp);
+  }
+  opts.src_bus = parser.value("src-bus").toUInt();
+  opts.src_address = parser.value("src-address").toUInt(nullptr, 16);
+  opts.byte_idx = parser.value("byte").toInt();
+  opts.bit_idx = parser.value("bit").toInt();
+  opts.find_bus = parser.value("find-bus").toUInt();
+  opts.equal = !parser.isSet("not-equal");
+  opts.min_msgs = parser.value("min-msgs").toInt();
+  opts.max_results = parser.value("max-results").toInt();
+  opts.out_dir = parser.value("out");
+
+  QThreadPool::globalInstance()->setMaxThreadCount(std::max(1, parser.value("jobs").toInt()));
+  QElapsedTimer timer;
+  timer.start();
+  const QStringList routes = args.mid(1);
+  std::function<QJsonObject(const QString &)> process = [&opts](const QString &route) { return processRoute(route, opts); };
+  auto results = QtConcurrent::blockingMapped<QList<QJsonObject>>(routes, process);
+
+  QJsonArray routes_json;
+  int failed = 0;
+  for (const auto &r : results) {
+    failed += !r["success"].toBool();
+    routes_json.append(r);
+  }
+  QJsonObject output{{"command", opts.command},
+                     {"routes", routes_json},
+                     {"stats", QJsonObject{{"routes", routes.size()}, {"failed", failed}, {"total_ms", timer.elapsed()}}}};
+  printf("%s\n", QJsonDocument(output).toJson(QJsonDocument::Compact).constData());
+  return failed == 0 ? 0 : 1;
+}
@@ -15,35 +15,175 @@ void Sparkline::update(const MessageId &msg_id, const cabana::Signal *sig, doubl
 
   if (first == last || size.isEmpty()) {
     pixmap = QPixmap();
+    reset();
     return;
   }
 
-  points.clear();
+  // The decoded samples can be reused if the signal definition is unchanged, the range only moved forward,
+  // and no events were inserted into the previous range (e.g. by a segment merged after seeking).
+  bool reusable = sig == sig_ && msg_id == msg_id_ && ts >= last_ts_ && first_ts >= first_ts_ && *sig == sig_def_;
+  auto begin = first;
+  if (reusable) {
+    auto prev_first = std::lower_bound(msgs.cbegin(), msgs.cend(), first_ts_, CompareCanEvent());
+    auto prev_last = std::upper_bound(prev_first, msgs.cend(), last_ts_, CompareCanEvent());
+    reusable = (size_t)std::distance(prev_first, prev_last) == event_count_;
+    begin = std::max(first, prev_last);
+  }
+  if (!reusable) {
+    reset();
+    msg_id_ = msg_id;
+    sig_ = sig;
+    sig_def_ = *sig;
+  }
+
+  const uint64_t new_bucket_ns = std::max<uint64_t>(1, range * 1e9 / std::max(1, size.width() - 1));
+  const bool rebuild_columns = !reusable || new_bucket_ns != bucket_ns;
+  bucket_ns = new_bucket_ns;
+  dirty_ |= rebuild_columns || size != size_ || sig->color != color_;
+
+  // drop samples that left the range
+  bool front_changed = false;
+  while (!samples.empty() && samples.front().mono_time < first_ts) {
+    popSample();
+    front_changed = true;
+  }
+
+  // decode new events only
   double value = 0;
-  for (auto it = first; it != last; ++it) {
+  for (auto it = begin; it != last; ++it) {
     if (sig->getValue((*it)->dat, (*it)->size, &value)) {
-      points.emplace_back(((*it)->mono_time - (*first)->mono_time) / 1e9, value);
+      pushSample((*it)->mono_time, value);
+      if (!rebuild_columns) addToColumns(samples.back());
     }
   }
 
-  if (points.empty()) {
+  if (rebuild_columns) {
+    rebuildColumns();
+  } else if (front_changed) {
+    rebuildFrontColumn();
+  }
+
+  first_ts_ = first_ts;
+  last_ts_ = ts;
+  event_count_ = std::distance(first, last);
+  size_ = size;
+  color_ = sig->color;
+
+  if (samples.empty()) {
     pixmap = QPixmap();
+    dirty_ = true;
+    return;
+  }
+
+  const double min = samples[min_seqs.front() - front_seq].value;
+  const double max = samples[max_seqs.front() - front_seq].value;
+  const double new_min = min == max ? min - 1 : min;
+  const double new_max = min == max ? max + 1 : max;
+  dirty_ |= new_min != min_val || new_max != max_val || pixmap.isNull();
+  min_val = new_min;
+  max_val = new_max;
+  freq_ = samples.size() / std::max((samples.back().mono_time - samples.front().mono_time) / 1e9, 1.0);
+
+  if (dirty_) {
+    render(sig->color, size);
+    dirty_ = false;
+  }
+}
+
+void Sparkline::reset() {
+  samples.clear();
+  min_seqs.clear();
+  max_seqs.clear();
+  columns.clear();
+  front_seq = 0;
+  sig_ = nullptr;
+  first_ts_ = last_ts_ = 0;
+  event_count_ = 0;
+  dirty_ = true;
+}
+
+void Sparkline::pushSample(uint64_t mono_time, double value) {
+  const uint64_t seq = front_seq + samples.size();
+  samples.push_back({mono_time, value});
+  while (!min_seqs.empty() && samples[min_seqs.back() - front_seq].value >= value) min_seqs.pop_back();
+  min_seqs.push_back(seq);
+  while (!max_seqs.empty() && samples[max_seqs.back() - front_seq].value <= value) max_seqs.pop_back();
+  max_seqs.push_back(seq);
+}
+
+void Sparkline::popSample() {
+  if (min_seqs.front() == front_seq) min_seqs.pop_front();
+  if (max_seqs.front() == front_seq) max_seqs.pop_front();
+  samples.pop_front();
+  ++front_seq;
+}
+
+void Sparkline::addToColumns(const Sample &s) {
+  const int64_t bucket = bucketOf(s.mono_time);
+  if (columns.empty() || columns.back().bucket != bucket) {
+    columns.push_back({.bucket = bucket, .first = s.value, .last = s.value, .min = s.value, .max = s.value, .count = 1});
+    dirty_ = true;
     return;
   }
 
-  const auto [min, max] = std::minmax_element(points.begin(), points.end(),
-                                              [](auto &l, auto &r) { return l.y() < r.y(); });
-  min_val = min->y() == max->y() ? min->y() - 1 : min->y();
-  max_val = min->y() == max->y() ? max->y() + 1 : max->y();
-  freq_ = points.size() / std::max(points.back().x() - points.front().x(), 1.0);
-  render(sig->color, range, size);
+  auto &c = columns.back();
+  dirty_ |= s.value != c.last;
+  c.last = s.value;
+  c.min = std::min(c.min, s.value);
+  c.max = std::max(c.max, s.value);
+  ++c.count;
 }
 
-void Sparkline::render(const QColor &color, int range, QSize size) {
-  const double xscale = (size.width() - 1) / (double)range;
+void Sparkline::rebuildFrontColumn() {
+  if (samples.empty()) {
+    columns.clear();
+    return;
+  }
+
+  const int64_t front_bucket = bucketOf(samples.front().mono_time);
+  while (!columns.empty() && columns.front().bucket < front_bucket) {
+    columns.pop_front();
+    dirty_ = true;
+  }
+
+  // the front column may have lost some of its samples, recompute it from the ring.
+  if (!columns.empty() && columns.front().bucket == front_bucket) {
+    Column c = {.bucket = front_bucket, .first = samples.front().value, .last = samples.front().value,
+                .min = samples.front().value, .max = samples.front().value, .count = 0};
+    for (auto it = samples.cbegin(); it != samples.cend() && bucketOf(it->mono_time) == front_bucket; ++it) {
+      c.last = it->value;
+      c.min = std::min(c.min, it->value);
+      c.max = std::max(c.max, it->value);
+      ++c.count;
+    }
+    auto &front = columns.front();
+    dirty_ |= c.first != front.first || c.min != front.min || c.max != front.max;
+    front = c;
+  }
+}
+
+void Sparkline::rebuildColumns() {
+  columns.clear();
+  for (const auto &s : samples) {
+    addToColumns(s);
+  }
+  dirty_ = true;
+}
+
+void Sparkline::render(const QColor &color, QSize size) {
   const double yscale = (size.height() - 3) / (max_val - min_val);
-  for (auto &v : points) {
-    v = QPoint(v.x() * xscale, 1 + std::abs(v.y() - max_val) * yscale);
+  auto y = [&](double v) { return 1 + std::abs(v - max_val) * yscale; };
+
+  points.clear();
+  const int64_t first_bucket = columns.front().bucket;
+  for (const auto &c : columns) {
+    const double x = c.bucket - first_bucket;
+    points.emplace_back(x, y(c.first));
+    if (c.count > 1) {
+      points.emplace_back(x, y(c.min));
+      points.emplace_back(x, y(c.max));
+      points.emplace_back(x, y(c.last));
+    }
   }
 
   qreal dpr = qApp->devicePixelRatio();
@@ -58,7 +198,7 @@ void Sparkline::render(const QColor &color, int range, QSize size) {
   painter.setPen(color);
   painter.drawPolyline(points.data(), points.size());
   painter.setPen(QPen(color, 3));
-  if ((points.back().x() - points.front().x()) / points.size() > 8) {
+  if ((points.back().x() - points.front().x()) / samples.size() > 8) {
     painter.drawPoints(points.data(), points.size());
   } else {
     painter.drawPoint(points.back());
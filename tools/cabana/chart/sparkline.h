@@ -1,11 +1,14 @@
 #pragma once
 
+#include <deque>
 #include <QPixmap>
 #include <QPointF>
 #include <vector>
 
 #include "tools/cabana/dbc/dbc.h"
 
+// Sparkline keeps the decoded samples of the visible time range between updates,
+// so each refresh only decodes the events received since the last one.
 class Sparkline {
 public:
   void update(const MessageId &msg_id, const cabana::Signal *sig, double last_msg_ts, int range, QSize size);
@@ -17,7 +20,44 @@ public:
   double max_val = 0;
 
 private:
-  void render(const QColor &color, int range, QSize size);
+  struct Sample {
+    uint64_t mono_time;
+    double value;
+  };
+  struct Column {
+    int64_t bucket;
+    double first, last, min, max;
+    uint32_t count;
+  };
+
+  void reset();
+  void pushSample(uint64_t mono_time, double value);
+  void popSample();
+  void addToColumns(const Sample &s);
+  void rebuildFrontColumn();
+  void rebuildColumns();
+  inline int64_t bucketOf(uint64_t mono_time) const { return mono_time / bucket_ns; }
+  void render(const QColor &color, QSize size);
+
+  // ring of decoded samples in the visible range. sample i has sequence number front_seq + i.
+  std::deque<Sample> samples;
+  uint64_t front_seq = 0;
+  // monotonic deques of sample sequence numbers for the sliding min/max.
+  std::deque<uint64_t> min_seqs, max_seqs;
+  // per pixel column min/max reduction of the samples.
+  std::deque<Column> columns;
+  uint64_t bucket_ns = 1;
+
+  // state of the previous update, used to decide what needs to be recomputed.
+  MessageId msg_id_;
+  const cabana::Signal *sig_ = nullptr;
+  cabana::Signal sig_def_;
+  QColor color_;
+  QSize size_;
+  uint64_t first_ts_ = 0;
+  uint64_t last_ts_ = 0;
+  size_t event_count_ = 0;
+  bool dirty_ = true;
 
   std::vector<QPointF> points;
   double freq_ = 0;
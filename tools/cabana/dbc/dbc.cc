@@ -1,8 +1,7 @@
 #include "tools/cabana/dbc/dbc.h"
 
 #include <algorithm>
-
-#include "tools/cabana/utils/util.h"
+#include <cmath>
 
 uint qHash(const MessageId &item) {
   return qHash(item.source) ^ qHash(item.address);
@@ -126,6 +125,12 @@ void cabana::Msg::update() {
 
 // cabana::Signal
 
+static int num_decimals(double num) {
+  const QString string = QString::number(num);
+  auto dot_pos = string.indexOf('.');
+  return dot_pos == -1 ? 0 : string.size() - dot_pos - 1;
+}
+
 void cabana::Signal::update() {
   updateMsbLsb(*this);
   if (receiver_name.isEmpty()) {
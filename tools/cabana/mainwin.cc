@@ -369,7 +369,11 @@ void MainWindow::streamStarted() {
   }
   // Don't overwrite already loaded DBC
   if (!dbc()->nonEmptyDBCCount()) {
-    newFile();
+    if (auto snapshot = can->snapshot(); snapshot && !snapshot->dbcs().empty()) {
+      restoreDBCs(snapshot->dbcs());
+    } else {
+      newFile();
+    }
   }
 
   QObject::connect(messages_widget, &MessagesWidget::msgSelectionChanged, center_widget, &CenterWidget::setMessage);
@@ -377,6 +381,16 @@ void MainWindow::streamStarted() {
   QObject::connect(can, &AbstractStream::sourcesUpdated, this, &MainWindow::updateLoadSaveMenus);
 }
 
+void MainWindow::restoreDBCs(const std::vector<SessionSnapshot::DBCAssignment> &dbcs) {
+  for (const auto &d : dbcs) {
+    // Prefer the file on disk, fall back to the content saved in the snapshot.
+    bool opened = !d.filename.isEmpty() && QFile::exists(d.filename) && dbc()->open(d.sources, d.filename);
+    if (!opened) {
+      dbc()->open(d.sources, d.name, d.content);
+    }
+  }
+}
+
 void MainWindow::eventsMerged() {
   if (!can->liveStreaming() && std::exchange(car_fingerprint, can->carFingerprint()) != car_fingerprint) {
     video_dock->setWindowTitle(tr("ROUTE: %1  FINGERPRINT: %2")
@@ -13,6 +13,7 @@
 #include "tools/cabana/dbc/dbcmanager.h"
 #include "tools/cabana/detailwidget.h"
 #include "tools/cabana/messageswidget.h"
+#include "tools/cabana/streams/snapshot.h"
 #include "tools/cabana/videowidget.h"
 #include "tools/cabana/tools/findsimilarbits.h"
 
@@ -75,6 +76,7 @@ protected:
   void updateStatus();
   void updateLoadSaveMenus();
   void createDockWidgets();
+  void restoreDBCs(const std::vector<SessionSnapshot::DBCAssignment> &dbcs);
   void eventsMerged();
 
   VideoWidget *video_widget = nullptr;
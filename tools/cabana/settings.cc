@@ -23,6 +23,7 @@ void settings_op(SettingOperation op) {
   op(s, "absolute_time", settings.absolute_time);
   op(s, "fps", settings.fps);
   op(s, "max_cached_minutes", settings.max_cached_minutes);
+  op(s, "snapshot_cache_mb", settings.snapshot_cache_mb);
   op(s, "chart_height", settings.chart_height);
   op(s, "chart_range", settings.chart_range);
   op(s, "chart_column_count", settings.chart_column_count);
@@ -78,6 +79,13 @@ SettingsDlg::SettingsDlg(QWidget *parent) : QDialog(parent) {
   cached_minutes->setRange(MIN_CACHE_MINIUTES, MAX_CACHE_MINIUTES);
   cached_minutes->setSingleStep(1);
   cached_minutes->setValue(settings.max_cached_minutes);
+
+  form_layout->addRow(tr("Route Snapshot Cache"), snapshot_cache_mb = new QSpinBox(this));
+  snapshot_cache_mb->setToolTip(tr("Disk space for the CAN events of opened routes, to reopen them instantly. 0 disables it"));
+  snapshot_cache_mb->setRange(0, 100 * 1024);
+  snapshot_cache_mb->setSingleStep(256);
+  snapshot_cache_mb->setSuffix(" MB");
+  snapshot_cache_mb->setValue(settings.snapshot_cache_mb);
   main_layout->addWidget(groupbox);
 
   groupbox = new QGroupBox("New Signal Settings");
@@ -132,6 +140,7 @@ void SettingsDlg::save() {
   }
   settings.fps = fps->value();
   settings.max_cached_minutes = cached_minutes->value();
+  settings.snapshot_cache_mb = snapshot_cache_mb->value();
   settings.chart_series_type = chart_series_type->currentIndex();
   settings.chart_height = chart_height->value();
   settings.log_livestream = log_livestream->isChecked();
@@ -6,6 +6,7 @@
 #include <QApplication>
 #include "common/timing.h"
 #include "tools/cabana/settings.h"
+#include "tools/cabana/streams/snapshot.h"
 
 static const int EVENT_NEXT_BUFFER_SIZE = 6 * 1024 * 1024;  // 6MB
 
@@ -33,6 +34,8 @@ AbstractStream::AbstractStream(QObject *parent) : QObject(parent) {
   });
 }
 
+AbstractStream::~AbstractStream() {}
+
 void AbstractStream::updateMasks() {
   std::lock_guard lk(mutex_);
   masks_.clear();
@@ -216,6 +219,24 @@ void AbstractStream::mergeEvents(const std::vector<const CanEvent *> &events) {
   lastest_event_ts = all_events_.empty() ? 0 : all_events_.back()->mono_time;
 }
 
+// Events in the snapshot are used in place, the snapshot must outlive all_events_ and events_.
+void AbstractStream::attachSnapshot(std::unique_ptr<SessionSnapshot> snapshot) {
+  snapshot_ = std::move(snapshot);
+  all_events_.resize(snapshot_->eventCount());
+  for (size_t i = 0; i < all_events_.size(); ++i) {
+    all_events_[i] = snapshot_->event(i);
+  }
+
+  events_.clear();
+  for (const auto &m : snapshot_->messages()) {
+    auto &e = events_[m.id];
+    e.reserve(m.count);
+    std::transform(m.indices, m.indices + m.count, std::back_inserter(e), [this](uint32_t i) { return all_events_[i]; });
+  }
+  lastest_event_ts = all_events_.empty() ? 0 : all_events_.back()->mono_time;
+  emit eventsMerged(events_);
+}
+
 namespace {
 
 enum Color { GREYISH_BLUE, CYAN, RED};
@@ -14,6 +14,7 @@
 
 #include "cereal/messaging/messaging.h"
 #include "tools/cabana/dbc/dbcmanager.h"
+#include "tools/cabana/streams/canevent.h"
 #include "tools/cabana/utils/util.h"
 #include "tools/replay/util.h"
 
@@ -38,33 +39,20 @@ struct CanData {
   double last_freq_update_ts = 0;
 };
 
-struct CanEvent {
-  uint8_t src;
-  uint32_t address;
-  uint64_t mono_time;
-  uint8_t size;
-  uint8_t dat[];
-};
-
-struct CompareCanEvent {
-  constexpr bool operator()(const CanEvent *const e, uint64_t ts) const { return e->mono_time < ts; }
-  constexpr bool operator()(uint64_t ts, const CanEvent *const e) const { return ts < e->mono_time; }
-};
-
 struct BusConfig {
   int can_speed_kbps = 500;
   int data_speed_kbps = 2000;
   bool can_fd = false;
 };
 
-typedef std::unordered_map<MessageId, std::vector<const CanEvent *>> MessageEventsMap;
+class SessionSnapshot;
 
 class AbstractStream : public QObject {
   Q_OBJECT
 
 public:
   AbstractStream(QObject *parent);
-  virtual ~AbstractStream() {}
+  virtual ~AbstractStream();
   virtual void start() = 0;
   virtual void stop() {}
   virtual bool liveStreaming() const { return true; }
@@ -87,6 +75,7 @@ public:
   inline const std::vector<const CanEvent *> &allEvents() const { return all_events_; }
   const CanData &lastMessage(const MessageId &id);
   const std::vector<const CanEvent *> &events(const MessageId &id) const;
+  inline const SessionSnapshot *snapshot() const { return snapshot_.get(); }
 
   size_t suppressHighlighted();
   void clearSuppressed();
@@ -109,6 +98,7 @@ public:
 
 protected:
   void mergeEvents(const std::vector<const CanEvent *> &events);
+  void attachSnapshot(std::unique_ptr<SessionSnapshot> snapshot);
   const CanEvent *newEvent(uint64_t mono_time, const cereal::CanData::Reader &c);
   void updateEvent(const MessageId &id, double sec, const uint8_t *data, uint8_t size);
   uint64_t lastEventMonoTime() const { return lastest_event_ts; }
@@ -126,6 +116,7 @@ private:
   MessageEventsMap events_;
   std::unordered_map<MessageId, CanData> last_msgs;
   std::unique_ptr<MonotonicBuffer> event_buffer_;
+  std::unique_ptr<SessionSnapshot> snapshot_;
 
   // Members accessed in multiple threads. (mutex protected)
   std::mutex mutex_;
@@ -0,0 +1,110 @@
+#include "tools/cabana/streams/eventstore.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <capnp/schema.h>
+
+#include "tools/replay/route.h"
+
+static const int EVENT_BUFFER_SIZE = 6 * 1024 * 1024;  // 6MB
+
+CanEventStore::CanEventStore() : buffer_(std::make_unique<MonotonicBuffer>(EVENT_BUFFER_SIZE)) {}
+
+bool CanEventStore::loadRoute(const QString &route, const QString &data_dir, bool use_qlog, std::atomic<bool> *abort) {
+  Route r(route, data_dir);
+  if (!r.load()) {
+    rWarning("failed to load route %s", qPrintable(route));
+    return false;
+  }
+
+  bool loaded = false;
+  for (const auto &[n, files] : r.segments()) {
+    if (abort && *abort) break;
+
+    const QString &file = use_qlog || files.rlog.isEmpty() ? files.qlog : files.rlog;
+    if (!file.isEmpty() && loadLog(file.toStdString(), abort)) {
+      loaded = true;
+    } else {
+      rWarning("failed to load segment %d of %s", n, qPrintable(route));
+    }
+  }
+  return loaded;
+}
+
+bool CanEventStore::loadLog(const std::string &file, std::atomic<bool> *abort) {
+  std::vector<bool> filters(capnp::Schema::from<cereal::Event>().asStruct().getUnionFields().size(), false);
+  filters[cereal::Event::Which::INIT_DATA] = true;
+  filters[cereal::Event::Which::CAN] = true;
+
+  LogReader log(filters);
+  if (!log.load(file, abort, true, 0, 3)) {
+    return false;
+  }
+  mergeLog(log);
+  return true;
+}
+
+void CanEventStore::mergeLog(const LogReader &log) {
+  if (route_start_time_ == 0 || log.events.front().mono_time < route_start_time_) {
+    route_start_time_ = log.events.front().mono_time;
+  }
+
+  std::vector<const CanEvent *> new_events;
+  new_events.reserve(log.events.size() * 50);
+  for (const Event &e : log.events) {
+    if (e.which == cereal::Event::Which::CAN) {
+      capnp::FlatArrayMessageReader reader(e.data);
+      for (const auto &c : reader.getRoot<cereal::Event>().getCan()) {
+        auto dat = c.getDat();
+        new_events.push_back(newEvent(e.mono_time, c.getSrc(), c.getAddress(), dat.begin(), dat.size()));
+      }
+    }
+  }
+  addEvents(new_events);
+}
+
+const CanEvent *CanEventStore::newEvent(uint64_t mono_time, uint8_t src, uint32_t address, const uint8_t *dat, uint8_t size) {
+  CanEvent *e = (CanEvent *)buffer_->allocate(sizeof(CanEvent) + sizeof(uint8_t) * size);
+  e->src = src;
+  e->address = address;
+  e->mono_time = mono_time;
+  e->size = size;
+  memcpy(e->dat, dat, size);
+  return e;
+}
+
+// events must be sorted by mono_time.
+void CanEventStore::addEvents(const std::vector<const CanEvent *> &events) {
+  if (events.empty()) return;
+
+  auto merge = [](std::vector<const CanEvent *> &dst, auto first, auto last) {
+    size_t size = dst.size();
+    dst.insert(dst.end(), first, last);
+    std::inplace_merge(dst.begin(), dst.begin() + size, dst.end(),
+                       [](const CanEvent *l, const CanEvent *r) { return l->mono_time < r->mono_time; });
+  };
+
+  MessageEventsMap msg_events;
+  for (auto e : events) {
+    msg_events[{.source = e->src, .address = e->address}].push_back(e);
+  }
+  for (const auto &[id, e] : msg_events) {
+    merge(events_[id], e.cbegin(), e.cend());
+  }
+  merge(all_events_, events.cbegin(), events.cend());
+}
+
+const std::vector<const CanEvent *> &CanEventStore::events(const MessageId &id) const {
+  static std::vector<const CanEvent *> empty_events;
+  auto it = events_.find(id);
+  return it != events_.end() ? it->second : empty_events;
+}
+
+std::set<uint8_t> CanEventStore::sources() const {
+  std::set<uint8_t> s;
+  for (const auto &[id, _] : events_) {
+    s.insert(id.source);
+  }
+  return s;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <QString>
+
+#include "tools/cabana/streams/canevent.h"
+#include "tools/replay/logreader.h"
+
+// CanEventStore holds the CAN events of routes or log files. Unlike AbstractStream it doesn't
+// need the global stream or an event loop, so several stores can be built and analyzed in parallel.
+class CanEventStore {
+public:
+  CanEventStore();
+  bool loadRoute(const QString &route, const QString &data_dir = {}, bool use_qlog = false, std::atomic<bool> *abort = nullptr);
+  bool loadLog(const std::string &file, std::atomic<bool> *abort = nullptr);
+  void addEvents(const std::vector<const CanEvent *> &events);
+  const CanEvent *newEvent(uint64_t mono_time, uint8_t src, uint32_t address, const uint8_t *dat, uint8_t size);
+
+  inline uint64_t routeStartTime() const { return route_start_time_; }
+  inline const std::vector<const CanEvent *> &allEvents() const { return all_events_; }
+  inline const MessageEventsMap &eventsMap() const { return events_; }
+  const std::vector<const CanEvent *> &events(const MessageId &id) const;
+  std::set<uint8_t> sources() const;
+
+private:
+  void mergeLog(const LogReader &log);
+
+  uint64_t route_start_time_ = 0;
+  std::vector<const CanEvent *> all_events_;
+  MessageEventsMap events_;
+  std::unique_ptr<MonotonicBuffer> buffer_;
+};
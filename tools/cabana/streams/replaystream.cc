@@ -8,6 +8,7 @@
 
 #include "common/timing.h"
 #include "tools/cabana/streams/routes.h"
+#include "tools/cabana/streams/snapshot.h"
 
 ReplayStream::ReplayStream(QObject *parent) : AbstractStream(parent) {
   unsetenv("ZMQ");
@@ -44,6 +45,65 @@ void ReplayStream::mergeSegments() {
         }
       }
       mergeEvents(new_events);
+      snapshot_outdated = true;
+    }
+  }
+}
+
+void ReplayStream::loadSnapshot() {
+  if (settings.snapshot_cache_mb <= 0) return;
+
+  auto snapshot = SessionSnapshot::load(snapshotPath());
+  if (!snapshot) return;
+
+  // Segments in the snapshot are already in the event store, their CAN events aren't merged again when they are
+  // loaded. Replay still loads their logs, it needs them for the video and for seeking.
+  for (int n : snapshot->segments()) {
+    if (replay->segments().count(n)) processed_segments.insert(n);
+  }
+  {
+    std::lock_guard lk(thumbnails_mutex);
+    thumbnails.insert(snapshot->thumbnails().begin(), snapshot->thumbnails().end());
+  }
+  attachSnapshot(std::move(snapshot));
+}
+
+void ReplayStream::saveSnapshot() {
+  if (settings.snapshot_cache_mb <= 0 || !snapshot_outdated || all_events_.empty()) return;
+
+  SessionSnapshot::Data data = {.route_start_time = replay->routeStartTime(), .events = all_events_, .segments = processed_segments};
+  {
+    std::lock_guard lk(thumbnails_mutex);
+    data.thumbnails = thumbnails;
+  }
+  for (auto f : dbc()->allDBCFiles()) {
+    if (f->isEmpty()) continue;
+    data.dbcs.push_back({.sources = dbc()->sources(f), .name = f->name(), .filename = f->filename, .content = f->generateDBC()});
+  }
+  if (SessionSnapshot::save(snapshotPath(), data)) {
+    snapshot_outdated = false;
+  }
+  SessionSnapshot::evict((qint64)settings.snapshot_cache_mb * 1024 * 1024);
+}
+
+// One snapshot per segment range, a snapshot of the whole route has the events of segments outside of route/2:4.
+QString ReplayStream::snapshotPath() const {
+  const auto &segments = replay->segments();
+  return SessionSnapshot::pathForRoute(QString("%1--%2-%3").arg(routeName()).arg(segments.begin()->first).arg(segments.rbegin()->first));
+}
+
+// Called from the qlog loading thread, only keeps the raw jpeg data.
+void ReplayStream::collectThumbnails(std::shared_ptr<LogReader> qlog) {
+  std::lock_guard lk(thumbnails_mutex);
+  for (const Event &e : qlog->events) {
+    if (e.which == cereal::Event::Which::THUMBNAIL) {
+      capnp::FlatArrayMessageReader reader(e.data);
+      auto thumb = reader.getRoot<cereal::Event>().getThumbnail();
+      if (!thumbnails.count(thumb.getTimestampEof())) {
+        auto data = thumb.getThumbnail();
+        thumbnails[thumb.getTimestampEof()] = QByteArray((const char *)data.begin(), data.size());
+        snapshot_outdated = true;
+      }
     }
   }
 }
@@ -56,7 +116,12 @@ bool ReplayStream::loadRoute(const QString &route, const QString &data_dir, uint
   QObject::connect(replay.get(), &Replay::seeking, this, &AbstractStream::seeking);
   QObject::connect(replay.get(), &Replay::seekedTo, this, &AbstractStream::seekedTo);
   QObject::connect(replay.get(), &Replay::segmentsMerged, this, &ReplayStream::mergeSegments);
-  return replay->load();
+  QObject::connect(replay.get(), &Replay::qLogLoaded, this, &ReplayStream::collectThumbnails, Qt::DirectConnection);
+  bool success = replay->load();
+  if (success) {
+    loadSnapshot();
+  }
+  return success;
 }
 
 void ReplayStream::start() {
@@ -67,7 +132,17 @@ void ReplayStream::start() {
 void ReplayStream::stop() {
   if (replay) {
     replay->stop();
+    saveSnapshot();
+  }
+}
+
+double ReplayStream::routeStartTime() const {
+  // The route start time is unknown until the first segment is loaded, use the one from the snapshot until then.
+  uint64_t start_time = replay->routeStartTime();
+  if (start_time == 0 && snapshot()) {
+    start_time = snapshot()->routeStartTime();
   }
+  return start_time / (double)1e9;
 }
 
 bool ReplayStream::eventFilter(const Event *event) {
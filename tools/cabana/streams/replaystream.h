@@ -2,7 +2,10 @@
 
 #include <QCheckBox>
 #include <algorithm>
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <vector>
 
@@ -25,7 +28,7 @@ public:
   inline QString carFingerprint() const override { return replay->carFingerprint().c_str(); }
   double totalSeconds() const override { return replay->totalSeconds(); }
   inline QDateTime beginDateTime() const { return replay->routeDateTime(); }
-  inline double routeStartTime() const override { return replay->routeStartTime() / (double)1e9; }
+  double routeStartTime() const override;
   inline const Route *route() const { return replay->route(); }
   inline void setSpeed(float speed) override { replay->setSpeed(speed); }
   inline float getSpeed() const { return replay->getSpeed(); }
@@ -36,8 +39,15 @@ public:
 
 private:
   void mergeSegments();
+  void loadSnapshot();
+  void saveSnapshot();
+  QString snapshotPath() const;
+  void collectThumbnails(std::shared_ptr<LogReader> qlog);
   std::unique_ptr<Replay> replay = nullptr;
   std::set<int> processed_segments;
+  std::atomic<bool> snapshot_outdated = false;
+  std::mutex thumbnails_mutex;
+  std::map<uint64_t, QByteArray> thumbnails;
   std::unique_ptr<OpenpilotPrefix> op_prefix;
 };
 
@@ -0,0 +1,276 @@
+#include "tools/cabana/streams/snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace {
+
+// File layout: a Header followed by 8-byte aligned sections. All integers are stored in host byte order.
+constexpr char SNAPSHOT_MAGIC[8] = {'C', 'A', 'B', 'S', 'N', 'A', 'P', '\0'};
+constexpr size_t WRITE_CHUNK_SIZE = 4 * 1024 * 1024;
+
+struct Section {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct BlobRef {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t can_event_size;
+  uint64_t route_start_time;
+  uint64_t file_size;
+  Section events;         // CanEvent records, each aligned to 8 bytes
+  Section event_offsets;  // uint64_t offset of each record in the events section, in time order
+  Section messages;       // MessageEntry
+  Section indices;        // uint32_t event indices of each message
+  Section thumbnails;     // ThumbnailEntry
+  Section dbcs;           // DBCEntry
+  Section segments;       // int32_t segment numbers covered by the events
+  Section blob;           // variable sized data referenced by BlobRef
+};
+
+struct MessageEntry {
+  uint32_t address;
+  uint32_t source;
+  uint64_t first_index;
+  uint64_t count;
+};
+
+struct ThumbnailEntry {
+  uint64_t mono_time;
+  BlobRef data;
+};
+
+struct DBCEntry {
+  BlobRef sources;  // int32_t
+  BlobRef name;
+  BlobRef filename;
+  BlobRef content;
+};
+
+inline uint64_t align8(uint64_t n) { return (n + 7) & ~7ull; }
+inline uint64_t eventRecordSize(const CanEvent *e) { return align8(sizeof(CanEvent) + e->size); }
+
+class BlobWriter {
+public:
+  BlobRef add(const void *data, size_t size) {
+    BlobRef ref = {.offset = (uint64_t)blob.size(), .size = size};
+    blob.append((const char *)data, size);
+    blob.append(QByteArray(align8(blob.size()) - blob.size(), '\0'));
+    return ref;
+  }
+  BlobRef add(const QString &str) {
+    QByteArray utf8 = str.toUtf8();
+    return add(utf8.constData(), utf8.size());
+  }
+  QByteArray blob;
+};
+
+}  // namespace
+
+static QString snapshotDir() {
+  return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/snapshots";
+}
+
+QString SessionSnapshot::pathForRoute(const QString &route_name) {
+  QString dir = snapshotDir();
+  QDir().mkpath(dir);
+  QString name = route_name;
+  name.replace('|', '_').replace('/', '_');
+  return dir + "/" + name + ".snapshot";
+}
+
+bool SessionSnapshot::save(const QString &fn, const Data &data) {
+  // Build per-message indices and the variable sized data.
+  std::map<MessageId, std::vector<uint32_t>> msg_indices;
+  uint64_t events_size = 0;
+  for (size_t i = 0; i < data.events.size(); ++i) {
+    const CanEvent *e = data.events[i];
+    msg_indices[{.source = e->src, .address = e->address}].push_back(i);
+    events_size += eventRecordSize(e);
+  }
+
+  std::vector<MessageEntry> messages;
+  std::vector<uint32_t> indices;
+  indices.reserve(data.events.size());
+  for (const auto &[id, idx] : msg_indices) {
+    messages.push_back({.address = id.address, .source = id.source, .first_index = indices.size(), .count = idx.size()});
+    indices.insert(indices.end(), idx.begin(), idx.end());
+  }
+
+  BlobWriter blob;
+  std::vector<ThumbnailEntry> thumbnails;
+  for (const auto &[mono_time, jpeg] : data.thumbnails) {
+    thumbnails.push_back({.mono_time = mono_time, .data = blob.add(jpeg.constData(), jpeg.size())});
+  }
+  std::vector<DBCEntry> dbcs;
+  for (const auto &d : data.dbcs) {
+    std::vector<int32_t> sources(d.sources.begin(), d.sources.end());
+    dbcs.push_back({.sources = blob.add(sources.data(), sources.size() * sizeof(int32_t)),
+                    .name = blob.add(d.name),
+                    .filename = blob.add(d.filename),
+                    .content = blob.add(d.content)});
+  }
+  std::vector<int32_t> segments(data.segments.begin(), data.segments.end());
+
+  Header header = {};
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version = VERSION;
+  header.can_event_size = sizeof(CanEvent);
+  header.route_start_time = data.route_start_time;
+  uint64_t offset = align8(sizeof(Header));
+  auto section = [&offset](uint64_t size) {
+    Section s = {.offset = offset, .size = size};
+    offset = align8(offset + size);
+    return s;
+  };
+  header.events = section(events_size);
+  header.event_offsets = section(data.events.size() * sizeof(uint64_t));
+  header.messages = section(messages.size() * sizeof(MessageEntry));
+  header.indices = section(indices.size() * sizeof(uint32_t));
+  header.thumbnails = section(thumbnails.size() * sizeof(ThumbnailEntry));
+  header.dbcs = section(dbcs.size() * sizeof(DBCEntry));
+  header.segments = section(segments.size() * sizeof(int32_t));
+  header.blob = section(blob.blob.size());
+  header.file_size = offset;
+
+  QSaveFile file(fn);
+  if (!file.open(QIODevice::WriteOnly)) {
+    qWarning() << "failed to write snapshot" << fn << file.errorString();
+    return false;
+  }
+
+  QByteArray buf;
+  buf.reserve(WRITE_CHUNK_SIZE);
+  auto flush = [&]() {
+    file.write(buf);
+    buf.clear();
+  };
+  auto write = [&](const Section &s, const void *p, size_t size) {
+    buf.append(QByteArray(s.offset - (file.pos() + buf.size()), '\0'));
+    buf.append((const char *)p, size);
+    if (buf.size() >= WRITE_CHUNK_SIZE) flush();
+  };
+
+  buf.append((const char *)&header, sizeof(header));
+  std::vector<uint64_t> event_offsets;
+  event_offsets.reserve(data.events.size());
+  uint64_t event_offset = 0;
+  for (const CanEvent *e : data.events) {
+    event_offsets.push_back(event_offset);
+    write({.offset = header.events.offset + event_offset}, e, sizeof(CanEvent) + e->size);
+    event_offset += eventRecordSize(e);
+  }
+  write(header.event_offsets, event_offsets.data(), event_offsets.size() * sizeof(uint64_t));
+  write(header.messages, messages.data(), messages.size() * sizeof(MessageEntry));
+  write(header.indices, indices.data(), indices.size() * sizeof(uint32_t));
+  write(header.thumbnails, thumbnails.data(), thumbnails.size() * sizeof(ThumbnailEntry));
+  write(header.dbcs, dbcs.data(), dbcs.size() * sizeof(DBCEntry));
+  write(header.segments, segments.data(), segments.size() * sizeof(int32_t));
+  write(header.blob, blob.blob.constData(), blob.blob.size());
+  buf.append(QByteArray(header.file_size - (file.pos() + buf.size()), '\0'));
+  flush();
+  return file.commit();
+}
+
+std::unique_ptr<SessionSnapshot> SessionSnapshot::load(const QString &fn) {
+  std::unique_ptr<SessionSnapshot> snapshot(new SessionSnapshot());
+  snapshot->file_.setFileName(fn);
+  if (!snapshot->file_.open(QIODevice::ReadOnly)) {
+    return nullptr;
+  }
+
+  snapshot->size_ = snapshot->file_.size();
+  snapshot->data_ = snapshot->file_.map(0, snapshot->size_);
+  if (!snapshot->data_ || !snapshot->parse()) {
+    qWarning() << "invalid snapshot" << fn;
+    return nullptr;
+  }
+  // the modification time orders snapshots for eviction
+  QFile(fn).setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+  return snapshot;
+}
+
+void SessionSnapshot::evict(qint64 max_bytes) {
+  QFileInfoList files = QDir(snapshotDir()).entryInfoList({"*.snapshot"}, QDir::Files, QDir::Time);  // newest first
+  qint64 total = 0;
+  for (const QFileInfo &f : files) {
+    total += f.size();
+    if (total > max_bytes) {
+      QFile::remove(f.absoluteFilePath());
+    }
+  }
+}
+
+bool SessionSnapshot::parse() {
+  if (size_ < (qint64)sizeof(Header)) return false;
+
+  const Header *h = (const Header *)data_;
+  if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || h->version != VERSION ||
+      h->can_event_size != sizeof(CanEvent) || h->file_size != (uint64_t)size_) {
+    return false;
+  }
+  for (const Section &s : {h->events, h->event_offsets, h->messages, h->indices, h->thumbnails, h->dbcs, h->segments, h->blob}) {
+    if (s.offset % 8 != 0 || s.offset > h->file_size || s.size > h->file_size - s.offset) return false;
+  }
+
+  route_start_time_ = h->route_start_time;
+  events_begin_ = data_ + h->events.offset;
+  event_offsets_ = (const uint64_t *)(data_ + h->event_offsets.offset);
+  event_count_ = h->event_offsets.size / sizeof(uint64_t);
+  for (size_t i = 0; i < event_count_; ++i) {
+    if (event_offsets_[i] % 8 != 0 || event_offsets_[i] + sizeof(CanEvent) > h->events.size ||
+        event_offsets_[i] + sizeof(CanEvent) + event(i)->size > h->events.size) {
+      return false;
+    }
+  }
+
+  const uint32_t *indices = (const uint32_t *)(data_ + h->indices.offset);
+  const size_t index_count = h->indices.size / sizeof(uint32_t);
+  const MessageEntry *msgs = (const MessageEntry *)(data_ + h->messages.offset);
+  for (size_t i = 0; i < h->messages.size / sizeof(MessageEntry); ++i) {
+    const auto &m = msgs[i];
+    if (m.first_index > index_count || m.count > index_count - m.first_index) return false;
+    if (std::any_of(indices + m.first_index, indices + m.first_index + m.count, [this](uint32_t idx) { return idx >= event_count_; })) {
+      return false;
+    }
+    messages_.push_back({.id = {.source = (uint8_t)m.source, .address = m.address}, .indices = indices + m.first_index, .count = m.count});
+  }
+
+  const char *blob = (const char *)(data_ + h->blob.offset);
+  auto valid = [h](const BlobRef &r) { return r.offset <= h->blob.size && r.size <= h->blob.size - r.offset; };
+  auto str = [blob](const BlobRef &r) { return QString::fromUtf8(blob + r.offset, r.size); };
+
+  const ThumbnailEntry *thumbnails = (const ThumbnailEntry *)(data_ + h->thumbnails.offset);
+  for (size_t i = 0; i < h->thumbnails.size / sizeof(ThumbnailEntry); ++i) {
+    if (!valid(thumbnails[i].data)) return false;
+    thumbnails_[thumbnails[i].mono_time] = QByteArray::fromRawData(blob + thumbnails[i].data.offset, thumbnails[i].data.size);
+  }
+
+  const DBCEntry *dbcs = (const DBCEntry *)(data_ + h->dbcs.offset);
+  for (size_t i = 0; i < h->dbcs.size / sizeof(DBCEntry); ++i) {
+    const auto &d = dbcs[i];
+    if (!valid(d.sources) || !valid(d.name) || !valid(d.filename) || !valid(d.content)) return false;
+    const int32_t *sources = (const int32_t *)(blob + d.sources.offset);
+    dbcs_.push_back({.sources = SourceSet(sources, sources + d.sources.size / sizeof(int32_t)),
+                     .name = str(d.name),
+                     .filename = str(d.filename),
+                     .content = str(d.content)});
+  }
+
+  const int32_t *segments = (const int32_t *)(data_ + h->segments.offset);
+  segments_.insert(segments, segments + h->segments.size / sizeof(int32_t));
+  return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include "tools/cabana/streams/abstractstream.h"
+
+// SessionSnapshot is a versioned file holding the already-built CAN event store of a route.
+// CAN events are stored in the in-memory CanEvent layout, so a stream can use them directly
+// from the memory mapped file instead of downloading and parsing the logs again.
+class SessionSnapshot {
+public:
+  static constexpr uint32_t VERSION = 1;
+
+  struct DBCAssignment {
+    SourceSet sources;
+    QString name;
+    QString filename;
+    QString content;
+  };
+
+  struct Data {
+    uint64_t route_start_time = 0;
+    std::vector<const CanEvent *> events;
+    std::set<int> segments;
+    std::map<uint64_t, QByteArray> thumbnails;
+    std::vector<DBCAssignment> dbcs;
+  };
+
+  struct MessageIndex {
+    MessageId id;
+    const uint32_t *indices;
+    size_t count;
+  };
+
+  static QString pathForRoute(const QString &route_name);
+  static bool save(const QString &fn, const Data &data);
+  // loading a snapshot marks it as recently used
+  static std::unique_ptr<SessionSnapshot> load(const QString &fn);
+  // deletes the least recently used snapshots until they take at most max_bytes
+  static void evict(qint64 max_bytes);
+
+  inline uint64_t routeStartTime() const { return route_start_time_; }
+  inline size_t eventCount() const { return event_count_; }
+  inline const CanEvent *event(size_t i) const { return (const CanEvent *)(events_begin_ + event_offsets_[i]); }
+  inline const std::vector<MessageIndex> &messages() const { return messages_; }
+  inline const std::set<int> &segments() const { return segments_; }
+  // thumbnails are raw jpeg data referencing the mapped file.
+  inline const std::map<uint64_t, QByteArray> &thumbnails() const { return thumbnails_; }
+  inline const std::vector<DBCAssignment> &dbcs() const { return dbcs_; }
+
+private:
+  SessionSnapshot() = default;
+  bool parse();
+
+  QFile file_;
+  const uchar *data_ = nullptr;
+  qint64 size_ = 0;
+
+  uint64_t route_start_time_ = 0;
+  const uchar *events_begin_ = nullptr;
+  const uint64_t *event_offsets_ = nullptr;
+  size_t event_count_ = 0;
+  std::vector<MessageIndex> messages_;
+  std::set<int> segments_;
+  std::map<uint64_t, QByteArray> thumbnails_;
+  std::vector<DBCAssignment> dbcs_;
+};
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <numeric>
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "tools/cabana/chart/chart.h"
+#include "tools/cabana/chart/chartswidget.h"
+#include "tools/cabana/messageswidget.h"
+#include "tools/cabana/streams/abstractstream.h"
+#include "tools/cabana/tests/workload.h"
+
+// Replays a synthetic workload through the stream, message list and chart code paths
+// (offscreen), and reports throughput and latency percentiles of each stage.
+
+class BenchStream : public AbstractStream {
+public:
+  BenchStream(QObject *parent) : AbstractStream(parent) {}
+  void start() override { emit streamStarted(); }
+  bool liveStreaming() const override { return false; }
+  QString routeName() const override { return "bench"; }
+  double routeStartTime() const override { return start_time; }
+  void updateLastMessages() {
+    emit privateUpdateLastMsgsSignal();
+    QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+  }
+  using AbstractStream::mergeEvents;
+  using AbstractStream::updateEvent;
+
+  double start_time = 0;
+};
+
+struct Stage {
+  std::vector<double> latencies;  // us
+  size_t items = 0;
+
+  template <class Func>
+  void run(size_t n, Func &&func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    items += n;
+  }
+
+  QJsonObject report(const QString &name, const QString &unit) {
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [this](double p) { return latencies.empty() ? 0 : latencies[std::min<size_t>(latencies.size() - 1, p * latencies.size())]; };
+    const double total_us = std::accumulate(latencies.begin(), latencies.end(), 0.0);
+    QJsonObject r{{"stage", name}, {"calls", (qint64)latencies.size()}, {"items", (qint64)items}, {"total_ms", total_us / 1000},
+                  {"throughput", total_us > 0 ? items / (total_us / 1e6) : 0}, {"unit", unit},
+                  {"p50_us", percentile(0.5)}, {"p90_us", percentile(0.9)}, {"p99_us", percentile(0.99)},
+                  {"max_us", latencies.empty() ? 0 : latencies.back()}};
+    printf("%-22s %8zu calls %12.0f %s/s   p50 %10.1fus  p90 %10.1fus  p99 %10.1fus  max %10.1fus\n", qPrintable(name),
+           latencies.size(), r["throughput"].toDouble(), qPrintable(unit), percentile(0.5), percentile(0.9), percentile(0.99),
+           r["max_us"].toDouble());
+    return r;
+  }
+};
+
+int main(int argc, char *argv[]) {
+  setenv("QT_QPA_PLATFORM", "offscreen", 0);
+  QApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("cabana benchmark on synthetic CAN traffic");
+  parser.addHelpOption();
+  parser.addOption({"buses", "number of buses", "n", "3"});
+  parser.addOption({"messages", "messages per bus", "n", "100"});
+  parser.addOption({"min-hz", "min message rate", "hz", "1"});
+  parser.addOption({"max-hz", "max message rate", "hz", "100"});
+  parser.addOption({"size", "message size, each 2 bytes carry a 16 bit signal", "bytes", "8"});
+  parser.addOption({"duration", "route length", "seconds", "300"});
+  parser.addOption({"segment", "segment length", "seconds", "60"});
+  parser.addOption({"out-of-order", "fraction of segments delivered out of order", "ratio", "0.25"});
+  parser.addOption({"seed", "random seed", "seed", "1"});
+  parser.addOption({"charts", "number of charted signals", "n", "8"});
+  parser.addOption({"json", "write results as json to <file>", "file"});
+  parser.process(app);
+
+  WorkloadConfig config{
+      .buses = std::clamp(parser.value("buses").toInt(), 1, 256),
+      .messages_per_bus = parser.value("messages").toInt(),
+      .min_hz = parser.value("min-hz").toDouble(),
+      .max_hz = parser.value("max-hz").toDouble(),
+      .msg_size = std::clamp(parser.value("size").toInt(), 2, 64),
+      .duration_sec = parser.value("duration").toDouble(),
+      .segment_sec = parser.value("segment").toDouble(),
+      .out_of_order = parser.value("out-of-order").toDouble(),
+      .seed = parser.value("seed").toUInt(),
+  };
+  CanWorkload workload(config);
+  printf("workload: %zu messages, %zu events in %zu segments\n", workload.messages().size(), workload.eventCount(),
+         workload.segments().size());
+
+  BenchStream *stream = new BenchStream(&app);
+  stream->start_time = config.start_mono_time / 1e9;
+  stream->start();
+
+  QString error;
+  if (!dbc()->open(SOURCE_ALL, "bench", workload.generateDBC(), &error)) {
+    fprintf(stderr, "failed to open dbc: %s\n", qPrintable(error));
+    return 1;
+  }
+
+  MessageListModel message_model(nullptr);
+  message_model.dbcModified();
+
+  ChartsWidget charts_widget;
+  std::vector<ChartView *> charts;
+  const int num_charts = std::min<int>(parser.value("charts").toInt(), workload.messages().size());
+  for (int i = 0; i < num_charts; ++i) {
+    const auto &id = workload.messages()[i * workload.messages().size() / num_charts].id;
+    auto msg = dbc()->msg(id);
+    auto chart = new ChartView({0, config.duration_sec}, &charts_widget);
+    chart->addSignal(id, msg->sigs[i % msg->sigs.size()]);
+    charts.push_back(chart);
+  }
+
+  const MessageEventsMap *merged_events = nullptr;
+  QObject::connect(stream, &AbstractStream::eventsMerged, [&](const MessageEventsMap &events_map) { merged_events = &events_map; });
+
+  Stage merge, update_event, update_last_msgs, filter_sort, update_series, rebuild_series;
+  for (const auto &segment : workload.segments()) {
+    merge.run(segment.size(), [&]() { stream->mergeEvents(segment); });
+    if (merged_events) {
+      for (auto c : charts) {
+        update_series.run(segment.size(), [&]() { c->updateSeries(nullptr, merged_events); });
+      }
+      merged_events = nullptr;
+    }
+
+    // feed events in batches, like a live stream does between two UI updates
+    const size_t batch_size = std::max<size_t>(1, segment.size() / (config.segment_sec * settings.fps));
+    for (size_t i = 0; i < segment.size(); i += batch_size) {
+      const size_t n = std::min(batch_size, segment.size() - i);
+      update_event.run(n, [&]() {
+        for (size_t j = i; j < i + n; ++j) {
+          auto e = segment[j];
+          stream->updateEvent({.source = e->src, .address = e->address}, e->mono_time / 1e9 - stream->start_time, e->dat, e->size);
+        }
+      });
+      update_last_msgs.run(n, [&]() { stream->updateLastMessages(); });
+    }
+    filter_sort.run(stream->lastMessages().size(), [&]() { message_model.filterAndSort(); });
+  }
+  for (auto c : charts) {
+    rebuild_series.run(stream->allEvents().size(), [&]() { c->updateSeries(); });
+  }
+
+  QJsonArray results = {
+      merge.report("mergeEvents", "events"),
+      update_event.report("updateEvent", "events"),
+      update_last_msgs.report("updateLastMessages", "events"),
+      filter_sort.report("filterAndSort", "msgs"),
+      update_series.report("updateSeries", "events"),
+      rebuild_series.report("updateSeries (full)", "events"),
+  };
+
+  if (parser.isSet("json")) {
+    QFile file(parser.value("json"));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      fprintf(stderr, "failed to write %s\n", qPrintable(parser.value("json")));
+      return 1;
+    }
+    file.write(QJsonDocument(QJsonObject{{"events", (qint64)workload.eventCount()}, {"stages", results}}).toJson());
+  }
+  return 0;
+}
@@ -1,9 +1,18 @@
 
 #undef INFO
+#include <algorithm>
+
+#include <QDateTime>
 #include <QDir>
+#include <QStandardPaths>
+#include <QTemporaryDir>
 
 #include "catch2/catch.hpp"
 #include "tools/cabana/dbc/dbcmanager.h"
+#include "tools/cabana/streams/eventstore.h"
+#include "tools/cabana/streams/snapshot.h"
+#include "tools/cabana/tools/analysis.h"
+#include "tools/cabana/tools/bitstats.h"
 
 const std::string TEST_RLOG_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/rlog.bz2";
 
@@ -155,3 +164,185 @@ TEST_CASE("parse_opendbc") {
   INFO(errors.join("\n").toStdString());
   REQUIRE(errors.empty());
 }
+
+TEST_CASE("SessionSnapshot") {
+  MonotonicBuffer buffer(1024);
+  SessionSnapshot::Data data = {.route_start_time = 1000, .segments = {0, 1}};
+  for (int i = 0; i < 100; ++i) {
+    const uint8_t size = i % 9;
+    CanEvent *e = (CanEvent *)buffer.allocate(sizeof(CanEvent) + size);
+    e->src = i % 3;
+    e->address = 0x100 + i % 5;
+    e->mono_time = 1000 + i;
+    e->size = size;
+    for (int j = 0; j < size; ++j) e->dat[j] = i + j;
+    data.events.push_back(e);
+  }
+  data.thumbnails[1050] = QByteArray("jpeg");
+  data.dbcs.push_back({.sources = {0, 128, 192}, .name = "test", .filename = "", .content = "BO_ 256 message_1: 8 EON\n"});
+
+  QTemporaryDir dir;
+  QString fn = dir.filePath("test.snapshot");
+  REQUIRE(SessionSnapshot::save(fn, data));
+
+  auto snapshot = SessionSnapshot::load(fn);
+  REQUIRE(snapshot != nullptr);
+  REQUIRE(snapshot->routeStartTime() == 1000);
+  REQUIRE(snapshot->segments() == data.segments);
+  REQUIRE(snapshot->eventCount() == data.events.size());
+  for (size_t i = 0; i < data.events.size(); ++i) {
+    const CanEvent *e = snapshot->event(i), *expected = data.events[i];
+    REQUIRE(e->src == expected->src);
+    REQUIRE(e->address == expected->address);
+    REQUIRE(e->mono_time == expected->mono_time);
+    REQUIRE(e->size == expected->size);
+    REQUIRE(memcmp(e->dat, expected->dat, e->size) == 0);
+  }
+
+  size_t indexed_events = 0;
+  for (const auto &m : snapshot->messages()) {
+    for (size_t i = 0; i < m.count; ++i) {
+      const CanEvent *e = snapshot->event(m.indices[i]);
+      REQUIRE(e->src == m.id.source);
+      REQUIRE(e->address == m.id.address);
+    }
+    indexed_events += m.count;
+  }
+  REQUIRE(indexed_events == data.events.size());
+
+  REQUIRE(snapshot->thumbnails().at(1050) == "jpeg");
+  REQUIRE(snapshot->dbcs().size() == 1);
+  REQUIRE(snapshot->dbcs()[0].sources == data.dbcs[0].sources);
+  REQUIRE(snapshot->dbcs()[0].content == data.dbcs[0].content);
+
+  // reject truncated files
+  QFile::resize(fn, QFileInfo(fn).size() - 8);
+  REQUIRE(SessionSnapshot::load(fn) == nullptr);
+}
+
+TEST_CASE("SessionSnapshot::evict") {
+  QStandardPaths::setTestModeEnabled(true);
+  // the least recently used go first
+  const QDateTime now = QDateTime::currentDateTime();
+  const QStringList routes = {"oldest", "older", "newest"};
+  for (int i = 0; i < routes.size(); ++i) {
+    QFile f(SessionSnapshot::pathForRoute(routes[i]));
+    REQUIRE(f.open(QIODevice::WriteOnly));
+    f.write(QByteArray(1000, 'x'));
+    f.setFileTime(now.addSecs(i - 10), QFileDevice::FileModificationTime);
+  }
+  SessionSnapshot::evict(2500);
+  REQUIRE(!QFile::exists(SessionSnapshot::pathForRoute("oldest")));
+  REQUIRE(QFile::exists(SessionSnapshot::pathForRoute("older")));
+  REQUIRE(QFile::exists(SessionSnapshot::pathForRoute("newest")));
+  SessionSnapshot::evict(0);
+  REQUIRE(!QFile::exists(SessionSnapshot::pathForRoute("newest")));
+  QStandardPaths::setTestModeEnabled(false);
+}
+
+TEST_CASE("analysis") {
+  CanEventStore store;
+  std::vector<const CanEvent *> events;
+  for (uint8_t i = 0; i < 200; ++i) {
+    uint8_t dat[] = {i, (uint8_t)(i & 1 ? 0x80 : 0)};
+    events.push_back(store.newEvent((i + 1) * 1000, 0, 0x100, dat, sizeof(dat)));
+    uint8_t mirror[] = {(uint8_t)(i & 1 ? 0x80 : 0)};
+    events.push_back(store.newEvent((i + 1) * 1000 + 10, 1, 0x200, mirror, sizeof(mirror)));
+  }
+  store.addEvents(events);
+  REQUIRE(store.allEvents().size() == 400);
+  REQUIRE(store.events({.source = 0, .address = 0x100}).size() == 200);
+
+  SECTION("searchSignals") {
+    analysis::SearchConfig config;
+    config.buses = {0};
+    auto candidates = analysis::initialSignals(store.eventsMap(), config);
+    REQUIRE(candidates.size() == 9);  // 8-bit signals in a 16-bit message
+    candidates = analysis::searchSignals(store.eventsMap(), candidates, [](double v) { return v == 150; }, 0);
+    REQUIRE(candidates.size() > 0);
+    REQUIRE(std::any_of(candidates.begin(), candidates.end(), [](auto &s) { return s.sig.start_bit == 0; }));
+  }
+
+  SECTION("findSimilarBits") {
+    // bit 7 of byte 1 on bus 0 is mirrored in bit 7 of byte 0 on bus 1
+    auto bits = analysis::findSimilarBits(store.allEvents(), 0, 0x100, 1, 0, 1, true, 100);
+    REQUIRE(bits.size() > 0);
+    REQUIRE(bits[0].address == 0x200);
+    REQUIRE(bits[0].byte_idx == 0);
+    REQUIRE(bits[0].bit_idx == 0);
+    REQUIRE(bits[0].mismatches == 0);
+  }
+}
+
+TEST_CASE("BitStatsIndex") {
+  CanEventStore store;
+  std::vector<const CanEvent *> events;
+  for (int i = 0; i < 1000; ++i) {
+    uint8_t dat[] = {(uint8_t)i, (uint8_t)(i * 7)};
+    events.push_back(store.newEvent(i * 1000, 0, 0x100, dat, sizeof(dat)));
+  }
+  BitStatsIndex index(events);
+  REQUIRE(index.bitCount() == 16);
+
+  auto brute_force = [&](size_t first, size_t last) {
+    std::vector<BitStatsIndex::BitStats> stats(16);
+    for (size_t i = first; i < last; ++i) {
+      for (int b = 0; b < 16; ++b) {
+        int bit = (events[i]->dat[b / 8] >> (7 - b % 8)) & 1;
+        stats[b].ones += bit;
+        stats[b].count += 1;
+        if (i > first) {
+          stats[b].flips += bit != ((events[i - 1]->dat[b / 8] >> (7 - b % 8)) & 1);
+        }
+      }
+    }
+    return stats;
+  };
+
+  for (auto [first, last] : {std::pair{0, 1000}, {0, 1}, {3, 17}, {16, 32}, {15, 16}, {123, 987}, {999, 1000}}) {
+    auto stats = index.query(first, last);
+    auto expected = brute_force(first, last);
+    REQUIRE(stats.size() == expected.size());
+    for (int b = 0; b < 16; ++b) {
+      REQUIRE(stats[b].ones == expected[b].ones);
+      REQUIRE(stats[b].flips == expected[b].flips);
+      REQUIRE(stats[b].count == expected[b].count);
+    }
+  }
+
+  // the lsb of byte 0 toggles on every event
+  auto stats = index.queryTime(10000, 19000);
+  REQUIRE(stats[7].count == 10);
+  REQUIRE(stats[7].flips == 9);
+  REQUIRE(stats[7].dutyCycle() == 0.5);
+  REQUIRE(stats[7].entropy() == 1.0);
+  REQUIRE(index.query(10, 10).empty());
+
+  SECTION("merged events") {
+    // merge events into the middle and at the end, with a wider message at the end
+    std::vector<const CanEvent *> merged = events;
+    for (int i = 0; i < 40; ++i) {
+      uint8_t dat[] = {(uint8_t)(i * 3), (uint8_t)i};
+      merged.push_back(store.newEvent(500000 + i * 10 + 5, 0, 0x100, dat, sizeof(dat)));
+    }
+    std::stable_sort(merged.begin(), merged.end(), [](auto l, auto r) { return l->mono_time < r->mono_time; });
+    for (int wide : {0, 1}) {
+      if (wide) {
+        uint8_t dat[] = {0xff, 0xff, 0xff};
+        merged.push_back(store.newEvent(2000000, 0, 0x100, dat, sizeof(dat)));
+      }
+      BitStatsIndex updated(merged, index, 500000);
+      BitStatsIndex rebuilt(merged);
+      REQUIRE(updated.size() == rebuilt.size());
+      REQUIRE(updated.bitCount() == rebuilt.bitCount());
+      for (auto [first, last] : {std::pair<size_t, size_t>{0, merged.size()}, {0, 500}, {490, 560}, {511, 512}, {100, 1040}}) {
+        auto a = updated.query(first, last), b = rebuilt.query(first, last);
+        REQUIRE(a.size() == b.size());
+        for (size_t i = 0; i < a.size(); ++i) {
+          REQUIRE(a[i].ones == b[i].ones);
+          REQUIRE(a[i].flips == b[i].flips);
+        }
+      }
+    }
+  }
+}
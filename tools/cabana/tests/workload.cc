@@ -0,0 +1,93 @@
+#include "tools/cabana/tests/workload.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include <QTextStream>
+
+CanWorkload::CanWorkload(const WorkloadConfig &cfg) : config(cfg) {
+  buffer_ = std::make_unique<MonotonicBuffer>(6 * 1024 * 1024);
+  std::mt19937 rng(config.seed);
+
+  // log-uniform rates, like the mix of 1Hz status and 100Hz control messages on a real bus
+  std::uniform_real_distribution<double> rate_dist(std::log(config.min_hz), std::log(config.max_hz));
+  for (int bus = 0; bus < config.buses; ++bus) {
+    for (int i = 0; i < config.messages_per_bus; ++i) {
+      // unique across buses, the SOURCE_ALL dbc defines every message once
+      uint32_t address = 0x100 + i * config.buses + bus;
+      messages_.push_back({.id = {.source = (uint8_t)bus, .address = address},
+                           .hz = std::exp(rate_dist(rng)),
+                           .name = QString("MSG_%1_%2").arg(bus).arg(address, 0, 16)});
+    }
+  }
+
+  struct State {
+    uint64_t next_time;
+    uint64_t interval;
+    uint16_t counter = 0;
+    int32_t walk = 0x8000;
+  };
+  std::vector<State> states;
+  std::uniform_int_distribution<uint64_t> phase_dist(0, 1e9);
+  for (const auto &m : messages_) {
+    uint64_t interval = 1e9 / m.hz;
+    states.push_back({.next_time = config.start_mono_time + phase_dist(rng) % interval, .interval = interval});
+  }
+
+  const uint64_t segment_ns = config.segment_sec * 1e9;
+  const uint64_t end_time = config.start_mono_time + config.duration_sec * 1e9;
+  const int num_segments = std::max<int>(1, std::ceil(config.duration_sec / config.segment_sec));
+  segments_.resize(num_segments);
+
+  std::uniform_int_distribution<int> step_dist(-64, 64);
+  std::vector<uint8_t> dat(config.msg_size);
+  for (int seg = 0; seg < num_segments; ++seg) {
+    const uint64_t seg_end = std::min(end_time, config.start_mono_time + (seg + 1) * segment_ns);
+    auto &events = segments_[seg];
+    for (size_t i = 0; i < messages_.size(); ++i) {
+      auto &s = states[i];
+      for (; s.next_time < seg_end; s.next_time += s.interval) {
+        const double t = (s.next_time - config.start_mono_time) / 1e9;
+        s.walk = std::clamp(s.walk + step_dist(rng), 0, 0xffff);
+        const uint16_t values[] = {s.counter++, (uint16_t)(0x8000 + 0x7fff * std::sin(t * (1 + i % 7))), (uint16_t)s.walk, (uint16_t)i};
+        std::fill(dat.begin(), dat.end(), 0);
+        memcpy(dat.data(), values, std::min<size_t>(sizeof(values), dat.size()));
+
+        CanEvent *e = (CanEvent *)buffer_->allocate(sizeof(CanEvent) + dat.size());
+        e->src = messages_[i].id.source;
+        e->address = messages_[i].id.address;
+        e->mono_time = s.next_time;
+        e->size = dat.size();
+        memcpy(e->dat, dat.data(), dat.size());
+        events.push_back(e);
+      }
+    }
+    std::stable_sort(events.begin(), events.end(), [](auto l, auto r) { return l->mono_time < r->mono_time; });
+    event_count_ += events.size();
+  }
+
+  // deliver some segments later than they happened
+  std::uniform_real_distribution<double> prob(0, 1);
+  for (int seg = 0; seg + 1 < num_segments; ++seg) {
+    if (prob(rng) < config.out_of_order) {
+      std::uniform_int_distribution<int> dst_dist(seg + 1, num_segments - 1);
+      std::swap(segments_[seg], segments_[dst_dist(rng)]);
+    }
+  }
+}
+
+QString CanWorkload::generateDBC() const {
+  QString dbc;
+  QTextStream stream(&dbc);
+  const char *sig_names[] = {"COUNTER", "SINE", "WALK", "CONSTANT"};
+  for (const auto &m : messages_) {
+    stream << "BO_ " << m.id.address << " " << m.name << ": " << config.msg_size << " XXX\n";
+    for (int i = 0; i < std::min(4, config.msg_size / 2); ++i) {
+      stream << " SG_ " << sig_names[i] << " : " << i * 16 << "|16@1+ (1,0) [0|65535] \"\" XXX\n";
+    }
+    stream << "\n";
+  }
+  return dbc;
+}
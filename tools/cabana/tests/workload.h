@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QString>
+
+#include "tools/cabana/streams/canevent.h"
+#include "tools/replay/util.h"
+
+// Deterministic synthetic CAN traffic for benchmarks.
+// Each message carries four little endian 16 bit signals: a counter, a sine wave,
+// a random walk and a constant. The same config and seed always produce the same events.
+struct WorkloadConfig {
+  int buses = 3;  // at most 256, bus numbers are uint8_t
+  int messages_per_bus = 100;
+  double min_hz = 1;
+  double max_hz = 100;
+  int msg_size = 8;  // at least 2 bytes, the size of one signal
+  double duration_sec = 300;
+  double segment_sec = 60;     // events are delivered in segments of this length, like route segments
+  double out_of_order = 0.25;  // fraction of segments delivered out of order
+  uint64_t start_mono_time = 1e9;
+  uint32_t seed = 1;
+};
+
+class CanWorkload {
+public:
+  struct Message {
+    MessageId id;
+    double hz;
+    QString name;
+  };
+
+  CanWorkload(const WorkloadConfig &config);
+  // DBC with the signals of all messages, for SOURCE_ALL.
+  QString generateDBC() const;
+  inline const std::vector<Message> &messages() const { return messages_; }
+  // Segments in delivery order. Events in each segment are sorted by mono_time.
+  inline const std::vector<std::vector<const CanEvent *>> &segments() const { return segments_; }
+  inline size_t eventCount() const { return event_count_; }
+
+  const WorkloadConfig config;
+
+private:
+  std::vector<Message> messages_;
+  std::vector<std::vector<const CanEvent *>> segments_;
+  size_t event_count_ = 0;
+  std::unique_ptr<MonotonicBuffer> buffer_;
+};
@@ -0,0 +1,143 @@
+#include "tools/cabana/tools/analysis.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include <QHash>
+#include <QVector>
+#include <QtConcurrent>
+
+namespace analysis {
+
+QList<SearchSignal> initialSignals(const MessageEventsMap &events, const SearchConfig &config) {
+  cabana::Signal sig{};
+  sig.is_little_endian = config.is_little_endian;
+  sig.is_signed = config.is_signed;
+  sig.factor = config.factor;
+  sig.offset = config.offset;
+
+  QList<SearchSignal> result;
+  for (const auto &[id, msg_events] : events) {
+    if ((!config.buses.empty() && !config.buses.count(id.source)) ||
+        (!config.addresses.empty() && !config.addresses.count(id.address))) {
+      continue;
+    }
+
+    auto e = std::lower_bound(msg_events.cbegin(), msg_events.cend(), config.first_time, CompareCanEvent());
+    if (e != msg_events.cend()) {
+      const int total_size = (*e)->size * 8;
+      for (int size = config.min_size; size <= config.max_size; ++size) {
+        for (int start = 0; start <= total_size - size; ++start) {
+          SearchSignal s{.id = id, .mono_time = config.first_time, .sig = sig};
+          s.sig.start_bit = start;
+          s.sig.size = size;
+          updateMsbLsb(s.sig);
+          s.value = get_raw_value((*e)->dat, (*e)->size, s.sig);
+          result.push_back(s);
+        }
+      }
+    }
+  }
+  return result;
+}
+
+QList<SearchSignal> searchSignals(const MessageEventsMap &events, const QList<SearchSignal> &candidates,
+                                  const std::function<bool(double)> &cmp, double route_start_sec, uint64_t last_time) {
+  static const std::vector<const CanEvent *> empty_events;
+
+  std::mutex lock;
+  QList<SearchSignal> result;
+  result.reserve(candidates.size());
+  QtConcurrent::blockingMap(candidates, [&](const SearchSignal &s) {
+    auto msg_it = events.find(s.id);
+    const auto &msg_events = msg_it != events.end() ? msg_it->second : empty_events;
+    auto first = std::upper_bound(msg_events.cbegin(), msg_events.cend(), s.mono_time, CompareCanEvent());
+    auto last = msg_events.cend();
+    if (last_time < std::numeric_limits<uint64_t>::max()) {
+      last = std::upper_bound(msg_events.cbegin(), msg_events.cend(), last_time, CompareCanEvent());
+    }
+
+    auto it = std::find_if(first, last, [&](const CanEvent *e) { return cmp(get_raw_value(e->dat, e->size, s.sig)); });
+    if (it != last) {
+      auto values = s.values;
+      values += QString("(%1, %2)").arg((*it)->mono_time / 1e9 - route_start_sec, 0, 'f', 2).arg(get_raw_value((*it)->dat, (*it)->size, s.sig));
+      std::lock_guard lk(lock);
+      result.push_back({.id = s.id, .mono_time = (*it)->mono_time, .sig = s.sig, .values = values});
+    }
+  });
+  return result;
+}
+
+QList<MismatchedBits> findSimilarBits(const std::vector<const CanEvent *> &events, uint8_t bus, uint32_t selected_address,
+                                      int byte_idx, int bit_idx, uint8_t find_bus, bool equal, int min_msgs_cnt) {
+  QHash<uint32_t, QVector<uint32_t>> mismatches;
+  QHash<uint32_t, uint32_t> msg_count;
+  int bit_to_find = -1;
+  for (const CanEvent *e : events) {
+    if (e->src == bus) {
+      if (e->address == selected_address && e->size > byte_idx) {
+        bit_to_find = ((e->dat[byte_idx] >> (7 - bit_idx)) & 1) != 0;
+      }
+    }
+    if (e->src == find_bus) {
+      ++msg_count[e->address];
+      if (bit_to_find == -1) continue;
+
+      auto &mismatched = mismatches[e->address];
+      if (mismatched.size() < e->size * 8) {
+        mismatched.resize(e->size * 8);
+      }
+      for (int i = 0; i < e->size; ++i) {
+        for (int j = 0; j < 8; ++j) {
+          int bit = ((e->dat[i] >> (7 - j)) & 1) != 0;
+          mismatched[i * 8 + j] += equal ? (bit != bit_to_find) : (bit == bit_to_find);
+        }
+      }
+    }
+  }
+
+  QList<MismatchedBits> result;
+  result.reserve(mismatches.size());
+  for (auto it = mismatches.begin(); it != mismatches.end(); ++it) {
+    if (auto cnt = msg_count[it.key()]; cnt > min_msgs_cnt) {
+      auto &mismatched = it.value();
+      for (int i = 0; i < mismatched.size(); ++i) {
+        if (float perc = (mismatched[i] / (double)cnt) * 100; perc < 50) {
+          result.push_back({it.key(), (uint32_t)i / 8, (uint32_t)i % 8, mismatched[i], cnt, perc});
+        }
+      }
+    }
+  }
+  std::sort(result.begin(), result.end(), [](auto &l, auto &r) { return l.perc < r.perc; });
+  return result;
+}
+
+void exportToCSV(QTextStream &stream, const std::vector<const CanEvent *> &events, uint64_t start_sec) {
+  stream << "time,addr,bus,data\n";
+  for (auto e : events) {
+    stream << QString::number((e->mono_time / 1e9) - start_sec, 'f', 2) << ","
+           << "0x" << QString::number(e->address, 16) << "," << e->src << ","
+           << "0x" << QByteArray::fromRawData((const char *)e->dat, e->size).toHex().toUpper() << "\n";
+  }
+}
+
+void exportSignalsToCSV(QTextStream &stream, const std::vector<const CanEvent *> &events, const cabana::Msg &msg,
+                        uint64_t start_sec) {
+  stream << "time,addr,bus";
+  for (auto s : msg.sigs)
+    stream << "," << s->name;
+  stream << "\n";
+
+  for (auto e : events) {
+    stream << QString::number((e->mono_time / 1e9) - start_sec, 'f', 2) << ","
+           << "0x" << QString::number(e->address, 16) << "," << e->src;
+    for (auto s : msg.sigs) {
+      double value = 0;
+      s->getValue(e->dat, e->size, &value);
+      stream << "," << QString::number(value, 'f', s->precision);
+    }
+    stream << "\n";
+  }
+}
+
+}  // namespace analysis
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <functional>
+#include <limits>
+#include <set>
+#include <vector>
+
+#include <QList>
+#include <QStringList>
+#include <QTextStream>
+
+#include "tools/cabana/streams/canevent.h"
+
+// Signal search, similar bits and export over an explicit set of events.
+// These don't depend on the global stream or widgets, and are shared by cabana and cabana_cli.
+namespace analysis {
+
+struct SearchSignal {
+  MessageId id = {};
+  uint64_t mono_time = 0;
+  cabana::Signal sig = {};
+  double value = 0.;
+  QStringList values;
+};
+
+struct SearchConfig {
+  std::set<uint8_t> buses;       // empty for all buses
+  std::set<uint32_t> addresses;  // empty for all addresses
+  int min_size = 8;
+  int max_size = 8;
+  bool is_little_endian = true;
+  bool is_signed = false;
+  double factor = 1.0;
+  double offset = 0.;
+  uint64_t first_time = 0;
+};
+
+struct MismatchedBits {
+  uint32_t address, byte_idx, bit_idx, mismatches, total;
+  float perc;
+};
+
+// All signal candidates of the selected messages, with their values at first_time.
+// The address filter applies with or without a bus filter, and the candidates cover the bytes of the
+// event at first_time instead of the message's size at the current playback position.
+QList<SearchSignal> initialSignals(const MessageEventsMap &events, const SearchConfig &config);
+// Keeps the candidates whose value matches cmp after their previous match and before last_time.
+QList<SearchSignal> searchSignals(const MessageEventsMap &events, const QList<SearchSignal> &candidates,
+                                  const std::function<bool(double)> &cmp, double route_start_sec,
+                                  uint64_t last_time = std::numeric_limits<uint64_t>::max());
+QList<MismatchedBits> findSimilarBits(const std::vector<const CanEvent *> &events, uint8_t bus, uint32_t selected_address,
+                                      int byte_idx, int bit_idx, uint8_t find_bus, bool equal, int min_msgs_cnt);
+
+// Times are relative to start_sec, the route start truncated to whole seconds as cabana's CSV export always did.
+void exportToCSV(QTextStream &stream, const std::vector<const CanEvent *> &events, uint64_t start_sec);
+void exportSignalsToCSV(QTextStream &stream, const std::vector<const CanEvent *> &events, const cabana::Msg &msg,
+                        uint64_t start_sec);
+
+}  // namespace analysis
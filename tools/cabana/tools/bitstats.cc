@@ -0,0 +1,104 @@
+#include "tools/cabana/tools/bitstats.h"
+
+#include <algorithm>
+#include <cmath>
+
+double BitStatsIndex::BitStats::entropy() const {
+  const double p = dutyCycle();
+  return p <= 0 || p >= 1 ? 0 : -(p * std::log2(p) + (1 - p) * std::log2(1 - p));
+}
+
+BitStatsIndex::BitStatsIndex(const std::vector<const CanEvent *> &events) : events_(events) {
+  for (auto e : events_) {
+    bit_count_ = std::max(bit_count_, e->size * 8);
+  }
+  build(0);
+}
+
+BitStatsIndex::BitStatsIndex(const std::vector<const CanEvent *> &events, const BitStatsIndex &prev, uint64_t merged_from)
+    : events_(events), bit_count_(prev.bit_count_) {
+  // events before merged_from are prev's events, so are its checkpoints up to there.
+  auto first = std::lower_bound(events_.cbegin(), events_.cend(), merged_from, CompareCanEvent());
+  for (auto it = first; it != events_.cend(); ++it) {
+    bit_count_ = std::max(bit_count_, (*it)->size * 8);
+  }
+
+  size_t checkpoint = 0;
+  if (bit_count_ == prev.bit_count_) {
+    checkpoint = std::min<size_t>((first - events_.cbegin()) / STRIDE, prev.events_.size() / STRIDE);
+    ones_.assign(prev.ones_.begin(), prev.ones_.begin() + (checkpoint + 1) * bit_count_);
+    flips_.assign(prev.flips_.begin(), prev.flips_.begin() + (checkpoint + 1) * bit_count_);
+  }
+  build(checkpoint);
+}
+
+// Fills the checkpoints after the given one, which must already be set.
+void BitStatsIndex::build(size_t checkpoint) {
+  const size_t checkpoints = events_.size() / STRIDE + 1;
+  ones_.resize(checkpoints * bit_count_);
+  flips_.resize(checkpoints * bit_count_);
+  std::vector<uint32_t> ones(ones_.begin() + checkpoint * bit_count_, ones_.begin() + (checkpoint + 1) * bit_count_);
+  std::vector<uint32_t> flips(flips_.begin() + checkpoint * bit_count_, flips_.begin() + (checkpoint + 1) * bit_count_);
+  for (size_t i = checkpoint * STRIDE; i < events_.size(); ++i) {
+    if (i % STRIDE == 0) {
+      std::copy(ones.begin(), ones.end(), ones_.begin() + (i / STRIDE) * bit_count_);
+      std::copy(flips.begin(), flips.end(), flips_.begin() + (i / STRIDE) * bit_count_);
+    }
+    accumulate(i, ones.data(), flips.data());
+  }
+  if (events_.size() % STRIDE == 0) {
+    std::copy(ones.begin(), ones.end(), ones_.begin() + (checkpoints - 1) * bit_count_);
+    std::copy(flips.begin(), flips.end(), flips_.begin() + (checkpoints - 1) * bit_count_);
+  }
+}
+
+void BitStatsIndex::accumulate(size_t i, uint32_t *ones, uint32_t *flips) const {
+  const CanEvent *e = events_[i];
+  const CanEvent *prev = i > 0 ? events_[i - 1] : nullptr;
+  const int size = std::max<int>(e->size, prev ? prev->size : 0);
+  for (int byte = 0; byte < size; ++byte) {
+    const uint8_t cur = byte < e->size ? e->dat[byte] : 0;
+    const uint8_t changed = prev ? cur ^ (byte < prev->size ? prev->dat[byte] : 0) : 0;
+    if ((cur | changed) == 0) continue;
+
+    for (int j = 0; j < 8; ++j) {
+      const int shift = 7 - j;
+      ones[byte * 8 + j] += (cur >> shift) & 1;
+      flips[byte * 8 + j] += (changed >> shift) & 1;
+    }
+  }
+}
+
+BitStatsIndex::Prefix BitStatsIndex::prefix(size_t k) const {
+  const size_t c = k / STRIDE;
+  Prefix p;
+  p.ones.assign(ones_.begin() + c * bit_count_, ones_.begin() + (c + 1) * bit_count_);
+  p.flips.assign(flips_.begin() + c * bit_count_, flips_.begin() + (c + 1) * bit_count_);
+  for (size_t i = c * STRIDE; i < k; ++i) {
+    accumulate(i, p.ones.data(), p.flips.data());
+  }
+  return p;
+}
+
+std::vector<BitStatsIndex::BitStats> BitStatsIndex::query(size_t first, size_t last) const {
+  last = std::min(last, events_.size());
+  if (first >= last) return {};
+
+  std::vector<BitStats> stats(bit_count_);
+  const Prefix begin = prefix(first), end = prefix(last);
+  // transitions are counted on the later event, the one into events[first] is outside of the range.
+  Prefix flips_begin = begin;
+  accumulate(first, flips_begin.ones.data(), flips_begin.flips.data());
+  for (int b = 0; b < bit_count_; ++b) {
+    stats[b].ones = end.ones[b] - begin.ones[b];
+    stats[b].flips = end.flips[b] - flips_begin.flips[b];
+    stats[b].count = last - first;
+  }
+  return stats;
+}
+
+std::vector<BitStatsIndex::BitStats> BitStatsIndex::queryTime(uint64_t first_time, uint64_t last_time) const {
+  auto first = std::lower_bound(events_.cbegin(), events_.cend(), first_time, CompareCanEvent());
+  auto last = std::upper_bound(first, events_.cend(), last_time, CompareCanEvent());
+  return query(first - events_.cbegin(), last - events_.cbegin());
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "tools/cabana/streams/canevent.h"
+
+// BitStatsIndex keeps per-bit prefix counts of ones and transitions over the events of a message,
+// so the flip count, duty cycle and entropy of any range of events can be computed without
+// scanning the range. Prefix counts are stored every STRIDE events, a query scans at most
+// 2 * STRIDE events on top of the checkpoint lookups, regardless of the range length.
+class BitStatsIndex {
+public:
+  static constexpr int STRIDE = 16;
+
+  struct BitStats {
+    uint32_t ones = 0;
+    uint32_t flips = 0;
+    uint32_t count = 0;
+    inline double dutyCycle() const { return count > 0 ? ones / (double)count : 0; }
+    double entropy() const;
+  };
+
+  BitStatsIndex(const std::vector<const CanEvent *> &events);
+  // Index of prev's events with more events merged in at or after merged_from. The checkpoints of
+  // prev before the merged events are reused, only the events after them are scanned again.
+  BitStatsIndex(const std::vector<const CanEvent *> &events, const BitStatsIndex &prev, uint64_t merged_from);
+  // Stats of each bit over events[first, last). bits are ordered as in the binary view: byte * 8 + (7 - shift).
+  std::vector<BitStats> query(size_t first, size_t last) const;
+  // Stats of each bit over the events in [first_time, last_time].
+  std::vector<BitStats> queryTime(uint64_t first_time, uint64_t last_time) const;
+  inline size_t size() const { return events_.size(); }
+  inline int bitCount() const { return bit_count_; }
+
+private:
+  struct Prefix {
+    std::vector<uint32_t> ones, flips;  // flips[b] counts transitions into events[1, k)
+  };
+  void build(size_t checkpoint);
+  Prefix prefix(size_t k) const;
+  void accumulate(size_t i, uint32_t *ones, uint32_t *flips) const;
+
+  std::vector<const CanEvent *> events_;
+  int bit_count_ = 0;
+  std::vector<uint32_t> ones_;   // ones_[c * bit_count_ + b]: ones of bit b in events[0, c * STRIDE)
+  std::vector<uint32_t> flips_;  // flips_[c * bit_count_ + b]: transitions of bit b in events[1, c * STRIDE)
+};
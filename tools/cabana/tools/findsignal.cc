@@ -4,7 +4,6 @@
 #include <QHBoxLayout>
 #include <QHeaderView>
 #include <QMenu>
-#include <QtConcurrent>
 #include <QTimer>
 #include <QVBoxLayout>
 
@@ -31,26 +30,8 @@ QVariant FindSignalModel::data(const QModelIndex &index, int role) const {
 void FindSignalModel::search(std::function<bool(double)> cmp) {
   beginResetModel();
 
-  std::mutex lock;
   const auto prev_sigs = !histories.isEmpty() ? histories.back() : initial_signals;
-  filtered_signals.clear();
-  filtered_signals.reserve(prev_sigs.size());
-  QtConcurrent::blockingMap(prev_sigs, [&](auto &s) {
-    const auto &events = can->events(s.id);
-    auto first = std::upper_bound(events.cbegin(), events.cend(), s.mono_time, CompareCanEvent());
-    auto last = events.cend();
-    if (last_time < std::numeric_limits<uint64_t>::max()) {
-      last = std::upper_bound(events.cbegin(), events.cend(), last_time, CompareCanEvent());
-    }
-
-    auto it = std::find_if(first, last, [&](const CanEvent *e) { return cmp(get_raw_value(e->dat, e->size, s.sig)); });
-    if (it != last) {
-      auto values = s.values;
-      values += QString("(%1, %2)").arg((*it)->mono_time / 1e9 - can->routeStartTime(), 0, 'f', 2).arg(get_raw_value((*it)->dat, (*it)->size, s.sig));
-      std::lock_guard lk(lock);
-      filtered_signals.push_back({.id = s.id, .mono_time = (*it)->mono_time, .sig = s.sig, .values = values});
-    }
-  });
+  filtered_signals = analysis::searchSignals(can->eventsMap(), prev_sigs, cmp, can->routeStartTime(), last_time);
   histories.push_back(filtered_signals);
 
   endResetModel();
@@ -196,53 +177,33 @@ void FindSignalDlg::search() {
 }
 
 void FindSignalDlg::setInitialSignals() {
-  QSet<ushort> buses;
+  analysis::SearchConfig config;
   for (auto bus : bus_edit->text().trimmed().split(",")) {
     bus = bus.trimmed();
-    if (!bus.isEmpty()) buses.insert(bus.toUShort());
+    if (!bus.isEmpty()) config.buses.insert(bus.toUShort());
   }
 
-  QSet<uint32_t> addresses;
   for (auto addr : address_edit->text().trimmed().split(",")) {
     addr = addr.trimmed();
-    if (!addr.isEmpty()) addresses.insert(addr.toULong(nullptr, 16));
+    if (!addr.isEmpty()) config.addresses.insert(addr.toULong(nullptr, 16));
   }
 
-  cabana::Signal sig{};
-  sig.is_little_endian = litter_endian->isChecked();
-  sig.is_signed = is_signed->isChecked();
-  sig.factor = factor_edit->text().toDouble();
-  sig.offset = offset_edit->text().toDouble();
+  config.min_size = min_size->value();
+  config.max_size = max_size->value();
+  config.is_little_endian = litter_endian->isChecked();
+  config.is_signed = is_signed->isChecked();
+  config.factor = factor_edit->text().toDouble();
+  config.offset = offset_edit->text().toDouble();
 
   double first_time_val = first_time_edit->text().toDouble();
   double last_time_val = last_time_edit->text().toDouble();
   auto [first_sec, last_sec] = std::minmax(first_time_val, last_time_val);
-  uint64_t first_time = (can->routeStartTime() + first_sec) * 1e9;
+  config.first_time = (can->routeStartTime() + first_sec) * 1e9;
   model->last_time = std::numeric_limits<uint64_t>::max();
   if (last_sec > 0) {
     model->last_time = (can->routeStartTime() + last_sec) * 1e9;
   }
-  model->initial_signals.clear();
-
-  for (const auto &[id, m] : can->lastMessages()) {
-    if (buses.isEmpty() || buses.contains(id.source) && (addresses.isEmpty() || addresses.contains(id.address))) {
-      const auto &events = can->events(id);
-      auto e = std::lower_bound(events.cbegin(), events.cend(), first_time, CompareCanEvent());
-      if (e != events.cend()) {
-        const int total_size = m.dat.size() * 8;
-        for (int size = min_size->value(); size <= max_size->value(); ++size) {
-          for (int start = 0; start <= total_size - size; ++start) {
-            FindSignalModel::SearchSignal s{.id = id, .mono_time = first_time, .sig = sig};
-            s.sig.start_bit = start;
-            s.sig.size = size;
-            updateMsbLsb(s.sig);
-            s.value = get_raw_value((*e)->dat, (*e)->size, s.sig);
-            model->initial_signals.push_back(s);
-          }
-        }
-      }
-    }
-  }
+  model->initial_signals = analysis::initialSignals(can->eventsMap(), config);
 }
 
 void FindSignalDlg::modelReset() {
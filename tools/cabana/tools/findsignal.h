@@ -11,16 +11,11 @@
 
 #include "tools/cabana/commands.h"
 #include "tools/cabana/settings.h"
+#include "tools/cabana/tools/analysis.h"
 
 class FindSignalModel : public QAbstractTableModel {
 public:
-  struct SearchSignal {
-    MessageId id = {};
-    uint64_t mono_time = 0;
-    cabana::Signal sig = {};
-    double value = 0.;
-    QStringList values;
-  };
+  using SearchSignal = analysis::SearchSignal;
 
   FindSignalModel(QObject *parent) : QAbstractTableModel(parent) {}
   QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
@@ -18,12 +18,6 @@ signals:
   void openMessage(const MessageId &msg_id);
 
 private:
-  struct mismatched_struct {
-    uint32_t address, byte_idx, bit_idx, mismatches, total;
-    float perc;
-  };
-  QList<mismatched_struct> calcBits(uint8_t bus, uint32_t selected_address, int byte_idx, int bit_idx, uint8_t find_bus,
-                                    bool equal, int min_msgs_cnt);
   void find();
 
   QTableWidget *table;
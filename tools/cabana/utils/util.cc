@@ -254,12 +254,6 @@ QString formatSeconds(double sec, bool include_milliseconds, bool absolute_time)
 
 }  // namespace utils
 
-int num_decimals(double num) {
-  const QString string = QString::number(num);
-  auto dot_pos = string.indexOf('.');
-  return dot_pos == -1 ? 0 : string.size() - dot_pos - 1;
-}
-
 QString signalToolTip(const cabana::Signal *sig) {
   return QObject::tr(R"(
     %1<br /><span font-size:small">
@@ -161,5 +161,4 @@ private:
   QSocketNotifier *sn;
 };
 
-int num_decimals(double num);
 QString signalToolTip(const cabana::Signal *sig);
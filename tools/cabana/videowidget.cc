@@ -14,6 +14,7 @@
 #include <QtConcurrent>
 
 #include "tools/cabana/streams/replaystream.h"
+#include "tools/cabana/streams/snapshot.h"
 
 const int MIN_VIDEO_HEIGHT = 100;
 const int THUMBNAIL_MARGIN = 3;
@@ -159,6 +160,9 @@ QWidget *VideoWidget::createCameraWidget() {
     if (index != -1) cam_widget->setStreamType((VisionStreamType)camera_tab->tabData(index).toInt());
   });
 
+  if (auto snapshot = can->snapshot()) {
+    slider->setThumbnailData(snapshot->thumbnails());
+  }
   auto replay = static_cast<ReplayStream*>(can)->getReplay();
   QObject::connect(replay, &Replay::qLogLoaded, slider, &Slider::parseQLog, Qt::QueuedConnection);
   QObject::connect(replay, &Replay::totalSecondsUpdated, this, &VideoWidget::setMaximumTime, Qt::QueuedConnection);
@@ -248,12 +252,29 @@ AlertInfo Slider::alertInfo(double seconds) {
   return has_alert ? alert_it->second : AlertInfo{};
 }
 
+static QPixmap decodeThumbnail(const uint8_t *data, size_t size) {
+  QPixmap pm;
+  if (pm.loadFromData(data, size, "jpeg")) {
+    return pm.scaledToHeight(MIN_VIDEO_HEIGHT - THUMBNAIL_MARGIN * 2, Qt::SmoothTransformation);
+  }
+  return pm;
+}
+
 QPixmap Slider::thumbnail(double seconds)  {
   uint64_t mono_time = (seconds + can->routeStartTime()) * 1e9;
   auto it = thumbnails.lowerBound(mono_time);
+  auto data_it = thumbnail_data.lower_bound(mono_time);
+  if (data_it != thumbnail_data.end() && (it == thumbnails.end() || data_it->first < it.key())) {
+    const QByteArray &jpeg = data_it->second;
+    it = thumbnails.insert(data_it->first, decodeThumbnail((const uint8_t *)jpeg.constData(), jpeg.size()));
+  }
   return it != thumbnails.end() ? it.value() : QPixmap();
 }
 
+void Slider::setThumbnailData(const std::map<uint64_t, QByteArray> &data) {
+  thumbnail_data = data;
+}
+
 void Slider::setTimeRange(double min, double max) {
   assert(min < max);
   setRange(min * factor, max * factor);
@@ -265,9 +286,11 @@ void Slider::parseQLog(std::shared_ptr<LogReader> qlog) {
     if (e.which == cereal::Event::Which::THUMBNAIL) {
       capnp::FlatArrayMessageReader reader(e.data);
       auto thumb = reader.getRoot<cereal::Event>().getThumbnail();
+      // thumbnails restored from the snapshot are decoded on demand
+      if (thumbnail_data.count(thumb.getTimestampEof())) return;
+
       auto data = thumb.getThumbnail();
-      if (QPixmap pm; pm.loadFromData(data.begin(), data.size(), "jpeg")) {
-        QPixmap scaled = pm.scaledToHeight(MIN_VIDEO_HEIGHT - THUMBNAIL_MARGIN * 2, Qt::SmoothTransformation);
+      if (QPixmap scaled = decodeThumbnail(data.begin(), data.size()); !scaled.isNull()) {
         std::lock_guard lk(mutex);
         thumbnails[thumb.getTimestampEof()] = scaled;
       }
@@ -41,6 +41,7 @@ public:
   void setTimeRange(double min, double max);
   AlertInfo alertInfo(double sec);
   QPixmap thumbnail(double sec);
+  void setThumbnailData(const std::map<uint64_t, QByteArray> &data);
   void parseQLog(std::shared_ptr<LogReader> qlog);
 
   const double factor = 1000.0;
@@ -52,6 +53,8 @@ private:
   void paintEvent(QPaintEvent *ev) override;
 
   QMap<uint64_t, QPixmap> thumbnails;
+  // jpeg data of thumbnails restored from a session snapshot, decoded on demand.
+  std::map<uint64_t, QByteArray> thumbnail_data;
   std::map<uint64_t, AlertInfo> alerts;
   InfoLabel *thumbnail_label;
 };
@@ -6,6 +6,7 @@ import capnp
 import enum
 import os
 import pathlib
+import struct
 import sys
 import tqdm
 import urllib.parse
@@ -22,6 +23,38 @@ from openpilot.tools.lib.openpilotci import get_url
 from openpilot.tools.lib.filereader import FileReader, file_exists, internal_source_available
 from openpilot.tools.lib.route import Route, SegmentRange
 
+LOG_FRAME_MAGIC = b'LFRM'
+LOG_FRAME_HEADER = struct.Struct('<IIII')
+try:
+  from crc32c import crc32c as _crc32c
+except ImportError:
+  try:
+    from google_crc32c import value as _crc32c
+  except ImportError:
+    import crcmod.predefined
+    _crc32c = crcmod.predefined.mkCrcFun('crc-32c')
+
+
+def unframe_log(dat: bytes) -> bytes:
+  """Intact messages of a framed log (LOGGERD_FRAMED, see system/loggerd/framed_log.h). Like recover_log, frames
+  with a bad header or message CRC are skipped, resyncing on the next frame header."""
+  out = []
+  pos = 0
+  while pos + LOG_FRAME_HEADER.size <= len(dat):
+    _, size, crc, header_crc = LOG_FRAME_HEADER.unpack_from(dat, pos)
+    start = pos + LOG_FRAME_HEADER.size
+    msg = dat[start:start+size]
+    if dat[pos:pos+4] == LOG_FRAME_MAGIC and header_crc == _crc32c(dat[pos:pos+12]) and len(msg) == size and crc == _crc32c(msg):
+      out.append(msg)
+      pos = start + ((size + 7) & ~7)
+    else:
+      nxt = dat.find(LOG_FRAME_MAGIC, pos + 8)
+      if nxt == -1:
+        break
+      pos = nxt
+  return b''.join(out)
+
+
 LogMessage = type[capnp._DynamicStructReader]
 LogIterable = Iterable[LogMessage]
 RawLogIterable = Iterable[bytes]
@@ -48,6 +81,9 @@ class _LogFileReader:
       # https://github.com/facebook/zstd/blob/dev/doc/zstd_compression_format.md#zstandard-frames
       dat = zstd.decompress(dat)
 
+    if dat.startswith(LOG_FRAME_MAGIC):
+      dat = unframe_log(dat)
+
     ents = capnp_log.Event.read_multiple_bytes(dat)
 
     self._ents = []
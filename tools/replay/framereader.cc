@@ -6,6 +6,7 @@
 #include <utility>
 
 #include "common/util.h"
+#include "system/loggerd/video_index.h"
 #include "third_party/libyuv/include/libyuv.h"
 #include "tools/replay/util.h"
 
@@ -87,11 +88,21 @@ bool FrameReader::loadFromFile(CameraType type, const std::string &file, bool no
   width = decoder_->width;
   height = decoder_->height;
 
-  AVPacket pkt;
-  packets_info.reserve(60 * 20);  // 20fps, one minute
-  while (!(abort && *abort) && av_read_frame(input_ctx, &pkt) == 0) {
-    packets_info.emplace_back(PacketInfo{.flags = pkt.flags, .pos = pkt.pos});
-    av_packet_unref(&pkt);
+  // loggerd writes an index of the raw videos. without one, or if it's missing frames at the end, find the frames
+  // by demuxing the whole file
+  std::vector<VideoIndexEntry> index;
+  if (read_video_index(file, index)) {
+    packets_info.reserve(index.size());
+    for (const auto &e : index) {
+      packets_info.emplace_back(PacketInfo{.flags = (e.flags & VIDEO_INDEX_KEYFRAME) ? AV_PKT_FLAG_KEY : 0, .pos = (int64_t)e.offset});
+    }
+  } else {
+    AVPacket pkt;
+    packets_info.reserve(60 * 20);  // 20fps, one minute
+    while (!(abort && *abort) && av_read_frame(input_ctx, &pkt) == 0) {
+      packets_info.emplace_back(PacketInfo{.flags = pkt.flags, .pos = pkt.pos});
+      av_packet_unref(&pkt);
+    }
   }
   avio_seek(input_ctx->pb, 0, SEEK_SET);
   return !packets_info.empty();
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <utility>
+#include "system/loggerd/framed_log.h"
 #include "tools/replay/filereader.h"
 #include "tools/replay/util.h"
 
@@ -17,39 +18,29 @@ bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool loca
 }
 
 bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort) {
-  try {
-    events.reserve(65000);
-    kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
-    while (words.size() > 0 && !(abort && *abort)) {
-      capnp::FlatArrayMessageReader reader(words);
-      auto event = reader.getRoot<cereal::Event>();
-      auto which = event.which();
-      auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
-      words = kj::arrayPtr(reader.getEnd(), words.end());
-
-      if (!filters_.empty()) {
-        if (which >= filters_.size() || !filters_[which])
-          continue;
-        auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
-        memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
-        event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
+  events.reserve(65000);
+  if (is_framed_log(data, size)) {
+    // messages failing their CRC are skipped, e.g. the end of a log cut off by a power loss
+    auto stats = scan_framed_log(data, size, [&](const char *msg, size_t msg_size) {
+      if (abort && *abort) return;
+      try {
+        parseEvent(kj::ArrayPtr<const capnp::word>((const capnp::word *)msg, msg_size / sizeof(capnp::word)));
+      } catch (const kj::Exception &e) {
+        rWarning("Failed to parse event : %s", e.getDescription().cStr());
       }
-
-      uint64_t mono_time = event.getLogMonoTime();
-      const Event &evt = events.emplace_back(which, mono_time, event_data);
-      // Add encodeIdx packet again as a frame packet for the video stream
-      if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
-          evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
-          evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
-        auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-        if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
-          uint64_t sof = idx.getTimestampSof();
-          events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
-        }
+    });
+    if (stats.corrupt_regions > 0 || stats.truncated_bytes > 0) {
+      rWarning("Skipped %zu corrupt regions (%zu bytes) and %zu truncated bytes", stats.corrupt_regions, stats.corrupt_bytes, stats.truncated_bytes);
+    }
+  } else {
+    try {
+      kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
+      while (words.size() > 0 && !(abort && *abort)) {
+        words = kj::arrayPtr(parseEvent(words), words.end());
       }
+    } catch (const kj::Exception &e) {
+      rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
     }
-  } catch (const kj::Exception &e) {
-    rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
   }
 
   if (!events.empty() && !(abort && *abort)) {
@@ -59,3 +50,33 @@ bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort) {
   }
   return false;
 }
+
+// adds the event at the start of words, returns its end
+const capnp::word *LogReader::parseEvent(kj::ArrayPtr<const capnp::word> words) {
+  capnp::FlatArrayMessageReader reader(words);
+  auto event = reader.getRoot<cereal::Event>();
+  auto which = event.which();
+  auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
+
+  if (!filters_.empty()) {
+    if (which >= filters_.size() || !filters_[which])
+      return reader.getEnd();
+    auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
+    memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
+    event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
+  }
+
+  uint64_t mono_time = event.getLogMonoTime();
+  const Event &evt = events.emplace_back(which, mono_time, event_data);
+  // Add encodeIdx packet again as a frame packet for the video stream
+  if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
+      evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
+      evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
+    auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+    if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+      uint64_t sof = idx.getTimestampSof();
+      events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
+    }
+  }
+  return reader.getEnd();
+}
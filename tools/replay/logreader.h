@@ -34,6 +34,8 @@ public:
   std::vector<Event> events;
 
 private:
+  const capnp::word *parseEvent(kj::ArrayPtr<const capnp::word> words);
+
   std::string raw_;
   std::vector<bool> filters_;
   MonotonicBuffer buffer_{1024 * 1024};